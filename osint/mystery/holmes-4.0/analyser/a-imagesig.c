@@ -84,4 +84,5 @@ struct analyser an_imagesig = {
   .cleanup_context = an_imagesig_cleanup_context,
   .need = an_imagesig_need,
   .analyse = an_imagesig_analyse,
+  .cost = AN_COST_HIGH,
 };
@@ -69,7 +69,8 @@ struct analyser an_lang = {
   .init = an_lang_init,
   .init_context = an_lang_init_context,
   .need = an_lang_need,
-  .analyse = an_lang_analyse
+  .analyse = an_lang_analyse,
+  .cost = AN_COST_MEDIUM
 };
 
 byte *
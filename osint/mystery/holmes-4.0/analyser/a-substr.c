@@ -281,5 +281,6 @@ struct analyser an_substr = {
   .init = an_substr_init,
   .need = an_substr_need,
   .analyse = an_substr_analyse,
+  .cost = AN_COST_MEDIUM,
 };
 
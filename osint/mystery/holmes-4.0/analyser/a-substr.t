@@ -15,3 +15,11 @@ In:	Ux:x
 	Xhdsajsaahhoojdsadasjkdcaausa
 Out:	80
 
+
+Run:	(../obj/analyser/atest -C/dev/null -S 'Analyser { Threads=2; ParallelCost=0; HookScanner substr needed ctx; HookScanner test always; HookScanner substr always ctx2 }; SubStrings { Context { Name=ctx; Attr=8; Parts=text metas urls; Groups=grp1 0x1 grp2 0x2 grp4 0x4; }; Context { Name=ctx2; Attr=7; Parts=text; Groups=grp4 0x10; }; Group { Name=grp1; Search=ahoj; }; Group { Name=grp2; Search=aho; }; Group { Name=grp4; Search=cau; } }' -h scanner | grep '^[1278]' | sort)
+In:	Ux:x
+	Xhdsajsaahojdsadasjkcausa
+Out:	1eeek!
+	224
+	710
+	87
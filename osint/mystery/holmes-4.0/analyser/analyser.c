@@ -12,9 +12,13 @@
 #include "ucw/conf.h"
 #include "ucw/fastbuf.h"
 #include "ucw/mempool.h"
+#include "ucw/hashfunc.h"
+#include "ucw/workqueue.h"
 #include "analyser/analyser.h"
 
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define TRACE(x...) do { if (an_trace) log(L_DEBUG, x); } while (0)
 
@@ -29,6 +33,9 @@ static clist an_hooks[AN_HOOK_MAX];
 
 uns an_trace;
 static uns an_log_stats;
+static uns an_threads;
+static uns an_thread_stack_size;
+static uns an_parallel_cost = AN_COST_HIGH;
 
 static char *
 hook_init(struct an_hook *h)
@@ -90,6 +97,9 @@ static struct cf_section analyser_config = {
   CF_ITEMS{
     CF_UNS("Trace", &an_trace),
     CF_UNS("LogStats", &an_log_stats),
+    CF_UNS("Threads", &an_threads),
+    CF_UNS("ThreadStackSize", &an_thread_stack_size),
+    CF_UNS("ParallelCost", &an_parallel_cost),
     CF_LIST("HookRaw", an_hooks + AN_HOOK_RAW, &hook_section),
     CF_LIST("HookGather", an_hooks + AN_HOOK_GATHERER, &hook_section),
     CF_LIST("HookScanner", an_hooks + AN_HOOK_SCANNER, &hook_section),
@@ -123,6 +133,210 @@ analyser_init_hook(enum an_hook_type hook_type)
     }
 }
 
+/*
+ *  Parallel execution: Hooks of cost at least Analyser.ParallelCost are submitted to
+ *  a worker pool shared by all contexts of the process, while the other hooks run in
+ *  the calling thread. Each submitted hook works with a private copy of the object
+ *  and of the streams. When all of them finish, the attributes they have changed
+ *  are copied back to the original object in the order of the hooks.
+ */
+
+struct an_parallel {
+  struct work_queue q;
+  pid_t pid;			// The worker pool does not survive fork()
+  struct mempool *pool;		// Copies of the streams for the current document
+};
+
+struct an_job {
+  struct work w;
+  struct an_hook *h;
+  struct an_iface ai;
+  struct mempool *pool;		// The private object and temporary data
+  struct fastbuf text, metas, thumbnail;
+  u32 sig[OBJ_ATTR_SON];	// Hashes of attribute values before the analysis
+};
+
+static struct worker_pool an_pool;
+static uns an_pool_users;
+static pid_t an_pool_pid;
+static pthread_mutex_t an_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+analyser_par_start(struct an_parallel *p)
+{
+  pthread_mutex_lock(&an_pool_mutex);
+  if (an_pool_pid != getpid())
+    {
+      bzero(&an_pool, sizeof(an_pool));
+      an_pool.num_threads = an_threads;
+      an_pool.stack_size = an_thread_stack_size;
+      worker_pool_init(&an_pool);
+      an_pool_pid = getpid();
+      an_pool_users = 0;
+    }
+  an_pool_users++;
+  pthread_mutex_unlock(&an_pool_mutex);
+  work_queue_init(&an_pool, &p->q);
+  p->pid = getpid();
+}
+
+static void
+analyser_par_stop(struct an_parallel *p)
+{
+  if (p->pid != getpid())
+    return;
+  work_queue_cleanup(&p->q);
+  pthread_mutex_lock(&an_pool_mutex);
+  if (!--an_pool_users)
+    {
+      worker_pool_cleanup(&an_pool);
+      an_pool_pid = 0;
+    }
+  pthread_mutex_unlock(&an_pool_mutex);
+  p->pid = 0;
+}
+
+static void
+analyser_obj_sign(struct odes *o, u32 *sig)
+{
+  bzero(sig, OBJ_ATTR_SON * sizeof(u32));
+  for (struct oattr *a = o->attrs; a; a = a->next)
+    if (a->attr < OBJ_ATTR_SON)
+      {
+	u32 h = 1;
+	for (struct oattr *b = a; b; b = b->same)
+	  h = h * 0x9e3779b1 + hash_string(b->val);
+	sig[a->attr] = h ? : 1;
+      }
+}
+
+static void
+analyser_obj_merge(struct odes *dest, struct odes *src, u32 *old_sig)
+{
+  u32 sig[OBJ_ATTR_SON];
+  analyser_obj_sign(src, sig);
+  for (uns x = 0; x < OBJ_ATTR_SON; x++)
+    if (sig[x] != old_sig[x])
+      {
+	struct oattr *a = obj_find_attr(src, x);
+	obj_set_attr(dest, x, a ? a->val : NULL);
+	if (a)
+	  while (a = a->same)
+	    obj_add_attr(dest, x, a->val);
+      }
+}
+
+static struct fastbuf *
+analyser_copy_stream(struct an_parallel *p, struct fastbuf *fb, struct fastbuf **copies)
+{
+  if (!fb)
+    return NULL;
+  brewind(fb);
+  ucw_off_t len = bfilesize(fb);
+  ASSERT(len >= 0);
+  byte *buf = mp_alloc(p->pool, len);
+  breadb(fb, buf, len);
+  for (uns i = 0; copies[i]; i++)
+    fbbuf_init_read(copies[i], buf, len, 0);
+  return fb;
+}
+
+static void
+analyser_job_go(struct worker_thread *t UNUSED, struct work *w)
+{
+  struct an_job *j = (struct an_job *) w;
+  j->h->a->analyse(j->h, &j->ai);
+}
+
+static int
+analyser_run_parallel(struct an_context *c, struct an_iface *ai, uns all)
+{
+  /* Is it worth the effort? */
+  uns run = 0, jobs = 0;
+  CLIST_FOR_EACH(struct an_hook *, h, c->list)
+    if (all || h->triggered)
+      {
+	run++;
+	jobs += !!h->job;
+      }
+  if (!jobs || run < 2)
+    return 0;
+
+  /* Private copies of URL blocks other than the object itself are not supported */
+  if (ai->url_block != ai->obj)
+    return 0;
+  if (ai->all_urls)
+    for (struct odes **u = ai->all_urls; *u; u++)
+      if (*u != ai->obj)
+	return 0;
+
+  struct an_parallel *p = c->par;
+  if (p->pid != getpid())
+    analyser_par_start(p);
+  mp_flush(p->pool);
+
+  /* Prepare private copies of the streams */
+  struct fastbuf *text[jobs + 1], *metas[jobs + 1], *thumbnail[jobs + 1];
+  uns n = 0;
+  CLIST_FOR_EACH(struct an_hook *, h, c->list)
+    if (h->job && (all || h->triggered))
+      {
+	text[n] = &h->job->text;
+	metas[n] = &h->job->metas;
+	thumbnail[n++] = &h->job->thumbnail;
+      }
+  text[n] = metas[n] = thumbnail[n] = NULL;
+  uns have_text = !!analyser_copy_stream(p, ai->text, text);
+  uns have_metas = !!analyser_copy_stream(p, ai->metas, metas);
+  uns have_thumbnail = !!analyser_copy_stream(p, ai->thumbnail, thumbnail);
+
+  /* Submit the expensive hooks */
+  CLIST_FOR_EACH(struct an_hook *, h, c->list)
+    if (h->job && (all || h->triggered))
+      {
+	struct an_job *j = h->job;
+	TRACE("Analyser %s: Running in parallel", h->a->name);
+	h->doc_count++;
+	mp_flush(j->pool);
+	j->h = h;
+	j->ai = *ai;
+	j->ai.pool = j->pool;
+	j->ai.obj = j->ai.url_block = obj_clone(j->pool, ai->obj);
+	if (ai->all_urls)
+	  j->ai.all_urls = (struct odes **) mp_memdup(j->pool, (struct odes *[]) { j->ai.obj, NULL }, 2 * sizeof(struct odes *));
+	j->ai.text = have_text ? &j->text : NULL;
+	j->ai.metas = have_metas ? &j->metas : NULL;
+	j->ai.thumbnail = have_thumbnail ? &j->thumbnail : NULL;
+	analyser_obj_sign(j->ai.obj, j->sig);
+	j->w.priority = 0;
+	j->w.go = analyser_job_go;
+	work_submit(&p->q, &j->w);
+      }
+
+  /* Run the cheap ones meanwhile */
+  CLIST_FOR_EACH(struct an_hook *, h, c->list)
+    if (!h->job && (all || h->triggered))
+      {
+	TRACE("Analyser %s: Running", h->a->name);
+	h->doc_count++;
+	if (ai->text)
+	  brewind(ai->text);
+	if (ai->metas)
+	  brewind(ai->metas);
+	if (ai->thumbnail)
+	  brewind(ai->thumbnail);
+	h->a->analyse(h, ai);
+      }
+
+  /* Wait for the rest and merge the results */
+  for (uns i = 0; i < jobs; i++)
+    work_wait(&p->q);
+  CLIST_FOR_EACH(struct an_hook *, h, c->list)
+    if (h->job && (all || h->triggered))
+      analyser_obj_merge(ai->obj, h->job->ai.obj, h->job->sig);
+  return 1;
+}
+
 void
 analyser_init(struct an_context *c, enum an_hook_type hook_type, uns avail_need_mask, struct an_context *master)
 {
@@ -131,6 +345,7 @@ analyser_init(struct an_context *c, enum an_hook_type hook_type, uns avail_need_
   clist_init(&c->list);
   c->need_mask = 0;
   c->master = (master && master != c) ? master : NULL;
+  c->par = NULL;
   CLIST_FOR_EACH(struct an_hook *, hook, an_hooks[hook_type])
     {
       struct an_hook *h = mp_memdup(c->init_pool, hook, sizeof(*h));
@@ -145,6 +360,17 @@ analyser_init(struct an_context *c, enum an_hook_type hook_type, uns avail_need_
             a->name, an_hook_names[hook_type], avail_need_mask, h->need_mask);
       c->need_mask |= h->need_mask;
       h->doc_count = 0;
+      h->job = NULL;
+      if (an_threads && a->cost >= an_parallel_cost)
+	{
+	  h->job = mp_alloc_zero(c->init_pool, sizeof(struct an_job));
+	  h->job->pool = mp_new(4096);
+	  if (!c->par)
+	    {
+	      c->par = mp_alloc_zero(c->init_pool, sizeof(struct an_parallel));
+	      c->par->pool = mp_new(4096);
+	    }
+	}
     }
 }
 
@@ -156,6 +382,13 @@ analyser_cleanup(struct an_context *c)
       struct analyser *a = h->a;
       if (a->cleanup_context)
 	a->cleanup_context(h);
+      if (h->job)
+	mp_delete(h->job->pool);
+    }
+  if (c->par)
+    {
+      analyser_par_stop(c->par);
+      mp_delete(c->par->pool);
     }
   mp_delete(c->init_pool);
 }
@@ -202,6 +435,8 @@ analyser_need(struct an_context *c, struct an_iface *ai)
 void
 analyser_run(struct an_context *c, struct an_iface *ai)
 {
+  if (c->par && analyser_run_parallel(c, ai, 1))
+    return;
   CLIST_FOR_EACH(struct an_hook *, h, c->list)
     {
       TRACE("Analyser %s: Running", h->a->name);
@@ -219,6 +454,8 @@ analyser_run(struct an_context *c, struct an_iface *ai)
 void
 analyser_run_needed(struct an_context *c, struct an_iface *ai)
 {
+  if (c->par && analyser_run_parallel(c, ai, 0))
+    return;
   CLIST_FOR_EACH(struct an_hook *, h, c->list)
     if (h->triggered)
       {
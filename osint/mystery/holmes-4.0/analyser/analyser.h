@@ -29,6 +29,12 @@ enum an_needed {		// Which parts of the interface are required
   AN_NEED_TO_RUN = 128		// Set by analyser_need() to ensure non-zero output
 };
 
+enum an_cost {			// Estimated cost of analysing a single document
+  AN_COST_LOW,
+  AN_COST_MEDIUM,
+  AN_COST_HIGH,
+};
+
 enum an_hook_type {
   AN_HOOK_RAW,
   AN_HOOK_GATHERER,
@@ -49,6 +55,7 @@ struct an_hook {
   uns need_mask;		// A mask of AN_NEED_xxx flags
   char *parameter;		// Parameter from config
   uns initialized;
+  struct an_job *job;		// Private state for running in parallel (NULL=always run in the caller)
 };
 
 struct an_context {
@@ -56,6 +63,7 @@ struct an_context {
   struct mempool *init_pool;	// Context pool (for list allocation or analysers initialization)
   uns need_mask;		// OR combination of all hooks
   struct an_context *master;
+  struct an_parallel *par;	// Private state of parallel runs (NULL if not used)
 };
 
 struct analyser {
@@ -67,6 +75,7 @@ struct analyser {
   int (*need)(struct an_hook *h, struct an_iface *ai);		// Do we need to re-analyze the object? (optional)
 								// Only object attributes available here, no streams
   void (*analyse)(struct an_hook *h, struct an_iface *ai);	// Do the analysis
+  uns cost;							// AN_COST_xxx, see Analyser.ParallelCost
 };
 
 extern uns an_trace;
@@ -42,6 +42,10 @@ do {
   while (1)
     {
 
+#ifdef CONV_ASCII_RUNS
+      COPY_ASCII_RUN;
+#endif
+
 /*** Read ***/
 
 #ifdef CONV_READ_STD
@@ -286,3 +290,4 @@ write_slow:
 #undef CONV_WRITE_UTF8
 #undef CONV_WRITE_UTF16_BE
 #undef CONV_WRITE_UTF16_LE
+#undef CONV_ASCII_RUNS
@@ -14,6 +14,11 @@
 #include "charset/charconv.h"
 #include "charset/chartable.h"
 
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 void
 conv_init(struct conv_context *c)
 {
@@ -263,6 +268,49 @@ got_char:
   return CONV_DEST_END;
 }
 
+/*
+ *  Most texts consist mainly of ASCII characters, which are mapped to
+ *  themselves by nearly all conversions. We find runs of them with SSE2
+ *  (or a word at a time) and copy them at once.
+ */
+
+static inline uns
+ascii_prefix(const byte *s, uns len)
+{
+  const byte *p = s, *e = s + len;
+#ifdef __SSE2__
+  while (p + 16 <= e)
+    {
+      uns mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) p));
+      if (mask)
+	return p - s + __builtin_ctz(mask);
+      p += 16;
+    }
+#elif defined(CPU_ALLOW_UNALIGNED)
+  while (p + 8 <= e && !(get_u64_le(p) & 0x8080808080808080ULL))
+    p += 8;
+#endif
+  while (p < e && *p < 0x80)
+    p++;
+  return p - s;
+}
+
+unsigned int
+conv_ascii_prefix(const unsigned char *s, unsigned int len)
+{
+  return ascii_prefix(s, len);
+}
+
+/* Copy the ASCII run at the current position, if there is enough space for it */
+#define COPY_ASCII_RUN							\
+  if (c->ascii_copy && s < se && *s < 0x80)				\
+    {									\
+      uns run = ascii_prefix(s, MIN(se - s, de - d));			\
+      memcpy(d, s, run);						\
+      s += run;								\
+      d += run;								\
+    }
+
 /* Generate inlined routines */
 
 static int
@@ -270,6 +318,7 @@ conv_std_to_utf8(struct conv_context *c)
 {
 #define CONV_READ_STD
 #define CONV_WRITE_UTF8
+#define CONV_ASCII_RUNS
 #include "charset/charconv-gen.h"
 }
 
@@ -278,6 +327,7 @@ conv_utf8_to_std(struct conv_context *c)
 {
 #define CONV_READ_UTF8
 #define CONV_WRITE_STD
+#define CONV_ASCII_RUNS
 #include "charset/charconv-gen.h"
 }
 
@@ -372,6 +422,9 @@ main:
   de = c->dest_end;
   while (s < se)
     {
+      COPY_ASCII_RUN;
+      if (s >= se)
+	break;
       unsigned int code = x_to_out[in_to_x[*s]];
       if (code < 0x100)
 	{
@@ -443,6 +496,22 @@ conv_set_charset(struct conv_context *c, int src, int dest)
       c->x_to_out = dest_idx ? NULL : x_to_output[dest];
     }
   c->state = 0;
+
+  /* Can ASCII characters be copied? Only conversions between 8-bit charsets and UTF-8 try. */
+  c->ascii_copy = 0;
+  if (src != dest && (c->in_to_x || c->x_to_out) && dest != CONV_CHARSET_UTF16_BE && dest != CONV_CHARSET_UTF16_LE &&
+      src != CONV_CHARSET_UTF16_BE && src != CONV_CHARSET_UTF16_LE)
+    {
+      uns i;
+      for (i=0; i<0x80; i++)
+	{
+	  uns x = c->in_to_x ? c->in_to_x[i] : uni_to_x[0][i];
+	  uns out = c->x_to_out ? c->x_to_out[x] : x_to_uni[x];
+	  if (out != i)
+	    break;
+	}
+      c->ascii_copy = (i >= 0x80);
+    }
 }
 
 unsigned int
@@ -29,6 +29,7 @@ struct conv_context {
   unsigned short int *x_to_out;
   unsigned int state, code, remains;
   unsigned char *string_at;
+  unsigned int ascii_copy;		/* ASCII characters are copied verbatim */
 };
 
 void conv_init(struct conv_context *);
@@ -74,6 +75,9 @@ enum charset_id {
 int conv_in_to_ucs(struct conv_context *c, unsigned int y);
 int conv_ucs_to_out(struct conv_context *c, unsigned int ucs);
 
+/* Length of the initial run of ASCII characters (scanned many bytes at a time) */
+unsigned int conv_ascii_prefix(const unsigned char *s, unsigned int len);
+
 /* For those brave ones who want to mess with charconv internals */
 unsigned int conv_x_to_ucs(unsigned int x);
 unsigned int conv_ucs_to_x(unsigned int ucs);
@@ -0,0 +1,163 @@
+/*
+ *	The UniCode Library -- Combined Folding Table
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#include "ucw/lib.h"
+#include "ucw/unicode.h"
+#include "ucw/unaligned.h"
+#include "charset/unifold.h"
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const u64 *_U_fold[256];
+
+static void CONSTRUCTOR
+ufold_init(void)
+{
+  u64 p[256];
+  for (uns hi=0; hi<256; hi++)
+    {
+      for (uns lo=0; lo<256; lo++)
+	{
+	  uns x = (hi << 8) | lo;
+	  uns l = Utolower(x);
+	  uns a = Uunaccent(x);
+	  uns la = Uunaccent(l);
+	  p[lo] = ((u64) Ucategory(x) << 48) |
+	    ((u64) ((la - x) & 0xffff) << 32) |
+	    ((u64) ((a - x) & 0xffff) << 16) |
+	    ((l - x) & 0xffff);
+	}
+      /* Only the distinct pages are allocated, the rest point to them */
+      uns i = 0;
+      while (i < hi && memcmp(_U_fold[i], p, sizeof(p)))
+	i++;
+      if (i < hi)
+	_U_fold[hi] = _U_fold[i];
+      else
+	{
+	  u64 *q = xmalloc(sizeof(p));
+	  memcpy(q, p, sizeof(p));
+	  _U_fold[hi] = q;
+	}
+    }
+}
+
+/*
+ *  ASCII characters are never accented, so only the lower-case conversion
+ *  has to be done to them. We do it with SSE2 (or a word at a time) and stop
+ *  at the first non-ASCII character. Returns the number of bytes processed.
+ */
+
+#if !defined(__SSE2__) && defined(CPU_ALLOW_UNALIGNED)
+static inline u64
+ascii_lower_word(u64 w)
+{
+  /* For each byte <0x80, set its top bit iff it is between 'A' and 'Z' */
+  u64 upper = ((w + 0x3f3f3f3f3f3f3f3fULL) ^ (w + 0x2525252525252525ULL)) & 0x8080808080808080ULL;
+  return w | (upper >> 2);
+}
+#endif
+
+static inline uns
+ascii_fold(byte *to, const byte *from, uns len, uns lower)
+{
+  uns i = 0;
+#ifdef __SSE2__
+  const __m128i below_a = _mm_set1_epi8('A' - 1);
+  const __m128i above_z = _mm_set1_epi8('Z' + 1);
+  const __m128i bit = _mm_set1_epi8(0x20);
+  while (i + 16 <= len)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(from + i));
+      if (_mm_movemask_epi8(v))
+	break;
+      if (lower)
+	{
+	  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, below_a), _mm_cmplt_epi8(v, above_z));
+	  v = _mm_or_si128(v, _mm_and_si128(upper, bit));
+	}
+      _mm_storeu_si128((__m128i *)(to + i), v);
+      i += 16;
+    }
+#elif defined(CPU_ALLOW_UNALIGNED)
+  while (i + 8 <= len)
+    {
+      u64 w = get_u64_le(from + i);
+      if (w & 0x8080808080808080ULL)
+	break;
+      put_u64_le(to + i, lower ? ascii_lower_word(w) : w);
+      i += 8;
+    }
+#endif
+  while (i < len && from[i] < 0x80)
+    {
+      uns c = from[i];
+      to[i++] = (lower && c >= 'A' && c <= 'Z') ? c + 0x20 : c;
+    }
+  return i;
+}
+
+byte *
+ufold_utf8(byte *to, byte *stop, const byte *from, const byte *from_end, uns mode)
+{
+  uns u;
+  while (from < from_end)
+    {
+      uns run = ascii_fold(to, from, MIN(from_end - from, stop - to), mode & UFOLD_LOWER);
+      to += run;
+      from += run;
+      if (from >= from_end)
+	break;
+      from = utf8_get(from, &u);
+      u = Ufold_char(u, mode);
+      if (to + utf8_space(u) > stop)
+	return NULL;
+      to = utf8_put(to, u);
+    }
+  return to;
+}
+
+byte *
+ufold_uni(byte *to, const u16 *from, uns len, uns mode)
+{
+  const u16 *end = from + len;
+  while (from < end)
+    {
+#ifdef __SSE2__
+      /* Pack runs of 16 ASCII characters to bytes and lower-case them at once */
+      const __m128i high = _mm_set1_epi16(0xff80);
+      while (from + 16 <= end)
+	{
+	  __m128i a = _mm_loadu_si128((const __m128i *) from);
+	  __m128i b = _mm_loadu_si128((const __m128i *)(from + 8));
+	  __m128i h = _mm_and_si128(_mm_or_si128(a, b), high);
+	  if (_mm_movemask_epi8(_mm_cmpeq_epi16(h, _mm_setzero_si128())) != 0xffff)
+	    break;
+	  __m128i v = _mm_packus_epi16(a, b);
+	  if (mode & UFOLD_LOWER)
+	    {
+	      __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+	      v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+	    }
+	  _mm_storeu_si128((__m128i *) to, v);
+	  to += 16;
+	  from += 16;
+	}
+      if (from >= end)
+	break;
+#endif
+      uns u = *from++;
+      if (u < 0x80)
+	*to++ = ((mode & UFOLD_LOWER) && u >= 'A' && u <= 'Z') ? u + 0x20 : u;
+      else
+	to = utf8_put(to, Ufold_char(u, mode));
+    }
+  return to;
+}
@@ -0,0 +1,76 @@
+/*
+ *	The UniCode Library -- Combined Folding Table
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#ifndef _CHARSET_UNIFOLD_H
+#define _CHARSET_UNIFOLD_H
+
+#include "charset/unicat.h"
+
+/*
+ *  A single lookup in the folding table gives the category, the lower-case
+ *  form, the unaccented form and the unaccented lower-case form of a character
+ *  from the BMP. Each entry has the following layout:
+ *
+ *	bits 0--15	lower-case minus the character (mod 2^16)
+ *	bits 16--31	unaccented minus the character
+ *	bits 32--47	unaccented lower-case minus the character
+ *	bits 48--55	category (see unicat.h)
+ *
+ *  As we store differences, all pages of characters without any mapping
+ *  and with the same category are identical and they are shared: only
+ *  47 distinct pages of 2 KB each exist (94 KB).
+ *
+ *  The table is built from the usual tables when the library is loaded,
+ *  only the distinct pages are allocated.
+ */
+
+extern const u64 *_U_fold[];
+
+enum ufold_mode {
+  UFOLD_LOWER = 1,		/* Convert to lower case */
+  UFOLD_UNACCENT = 2,		/* Remove accents */
+  UFOLD_LOWER_UNACCENT = 3,	/* Both */
+};
+
+static inline u64 Ufold(uns x)
+{
+  return _U_fold[x >> 8U][x & 0xff];
+}
+
+#define UFOLD_CAT(f) ((uns)((f) >> 48) & 0xff)
+
+static inline uns Ufold_lower(uns x, u64 f)
+{
+  return (x + (uns)f) & 0xffff;
+}
+
+static inline uns Ufold_unaccent(uns x, u64 f)
+{
+  return (x + (uns)(f >> 16)) & 0xffff;
+}
+
+static inline uns Ufold_lower_unaccent(uns x, u64 f)
+{
+  return (x + (uns)(f >> 32)) & 0xffff;
+}
+
+/* Fold a single character according to ufold_mode */
+static inline uns Ufold_char(uns x, uns mode)
+{
+  return (x + (uns)(Ufold(x) >> (16 * (mode - 1)))) & 0xffff;
+}
+
+/*
+ *  Fold a whole word, runs of ASCII characters are processed many at a time.
+ *  The UTF-8 version fails and returns NULL if the result would not fit
+ *  below `stop', the UCS-2 version expects enough space for 3 bytes
+ *  per character.
+ */
+byte *ufold_utf8(byte *to, byte *stop, const byte *from, const byte *from_end, uns mode);
+byte *ufold_uni(byte *to, const u16 *from, uns len, uns mode);
+
+#endif
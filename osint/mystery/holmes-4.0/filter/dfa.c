@@ -0,0 +1,799 @@
+/*
+ *	Sherlock Filter Engine -- Sets of Regular Expressions
+ *
+ *	All regular expressions tested by one SWITCH are merged to a single
+ *	non-deterministic automaton, which is converted to a deterministic one
+ *	lazily during matching (only the states we really visit are built).
+ *	Each string is thus scanned once, regardless of the number of patterns.
+ *
+ *	The parser understands the POSIX extended syntax as used by rx_compile()
+ *	with the exception of back-references, word boundaries, collating
+ *	elements and equivalence classes.  Patterns using them are left to the
+ *	regex library and tested sequentially.
+ */
+
+#include "sherlock/sherlock.h"
+#include "ucw/mempool.h"
+#include "ucw/hashfunc.h"
+#include "ucw/chartype.h"
+#include "filter/filter.h"
+#include "filter/parse.tab.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#define DFA_MAX_NODES	65536		/* more nodes in the NFA means the pattern is not merged */
+#define DFA_MAX_STATES	4096		/* the cache of DFA states is flushed when it grows larger */
+
+enum dfa_node_type {
+	DN_SET,				/* consume a character from set[arg], go to out */
+	DN_SPLIT,			/* go to both out and arg */
+	DN_EPS,				/* go to out */
+	DN_BOL,				/* go to out at the beginning of the string */
+	DN_EOL,				/* go to out at the end of the string */
+	DN_MATCH,			/* pattern number arg matches */
+};
+
+struct dfa_node {
+	uns type;
+	uns out, arg;
+};
+
+struct dfa_set {
+	u32 bits[8];
+};
+
+struct filter_dfa_nfa {
+	uns nodes, patterns, classes;
+	struct dfa_node *node;
+	struct dfa_set *set;
+	uns *start;			/* the first node of each pattern */
+	byte class[256];		/* characters never distinguished by the automaton share a class */
+	byte rep[256];			/* a representative character of each class */
+};
+
+struct dfa_state {
+	struct dfa_state *hnext;
+	uns hash, len, bol;
+	uns *nfa;			/* sorted NFA nodes of types DN_SET, DN_EOL and DN_MATCH */
+	uns accepts;			/* patterns matching if the string ends here */
+	uns *accept;
+	struct dfa_state *next[0];	/* indexed by character classes, NULL if not known yet */
+};
+
+struct filter_dfa_cache {
+	struct mempool *pool;
+	uns states;
+	struct dfa_state *hash[2*DFA_MAX_STATES];
+	struct dfa_state *start;
+	uns gen, *mark;			/* visited NFA nodes */
+	uns *stack, *buf, *buf2;
+};
+
+static inline int
+set_has(struct dfa_set *s, uns c)
+{
+	return (s->bits[c / 32] >> (c % 32)) & 1;
+}
+
+static inline void
+set_add(struct dfa_set *s, uns c)
+{
+	s->bits[c / 32] |= 1U << (c % 32);
+}
+
+/*** Parser ***/
+
+#define GBUF_TYPE struct dfa_node
+#define GBUF_PREFIX(x) dfa_node_buf_##x
+#include "ucw/gbuf.h"
+
+#define GBUF_TYPE struct dfa_set
+#define GBUF_PREFIX(x) dfa_set_buf_##x
+#include "ucw/gbuf.h"
+
+struct dfa_builder {
+	dfa_node_buf_t node;
+	dfa_set_buf_t set;
+	uns nodes, sets;
+	byte *p;			/* the rest of the pattern */
+	byte *branch;			/* start of the current top-level branch */
+	uns depth;			/* nesting of parentheses */
+	uns icase;
+	int error;
+};
+
+struct dfa_frag {
+	uns start, end;			/* end is a DN_EPS node with out not set yet */
+};
+
+static uns
+new_node(struct dfa_builder *b, uns type, uns out, uns arg)
+{
+	if (b->nodes >= DFA_MAX_NODES)
+	{
+		b->error = 1;
+		return 0;
+	}
+	struct dfa_node *n = dfa_node_buf_grow(&b->node, b->nodes + 1) + b->nodes;
+	n->type = type;
+	n->out = out;
+	n->arg = arg;
+	return b->nodes++;
+}
+
+static struct dfa_frag
+new_frag(struct dfa_builder *b, uns type, uns arg)
+{
+	uns end = new_node(b, DN_EPS, ~0U, 0);
+	return (struct dfa_frag) { new_node(b, type, end, arg), end };
+}
+
+static struct dfa_frag
+empty_frag(struct dfa_builder *b)
+{
+	uns n = new_node(b, DN_EPS, ~0U, 0);
+	return (struct dfa_frag) { n, n };
+}
+
+static inline void
+patch(struct dfa_builder *b, uns end, uns to)
+{
+	if (!b->error)
+		b->node.ptr[end].out = to;
+}
+
+static struct dfa_frag
+concat(struct dfa_builder *b, struct dfa_frag f, struct dfa_frag g)
+{
+	patch(b, f.end, g.start);
+	return (struct dfa_frag) { f.start, g.end };
+}
+
+/* Adds a set of characters, taking care of case insensitivity */
+static struct dfa_frag
+set_frag(struct dfa_builder *b, struct dfa_set *s, int negate)
+{
+	struct dfa_set t;
+	bzero(&t, sizeof(t));
+	for (uns c=1; c<256; c++)
+		if (set_has(s, b->icase ? Clocase(c) : c) != negate)
+			set_add(&t, c);
+	*(dfa_set_buf_grow(&b->set, b->sets + 1) + b->sets) = t;
+	return new_frag(b, DN_SET, b->sets++);
+}
+
+static void
+set_add_item(struct dfa_builder *b, struct dfa_set *s, uns c)
+{
+	set_add(s, b->icase ? Clocase(c) : c);
+}
+
+static struct dfa_frag
+char_frag(struct dfa_builder *b, uns c)
+{
+	struct dfa_set s;
+	bzero(&s, sizeof(s));
+	set_add_item(b, &s, c);
+	return set_frag(b, &s, 0);
+}
+
+static int
+class_has(byte *name, uns len, uns c)
+{
+#define CLASS(n, test) if (len == sizeof(n)-1 && !memcmp(name, n, len)) return !!(test);
+	CLASS("alpha", isalpha(c));
+	CLASS("digit", isdigit(c));
+	CLASS("alnum", isalnum(c));
+	CLASS("upper", isupper(c));
+	CLASS("lower", islower(c));
+	CLASS("space", isspace(c));
+	CLASS("blank", c == ' ' || c == '\t');
+	CLASS("punct", ispunct(c));
+	CLASS("print", isprint(c));
+	CLASS("graph", isgraph(c));
+	CLASS("cntrl", iscntrl(c));
+	CLASS("xdigit", isxdigit(c));
+#undef CLASS
+	return -1;
+}
+
+static struct dfa_frag
+parse_bracket(struct dfa_builder *b)
+{
+	struct dfa_set s;
+	uns negate = 0, first = 1;
+	bzero(&s, sizeof(s));
+	if (*b->p == '^')
+	{
+		negate = 1;
+		b->p++;
+	}
+	for (;;)
+	{
+		uns c = *b->p;
+		if (!c)
+			goto error;
+		if (c == ']' && !first)
+		{
+			b->p++;
+			break;
+		}
+		first = 0;
+		if (c == '[' && b->p[1] == ':')
+		{
+			byte *name = b->p + 2, *end = strstr(name, ":]");
+			if (!end || class_has(name, end - name, 0) < 0)
+				goto error;
+			for (uns i=1; i<256; i++)
+				if (class_has(name, end - name, i))
+					set_add_item(b, &s, i);
+			b->p = end + 2;
+			continue;
+		}
+		if (c == '[' && (b->p[1] == '=' || b->p[1] == '.'))
+			goto error;
+		b->p++;
+		if (*b->p == '-' && b->p[1] && b->p[1] != ']')
+		{
+			uns d = b->p[1];
+			if (d == '[' || d < c)
+				goto error;
+			b->p += 2;
+			for (uns i=c; i<=d; i++)
+				set_add_item(b, &s, i);
+		}
+		else
+			set_add_item(b, &s, c);
+	}
+	return set_frag(b, &s, negate);
+
+error:
+	b->error = 1;
+	return empty_frag(b);
+}
+
+static struct dfa_frag parse_regex(struct dfa_builder *b);
+
+static struct dfa_frag
+parse_atom(struct dfa_builder *b)
+{
+	struct dfa_set s;
+	struct dfa_frag f;
+	uns c = *b->p++;
+
+	switch (c)
+	{
+		case '(':
+			b->depth++;
+			f = parse_regex(b);
+			b->depth--;
+			if (*b->p != ')')
+				break;
+			b->p++;
+			return f;
+		case '.':
+			bzero(&s, sizeof(s));
+			return set_frag(b, &s, 1);
+		case '[':
+			return parse_bracket(b);
+		/*
+		 *  Anchors are accepted only at the edges of top-level branches. Elsewhere
+		 *  (e.g., inside a repeated group), glibc does not follow POSIX semantics
+		 *  and we prefer to stay compatible with the sequential matching.
+		 */
+		case '^':
+			if (b->depth || b->p-1 != b->branch || *b->p && strchr("*+?{", *b->p))
+				break;
+			return new_frag(b, DN_BOL, 0);
+		case '$':
+			if (b->depth || (*b->p && *b->p != '|'))
+				break;
+			return new_frag(b, DN_EOL, 0);
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+			break;
+		case '\\':
+			if (!(c = *b->p))
+				break;
+			b->p++;
+			bzero(&s, sizeof(s));
+			switch (c)
+			{
+				case 'w':
+				case 'W':
+					for (uns i=1; i<256; i++)
+						if (isalnum(i) || i == '_')
+							set_add(&s, i);
+					return set_frag(b, &s, c == 'W');
+				case 's':
+				case 'S':
+					for (uns i=1; i<256; i++)
+						if (isspace(i))
+							set_add(&s, i);
+					return set_frag(b, &s, c == 'S');
+				case '1' ... '9':
+				case 'b':
+				case 'B':
+				case '<':
+				case '>':
+				case '`':
+				case '\'':
+					break;
+				default:
+					return char_frag(b, c);
+			}
+			break;
+		default:
+			return char_frag(b, c);
+	}
+	b->error = 1;
+	return empty_frag(b);
+}
+
+static struct dfa_frag
+star(struct dfa_builder *b, struct dfa_frag f)
+{
+	uns end = new_node(b, DN_EPS, ~0U, 0);
+	uns split = new_node(b, DN_SPLIT, f.start, end);
+	patch(b, f.end, split);
+	return (struct dfa_frag) { split, end };
+}
+
+static struct dfa_frag
+plus(struct dfa_builder *b, struct dfa_frag f)
+{
+	uns end = new_node(b, DN_EPS, ~0U, 0);
+	uns split = new_node(b, DN_SPLIT, f.start, end);
+	patch(b, f.end, split);
+	return (struct dfa_frag) { f.start, end };
+}
+
+static struct dfa_frag
+optional(struct dfa_builder *b, struct dfa_frag f)
+{
+	uns split = new_node(b, DN_SPLIT, f.start, f.end);
+	return (struct dfa_frag) { split, f.end };
+}
+
+static int
+parse_bound(struct dfa_builder *b, uns *min, uns *max)
+{
+	byte *p = b->p;
+	if (!Cdigit(*p))
+		return 0;
+	for (*min = 0; Cdigit(*p) && *min < 1000; p++)
+		*min = *min * 10 + *p - '0';
+	*max = *min;
+	if (*p == ',')
+	{
+		p++;
+		*max = ~0U;
+		if (Cdigit(*p))
+			for (*max = 0; Cdigit(*p) && *max < 1000; p++)
+				*max = *max * 10 + *p - '0';
+	}
+	if (*p++ != '}' || *min > *max || *min > 255 || (*max != ~0U && *max > 255))
+		return 0;
+	b->p = p;
+	return 1;
+}
+
+/* The first copy of a repeated atom is the one already parsed */
+static struct dfa_frag
+next_copy(struct dfa_builder *b, byte *atom, struct dfa_frag f, uns *copies)
+{
+	if (!(*copies)++)
+		return f;
+	b->p = atom;
+	return parse_atom(b);
+}
+
+static struct dfa_frag
+parse_piece(struct dfa_builder *b)
+{
+	byte *atom = b->p;
+	struct dfa_frag f = parse_atom(b);
+	uns quantified = 0, min, max;
+
+	while (!b->error)
+	{
+		switch (*b->p)
+		{
+			case '*':
+				f = star(b, f);
+				break;
+			case '+':
+				f = plus(b, f);
+				break;
+			case '?':
+				f = optional(b, f);
+				break;
+			case '{':
+				b->p++;
+				if (quantified || !parse_bound(b, &min, &max))
+				{
+					b->error = 1;
+					return f;
+				}
+				/* Repeat the atom by parsing it again */
+				byte *rest = b->p;
+				struct dfa_frag g = empty_frag(b);
+				uns copies = 0;
+				for (uns i=0; i<min; i++)
+					g = concat(b, g, next_copy(b, atom, f, &copies));
+				if (max == ~0U)
+					g = concat(b, g, star(b, next_copy(b, atom, f, &copies)));
+				else
+					for (uns i=min; i<max; i++)
+						g = concat(b, g, optional(b, next_copy(b, atom, f, &copies)));
+				f = g;
+				b->p = rest;
+				quantified = 1;
+				continue;
+			default:
+				return f;
+		}
+		b->p++;
+		quantified = 1;
+	}
+	return f;
+}
+
+static struct dfa_frag
+parse_branch(struct dfa_builder *b)
+{
+	struct dfa_frag f = empty_frag(b);
+	if (!b->depth)
+		b->branch = b->p;
+	while (!b->error && *b->p && *b->p != '|' && *b->p != ')')
+		f = concat(b, f, parse_piece(b));
+	return f;
+}
+
+static struct dfa_frag
+parse_regex(struct dfa_builder *b)
+{
+	struct dfa_frag f = parse_branch(b);
+	while (!b->error && *b->p == '|')
+	{
+		b->p++;
+		struct dfa_frag g = parse_branch(b);
+		uns end = new_node(b, DN_EPS, ~0U, 0);
+		uns split = new_node(b, DN_SPLIT, f.start, g.start);
+		patch(b, f.end, end);
+		patch(b, g.end, end);
+		f = (struct dfa_frag) { split, end };
+	}
+	return f;
+}
+
+/* Returns the start node of the pattern or ~0U if it cannot be handled */
+static uns
+add_pattern(struct dfa_builder *b, byte *pattern, uns icase, uns id)
+{
+	uns nodes = b->nodes, sets = b->sets;
+	b->p = pattern;
+	b->icase = icase;
+	b->depth = 0;
+	b->error = 0;
+	struct dfa_frag f = parse_regex(b);
+	if (*b->p)
+		b->error = 1;
+	uns match = new_node(b, DN_MATCH, 0, id);
+	patch(b, f.end, match);
+	if (b->error)
+	{
+		b->nodes = nodes;
+		b->sets = sets;
+		return ~0U;
+	}
+	return f.start;
+}
+
+static int
+can_be_in_dfa(struct filter *f, struct filter_case *cs)
+{
+	struct filter_cond *cond = cs->cond;
+	ASSERT(cond->cat == F_CC_EXPR);
+	return cs->type == F_ET_STRING
+		&& cond->o.expr.op == EREG
+		&& !cond->o.expr.neg
+		&& cond->o.expr.r->cat == F_EC_CONST
+		&& cond->o.expr.r->type == F_ET_REGEXP
+		&& f->lookup[cond->o.expr.r->o.i].type == F_LT_REGEX;
+}
+
+/* Splits characters to classes, which behave the same in all sets */
+static void
+build_classes(struct filter_dfa_nfa *nfa)
+{
+	bzero(nfa->class, sizeof(nfa->class));
+	nfa->classes = 1;
+	for (uns i=0; i<nfa->nodes; i++)
+	{
+		if (nfa->node[i].type != DN_SET)
+			continue;
+		struct dfa_set *s = &nfa->set[nfa->node[i].arg];
+		int split[256][2];
+		memset(split, 0xff, sizeof(split));
+		uns classes = 0;
+		for (uns c=0; c<256; c++)
+		{
+			int *to = &split[nfa->class[c]][set_has(s, c)];
+			if (*to < 0)
+				*to = classes++;
+			nfa->class[c] = *to;
+		}
+		nfa->classes = classes;
+	}
+	for (int c=255; c>=0; c--)
+		nfa->rep[nfa->class[c]] = c;
+}
+
+struct filter_dfa_table *
+filter_dfa_new(struct filter *f, struct filter_cmd *case_cmd)
+{
+	struct filter_case **cs, *x;
+	struct dfa_builder b;
+	uns count = 0;
+
+	ASSERT(case_cmd->op == SWITCH);
+	if (case_cmd->c.swit.expr->type != F_ET_STRING)
+		return NULL;
+	for (x = case_cmd->c.swit.cases; x; x = x->next)
+		count += can_be_in_dfa(f, x);
+	if (!count || count < filter_dfa_limit)
+		return NULL;
+
+	bzero(&b, sizeof(b));
+	dfa_node_buf_init(&b.node);
+	dfa_set_buf_init(&b.set);
+	struct filter_dfa_table *dfa = mp_alloc_zero(f->pool, sizeof(*dfa));
+	struct filter_dfa_nfa *nfa = mp_alloc_zero(f->pool, sizeof(*nfa));
+	dfa->nfa = nfa;
+	dfa->cmd = mp_alloc(f->pool, count * sizeof(struct filter_case *));
+	nfa->start = mp_alloc(f->pool, count * sizeof(uns));
+	for (cs = &case_cmd->c.swit.cases; *cs; )
+	{
+		uns start;
+		if (can_be_in_dfa(f, *cs))
+		{
+			struct filter_regex_value *rv = f->lookup[(*cs)->cond->o.expr.r->o.i].regex;
+			start = add_pattern(&b, rv->source, rv->icase, dfa->cmds);
+		}
+		else
+			start = ~0U;
+		if (start == ~0U)
+		{
+			cs = &(*cs)->next;
+			continue;
+		}
+		nfa->start[dfa->cmds] = start;
+		dfa->cmd[dfa->cmds++] = *cs;
+		*cs = (*cs)->next;
+	}
+	if (dfa->cmds < filter_dfa_limit)
+	{
+		/* Too few patterns understood, return the cases to the SWITCH */
+		for (uns i=dfa->cmds; i--; )
+		{
+			for (cs = &case_cmd->c.swit.cases; *cs && (*cs)->case_id < dfa->cmd[i]->case_id; cs = &(*cs)->next)
+				;
+			dfa->cmd[i]->next = *cs;
+			*cs = dfa->cmd[i];
+		}
+		dfa = NULL;
+	}
+	else
+	{
+		nfa->patterns = dfa->cmds;
+		nfa->nodes = b.nodes;
+		nfa->node = mp_memdup(f->pool, b.node.ptr, b.nodes * sizeof(struct dfa_node));
+		nfa->set = mp_memdup(f->pool, b.set.ptr, b.sets * sizeof(struct dfa_set) + 1);
+		build_classes(nfa);
+		if (filter_trace > 0)
+			log(L_DEBUG, "filter: Merged %d regular expressions to an automaton with %d nodes and %d character classes", nfa->patterns, nfa->nodes, nfa->classes);
+	}
+	dfa_node_buf_done(&b.node);
+	dfa_set_buf_done(&b.set);
+	return dfa;
+}
+
+/*** Lazy construction of the deterministic automaton ***/
+
+#define ASORT_PREFIX(x) dfa_nodes_##x
+#define ASORT_KEY_TYPE uns
+#include "ucw/sorter/array-simple.h"
+
+static void
+cache_init(struct filter_dfa_table *dfa)
+{
+	struct filter_dfa_cache *c = xmalloc_zero(sizeof(*c));
+	uns n = dfa->nfa->nodes;
+	c->pool = mp_new(65536);
+	c->mark = xmalloc_zero(n * sizeof(uns));
+	c->stack = xmalloc(n * sizeof(uns));
+	c->buf = xmalloc(n * sizeof(uns));
+	c->buf2 = xmalloc(n * sizeof(uns));
+	dfa->cache = c;
+}
+
+static void
+cache_flush(struct filter_dfa_cache *c)
+{
+	mp_flush(c->pool);
+	bzero(c->hash, sizeof(c->hash));
+	c->states = 0;
+	c->start = NULL;
+}
+
+/*
+ *  Adds the epsilon-closure of a node to buf[len...], returns the new length.
+ *  Only the nodes important for the state are recorded: character sets,
+ *  end-of-line assertions (unless we are at the end and can pass them)
+ *  and matches.
+ */
+static uns
+closure(struct filter_dfa_nfa *nfa, struct filter_dfa_cache *c, uns node, uns *buf, uns len, uns bol, uns eol)
+{
+	uns sp = 0;
+	c->stack[sp++] = node;
+	while (sp)
+	{
+		uns i = c->stack[--sp];
+		if (c->mark[i] == c->gen)
+			continue;
+		c->mark[i] = c->gen;
+		struct dfa_node *n = &nfa->node[i];
+		switch (n->type)
+		{
+			case DN_SET:
+			case DN_MATCH:
+				buf[len++] = i;
+				break;
+			case DN_EOL:
+				if (eol)
+					c->stack[sp++] = n->out;
+				else
+					buf[len++] = i;
+				break;
+			case DN_BOL:
+				if (bol)
+					c->stack[sp++] = n->out;
+				break;
+			case DN_EPS:
+				c->stack[sp++] = n->out;
+				break;
+			case DN_SPLIT:
+				c->stack[sp++] = n->arg;
+				c->stack[sp++] = n->out;
+				break;
+		}
+	}
+	return len;
+}
+
+/* Returns NULL if the cache is full */
+static struct dfa_state *
+get_state(struct filter_dfa_table *dfa, uns *nodes, uns len, uns bol)
+{
+	struct filter_dfa_nfa *nfa = dfa->nfa;
+	struct filter_dfa_cache *c = dfa->cache;
+	dfa_nodes_sort(nodes, len);
+	uns hash = hash_block((byte *) nodes, len * sizeof(uns)) ^ bol;
+	uns h = hash % ARRAY_SIZE(c->hash);
+	for (struct dfa_state *s = c->hash[h]; s; s = s->hnext)
+		if (s->hash == hash && s->len == len && s->bol == bol && !memcmp(s->nfa, nodes, len * sizeof(uns)))
+			return s;
+	if (c->states >= DFA_MAX_STATES)
+		return NULL;
+
+	struct dfa_state *s = mp_alloc_zero(c->pool, sizeof(*s) + nfa->classes * sizeof(struct dfa_state *));
+	s->hash = hash;
+	s->len = len;
+	s->bol = bol;
+	s->nfa = mp_memdup(c->pool, nodes, len * sizeof(uns));
+	s->hnext = c->hash[h];
+	c->hash[h] = s;
+	c->states++;
+
+	/* Which patterns match if the string ends here? */
+	uns *acc = c->buf2, accs = 0;
+	c->gen++;
+	for (uns i=0; i<len; i++)
+		if (nfa->node[nodes[i]].type == DN_EOL)
+			accs = closure(nfa, c, nfa->node[nodes[i]].out, acc, accs, bol, 1);
+		else if (nfa->node[nodes[i]].type == DN_MATCH)
+			acc[accs++] = nodes[i];
+	uns k = 0;
+	for (uns i=0; i<accs; i++)
+		if (nfa->node[acc[i]].type == DN_MATCH)
+			acc[k++] = nfa->node[acc[i]].arg;
+	dfa_nodes_sort(acc, k);
+	s->accepts = 0;
+	s->accept = mp_alloc(c->pool, k * sizeof(uns) + 1);
+	for (uns i=0; i<k; i++)
+		if (!i || acc[i] != acc[i-1])
+			s->accept[s->accepts++] = acc[i];
+	return s;
+}
+
+static struct dfa_state *
+start_state(struct filter_dfa_table *dfa)
+{
+	struct filter_dfa_nfa *nfa = dfa->nfa;
+	struct filter_dfa_cache *c = dfa->cache;
+	uns len = 0;
+	c->gen++;
+	for (uns i=0; i<nfa->patterns; i++)
+		len = closure(nfa, c, nfa->start[i], c->buf, len, 1, 0);
+	return c->start = get_state(dfa, c->buf, len, 1);
+}
+
+/* Computes the transition from the state s by the character class cl */
+static struct dfa_state *
+step(struct filter_dfa_table *dfa, struct dfa_state *s, uns cl)
+{
+	struct filter_dfa_nfa *nfa = dfa->nfa;
+	struct filter_dfa_cache *c = dfa->cache;
+	uns len = 0, ch = nfa->rep[cl];
+	c->gen++;
+	for (uns i=0; i<s->len; i++)
+	{
+		struct dfa_node *n = &nfa->node[s->nfa[i]];
+		if (n->type == DN_SET && set_has(&nfa->set[n->arg], ch))
+			len = closure(nfa, c, n->out, c->buf, len, 0, 0);
+	}
+	struct dfa_state *t = get_state(dfa, c->buf, len, 0);
+	if (t)
+		s->next[cl] = t;
+	else
+	{
+		/* The cache is full: start from scratch, the nodes are still in buf */
+		cache_flush(c);
+		t = get_state(dfa, c->buf, len, 0);
+	}
+	return t;
+}
+
+void
+filter_dfa_search(struct filter_dfa_table *dfa, byte *string, struct filter_cases *res)
+{
+	struct filter_dfa_nfa *nfa = dfa->nfa;
+	if (!dfa->cache)
+		cache_init(dfa);
+	struct dfa_state *s = dfa->cache->start ? : start_state(dfa);
+	for (byte *p = string; *p && s->len; p++)
+	{
+		uns cl = nfa->class[*p];
+		s = s->next[cl] ? : step(dfa, s, cl);
+	}
+	for (uns i=0; i<s->accepts; i++)
+		filter_cases_add(res, dfa->cmd[s->accept[i]]);
+}
+
+struct filter_dfa_table *
+filter_dfa_clone(struct mempool *mp, struct filter_dfa_table *dfa)
+{
+	struct filter_dfa_table *d = mp_memdup(mp, dfa, sizeof(*dfa));
+	d->cache = NULL;
+	return d;
+}
+
+void
+filter_dfa_free(struct filter_dfa_table *dfa)
+{
+	struct filter_dfa_cache *c = dfa->cache;
+	if (!c)
+		return;
+	mp_delete(c->pool);
+	xfree(c->mark);
+	xfree(c->stack);
+	xfree(c->buf);
+	xfree(c->buf2);
+	xfree(c);
+	dfa->cache = NULL;
+}
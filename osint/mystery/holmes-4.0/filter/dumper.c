@@ -279,6 +279,24 @@ dump_switch_kmp(struct fastbuf *b, struct filter *f, struct filter_kmp_table *km
 	dump_kmp_chain(b, f, kmp->cases, op, level);
 }
 
+static void
+dump_switch_dfa(struct fastbuf *b, struct filter *f, struct filter_dfa_table *dfa, uns level)
+{
+	if (!dfa)
+		return;
+	filter_dump_spaces(b, level);
+	bputs(b, "# automaton for the operator =~\n");
+	for (uns i=0; i<dfa->cmds; i++)		/* The order is the same as in the original program.  */
+	{
+		struct filter_case *cas = dfa->cmd[i];
+		filter_dump_spaces(b, level);
+		bputs(b, "case ");
+		filter_dump_condition(b, f, cas->cond);
+		bputs(b, ":\n");
+		filter_dump_commands(b, f, cas->positive, level+1);
+	}
+}
+
 static void
 dump_switch_trie(struct fastbuf *b, struct filter *f, struct filter_trie_table *trie, byte *op, uns level)
 {
@@ -411,6 +429,7 @@ filter_dump_commands(struct fastbuf *b, struct filter *f, struct filter_cmd *cmd
 				dump_switch_kmp(b, f, cmd->c.swit.ikmp, "=**", level+1);
 				dump_switch_trie(b, f, f->lookup[cmd->c.swit.pat].trie, "=*", level+1);
 				dump_switch_trie(b, f, f->lookup[cmd->c.swit.ipat].trie, "=**", level+1);
+				dump_switch_dfa(b, f, f->lookup[cmd->c.swit.dfa].dfa, level+1);
 				if (cmd->c.swit.expr->type == F_ET_STRING)
 				{
 					filter_s_tree_dump(b, f, cmd->c.swit.bins, level+1);
@@ -13,7 +13,9 @@ uns filter_hash_limit = 4;
 uns filter_kmp_limit = 4;
 uns filter_trie_limit = 4;
 uns filter_tree_limit = 4;
+uns filter_dfa_limit = 4;
 uns filter_optimize = 1;
+uns filter_compile_code = 1;
 char *filter_dump_to = NULL;
 
 static struct cf_section fconfig = {
@@ -23,7 +25,9 @@ static struct cf_section fconfig = {
 		CF_UNS("KMPLimit", &filter_kmp_limit),
 		CF_UNS("TrieLimit", &filter_trie_limit),
 		CF_UNS("TreeLimit", &filter_tree_limit),
+		CF_UNS("DFALimit", &filter_dfa_limit),
 		CF_UNS("Optimize", &filter_optimize),
+		CF_UNS("Compile", &filter_compile_code),
 		CF_STRING("DumpFilterTo", &filter_dump_to),
 		CF_END
 	}
@@ -54,6 +54,8 @@ filter_do_load(struct filter_variable *var, struct filter_binding *bind, struct
 	f->lookup_limit = 32;
 	f->lookup = xmalloc(f->lookup_limit * sizeof(*f->lookup));
 	bzero(f->lookup, sizeof(*f->lookup));
+	f->code = NULL;
+	f->code_len = f->code_entry = f->code_regs = 0;
 
 	filter_current = f;
 	int err = filter_do_parse(f);
@@ -128,6 +130,9 @@ filter_clone(struct filter *filter)
 				}
 				break;
 			}
+			case F_LT_DFA:
+				l->dfa = filter_dfa_clone(f->pool, l->dfa);
+				break;
 			default:
 				ASSERT(0);
 		}
@@ -161,6 +166,9 @@ filter_delete(struct filter *f)
 	// memory leak (regex)
 	if (!f)
 		return;
+	for (uns i = 1; i <= f->lookup_count; i++)
+		if (f->lookup[i].type == F_LT_DFA)
+			filter_dfa_free(f->lookup[i].dfa);
 	mp_delete(f->pool);
 	xfree(f->lookup);
 	xfree(f);
@@ -173,6 +181,8 @@ filter_intr_new(struct filter *f)
 	a->filter = f;
 	if (a->filter->user_vars)
 		a->user_var = xmalloc_zero(a->filter->user_vars*sizeof(union filter_raw_value));
+	if (a->filter->code)
+		a->reg = xmalloc_zero(a->filter->code_regs*sizeof(struct filter_value));
 	return a;
 }
 
@@ -181,10 +191,11 @@ filter_intr_delete(struct filter_args *a)
 {
 	xfree(a->user_var);
 	a->user_var = NULL;
+	xfree(a->reg);
 	xfree(a);
 }
 
-static void
+void
 filter_get_lvalue(struct filter_value *dest, struct filter_args *args, struct filter_lvalue *lv)
 {
 	struct oattr *o;
@@ -249,7 +260,7 @@ filter_get_lvalue(struct filter_value *dest, struct filter_args *args, struct fi
 		dest->undef = 1;
 }
 
-static void
+void
 filter_set_lvalue(struct filter_lvalue *dest, struct filter_args *args, struct filter_value *v, int append)
 {
 	byte tmp[32], *tmp1;
@@ -379,12 +390,24 @@ value_sprintf(byte *dest, struct filter_value *v)
 	PRINT_VALUE(sprintf, dest);
 }
 
-static void
-value_log(int level, struct filter_value *v)
+void
+filter_log_value(int level, struct filter_value *v)
 {
 	PRINT_VALUE(log, level);
 }
 
+void
+filter_concat(struct filter_args *args, struct filter_value *dest, struct filter_value *l, struct filter_value *r)
+{
+	/* The destination can be the same as one of the operands */
+	int len = printable_length(l) + printable_length(r) + 1;
+	byte *s = mp_alloc(args->pool, len);
+	value_sprintf(s, l);
+	value_sprintf(s+strlen(s), r);
+	dest->v.s = s;
+	dest->undef = 0;
+}
+
 void
 filter_eval_expr(struct filter_value *dest, struct filter_args *args, struct filter_expr *expr)
 {
@@ -472,14 +495,8 @@ filter_eval_expr(struct filter_value *dest, struct filter_args *args, struct fil
 					dest->v.i = l.v.i | r.v.i;
 					break;
 				case '.':
-				{
-					int len = printable_length(&l) + printable_length(&r) + 1;
-					dest->v.s = mp_alloc(args->pool, len);
-					value_sprintf(dest->v.s, &l);
-					value_sprintf(dest->v.s+strlen(dest->v.s), &r);
-					dest->undef = 0;
+					filter_concat(args, dest, &l, &r);
 					break;
-				}
 				case INTERVAL:
 					dest->v.interval[0] = l.v.interval[0];
 					dest->v.interval[1] = r.v.interval[0];
@@ -702,22 +719,20 @@ filter_eval_cond(struct filter_args *args, struct filter_cond *cond, struct filt
 	}
 }
 
-static byte *
-return_msg(struct filter_args *args, struct filter_expr *expr)
+byte *
+filter_value_msg(struct filter_args *args, struct filter_value *v)
 {
-	struct filter_value a;
 	byte *tmp;
-	filter_eval_expr(&a, args, expr);
-	if (a.undef)
+	if (v->undef)
 		return NULL;
-	switch (a.type)
+	switch (v->type)
 	{
 		case F_ET_INT:
 			tmp = mp_alloc(args->pool, 16);
-			sprintf(tmp, "%d", a.v.i);
+			sprintf(tmp, "%d", v->v.i);
 			return tmp;
 		case F_ET_STRING:
-			return a.v.s;
+			return v->v.s;
 		case F_ET_REGEXP:
 			tmp = mp_alloc(args->pool, 16);
 			sprintf(tmp, "<regexp>");
@@ -727,11 +742,61 @@ return_msg(struct filter_args *args, struct filter_expr *expr)
 	}
 }
 
+static byte *
+return_msg(struct filter_args *args, struct filter_expr *expr)
+{
+	struct filter_value a;
+	filter_eval_expr(&a, args, expr);
+	return filter_value_msg(args, &a);
+}
+
 #define ASORT_PREFIX(x) cases_##x
 #define ASORT_KEY_TYPE struct filter_case *
 #define ASORT_LT(x, y) ((x)->case_id < (y)->case_id)
 #include "ucw/sorter/array-simple.h"
 
+void
+filter_cases_sort(struct filter_cases *res)
+{
+	cases_sort(res->list, res->count);
+}
+
+/* Find the matching cases of a SWITCH in its lookup tables */
+void
+filter_switch_lookup(struct filter_args *args, struct filter_cmd *cmd, struct filter_value *v, struct filter_cases *res)
+{
+	if (cmd->c.swit.cmp || cmd->c.swit.icmp || cmd->c.swit.pat || cmd->c.swit.ipat || cmd->c.swit.dfa)
+		ASSERT(v->type == F_ET_STRING);
+	if (cmd->c.swit.cmp)
+		filter_ht_find(cmd->c.swit.cmp, v->v.s, res);
+	if (cmd->c.swit.icmp)
+		filter_ht_find(cmd->c.swit.icmp, v->v.s, res);
+	if (cmd->c.swit.kmp)
+		filter_kmp_find(cmd->c.swit.kmp, v->v.s, res);
+	if (cmd->c.swit.ikmp)
+		filter_kmp_find(cmd->c.swit.ikmp, v->v.s, res);
+	if (cmd->c.swit.pat)
+		filter_trie_search(args->filter->lookup[cmd->c.swit.pat].trie, v->v.s, res);
+	if (cmd->c.swit.ipat)
+		filter_trie_search(args->filter->lookup[cmd->c.swit.ipat].trie, v->v.s, res);
+	if (cmd->c.swit.dfa)
+		filter_dfa_search(args->filter->lookup[cmd->c.swit.dfa].dfa, v->v.s, res);
+	if (cmd->c.swit.expr->type == F_ET_STRING)
+	{
+		if (cmd->c.swit.bins)
+			filter_s_tree_search(cmd->c.swit.bins, v->v.s, res);
+		else if (cmd->c.swit.binis)
+			filter_is_tree_search(cmd->c.swit.binis, v->v.s, res);
+	}
+	else
+	{
+		if (cmd->c.swit.binud)
+			filter_ud_tree_search(cmd->c.swit.binud, v->v.i, res);
+		else if (cmd->c.swit.bind)
+			filter_d_tree_search(cmd->c.swit.bind, v->v.i, res);
+	}
+}
+
 static int
 filter_eval_cmd(struct filter_args *args, struct filter_cmd *cmd)
 {
@@ -747,7 +812,7 @@ filter_eval_cmd(struct filter_args *args, struct filter_cmd *cmd)
 				break;
 			case LOG1:
 				filter_eval_expr(&a, args, cmd->c.print.expr);
-				value_log(cmd->c.print.level, &a);
+				filter_log_value(cmd->c.print.level, &a);
 				break;
 			case ACCEPT:
 				if (cmd->c.print.expr)
@@ -802,34 +867,7 @@ filter_eval_cmd(struct filter_args *args, struct filter_cmd *cmd)
 						return ires;
 					break;
 				}
-				if (cmd->c.swit.cmp || cmd->c.swit.icmp || cmd->c.swit.pat || cmd->c.swit.ipat)
-					ASSERT(a.type == F_ET_STRING);
-				if (cmd->c.swit.cmp)
-					filter_ht_find(cmd->c.swit.cmp, a.v.s, &res);
-				if (cmd->c.swit.icmp)
-					filter_ht_find(cmd->c.swit.icmp, a.v.s, &res);
-				if (cmd->c.swit.kmp)
-					filter_kmp_find(cmd->c.swit.kmp, a.v.s, &res);
-				if (cmd->c.swit.ikmp)
-					filter_kmp_find(cmd->c.swit.ikmp, a.v.s, &res);
-				if (cmd->c.swit.pat)
-					filter_trie_search(args->filter->lookup[cmd->c.swit.pat].trie, a.v.s, &res);
-				if (cmd->c.swit.ipat)
-					filter_trie_search(args->filter->lookup[cmd->c.swit.ipat].trie, a.v.s, &res);
-				if (cmd->c.swit.expr->type == F_ET_STRING)
-				{
-					if (cmd->c.swit.bins)
-						filter_s_tree_search(cmd->c.swit.bins, a.v.s, &res);
-					else if (cmd->c.swit.binis)
-						filter_is_tree_search(cmd->c.swit.binis, a.v.s, &res);
-				}
-				else
-				{
-					if (cmd->c.swit.binud)
-						filter_ud_tree_search(cmd->c.swit.binud, a.v.i, &res);
-					else if (cmd->c.swit.bind)
-						filter_d_tree_search(cmd->c.swit.bind, a.v.i, &res);
-				}
+				filter_switch_lookup(args, cmd, &a, &res);
 				for (cas=cmd->c.swit.cases; cas; cas=cas->next)
 				{
 					ires = filter_eval_cond(args, cas->cond, cmd->c.swit.expr);
@@ -842,7 +880,7 @@ filter_eval_cmd(struct filter_args *args, struct filter_cmd *cmd)
 						return ires;
 					break;
 				}
-				cases_sort(res.list, res.count);
+				filter_cases_sort(&res);
 				for (uns i = 0; i < res.count; i++)
 					if (!i || res.list[i]->case_id != res.list[i - 1]->case_id)
 					{
@@ -914,7 +952,10 @@ filter_intr_run(struct filter_args *a)
 	filter_user_var_init(a);
 	if (a->config_changes_mode == 2)
 	                   filter_intr_undo_init(a);
-	res = filter_eval_cmd(a, a->filter->body);
+	if (a->filter->code)
+		res = filter_vm_run(a);
+	else
+		res = filter_eval_cmd(a, a->filter->body);
 	if (a->config_changes_mode == 2)
 	                  filter_intr_undo(a);
 	if (res != REJECT && res != ACCEPT)
@@ -20,7 +20,7 @@ enum filter_lvalue_cat { F_LVC_RAW, F_LVC_ATTR, F_LVC_CONF, F_LVC_USER};
 enum filter_expr_type { F_ET_INT, F_ET_STRING, F_ET_REGEXP, F_ET_UNKNOWN};
 enum filter_expr_cat { F_EC_CONST, F_EC_LVALUE, F_EC_UNOP, F_EC_BINOP, F_EC_FUNC};
 enum filter_cond_cat { F_CC_CONST, F_CC_EXPR, F_CC_DEFCOND, F_CC_DEFEXPR, F_CC_UNOP, F_CC_BINOP};
-enum filter_lookup_type { F_LT_REGEX, F_LT_TRIE };
+enum filter_lookup_type { F_LT_REGEX, F_LT_TRIE, F_LT_DFA };
 
 /*
  * Values of the variables may be undefined by the context (not bound) or by
@@ -131,6 +131,7 @@ struct filter_case {
 	struct filter_cond *cond;			/* partial condition */
 	struct filter_cmd *positive;
 	uns case_id;
+	uns code, cond_code;			/* compiled body and condition */
 };
 
 struct filter_hash_table;
@@ -144,6 +145,7 @@ struct filter_d_tree;
 struct filter_cmd {
 	struct filter_cmd *next, *last;
 	int op, pruned;
+	uns code;				/* compiled from here to the end of the chain */
 	union {
 		struct {
 			int level;
@@ -164,6 +166,7 @@ struct filter_cmd {
 			struct filter_hash_table *cmp, *icmp;
 			struct filter_kmp_table *kmp, *ikmp;
 			int pat, ipat;
+			int dfa;			/* lookup of the merged regular expressions */
 			union {
 				struct {
 					struct filter_s_tree *bins;
@@ -242,6 +245,7 @@ struct filter_lookup {
 		void *value;
 		struct filter_regex_value *regex;
 		struct filter_trie_table *trie;
+		struct filter_dfa_table *dfa;
 	};
 };
 
@@ -256,6 +260,8 @@ struct filter {
 	struct filter_cmd *body;
 	uns lookup_count, lookup_limit;
 	struct filter_lookup *lookup;
+	struct filter_insn *code;		/* compiled program or NULL */
+	uns code_len, code_entry, code_regs;
 };
 
 /*
@@ -277,6 +283,7 @@ struct filter_args {
 	int config_changes_mode;		/* 0 - disabled, 1 - leave changes, 2 - reset changes automatically */
 	struct cf_journal_item *oldj;		/* journalling of cf_item changes */
 	struct mempool *saved_pool;		/* saved cf_pool for want_config_changes disabled */
+	struct filter_value *reg;		/* registers of the compiled program */
 };
 
 /* parse.y */
@@ -337,6 +344,45 @@ filter_cases_add(struct filter_cases *r, struct filter_case *cas)
 void filter_eval_expr(struct filter_value *dest, struct filter_args *args, struct filter_expr *expr);
 int filter_eval_cond(struct filter_args *args, struct filter_cond *cond, struct filter_expr *partial_expr);
 
+/* Exported for the bytecode interpreter: */
+void filter_get_lvalue(struct filter_value *dest, struct filter_args *args, struct filter_lvalue *lv);
+void filter_set_lvalue(struct filter_lvalue *dest, struct filter_args *args, struct filter_value *v, int append);
+void filter_log_value(int level, struct filter_value *v);
+byte *filter_value_msg(struct filter_args *args, struct filter_value *v);
+void filter_concat(struct filter_args *args, struct filter_value *dest, struct filter_value *l, struct filter_value *r);
+void filter_switch_lookup(struct filter_args *args, struct filter_cmd *cmd, struct filter_value *v, struct filter_cases *res);
+void filter_cases_sort(struct filter_cases *res);
+
+/* vm.c */
+
+/*
+ * The pruned program is compiled to a flat array of instructions working
+ * on registers (struct filter_value's in filter_args).  The operations are
+ * specialized by type, so the interpreter does not need to check types at
+ * run time.  Bodies of IF's and SWITCH cases are subroutines ending with
+ * a return; conditions produce TRUE, FALSE or UNDEFINED in v.i.
+ */
+
+struct filter_insn {
+	u16 op;
+	byte type;				/* type of the result */
+	byte flag;				/* operation-specific flag */
+	u16 d, a;				/* destination and source registers */
+	u32 b, c;				/* the second source register or code offsets */
+	union {
+		int i;
+		uns u;
+		void *p;
+		union filter_raw_value2 raw;
+		struct filter_lvalue *lv;
+		struct filter_function *func;
+		struct filter_cmd *cmd;
+	} x;
+};
+
+void filter_compile(struct filter *f);
+int filter_vm_run(struct filter_args *a);
+
 /* prune.c */
 
 void filter_prune(struct filter *);
@@ -420,6 +466,20 @@ struct filter_trie_table *filter_trie_new(struct mempool *mp, struct filter_cmd
 void filter_trie_search(struct filter_trie_table *trie, byte *string, struct filter_cases *res);
 void filter_trie_dump(struct fastbuf *b, struct filter *f, struct filter_trie_table *trie);
 
+/* dfa.c */
+
+struct filter_dfa_table {
+	uns cmds;				/* cases matched by the automaton in their original order */
+	struct filter_case **cmd;
+	struct filter_dfa_nfa *nfa;		/* the automaton, shared by clones of the filter */
+	struct filter_dfa_cache *cache;		/* deterministic states built so far, private for each clone */
+};
+
+struct filter_dfa_table *filter_dfa_new(struct filter *f, struct filter_cmd *case_cmd);
+struct filter_dfa_table *filter_dfa_clone(struct mempool *mp, struct filter_dfa_table *dfa);
+void filter_dfa_free(struct filter_dfa_table *dfa);
+void filter_dfa_search(struct filter_dfa_table *dfa, byte *string, struct filter_cases *res);
+
 /* trees.c */
 
 struct filter_s_tree *filter_s_tree_new(struct mempool *mp, struct filter_cmd *case_cmd);
@@ -444,5 +504,5 @@ void filter_dump(struct fastbuf *b, struct filter *f);
 
 /* fconfig.c */
 
-extern uns filter_trace, filter_hash_limit, filter_kmp_limit, filter_trie_limit, filter_tree_limit, filter_optimize;
+extern uns filter_trace, filter_hash_limit, filter_kmp_limit, filter_trie_limit, filter_tree_limit, filter_dfa_limit, filter_optimize, filter_compile_code;
 extern char *filter_dump_to;
@@ -1,14 +1,19 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "sherlock/sherlock.h"
 #include "ucw/conf.h"
+#include "ucw/getopt.h"
 #include "ucw/mempool.h"
+#include "ucw/fastbuf.h"
+#include "ucw/url.h"
 #include "sherlock/object.h"
 #include "filter/filter.h"
 
 static uns num = 13;
-static byte *str = "initial value";
+static char *str = "initial value";
 
 static struct cf_section ftest_config = {
 	CF_ITEMS {
@@ -89,8 +94,107 @@ dump_internal(struct filter_args *a)
 	ASSERT(count == a->filter->user_vars);
 }
 
-int
-main(void)
+/*
+ *  Benchmark: run the filter given on the command line on URL's read from
+ *  stdin, both by walking the syntax tree and by the bytecode interpreter,
+ *  check that their verdicts agree and report the speed.
+ */
+
+struct url_vars {
+	byte *url, *protocol, *host;
+	int port;
+	byte *path, *username, *password;
+};
+
+static struct filter_binding url_bind[] = {
+	{ "url",	OFFSETOF(struct url_vars, url) },
+	{ "protocol",	OFFSETOF(struct url_vars, protocol) },
+	{ "host",	OFFSETOF(struct url_vars, host) },
+	{ "port",	OFFSETOF(struct url_vars, port) },
+	{ "path",	OFFSETOF(struct url_vars, path) },
+	{ "username",	OFFSETOF(struct url_vars, username) },
+	{ "password",	OFFSETOF(struct url_vars, password) },
+	{ NULL,		0 }
+};
+
+static double
+bench_run(struct filter *f, struct url_vars *urls, uns n, uns rounds, int *verdicts)
+{
+	struct filter_args *a = filter_intr_new(f);
+	struct mempool *mp = mp_new(65536);
+	timestamp_t timer;
+	a->pool = mp;
+	init_timer(&timer);
+	for (uns r=0; r<rounds; r++)
+		for (uns i=0; i<n; i++)
+		{
+			a->raw = &urls[i];
+			mp_flush(mp);
+			verdicts[i] = filter_intr_run(a);
+		}
+	uns ms = get_timer(&timer);
+	filter_intr_delete(a);
+	mp_delete(mp);
+	return (double) n * rounds * 1000 / MAX(ms, 1);
+}
+
+static void
+bench(byte *name, uns rounds)
+{
+	struct url_vars *urls = NULL;
+	uns n = 0, max = 0;
+	byte url[MAX_URL_SIZE], buf1[MAX_URL_SIZE], buf2[MAX_URL_SIZE];
+	struct fastbuf *fi = bfdopen(0, 65536);
+	struct mempool *mp = mp_new(65536);
+	while (bgets(fi, url, sizeof(url)))
+	{
+		struct url u;
+		if (url_canon_split(url, buf1, buf2, &u))
+			continue;
+		if (n >= max)
+			urls = xrealloc(urls, (max = MAX(2*max, 1024)) * sizeof(*urls));
+		urls[n++] = (struct url_vars) {
+			.url = mp_strdup(mp, url),
+			.protocol = u.protocol ? mp_strdup(mp, u.protocol) : NULL,
+			.host = u.host ? mp_strdup(mp, u.host) : NULL,
+			.port = u.port,
+			.path = u.rest ? mp_strdup(mp, u.rest) : NULL,
+			.username = u.user ? mp_strdup(mp, u.user) : NULL,
+			.password = u.pass ? mp_strdup(mp, u.pass) : NULL,
+		};
+	}
+	bclose(fi);
+	if (!n)
+		die("No valid URL's on input");
+
+	int *tree_res = xmalloc(n * sizeof(int));
+	int *code_res = xmalloc(n * sizeof(int));
+	uns saved = filter_compile_code;
+	filter_compile_code = 0;
+	struct filter *tree = filter_load(name, filter_builtin_vars, url_bind, NULL);
+	filter_compile_code = 1;
+	struct filter *code = filter_load(name, filter_builtin_vars, url_bind, NULL);
+	filter_compile_code = saved;
+
+	double tree_speed = bench_run(tree, urls, n, rounds, tree_res);
+	double code_speed = bench_run(code, urls, n, rounds, code_res);
+	for (uns i=0; i<n; i++)
+		if (tree_res[i] != code_res[i])
+			die("Verdicts differ for %s: %d by the tree, %d by the bytecode", urls[i].url, tree_res[i], code_res[i]);
+	printf("%d URL's, %d rounds, %d instructions\n", n, rounds, code->code_len);
+	printf("Tree:     %.0f URL's/s\n", tree_speed);
+	printf("Bytecode: %.0f URL's/s (%.2fx)\n", code_speed, code_speed / tree_speed);
+
+	filter_delete(tree);
+	filter_delete(code);
+	xfree(tree_res);
+	xfree(code_res);
+	xfree(urls);
+	mp_delete(mp);
+}
+
+static void
+self_test(void)
 {
 	struct filter *f;
 	struct filter_args *a;
@@ -98,9 +202,6 @@ main(void)
 	struct my_variables var = { 1, 2, "hello", "good day!" };
 	int res;
 
-	log_init("test");
-	cf_load(cf_def_file);
-
 	f = filter_load("filter/test-filter", my_vars, my_bind, NULL);
 	mp_oa = mp_new(4096);
 
@@ -108,7 +209,7 @@ main(void)
 	a->pool = mp_oa;
 	a->raw = &var;
 	a->attr = obj_new(mp_oa);
-	a->want_config_changes = 1;
+	a->config_changes_mode = 1;
 
 	filter_intr_undo_init(a);
 	res = filter_intr_run(a);
@@ -125,6 +226,28 @@ main(void)
 
 	mp_delete(mp_oa);
 	filter_delete(f);
+}
+
+int
+main(int argc, char **argv)
+{
+	uns rounds = 10;
+	int opt;
+
+	log_init("test");
+	while ((opt = cf_getopt(argc, argv, CF_SHORT_OPTS "n:", CF_NO_LONG_OPTS, NULL)) >= 0)
+		switch (opt)
+		{
+			case 'n':
+				rounds = atol(optarg);
+				break;
+			default:
+				die("Usage: ftest [-n <rounds>] [<filter> < <urls>]");
+		}
 
+	if (optind < argc)
+		bench(argv[optind], MAX(rounds, 1));
+	else
+		self_test();
 	return 0;
 }
@@ -416,6 +416,7 @@ prune_switch_command(struct filter_cmd *cmd)
 	ASSERT(!cmd->c.swit.ikmp);
 	ASSERT(!cmd->c.swit.bins);
 	ASSERT(!cmd->c.swit.binis);
+	ASSERT(!cmd->c.swit.dfa);
 	prune_command(&cmd->c.swit.negative);
 	prune_command(&cmd->c.swit.undefined);
 	prune_switch_case(&cmd->c.swit.cases, !cmd->c.swit.negative);
@@ -546,6 +547,7 @@ possibly_create_lookup_tables(struct filter *f, struct filter_cmd *cmd)
 		cmd->c.swit.ikmp = build_kmp_table(f, cmd, 1);
 	cmd->c.swit.pat = filter_lookup_new_no_null(f, F_LT_TRIE, filter_trie_new(f->pool, cmd, 0));
 	cmd->c.swit.ipat = filter_lookup_new_no_null(f, F_LT_TRIE, filter_trie_new(f->pool, cmd, 1));
+	cmd->c.swit.dfa = filter_lookup_new_no_null(f, F_LT_DFA, filter_dfa_new(f, cmd));
 	if (cmd->c.swit.expr->type == F_ET_STRING)
 	{
 		cmd->c.swit.bins = filter_s_tree_new(f->pool, cmd);
@@ -596,5 +598,8 @@ filter_prune(struct filter *f)
 	prune_args.pool = f->pool;
 	if (filter_optimize)
 		prune_command(&f->body);
+	/* Compile before the lookup tables steal the cases from SWITCH commands */
+	if (filter_compile_code)
+		filter_compile(f);
 	recursively_hash_tables(f, f->body);
 }
@@ -0,0 +1,797 @@
+/*
+ *	Sherlock Filter Engine -- Bytecode Compiler and Interpreter
+ *
+ *	The pruned syntax tree is translated to a flat array of instructions
+ *	(see struct filter_insn), which is then run by a single dispatch loop
+ *	instead of walking the tree recursively.
+ */
+
+#include "sherlock/sherlock.h"
+#include "ucw/mempool.h"
+#include "ucw/string.h"
+#include "sherlock/object.h"
+#include "filter/filter.h"
+#include "filter/parse.tab.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+enum vm_op {
+	VM_RET,			/* return from a subroutine */
+	VM_JMP,			/* jump to b */
+
+	/* Expressions: d = result, a and b are operands */
+	VM_UNDEF,		/* undefined value */
+	VM_CONST,		/* x.raw */
+	VM_LVALUE,		/* any lvalue x.lv, slow path */
+	VM_RAW_INT,		/* raw variable at offset x.i */
+	VM_RAW_PTR,
+	VM_ATTR_INT,		/* object attribute x.i */
+	VM_ATTR_STR,
+	VM_CONF_INT,		/* configuration item at x.p */
+	VM_CONF_STR,
+	VM_USER_INT,		/* user variable x.i */
+	VM_USER_PTR,
+	VM_NEG,
+	VM_ADD,
+	VM_SUB,
+	VM_MUL,
+	VM_DIV,
+	VM_MOD,
+	VM_POW,
+	VM_AND,
+	VM_OR,
+	VM_CONCAT,
+	VM_INTERVAL,
+	VM_CALL,		/* d = x.func(a, a+1, ...) */
+
+	/* Conditions: d = TRUE / FALSE / UNDEFINED */
+	VM_COND,		/* constant x.i */
+	VM_LT_INT,
+	VM_GT_INT,
+	VM_EQ_INT,
+	VM_LT_UNS,
+	VM_GT_UNS,
+	VM_EQ_UNS,
+	VM_IN_INT,		/* a in the interval b */
+	VM_IN_UNS,
+	VM_CMP_STR,		/* string comparison x.i, flag = ignore case */
+	VM_IN_STR,
+	VM_PAT,			/* wildcard pattern, flag = ignore case */
+	VM_REGEX,		/* regular expression with lookup index in b */
+	VM_NOT,
+	VM_DEFINED,		/* condition a is not UNDEFINED */
+	VM_DEFEXPR,		/* expression a is defined */
+	VM_CAND,
+	VM_COR,
+	VM_CEQ,
+	VM_CNE,
+	VM_JCOND,		/* jump to b if condition a is x.i */
+
+	/* Commands */
+	VM_LOG,			/* log a at level x.i */
+	VM_ACCEPT,		/* accept with message a if flag is set */
+	VM_REJECT,
+	VM_SET,			/* x.lv = a, flag = append */
+	VM_DELETE,		/* delete x.lv */
+	VM_IF,			/* run b, c or x.u if a is TRUE, FALSE or UNDEFINED */
+	VM_SWITCH,		/* switch x.cmd on d, run b if nothing matches, c if undefined */
+};
+
+/*** Compiler ***/
+
+#define GBUF_TYPE struct filter_insn
+#define GBUF_PREFIX(x) insn_buf_##x
+#include "ucw/gbuf.h"
+
+static insn_buf_t code;
+static uns code_len, code_regs;
+
+static struct filter_insn *
+emit(uns op, uns type, uns d)
+{
+	struct filter_insn *i = insn_buf_grow(&code, code_len + 1) + code_len;
+	code_len++;
+	bzero(i, sizeof(*i));
+	i->op = op;
+	i->type = type;
+	i->d = d;
+	if (d >= code_regs)
+	{
+		if (d >= 0xffff)
+			die("Filter too complex: out of registers");
+		code_regs = d + 1;
+	}
+	return i;
+}
+
+static void
+compile_lvalue(struct filter_lvalue *lv, uns d)
+{
+	uns op = VM_LVALUE;
+	switch (lv->cat)
+	{
+		case F_LVC_RAW:
+			if (lv->type == F_ET_INT)
+				op = VM_RAW_INT;
+			else if (lv->type == F_ET_STRING || lv->type == F_ET_REGEXP)
+				op = VM_RAW_PTR;
+			break;
+		case F_LVC_ATTR:
+			if (lv->type == F_ET_INT)
+				op = VM_ATTR_INT;
+			else if (lv->type == F_ET_STRING)
+				op = VM_ATTR_STR;
+			break;
+		case F_LVC_CONF:
+			if (lv->type == F_ET_INT)
+				op = VM_CONF_INT;
+			else if (lv->type == F_ET_STRING)
+				op = VM_CONF_STR;
+			break;
+		case F_LVC_USER:
+			if (lv->type == F_ET_INT)
+				op = VM_USER_INT;
+			else if (lv->type == F_ET_STRING || lv->type == F_ET_REGEXP)
+				op = VM_USER_PTR;
+			break;
+	}
+	if (lv->undef)
+		op = VM_UNDEF;
+	struct filter_insn *i = emit(op, lv->type, d);
+	switch (op)
+	{
+		case VM_LVALUE:
+			i->x.lv = lv;
+			break;
+		case VM_RAW_INT:
+		case VM_RAW_PTR:
+			i->x.i = lv->v.bind->offset;
+			break;
+		case VM_ATTR_INT:
+		case VM_ATTR_STR:
+			i->x.u = lv->v.name;
+			break;
+		case VM_CONF_INT:
+		case VM_CONF_STR:
+			i->x.p = lv->v.cfg->ptr;
+			break;
+		case VM_USER_INT:
+		case VM_USER_PTR:
+			i->x.i = lv->v.decl->nr;
+			break;
+	}
+}
+
+static void
+compile_expr(struct filter_expr *e, uns d)
+{
+	struct filter_insn *i;
+
+	if (e->undef)
+	{
+		emit(VM_UNDEF, e->type, d);
+		return;
+	}
+	switch (e->cat)
+	{
+		case F_EC_CONST:
+			emit(VM_CONST, e->type, d)->x.raw = e->o.raw;
+			break;
+		case F_EC_LVALUE:
+			compile_lvalue(e->o.lv, d);
+			break;
+		case F_EC_UNOP:
+			compile_expr(e->o.un.r, d);
+			if (e->o.un.op == '-')
+				emit(VM_NEG, e->type, d)->a = d;
+			break;
+		case F_EC_BINOP:
+		{
+			uns op;
+			compile_expr(e->o.bin.l, d);
+			compile_expr(e->o.bin.r, d+1);
+			switch (e->o.bin.op)
+			{
+				case '+': op = VM_ADD; break;
+				case '-': op = VM_SUB; break;
+				case '*': op = VM_MUL; break;
+				case '/': op = VM_DIV; break;
+				case '%': op = VM_MOD; break;
+				case '^': op = VM_POW; break;
+				case '&': op = VM_AND; break;
+				case '|': op = VM_OR; break;
+				case '.': op = VM_CONCAT; break;
+				case INTERVAL: op = VM_INTERVAL; break;
+				default: ASSERT(0);
+			}
+			i = emit(op, e->type, d);
+			i->a = d;
+			i->b = d+1;
+			break;
+		}
+		case F_EC_FUNC:
+			for (uns j=0; j < MAX_FUNC_ARGS && e->o.func.a[j]; j++)
+				compile_expr(e->o.func.a[j], d+1+j);
+			i = emit(VM_CALL, e->type, d);
+			i->a = d+1;
+			i->x.func = e->o.func.func;
+			break;
+		default:
+			ASSERT(0);
+	}
+}
+
+static void
+compile_cond(struct filter_cond *c, uns d, int partial, uns partial_type)
+{
+	struct filter_insn *i;
+
+	if (c->undef)
+	{
+		emit(VM_COND, 0, d)->x.i = UNDEFINED;
+		return;
+	}
+	switch (c->cat)
+	{
+		case F_CC_CONST:
+			emit(VM_COND, 0, d)->x.i = c->o.i;
+			break;
+		case F_CC_EXPR:
+		{
+			uns l, type, op;
+			if (c->o.expr.l)
+			{
+				l = d;
+				type = c->o.expr.l->type;
+				compile_expr(c->o.expr.l, l);
+			}
+			else
+			{
+				ASSERT(partial >= 0);
+				l = partial;
+				type = partial_type;
+			}
+			compile_expr(c->o.expr.r, d+1);
+			if (c->o.expr.op == EREG)
+				op = VM_REGEX;
+			else if (type == F_ET_INT)
+			{
+				uns unsign = c->o.expr.icase;
+				switch (c->o.expr.op)
+				{
+					case LT: op = unsign ? VM_LT_UNS : VM_LT_INT; break;
+					case GT: op = unsign ? VM_GT_UNS : VM_GT_INT; break;
+					case EQ: op = unsign ? VM_EQ_UNS : VM_EQ_INT; break;
+					case EIN: op = unsign ? VM_IN_UNS : VM_IN_INT; break;
+					default: ASSERT(0);
+				}
+			}
+			else if (type == F_ET_STRING)
+			{
+				switch (c->o.expr.op)
+				{
+					case LT:
+					case GT:
+					case EQ: op = VM_CMP_STR; break;
+					case EIN: op = VM_IN_STR; break;
+					case EPAT: op = VM_PAT; break;
+					default: ASSERT(0);
+				}
+			}
+			else
+				ASSERT(0);
+			i = emit(op, 0, d);
+			i->a = l;
+			i->b = d+1;
+			i->flag = c->o.expr.icase;
+			i->x.i = c->o.expr.op;
+			if (c->o.expr.neg)
+				emit(VM_NOT, 0, d)->a = d;
+			break;
+		}
+		case F_CC_DEFCOND:
+			compile_cond(c->o.neg, d, -1, 0);
+			emit(VM_DEFINED, 0, d)->a = d;
+			break;
+		case F_CC_DEFEXPR:
+			compile_expr(c->o.defexpr, d);
+			emit(VM_DEFEXPR, 0, d)->a = d;
+			break;
+		case F_CC_UNOP:
+			compile_cond(c->o.neg, d, -1, 0);
+			emit(VM_NOT, 0, d)->a = d;
+			break;
+		case F_CC_BINOP:
+		{
+			uns op, jump = ~0U;
+			compile_cond(c->o.bin.l, d, -1, 0);
+			switch (c->o.bin.op)
+			{
+				/* The result of AND and OR is often known from the left side */
+				case AND:
+					op = VM_CAND;
+					jump = code_len;
+					emit(VM_JCOND, 0, d)->x.i = FALSE;
+					break;
+				case OR:
+					op = VM_COR;
+					jump = code_len;
+					emit(VM_JCOND, 0, d)->x.i = TRUE;
+					break;
+				case EQ: op = VM_CEQ; break;
+				case NE: op = VM_CNE; break;
+				default: ASSERT(0);
+			}
+			if (jump != ~0U)
+				code.ptr[jump].a = d;
+			compile_cond(c->o.bin.r, d+1, -1, 0);
+			i = emit(op, 0, d);
+			i->a = d;
+			i->b = d+1;
+			if (jump != ~0U)
+				code.ptr[jump].b = code_len;
+			break;
+		}
+		default:
+			ASSERT(0);
+	}
+}
+
+static void
+compile_cmd(struct filter_cmd *cmd)
+{
+	struct filter_insn *i;
+
+	switch (cmd->op)
+	{
+		case 0:
+			break;
+		case LOG1:
+			compile_expr(cmd->c.print.expr, 0);
+			i = emit(VM_LOG, 0, 0);
+			i->x.i = cmd->c.print.level;
+			break;
+		case ACCEPT:
+		case REJECT:
+			if (cmd->c.print.expr)
+				compile_expr(cmd->c.print.expr, 0);
+			i = emit((cmd->op == ACCEPT) ? VM_ACCEPT : VM_REJECT, 0, 0);
+			i->flag = !!cmd->c.print.expr;
+			break;
+		case '=':
+		case ADD:
+			compile_expr(cmd->c.set.expr, 0);
+			i = emit(VM_SET, 0, 0);
+			i->flag = (cmd->op == ADD);
+			i->x.lv = cmd->c.set.lv;
+			break;
+		case DELETE:
+			emit(VM_DELETE, 0, 0)->x.lv = cmd->c.set.lv;
+			break;
+		case IF:
+			compile_cond(cmd->c.cond.cond, 0, -1, 0);
+			emit(VM_IF, 0, 0)->x.cmd = cmd;
+			break;
+		case SWITCH:
+			compile_expr(cmd->c.swit.expr, 0);
+			emit(VM_SWITCH, cmd->c.swit.expr->type, 0)->x.cmd = cmd;
+			break;
+		default:
+			ASSERT(0);
+	}
+}
+
+/*
+ *  Compiles a chain of commands to a subroutine and returns its offset.
+ *  The pruner can merge the tails of chains, so if we meet a command
+ *  compiled before, we jump to its code.  Nested blocks are compiled
+ *  after the whole chain is finished.
+ */
+static uns
+compile_chain(struct filter_cmd *cmd)
+{
+	if (!cmd)
+		return 0;
+	if (cmd->code)
+		return cmd->code;
+
+	uns start = code_len;
+	for (; cmd; cmd = cmd->next)
+	{
+		if (cmd->code)
+		{
+			emit(VM_JMP, 0, 0)->b = cmd->code;
+			break;
+		}
+		cmd->code = code_len;
+		compile_cmd(cmd);
+	}
+	if (!cmd)
+		emit(VM_RET, 0, 0);
+	uns end = code_len;
+
+	for (uns pc = start; pc < end; pc++)
+	{
+		uns op = code.ptr[pc].op;
+		if (op == VM_IF)
+		{
+			struct filter_cmd *c = code.ptr[pc].x.cmd;
+			uns pos = compile_chain(c->c.cond.positive);
+			uns neg = compile_chain(c->c.cond.negative);
+			uns undef = compile_chain(c->c.cond.undefined);
+			code.ptr[pc].b = pos;
+			code.ptr[pc].c = neg;
+			code.ptr[pc].x.u = undef;
+		}
+		else if (op == VM_SWITCH)
+		{
+			struct filter_cmd *c = code.ptr[pc].x.cmd;
+			uns d = code.ptr[pc].d;
+			for (struct filter_case *cas = c->c.swit.cases; cas; cas = cas->next)
+			{
+				cas->code = compile_chain(cas->positive);
+				cas->cond_code = code_len;
+				compile_cond(cas->cond, d+1, d, c->c.swit.expr->type);
+				emit(VM_RET, 0, 0);
+			}
+			uns neg = compile_chain(c->c.swit.negative);
+			uns undef = compile_chain(c->c.swit.undefined);
+			code.ptr[pc].b = neg;
+			code.ptr[pc].c = undef;
+		}
+	}
+	return start;
+}
+
+void
+filter_compile(struct filter *f)
+{
+	insn_buf_init(&code);
+	code_len = 0;
+	code_regs = 2;
+	emit(VM_RET, 0, 0);		/* offset 0 is an empty subroutine */
+	f->code_entry = compile_chain(f->body);
+	f->code_len = code_len;
+	f->code_regs = code_regs;
+	f->code = mp_memdup(f->pool, code.ptr, code_len * sizeof(struct filter_insn));
+	insn_buf_done(&code);
+	if (filter_trace > 0)
+		log(L_DEBUG, "filter: Compiled to %d instructions using %d registers", f->code_len, f->code_regs);
+}
+
+/*** Interpreter ***/
+
+static inline int
+vm_cmp(int x)
+{
+	return x ? TRUE : FALSE;
+}
+
+static inline int
+vm_not(int x)
+{
+	return (x == UNDEFINED) ? UNDEFINED : (x == TRUE) ? FALSE : TRUE;
+}
+
+static inline int
+vm_cmp_str(byte *l, byte *r, int op, uns icase)
+{
+	int res = icase ? strcasecmp(l, r) : strcmp(l, r);
+	switch (op)
+	{
+		case LT:
+			return vm_cmp(res < 0);
+		case GT:
+			return vm_cmp(res > 0);
+		default:
+			return vm_cmp(!res);
+	}
+}
+
+static int
+vm_exec(struct filter_args *args, uns pc)
+{
+	struct filter_value *reg = args->reg;
+	const struct filter_insn *code = args->filter->code;
+	const struct filter_insn *i = code + pc;
+	int res;
+
+#define D (reg + i->d)
+#define A (reg + i->a)
+#define B (reg + i->b)
+#define SET_TYPE D->type = i->type
+#define INT_BINOP(expr) SET_TYPE; if (A->undef | B->undef) D->undef = 1; else { D->undef = 0; D->v.i = expr; }
+#define COND(expr) D->v.i = (A->undef | B->undef) ? UNDEFINED : vm_cmp(expr)
+
+	for (;;)
+	{
+		switch (i->op)
+		{
+			case VM_RET:
+				return 0;
+			case VM_JMP:
+				i = code + i->b;
+				continue;
+
+			/* Expressions */
+			case VM_UNDEF:
+				SET_TYPE;
+				D->undef = 1;
+				break;
+			case VM_CONST:
+				SET_TYPE;
+				D->undef = 0;
+				D->v.interval[0] = i->x.raw;
+				break;
+			case VM_LVALUE:
+				filter_get_lvalue(D, args, i->x.lv);
+				break;
+			case VM_RAW_INT:
+				SET_TYPE;
+				D->v.i = * (int*) (args->raw + i->x.i);
+				D->undef = (D->v.i == F_UNDEF_INT);
+				break;
+			case VM_RAW_PTR:
+				SET_TYPE;
+				D->v.s = * (byte**) (args->raw + i->x.i);
+				D->undef = !D->v.s;
+				break;
+			case VM_ATTR_INT:
+			case VM_ATTR_STR:
+			{
+				struct oattr *o = args->attr ? obj_find_attr(args->attr, i->x.u) : NULL;
+				SET_TYPE;
+				if (!o)
+					D->undef = 1;
+				else if (i->op == VM_ATTR_STR)
+				{
+					D->v.s = o->val;
+					D->undef = 0;
+				}
+				else
+				{
+					char *c;
+					D->v.i = strtoul(o->val, &c, 0);
+					D->undef = ((c && *c) || errno == ERANGE || D->v.i == F_UNDEF_INT);
+				}
+				break;
+			}
+			case VM_CONF_INT:
+				SET_TYPE;
+				D->v.i = * (int*) i->x.p;
+				D->undef = (D->v.i == F_UNDEF_INT);
+				break;
+			case VM_CONF_STR:
+				SET_TYPE;
+				D->v.s = * (byte**) i->x.p;
+				D->undef = !D->v.s;
+				break;
+			case VM_USER_INT:
+				SET_TYPE;
+				D->v = args->user_var[i->x.i];
+				D->undef = (D->v.i == F_UNDEF_INT);
+				break;
+			case VM_USER_PTR:
+				SET_TYPE;
+				D->v = args->user_var[i->x.i];
+				D->undef = !D->v.s;
+				break;
+			case VM_NEG:
+				SET_TYPE;
+				D->undef = A->undef;
+				D->v.i = -A->v.i;
+				break;
+			case VM_ADD:
+				INT_BINOP(A->v.i + B->v.i);
+				break;
+			case VM_SUB:
+				INT_BINOP(A->v.i - B->v.i);
+				break;
+			case VM_MUL:
+				INT_BINOP(A->v.i * B->v.i);
+				break;
+			case VM_DIV:
+				INT_BINOP(B->v.i ? A->v.i / B->v.i : (D->undef = 1, 0));
+				break;
+			case VM_MOD:
+				INT_BINOP(B->v.i ? A->v.i % B->v.i : (D->undef = 1, 0));
+				break;
+			case VM_POW:
+			{
+				int x = 1, mask;
+				for (mask=0x4000000; mask; mask >>= 1)
+				{
+					x *= x;
+					if (B->v.i & mask)
+						x *= A->v.i;
+				}
+				INT_BINOP(x);
+				break;
+			}
+			case VM_AND:
+				INT_BINOP(A->v.i & B->v.i);
+				break;
+			case VM_OR:
+				INT_BINOP(A->v.i | B->v.i);
+				break;
+			case VM_CONCAT:
+				filter_concat(args, D, A, B);
+				SET_TYPE;
+				break;
+			case VM_INTERVAL:
+				SET_TYPE;
+				D->undef = A->undef | B->undef;
+				D->v.interval[0] = A->v.interval[0];
+				D->v.interval[1] = B->v.interval[0];
+				break;
+			case VM_CALL:
+				SET_TYPE;
+				D->undef = 0;
+				(*i->x.func->f)(args, D, A);
+				break;
+
+			/* Conditions */
+			case VM_COND:
+				D->v.i = i->x.i;
+				break;
+			case VM_LT_INT:
+				COND(A->v.i < B->v.i);
+				break;
+			case VM_GT_INT:
+				COND(A->v.i > B->v.i);
+				break;
+			case VM_EQ_INT:
+				COND(A->v.i == B->v.i);
+				break;
+			case VM_LT_UNS:
+				COND(A->v.u < B->v.u);
+				break;
+			case VM_GT_UNS:
+				COND(A->v.u > B->v.u);
+				break;
+			case VM_EQ_UNS:
+				COND(A->v.u == B->v.u);
+				break;
+			case VM_IN_INT:
+				COND(A->v.i >= B->v.interval[0].i && A->v.i <= B->v.interval[1].i);
+				break;
+			case VM_IN_UNS:
+				COND(A->v.u >= B->v.interval[0].u && A->v.u <= B->v.interval[1].u);
+				break;
+			case VM_CMP_STR:
+				D->v.i = (A->undef | B->undef) ? UNDEFINED : vm_cmp_str(A->v.s, B->v.s, i->x.i, i->flag);
+				break;
+			case VM_IN_STR:
+				if (A->undef | B->undef)
+					D->v.i = UNDEFINED;
+				else
+					D->v.i = (vm_cmp_str(A->v.s, B->v.interval[0].s, LT, i->flag) == TRUE ||
+						vm_cmp_str(A->v.s, B->v.interval[1].s, GT, i->flag) == TRUE) ? FALSE : TRUE;
+				break;
+			case VM_PAT:
+				if (i->flag)
+					COND(str_match_pattern_nocase(B->v.s, A->v.s));
+				else
+					COND(str_match_pattern(B->v.s, A->v.s));
+				break;
+			case VM_REGEX:
+				/* Ignoring case has been already handled when compiled */
+				D->v.i = A->undef ? UNDEFINED : vm_cmp(rx_match(args->filter->lookup[B->v.i].regex->regex, A->v.s));
+				break;
+			case VM_NOT:
+				D->v.i = vm_not(A->v.i);
+				break;
+			case VM_DEFINED:
+				D->v.i = vm_cmp(A->v.i != UNDEFINED);
+				break;
+			case VM_DEFEXPR:
+				D->v.i = vm_cmp(!A->undef);
+				break;
+			case VM_CAND:
+				D->v.i = (A->v.i == TRUE && B->v.i == TRUE) ? TRUE
+					: (A->v.i == FALSE || B->v.i == FALSE) ? FALSE : UNDEFINED;
+				break;
+			case VM_COR:
+				D->v.i = (A->v.i == FALSE && B->v.i == FALSE) ? FALSE
+					: (A->v.i == TRUE || B->v.i == TRUE) ? TRUE : UNDEFINED;
+				break;
+			case VM_CEQ:
+				D->v.i = (A->v.i == UNDEFINED || B->v.i == UNDEFINED) ? UNDEFINED : vm_cmp(A->v.i == B->v.i);
+				break;
+			case VM_CNE:
+				D->v.i = (A->v.i == UNDEFINED || B->v.i == UNDEFINED) ? UNDEFINED : vm_cmp(A->v.i != B->v.i);
+				break;
+			case VM_JCOND:
+				if (A->v.i == i->x.i)
+				{
+					i = code + i->b;
+					continue;
+				}
+				break;
+
+			/* Commands */
+			case VM_LOG:
+				filter_log_value(i->x.i, A);
+				break;
+			case VM_ACCEPT:
+				if (i->flag)
+					args->msg = filter_value_msg(args, A);
+				return ACCEPT;
+			case VM_REJECT:
+				if (i->flag)
+					args->msg = filter_value_msg(args, A);
+				return REJECT;
+			case VM_SET:
+				filter_set_lvalue(i->x.lv, args, A, i->flag);
+				break;
+			case VM_DELETE:
+				filter_set_lvalue(i->x.lv, args, NULL, 0);
+				break;
+			case VM_IF:
+				switch (A->v.i)
+				{
+					case TRUE:
+						res = vm_exec(args, i->b);
+						break;
+					case FALSE:
+						res = vm_exec(args, i->c);
+						break;
+					default:
+						res = vm_exec(args, i->x.u);
+				}
+				if (res)
+					return res;
+				break;
+			case VM_SWITCH:
+			{
+				struct filter_cmd *cmd = i->x.cmd;
+				struct filter_case *cas, *buf[16];
+				struct filter_cases cases = { .args = args, .list = buf, .size = ARRAY_SIZE(buf) };
+				if (D->undef)
+				{
+					if (res = vm_exec(args, i->c))
+						return res;
+					break;
+				}
+				filter_switch_lookup(args, cmd, D, &cases);
+				for (cas = cmd->c.swit.cases; cas; cas = cas->next)
+				{
+					vm_exec(args, cas->cond_code);
+					if (reg[i->d + 1].v.i == TRUE)
+						filter_cases_add(&cases, cas);
+				}
+				if (!cases.count)
+				{
+					if (res = vm_exec(args, i->b))
+						return res;
+					break;
+				}
+				filter_cases_sort(&cases);
+				for (uns j = 0; j < cases.count; j++)
+					if (!j || cases.list[j]->case_id != cases.list[j - 1]->case_id)
+						if (res = vm_exec(args, cases.list[j]->code))
+							return res;
+				break;
+			}
+			default:
+				ASSERT(0);
+		}
+		i++;
+	}
+
+#undef D
+#undef A
+#undef B
+#undef SET_TYPE
+#undef INT_BINOP
+#undef COND
+}
+
+int
+filter_vm_run(struct filter_args *a)
+{
+	return vm_exec(a, a->filter->code_entry);
+}
@@ -376,15 +376,82 @@ guess_lfams(int *lfams)
 
 /* Character set vaticination */
 
+/*
+ *  Both the byte histogram and the statistics of UTF-8 sequences are
+ *  gathered in a single pass over the document, the UTF-8 grade is then
+ *  computed from the statistics as many times as needed.
+ */
+
+static int utf8_correct, utf8_incorrect, utf8_neutral;
+
+static inline void
+utf8_classify(uns code)
+{
+  if (code < 0x10000)
+    {
+      if (conv_ucs_to_x(code) != 256)
+	utf8_correct++;
+      else
+	utf8_neutral++;
+    }
+}
+
 static void
 calc_histogram(uns *hist)
 {
   struct fastbuf *b = fbmem_clone_read(gthis->contents);
-  int c;
+  uns need = 0, code = 0;
+  byte *buf;
+  uns len;
 
   bzero(hist, 256*sizeof(hist[0]));
-  while ((c = bgetc(b)) >= 0)
-    hist[c]++;
+  utf8_correct = utf8_incorrect = utf8_neutral = 0;
+  while (len = bdirect_read_prepare(b, &buf))
+    {
+      const byte *p = buf, *end = buf + len;
+      while (p < end)
+	{
+	  if (!need)
+	    {
+	      /* Runs of ASCII characters are the common case */
+	      uns run = conv_ascii_prefix(p, end - p);
+	      for (const byte *e = p + run; p < e; p++)
+		hist[*p]++;
+	      if (p >= end)
+		break;
+	    }
+	  uns c = *p++;
+	  hist[c]++;
+	  if (need)
+	    {
+	      if ((c & 0xc0) == 0x80)
+		{
+		  code = (code << 6) | (c & 0x3f);
+		  if (!--need)
+		    utf8_classify(code);
+		  continue;
+		}
+	      /* An unfinished sequence, the current byte starts a new one */
+	      utf8_incorrect++;
+	      need = 0;
+	    }
+	  if (c < 0x80)
+	    ;
+	  else if (c < 0xc0 || c >= 0xfe)
+	    utf8_incorrect++;
+	  else
+	    {
+	      uns cnt = 1;
+	      while (c & (0x40 >> cnt))
+		cnt++;
+	      code = c & (0x3f >> cnt);
+	      need = cnt;
+	    }
+	}
+      bdirect_read_commit(b, buf+len);
+    }
+  if (need)
+    utf8_incorrect++;
   bclose(b);
 }
 
@@ -428,50 +495,7 @@ grade_histogram(byte *chs_name, unsigned short int *table, u32 lfamset, uns *his
 static int
 grade_utf8(void)
 {
-  struct fastbuf *b = fbmem_clone_read(gthis->contents);
-  int c;
-  uns code;
-  int correct = 0, incorrect = 0, neutral = 0;
-
-  while ((c = bgetc(b)) >= 0)
-    {
-      if (c < 0x80)
-	;
-      else if (c < 0xc0)
-	incorrect++;
-      else if (c >= 0xfe)
-	incorrect++;
-      else
-	{
-	  int cnt = 1;
-	  while (c & (0x40 >> cnt))
-	    cnt++;
-	  code = c & (0x3f >> cnt);
-	  while (cnt--)
-	    {
-	      c = bgetc(b);
-	      if (c < 0x80 || c >= 0xc0)
-	      {
-		incorrect++;
-		if (c >= 0xc0)
-		  bungetc(b);
-		goto on_err;
-	      }
-	      code = (code << 6) | (c & 0x3f);
-	    }
-	  if (code < 0x10000)
-	    {
-	      uns x = conv_ucs_to_x(code);
-	      if (x != 256)
-		correct++;
-	      else
-		neutral++;
-	    }
-on_err:
-	  ;
-	}
-    }
-  bclose(b);
+  int correct = utf8_correct, incorrect = utf8_incorrect, neutral = utf8_neutral;
   int grade;
   if (correct + incorrect + neutral)
     grade = (correct - incorrect * utf8_penalty) * MAX_GRADE / (correct + incorrect + neutral);
@@ -14,6 +14,8 @@ uns max_host_count;
 uns max_threads = 8;
 uns trace_threads = 0;
 uns min_server_delay = 5;
+uns max_server_delay = 600;
+double adaptive_delay_factor;
 uns rec_err_dly1 = 60;
 uns rec_err_limit = 3;
 uns rec_err_dly2 = 3600;
@@ -52,6 +54,8 @@ static struct cf_section gatherd_config = {
     CF_UNS("MaxThreads", &max_threads),
     CF_UNS("TraceThreads", &trace_threads),
     CF_UNS("MinServerDelay", &min_server_delay),
+    CF_UNS("MaxServerDelay", &max_server_delay),
+    CF_DOUBLE("AdaptiveDelay", &adaptive_delay_factor),
     CF_UNS("RecErrDelay1", &rec_err_dly1),
     CF_UNS("RecErrDelay2", &rec_err_dly2),
     CF_UNS("RecErrLimit", &rec_err_limit),
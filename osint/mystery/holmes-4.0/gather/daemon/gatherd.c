@@ -32,6 +32,7 @@ struct thread {
   pid_t pid;				/* Process running this thread */
   int pipe_fd;				/* Where is the thread pipe connected to */
   ucw_time_t start_time;			/* Timeout control */
+  timestamp_t start_timer;		/* Response time measurement for adaptive timing */
   int timed_out;
   struct mempool *pool;			/* Mempool local to this thread */
   struct qhost *host;			/* Host this thread works for */
@@ -424,6 +425,13 @@ gather_finish(struct thread *t, int err)
       (t->refreshing != OID_UNDEFINED) ? "*" : "",
       log_new, orig_qkey, h->qpriority);
 
+  if (orig_qkey >= NUM_RESOLVER_KEYS && (!new_qkey || new_qkey == orig_qkey))
+    {
+      qnode_feedback(qn, get_timer(&t->start_timer), (o ? obj_find_anum(o, 's', 0) : 0), (err >= 1000 && err < 2000));
+      retry_after = MAX(retry_after, qnode_delay(qn));
+      TTRACE("Qkey %08x: avg_rt=%dms avg_rate=%dB/s err=%d%% -> retry after %ds",
+	     orig_qkey, qn->avg_resp_time, qn->avg_rate, qn->err_rate * 100 / 65536, retry_after);
+    }
   if (retry_after < min_server_delay && new_qkey >= NUM_RESOLVER_KEYS)
     retry_after = min_server_delay;
   if (touched_urldb && !t->fetching_robot_file)
@@ -542,6 +550,7 @@ run_thread(struct qhost *h, struct qnode *n)
   clist_add_tail(&busy_threads, &t->n);
   t->pipe_fd = fds[0];
   t->start_time = now;
+  init_timer(&t->start_timer);
   t->timed_out = 0;
   t->obj = NULL;
   t->reply = fbmem_create(1<<16);
@@ -23,7 +23,8 @@ extern char *log_name, *host_file_name, *host_bak_name, *queue_file_name;
 extern char *lock_name, *urldb_name, *md5db_name;
 extern uns max_bucket_file_size, max_host_count;
 extern uns max_threads, trace_threads, trace_refs;
-extern uns min_server_delay, max_run_time;
+extern uns min_server_delay, max_server_delay, max_run_time;
+extern double adaptive_delay_factor;
 extern uns rec_err_dly1, rec_err_dly2, rec_err_limit;
 extern uns ignore_refs, soft_max_obj_count, hard_max_obj_count;
 extern uns max_rec_err, auto_enqueue_root;
@@ -150,6 +151,10 @@ struct qnode {
   u32 qpriority, sequence;		/* Those of the best of the queued hosts */
   ucw_time_t wait_until;
   uns rec_err_count;			/* Number of recoverable errors seen lately */
+  uns fb_requests, fb_replies;		/* Adaptive timing: number of requests measured and of those successful */
+  uns avg_resp_time;			/* Adaptive timing: average response time in ms */
+  uns avg_rate;				/* Adaptive timing: average transfer rate in bytes/s */
+  uns err_rate;				/* Adaptive timing: fraction of failed requests (scaled by 2^16) */
   struct bh_heap host_heap;		/* A heap of hosts */
   struct qhost *active_host;
   byte state;
@@ -180,6 +185,8 @@ void finish_host(struct qhost *h, uns delay, u32 new_qkey); /* Done with a deque
 void touch_host(struct qhost *h);			/* Call whenever you've changed persistent host settings */
 void put_host(struct qhost *h);				/* Done with a non-dequeued host */
 void walk_hosts(void (*f)(struct qhost *h));
+void qnode_feedback(struct qnode *n, uns resp_time, uns size, uns failed);	/* Account a finished request */
+uns qnode_delay(struct qnode *n);			/* Delay derived from the measurements */
 
 struct qitem *dequeue_item(struct qhost *h);
 struct qitem *peek_item(struct qhost *h);
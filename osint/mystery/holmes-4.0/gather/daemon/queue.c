@@ -490,6 +490,56 @@ walk_hosts(void (*f)(struct qhost *h))
     f(h);
 }
 
+/*** ADAPTIVE TIMING ***/
+
+/*
+ *  If AdaptiveDelay is set, we keep running averages of response time,
+ *  transfer rate and error rate for every qnode (i.e., for every server)
+ *  and derive the delay between two accesses from them: the server gets
+ *  AdaptiveDelay times the time it has spent answering our requests, so fast
+ *  servers are visited as often as MinServerDelay allows and slow ones get
+ *  proportionally less load. Temporary errors stretch the delay towards
+ *  RecErrDelay1. The result is always kept between MinServerDelay
+ *  and MaxServerDelay. Without AdaptiveDelay, qnode_delay() returns 0
+ *  and the traditional timing applies.
+ */
+
+#define FB_DECAY_SHIFT 3		/* Weight of a new sample is 1/8 */
+
+static inline uns
+fb_average(uns avg, uns sample, uns first)
+{
+  if (first)
+    return sample;
+  return avg - (avg >> FB_DECAY_SHIFT) + (sample >> FB_DECAY_SHIFT);
+}
+
+void
+qnode_feedback(struct qnode *n, uns resp_time, uns size, uns failed)
+{
+  n->err_rate = fb_average(n->err_rate, failed ? 0xffff : 0, !n->fb_requests++);
+  if (!failed)
+    {
+      uns first = !n->fb_replies++;
+      uns rate = resp_time ? MIN((u64) size * 1000 / resp_time, 0x7fffffff) : size;
+      n->avg_resp_time = fb_average(n->avg_resp_time, resp_time, first);
+      n->avg_rate = fb_average(n->avg_rate, rate, first);
+    }
+  DBG("Feedback for qkey %08x: rt=%d size=%d failed=%d -> avg_rt=%d avg_rate=%d err=%d/65536",
+      n->qkey, resp_time, size, failed, n->avg_resp_time, n->avg_rate, n->err_rate);
+}
+
+uns
+qnode_delay(struct qnode *n)
+{
+  if (adaptive_delay_factor <= 0 || !n->fb_requests)
+    return 0;
+  double d = n->avg_resp_time * adaptive_delay_factor / 1000;
+  d += (double) n->err_rate * rec_err_dly1 / 65536;
+  uns delay = (d < max_server_delay) ? (uns) d : max_server_delay;
+  return MAX(delay, min_server_delay);
+}
+
 static void
 flush_host_cache(void)
 {
@@ -60,7 +60,13 @@ uns redirect_to_zombie_timeout = ~0U;
 struct unsrange *prune_site_gerr_ranges;
 char *url_database_file;
 char *url_sorted_file;
+char *url_packed_file;
+uns url_pack_compress = 1;
+uns use_known_filter = 1;
 uns auto_sort_index;
+uns adaptive_timing;
+uns fast_server_time = 1;
+uns slow_server_time = 10;
 struct refresh_schema *refresh_schemas[256];
 
 #define TRY(x) do{ byte *_err=(x); if (_err) return _err; }while(0)
@@ -118,6 +124,8 @@ refresh_schema_commit(struct refresh_schema_cf *c)
 static char *
 shepherd_commit(void *p UNUSED)
 {
+  if (adaptive_timing && fast_server_time >= slow_server_time)
+    return "FastServerTime must be smaller than SlowServerTime";
   CF_JOURNAL_VAR(refresh_schemas);
   bzero(refresh_schemas, sizeof(refresh_schemas));
   CLIST_FOR_EACH(struct refresh_schema_cf *, c, refresh_schema_cfs)
@@ -185,6 +193,9 @@ static struct cf_section shepherd_config = {
     CF_UNS("MinServerDelay", &min_server_delay),
     CF_UNS("AutoreplyDelay", &autoreply_delay),
     CF_UNS("ServerOvertake", &server_overtake),
+    CF_UNS("AdaptiveTiming", &adaptive_timing),
+    CF_UNS("FastServerTime", &fast_server_time),
+    CF_UNS("SlowServerTime", &slow_server_time),
     CF_UNS("ReqErrRetry", &req_err_retry),
     CF_UNS("SiteErrRetry", &site_err_retry),
     CF_UNS("SiteErrExpire", &site_err_expire),
@@ -230,7 +241,10 @@ static struct cf_section shepherd_config = {
     CF_USER_DYN("PruneSiteErrors", &prune_site_gerr_ranges, &cf_type_unsrange, CF_ANY_NUM),
     CF_STRING("URLDatabaseFile", &url_database_file),
     CF_STRING("URLSortedFile", &url_sorted_file),
+    CF_STRING("URLPackedFile", &url_packed_file),
+    CF_UNS("URLPackCompress", &url_pack_compress),
     CF_UNS("SortIndex", &auto_sort_index),
+    CF_UNS("KnownFilter", &use_known_filter),
     CF_LIST("RefreshSchema", &refresh_schema_cfs, &refresh_schema_config),
     CF_END
   }
@@ -0,0 +1,230 @@
+/*
+ *	Sherlock Shepherd Daemon -- Filter of Known URL's
+ *
+ *	A cuckoo filter remembering footprints of all URL's in the index,
+ *	so that contributions of already known URL's (which shep-merge would
+ *	throw away anyway) can be dropped before they reach the contrib file.
+ *
+ *	The filter is rebuilt by shep-merge and kept up to date by the tools
+ *	which delete URL's from the index. Other tools rewriting the index
+ *	invalidate it by clearing STATE_FLAG_KNOWN.
+ *
+ *	A lookup compares 8 tags of 32 bits, so a false positive (and thus
+ *	a lost contribution) has probability about 2^-29. False negatives
+ *	(after deleting an entry with a colliding tag or when the filter
+ *	overflows) only make the filter less effective.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "sherlock/sherlock.h"
+#include "ucw/lfs.h"
+#include "ucw/fastbuf.h"
+#include "gather/shepherd/shepherd.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define KNOWN_SLOTS 4		/* Tags per bucket */
+#define KNOWN_MAX_KICKS 500	/* Relocations before giving up an insertion */
+
+struct known_hdr {
+  u32 magic;			/* KNOWN_MAGIC */
+  u32 buckets;			/* number of buckets, a power of two */
+  u32 count;			/* number of stored tags */
+  u32 lost;			/* number of tags lost by overflows */
+};
+
+struct known_filter {
+  struct known_hdr *hdr;
+  u32 *slots;			/* buckets * KNOWN_SLOTS tags, zero is an empty slot */
+  uns mask;
+  uns map_len;			/* size of the mapping or 0 if allocated */
+  uns kick;
+};
+
+static inline uns
+known_size(uns buckets)
+{
+  return sizeof(struct known_hdr) + buckets * KNOWN_SLOTS * sizeof(u32);
+}
+
+static inline u32 *
+known_bucket(struct known_filter *k, uns i)
+{
+  return k->slots + i * KNOWN_SLOTS;
+}
+
+static inline u32
+known_mix(u32 x)
+{
+  /* hash_u32() keeps low bits of similar values similar, which is fatal for cuckoo hashing */
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  return x ^ (x >> 16);
+}
+
+static inline void
+known_hash(struct known_filter *k, struct footprint *fp, uns *i, u32 *tag)
+{
+  *i = known_mix(fp->site.x[0] ^ known_mix(fp->rest.x[0])) & k->mask;
+  *tag = known_mix(fp->site.x[1] ^ known_mix(fp->rest.x[1])) ? : 1;
+}
+
+static inline uns
+known_alt(struct known_filter *k, uns i, u32 tag)
+{
+  return (i ^ known_mix(tag)) & k->mask;
+}
+
+static inline uns
+known_find_tag(u32 *b, u32 tag)
+{
+  for (uns j = 0; j < KNOWN_SLOTS; j++)
+    if (b[j] == tag)
+      return j + 1;
+  return 0;
+}
+
+uns
+known_lookup(struct known_filter *k, struct footprint *fp)
+{
+  uns i;
+  u32 tag;
+  known_hash(k, fp, &i, &tag);
+  return known_find_tag(known_bucket(k, i), tag) || known_find_tag(known_bucket(k, known_alt(k, i, tag)), tag);
+}
+
+void
+known_insert(struct known_filter *k, struct footprint *fp)
+{
+  uns i1, i2, j;
+  u32 tag;
+  known_hash(k, fp, &i1, &tag);
+  i2 = known_alt(k, i1, tag);
+  if (known_find_tag(known_bucket(k, i1), tag) || known_find_tag(known_bucket(k, i2), tag))
+    return;
+  k->hdr->count++;
+  u32 *b;
+  if ((j = known_find_tag(b = known_bucket(k, i1), 0)) || (j = known_find_tag(b = known_bucket(k, i2), 0)))
+    {
+      b[j - 1] = tag;
+      return;
+    }
+
+  /* Both buckets are full, relocate other tags to their alternative buckets */
+  uns i = (tag & 1) ? i1 : i2;
+  for (uns n = 0; n < KNOWN_MAX_KICKS; n++)
+    {
+      b = known_bucket(k, i);
+      j = k->kick++ % KNOWN_SLOTS;
+      u32 victim = b[j];
+      b[j] = tag;
+      tag = victim;
+      i = known_alt(k, i, tag);
+      b = known_bucket(k, i);
+      if (j = known_find_tag(b, 0))
+        {
+	  b[j - 1] = tag;
+	  return;
+	}
+    }
+  DBG("Known URL filter overflow");
+  k->hdr->count--;
+  k->hdr->lost++;
+}
+
+void
+known_delete(struct known_filter *k, struct footprint *fp)
+{
+  uns i, j;
+  u32 tag;
+  known_hash(k, fp, &i, &tag);
+  u32 *b = known_bucket(k, i);
+  if ((j = known_find_tag(b, tag)) || (j = known_find_tag(b = known_bucket(k, known_alt(k, i, tag)), tag)))
+    {
+      b[j - 1] = 0;
+      k->hdr->count--;
+    }
+}
+
+static struct known_filter *
+known_init(void *data)
+{
+  struct known_filter *k = xmalloc_zero(sizeof(*k));
+  k->hdr = data;
+  k->slots = (u32 *)(k->hdr + 1);
+  k->mask = k->hdr->buckets - 1;
+  return k;
+}
+
+struct known_filter *
+known_create(uns max_count)
+{
+  /* Keep the load factor below 90% */
+  uns buckets = 1;
+  while ((u64)buckets * KNOWN_SLOTS * 9 < (u64)max_count * 10)
+    buckets *= 2;
+  struct known_hdr *hdr = xmalloc_zero(known_size(buckets));
+  hdr->magic = KNOWN_MAGIC;
+  hdr->buckets = buckets;
+  return known_init(hdr);
+}
+
+struct known_filter *
+known_load(byte *state)
+{
+  if (!use_known_filter || !(state_flags_get(state) & STATE_FLAG_KNOWN))
+    return NULL;
+  byte *name = state_file_name(state, "known");
+  int fd = ucw_open(name, O_RDONLY);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+	return NULL;
+      die("Cannot open %s: %m", name);
+    }
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    die("Cannot stat %s: %m", name);
+  if ((u64)st.st_size < sizeof(struct known_hdr) || (u64)st.st_size > ~0U)
+    die("Invalid size of %s", name);
+
+  /* Private mapping, updates get to the file only by known_save() */
+  void *map = ucw_mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    die("Cannot map %s: %m", name);
+  close(fd);
+  struct known_hdr *hdr = map;
+  if (hdr->magic != KNOWN_MAGIC || !hdr->buckets || (hdr->buckets & (hdr->buckets - 1)) ||
+      known_size(hdr->buckets) != st.st_size)
+    die("Invalid format of %s", name);
+  struct known_filter *k = known_init(map);
+  k->map_len = st.st_size;
+  DBG("Loaded known URL filter with %u entries in %u buckets", hdr->count, hdr->buckets);
+  return k;
+}
+
+void
+known_save(struct known_filter *k, byte *state)
+{
+  struct fastbuf *fb = temp_state_file();
+  bwrite(fb, k->hdr, known_size(k->hdr->buckets));
+  put_state_file(state, "known", fb, 0);
+  log(L_INFO, "Known URL filter: %u entries in %u buckets (%u lost)", k->hdr->count, k->hdr->buckets, k->hdr->lost);
+}
+
+void
+known_free(struct known_filter *k)
+{
+  if (k->map_len)
+    munmap(k->hdr, k->map_len);
+  else
+    xfree(k->hdr);
+  xfree(k);
+}
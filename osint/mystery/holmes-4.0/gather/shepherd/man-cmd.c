@@ -245,7 +245,7 @@ cmd_set(struct selector *selector)
 {
   set_out = temp_state_file();
   if (sel_index(selector, set_entry, 0))
-    put_state_file(man_opt.state, "index", set_out, STATE_FLAG_SORTED);
+    put_state_file(man_opt.state, "index", set_out, STATE_FLAG_SORTED | STATE_FLAG_KNOWN);
   else
     bclose(set_out);
 }
@@ -262,7 +262,7 @@ cmd_delete(struct selector *selector)
 {
   set_out = temp_state_file();
   if (sel_index(selector, del_entry, 0))
-    put_state_file(man_opt.state, "index", set_out, STATE_FLAG_SORTED);
+    put_state_file(man_opt.state, "index", set_out, STATE_FLAG_SORTED | STATE_FLAG_KNOWN);
   else
     bclose(set_out);
 }
@@ -295,7 +295,7 @@ cmd_turn_to_zombie(struct selector *selector, uns error_code)
     {
       if (turn_to_zombie_sacred)
         log(L_WARN, "%d entries skipped due to incompatible type", turn_to_zombie_sacred);
-      put_state_file(man_opt.state, "index", set_out, STATE_FLAG_SORTED);
+      put_state_file(man_opt.state, "index", set_out, STATE_FLAG_SORTED | STATE_FLAG_KNOWN);
     }
   else
     bclose(set_out);
@@ -419,6 +419,8 @@ struct qkey_stats {
   uns num_sites;
   uns num_active, num_inactive;
   uns min_delay, max_conn;
+  uns error_cycles;
+  u64 dtime_sum, dtime_weight;
   uns cnt_refresh, cnt_regather, cnt_over, cnt_retry, cnt_new;
   uns schema;
   struct site *any_site;
@@ -490,6 +492,9 @@ cmd_qkey_stats(struct selector *selector, uns refresh)
       q->min_delay = MAX(q->min_delay, s->min_delay);
       if (!q->max_conn || q->max_conn > s->max_conn)
 	q->max_conn = s->max_conn;
+      q->dtime_sum += (u64) s->avg_download_time * (s->num_active + 1);
+      q->dtime_weight += s->num_active + 1;
+      q->error_cycles = MAX(q->error_cycles, s->error_cycles);
       if (!q->any_site)
 	q->any_site = s;
       if (q->schema < s->refresh_schema && refresh_schemas[s->refresh_schema])
@@ -510,15 +515,12 @@ cmd_qkey_stats(struct selector *selector, uns refresh)
     }
   HASH_FOR_ALL(qkey_hash, q)
     {
-      /* XXX: These rules should be the same as in shep-select. */
-      uns soft_limit = q->min_delay ? double_to_uns(refresh_cycle * duty_factor * q->max_conn / q->min_delay) : ~0U;
-      uns hard_limit = double_to_uns(soft_limit * hard_limit_factor);
-      uns frequent = refresh_schemas[q->schema] ? double_to_uns(soft_limit * refresh_schemas[q->schema]->frequent_factor) : 0;
-      soft_limit -= frequent;
-      hard_limit -= frequent;
+      struct qkey_limits l;
+      qkey_limits(&l, q->min_delay, q->max_conn, q->dtime_sum, q->dtime_weight, q->error_cycles,
+		  refresh_schemas[q->schema] ? refresh_schemas[q->schema]->frequent_factor : 0);
       bprintf(output, "%04x:%08x %9d %9d %9d %5d %9d %9d",
 	      QK_PAIR(q->qkey), q->num_sites, q->num_active, q->num_inactive,
-	      q->min_delay, soft_limit, hard_limit);
+	      q->min_delay, l.soft_limit, l.hard_limit);
       if (refresh)
 	bprintf(output, " %9d %9d %9d %9d %9d",
 		q->cnt_new, q->cnt_refresh, q->cnt_over, q->cnt_regather, q->cnt_retry);
@@ -706,7 +708,7 @@ cmd_replace_init(struct selector *selector)
       bwrite(out, &s, sizeof(s));
     }
   bclose(in);
-  put_state_file(man_opt.state, "index", out, STATE_FLAG_SORTED);
+  put_state_file(man_opt.state, "index", out, STATE_FLAG_SORTED | STATE_FLAG_KNOWN);
   log(L_INFO, "Initial set gained %d, lost %d entries, exorcised %d zombies", cnt_add, cnt_rem, cnt_zom);
   contrib_init(man_opt.state);
   sel_hash(selector, cmd_replace_callback);
@@ -17,6 +17,8 @@
 #include "gather/shepherd/reap.h"
 
 static struct fastbuf *contrib;
+static struct known_filter *known;
+static uns known_skipped;
 
 static struct filter_binding cfilter_bindings[] = {
   /* URL and its parts */
@@ -162,6 +164,11 @@ contrib_flush(void)
     }
   HASH_END_FOR;
   log(L_INFO, "Wrote %d contributions", cnt);
+  if (known_skipped)
+    {
+      log(L_INFO, "Skipped %d contributions of known URL's", known_skipped);
+      known_skipped = 0;
+    }
 }
 
 static void
@@ -186,6 +193,14 @@ add_contrib(byte *url, byte *src_url, uns want_xform, int weight, uns flags, int
   if (msg = verify_contrib(&cfd, want_xform))
     return msg;
 
+  /* Plain contributions of URL's already in the index would be dropped by shep-merge anyway */
+  struct footprint fp;
+  if (known && !flags && !url_footprint(&fp, cfd.url_xform) && known_lookup(known, &fp))
+    {
+      known_skipped++;
+      return "Known URL";
+    }
+
   if (chash_total_size >= contrib_cache_size)
     contrib_reset();
 
@@ -264,6 +279,7 @@ contrib_init(byte *new_state)
       contrib = append_state_file(new_state, "contrib");
       chash_pool = mp_new(65536);
       chash_init();
+      known = known_load(new_state);
     }
   cfilter = filter_load(shepherd_filter_name, filter_builtin_vars, cfilter_bindings, NULL);
   cfilter_args = filter_intr_new(cfilter);
@@ -275,6 +291,8 @@ contrib_cleanup(void)
 {
   contrib_flush();
   bclose(contrib);
+  if (known)
+    known_free(known);
 }
 
 ucw_off_t
@@ -315,7 +315,7 @@ dump_log(void)
 static void
 dump_urls(void)
 {
-  struct url_db *db = url_db_open_file(force_file ? : url_database_file, O_RDONLY, 0);
+  struct url_db *db = url_db_open_file(force_file ? : url_database_file, force_file ? NULL : url_packed_file, O_RDONLY, 0);
 
   bputsn(output, "Bucket   Site footprint   Path footprint   URL");
   for (struct url_record *r = url_db_find_first(db); r; r = url_db_find_next(db))
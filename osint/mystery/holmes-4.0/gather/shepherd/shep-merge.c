@@ -137,6 +137,7 @@ static uns cnt_sacred, cnt_contrib, cnt_normal;
 static uns cnt_dups, cnt_regather;
 static struct record *block_buf, **block_ptr;
 static uns block_len, block_id, block_limit = 1024;
+static struct known_filter *known;
 
 static inline int
 filtering_cmp(struct record *x, struct record *y)
@@ -264,7 +265,11 @@ filtering_block(struct fastbuf *dest)
   DBG("Writing %d records", len);
   /* Flush records */
   for (uns i = 0; i < len; i++)
-    bwrite(dest, &block_ptr[i]->state, sizeof(struct url_state));
+    {
+      bwrite(dest, &block_ptr[i]->state, sizeof(struct url_state));
+      if (known)
+	known_insert(known, &block_ptr[i]->state.fp);
+    }
 }
 
 static void
@@ -274,6 +279,8 @@ filtering(struct fastbuf *dest, struct fastbuf *src)
   struct url_state s;
   block_buf = xmalloc(block_limit * sizeof(*block_buf));
   block_ptr = xmalloc(block_limit * sizeof(*block_ptr));
+  if (use_known_filter)
+    known = known_create(bfilesize(src) / sizeof(s));
   while (breadb(src, &s, sizeof(s)))
     {
       ASSERT(!(ustate_type(&s) == UTYPE_ZOMBIE && (USF_IS_SACRISIMMUS(s.flags) || (s.flags & USF_CONTRIB))));
@@ -354,7 +361,13 @@ main(int argc, char **argv)
   struct fastbuf *new_index = temp_state_file();
   filtering(new_index, contrib_index);
   bclose(contrib_index);
-  put_state_file(state, "index", new_index, STATE_FLAG_SORTED);
+  put_state_file(state, "index", new_index, STATE_FLAG_SORTED | STATE_FLAG_KNOWN);
+  if (known)
+    {
+      known_save(known, state);
+      state_flags_set(state, STATE_FLAG_KNOWN);
+      known_free(known);
+    }
 
   log(L_INFO, "Writing new site list");
   site_hash_save(state);
@@ -501,7 +501,7 @@ mirror_urls:
       fbpos = bpos_sort(fbpos, NULL);
       index = idx_sort(index, NULL);
       index = fix_index(index, fbpos);
-      put_state_file(state, "index", index, 0);
+      put_state_file(state, "index", index, STATE_FLAG_KNOWN);
 
       struct fastbuf *x = temp_state_file();
       bputs(x, "closed\n");
@@ -36,6 +36,7 @@ struct qkey_hash {
   uns max_conn;
   uns delay;
   uns tight_p;
+  uns error_cycles;
   u64 avg_dtime;
 };
 
@@ -132,6 +133,7 @@ plan_analyse(void)
       q->avg_dtime += site->avg_download_time * site->u.plan.cnt;
       if (!q->max_conn || q->max_conn > site->max_conn)
 	q->max_conn = site->max_conn;
+      q->error_cycles = MAX(q->error_cycles, site->error_cycles);
       site->u.plan.cnt = 0;
       site->u.plan.qkey = q;
     }
@@ -156,10 +158,13 @@ plan_analyse(void)
 	{
 	  if (!q->min_delay)
 	    q->min_delay = min_server_delay;
+	  q->max_conn = adaptive_max_conn(q->max_conn, q->avg_dtime, q->error_cycles);
 
 	  uns t = q->active_urls_multi ? (uns)((double) (refresh_cycle * duty_factor * q->max_conn) / q->active_urls_multi * reap_slowdown_factor) : 0;
 	  t = MAX(t, q->avg_dtime) - q->avg_dtime;
 	  q->delay = CLAMP(t, (int)q->min_delay, (int)std_server_delay);
+	  if (adaptive_timing && q->error_cycles)
+	    q->delay = MAX(q->delay, std_server_delay);
 
 	  uns t0 = q->active_urls_multi ? (uns)((double) (refresh_cycle * duty_factor * q->max_conn) / q->active_urls_multi) : 0;
 	  t0 = MAX(t0, q->avg_dtime) - q->avg_dtime;
@@ -167,8 +172,13 @@ plan_analyse(void)
 	  if (q->tight_p)
 	    tight_cnt++;
 
-	  /* The planning limit should not be influenced by the average download time, only the timing should */
-	  uns limit = q->delay ? (reap_cycle * q->max_conn / q->delay) : ~0U;
+	  /*
+	   * The planning limit should not be influenced by the average download time, only the timing should.
+	   * With adaptive timing, we do account for it, so that slow servers do not tie up the reaper's slots
+	   * with URL's they will not be able to serve during the reap cycle anyway.
+	   */
+	  uns period = q->delay + (adaptive_timing ? q->avg_dtime : 0);
+	  uns limit = period ? (reap_cycle * q->max_conn / period) : ~0U;
 	  q->max_allowed_urls = limit;
 	}
       DBG("Qkey %04x:%08x: active_multi=%d delay=%d min_delay=%d max_conn=%d avg_dtime=%d limit=%d tight=%d",
@@ -132,6 +132,8 @@ create_buckets(byte *old_state, struct fastbuf *creq)
   return cres;
 }
 
+static struct known_filter *known;
+
 static void
 record(struct fastbuf *nidx, struct fastbuf *oidx, struct fastbuf *crep)
 {
@@ -157,6 +159,8 @@ record(struct fastbuf *nidx, struct fastbuf *oidx, struct fastbuf *crep)
 		sk_del++;
 	      else
 		rob_del++;
+	      if (known)
+		known_delete(known, &s.fp);
 	      continue;
 	    }
 	}
@@ -203,9 +207,15 @@ main(int argc, char **argv)
   log(L_INFO, "Recording contributions");
   struct fastbuf *new_idx = temp_state_file();
   bsetpos(orig_idx, 0);
+  known = known_load(state);
   record(new_idx, orig_idx, creq);
   bclose(orig_idx);
   bclose(creq);
+  if (known)
+    {
+      known_save(known, state);
+      known_free(known);
+    }
   put_state_file(state, "index", new_idx, STATE_FLAG_SORTED);
 
   site_hash_save(state);
@@ -421,7 +421,7 @@ main(int argc, char **argv)
   setproctitle("shep-recover: postprocessing");
   struct fastbuf *idx = temp_state_file();
   merge_updates(idx, old_idx, new_idx);
-  put_state_file(state, "index", idx, 0);
+  put_state_file(state, "index", idx, STATE_FLAG_KNOWN);
   state_flags_set(state, STATE_FLAG_SORTED);
 
   site_hash_save(state);
@@ -66,6 +66,8 @@ static const byte *cause_names[] = { "Perf", "Site", "Qkey", "Sect", "Space", "A
 struct select_qkey {
   u64 qkey;
   uns min_delay, max_conn;
+  uns avg_dtime, error_cycles;		/* Measured behaviour of the sites (for adaptive timing) */
+  u64 dtime_sum, dtime_weight;
   uns soft_limit, hard_limit;
   uns num_active, num_inactive;
   uns freq_total, freq_limit;
@@ -113,17 +115,17 @@ static uns site_cnt_died, site_cnt_revived;
 static void
 set_qkey_limits(struct select_qkey *q)
 {
-  /* XXX: shep.c:cmd_qkeystats() should follow the same rules */
-
   struct refresh_schema *schema = refresh_schemas[q->schema];
   double frequent_factor = schema ? schema->frequent_factor : 0;
   q->num_active = q->num_inactive = q->freq_total = 0;
-  uns soft = q->min_delay ? double_to_uns(refresh_cycle * duty_factor * q->max_conn / q->min_delay) : ~0U;
-  q->soft_limit = double_to_uns(soft * (1 - frequent_factor));
-  q->hard_limit = double_to_uns(q->soft_limit * hard_limit_factor);
 
-  uns soft2 = double_to_uns(refresh_cycle * duty_factor * q->max_conn / (q->min_delay ? : 1));
-  q->freq_limit = double_to_uns(soft2 * frequent_factor);
+  struct qkey_limits l;
+  qkey_limits(&l, q->min_delay, q->max_conn, q->dtime_sum, q->dtime_weight, q->error_cycles, frequent_factor);
+  q->avg_dtime = l.avg_dtime;
+  q->max_conn = l.max_conn;
+  q->soft_limit = l.soft_limit;
+  q->hard_limit = l.hard_limit;
+  q->freq_limit = l.freq_limit;
   if (schema)
     for (uns i=0; i<schema->num; i++)
       q->freq_limits[i] = double_to_uns(q->freq_limit * schema->allocations[i]);
@@ -196,6 +198,7 @@ set_limits(void)
       s->u.select.num_useful = 0;
       if (s->flags & SITE_REJECTED) /* We delete everything from rejected sites */
 	continue;
+      uns dtime_weight = s->num_active + 1;	/* Weighted by the number of active URL's in the last cycle */
       s->num_active = s->num_inactive = s->num_fresh = s->num_gathered = s->num_oscillations = 0;
       if (s->error_cycles > site_err_retry)
 	{
@@ -217,6 +220,9 @@ set_limits(void)
 	  q->min_delay = MAX(q->min_delay, s->min_delay);
 	  if (!q->max_conn || q->max_conn > s->max_conn)
 	    q->max_conn = s->max_conn;
+	  q->dtime_sum += (u64) s->avg_download_time * dtime_weight;
+	  q->dtime_weight += dtime_weight;
+	  q->error_cycles = MAX(q->error_cycles, s->error_cycles);
 	  if (q->schema < s->refresh_schema && refresh_schemas[s->refresh_schema])
 	    q->schema = s->refresh_schema;
 	  s->u.select.qkey = q;
@@ -360,6 +366,15 @@ select_freq(struct url_state *s, struct select_qkey *qkey, struct site *site)
   s->refresh_freq = f;
 }
 
+static struct known_filter *known;
+
+static void
+forget_url(struct url_state *s)
+{
+  if (known)
+    known_delete(known, &s->fp);
+}
+
 static inline uns
 zombie_expired(struct url_state *s, time_t now)
 {
@@ -387,7 +402,10 @@ select_urls(struct fastbuf *in)
       struct site *site = site_lookup(&s.fp.site);
       ASSERT(site);
       if (site->flags & SITE_REJECTED)
-	continue;
+	{
+	  forget_url(&s);
+	  continue;
+	}
       struct select_qkey *qkey = site->u.select.qkey;
       struct section *sect = &sections[(s.section < SHERLOCK_NUM_SECTIONS) ? s.section : 0];
       select_action action = ACT_OK;
@@ -418,6 +436,7 @@ select_urls(struct fastbuf *in)
 		  site->error_cycles = site_err_retry;
 		  site->skey = SKEY_UNRESOLVED;
 		  site_cnt_revived++;
+		  forget_url(&s);
 		  continue;
 		}
 	    }
@@ -435,6 +454,7 @@ select_urls(struct fastbuf *in)
 	{
 	  state_log(site, &s, LOG_SRC_SELECT, LOG_SELECT_UNREF, 0, s.weight);
 	  num_unref_errors++;
+	  forget_url(&s);
 	  continue;
 	}
       else
@@ -534,6 +554,7 @@ select_urls(struct fastbuf *in)
 	case ACT_KO:
 	  DBG("%08x%08x:%08x%08x %04x:%08x:%d: DISCARD by %d", FP_QUAD(s.fp), QK_TRIPLE(qkey->qkey), cause);
 	  state_log(site, &s, LOG_SRC_SELECT, LOG_SELECT_DISCARD, cause, CLAMP(select_weight(&s), 0, 255));
+	  forget_url(&s);
 	  continue;
 	default:
 	  ASSERT(0);
@@ -736,6 +757,7 @@ main(int argc, char **argv)
   struct fastbuf *orig_idx = weight_sort(read_state_file(state, "index"), NULL);
 
   log(L_INFO, "Selecting URL's");
+  known = known_load(state);
   struct fastbuf *idx = select_urls(orig_idx);
   if (select_stats > 1)
     put_state_file(state, "select-index", orig_idx, 0);
@@ -743,6 +765,11 @@ main(int argc, char **argv)
     bclose(orig_idx);
   prune_sites();
   site_hash_save(state);
+  if (known)
+    {
+      known_save(known, state);
+      known_free(known);
+    }
   put_state_file(state, "index", idx, STATE_FLAG_SORTED);
   show_stats(state);
 
@@ -87,6 +87,22 @@ convert_v0_sites(byte *state)
   put_state_file(state, "sites", s_out, 0);
 }
 
+static void
+convert_url_db(void)
+{
+  if (!url_packed_file || !*url_packed_file || !url_database_file || !*url_database_file)
+    return;
+  if (!access(url_packed_file, F_OK))
+    {
+      log(L_INFO, "Packed URL database is up to date");
+      return;
+    }
+  if (access(url_database_file, F_OK))
+    return;
+  log(L_INFO, "Converting URL database to the packed format");
+  url_db_pack(url_database_file, url_packed_file);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -112,6 +128,7 @@ main(int argc, char **argv)
     default:
       die("Unknown version, don't know how to handle");
     }
+  convert_url_db();
 
   byte *ctrl = state_file_name(state, "control");
   if (access(ctrl, R_OK))
@@ -22,13 +22,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 
-static char *shortopts = "abcdDf:i:rs" CF_SHORT_OPTS;
+static char *shortopts = "abcdDf:i:prs" CF_SHORT_OPTS;
 static struct option longopts[] =
 {
   CF_LONG_OPTS
   { "file",     	1, 0, 'f' },
   { "build",		0, 0, 'b' },
   { "append",   	0, 0, 'a' },
+  { "pack",		0, 0, 'p' },
   { "sort",		0, 0, 's' },
   { "incremental",	1, 0, 'i' },
   { "check",    	0, 0, 'c' },
@@ -47,6 +48,7 @@ CF_USAGE
 -f, --file=<path>         Force custom path to (sorted) URL database\n\
 -b, --build               (Re)build URL database from bucket file\n\
 -a, --append              Incremental build of URL database\n\
+-p, --pack                Move all records to the packed URL database\n\
 -s, --sort                Sort URL database by footprints\n\
 -i, --incremental=<path>  Use this file as the previous database version for incremental sorting\n\
 -c, --check               Check consistency\n\
@@ -67,6 +69,7 @@ usage(void)
 static char *force_file;
 static uns want_build;
 static uns want_append;
+static uns want_pack;
 static uns want_sort;
 static uns want_check;
 static uns want_dump;
@@ -79,7 +82,7 @@ static struct fastbuf *output;
 static struct url_db *
 my_url_db_open(int mode)
 {
-  return url_db_open_file(force_file ? : url_database_file, mode, 0);
+  return url_db_open_file(force_file ? : url_database_file, force_file ? NULL : url_packed_file, mode, 0);
 }
 
 static void
@@ -133,6 +136,15 @@ build(void)
   append();
 }
 
+static void
+pack(void)
+{
+  if (!url_packed_file || !*url_packed_file)
+    die("Packed URL database not configured");
+  log(L_INFO, "Packing URL database");
+  url_db_pack(force_file ? : url_database_file, url_packed_file);
+}
+
 struct sorted_trailer {
   ucw_time_t time;
   u64 src_size;
@@ -198,6 +210,21 @@ sort(void)
 	log(L_INFO, "Cannot sort incrementally, sorting everything");
     }
 
+  struct url_pack *pack;
+  if (!incr && (pack = url_pack_open(url_packed_file, 1)))
+    {
+      /* The sorter gets the packed records followed by the rest of the log */
+      log(L_INFO, "Unpacking URLs");
+      struct fastbuf *tmp = bopen_tmp(65536);
+      for (struct url_record *r = url_pack_find_first(pack); r; r = url_pack_find_next(pack))
+	url_record_write(tmp, r);
+      url_pack_close(pack);
+      bbcopy(fb, tmp, ~0U);
+      bclose(fb);
+      brewind(tmp);
+      fb = tmp;
+    }
+
   log(L_INFO, "Sorting URLs");
   fb = url_db_sort_records(fb);
 
@@ -392,6 +419,9 @@ main(int argc, char **argv)
 	case 'a':
 	  want_append++;
 	  break;
+	case 'p':
+	  want_pack++;
+	  break;
 	case 's':
 	  want_sort++;
 	  break;
@@ -424,6 +454,8 @@ main(int argc, char **argv)
     build();
   else if (want_append)
     append();
+  if (want_pack)
+    pack();
   if (want_check)
     check();
   if (want_dump)
@@ -35,8 +35,11 @@ extern u64 expected_bucket_file_size;
 extern struct unsrange *zombie_gerr_ranges;
 extern uns zombie_expire, redirect_to_zombie_timeout;
 extern struct unsrange *prune_site_gerr_ranges;
-extern char *url_database_file, *url_sorted_file;
+extern char *url_database_file, *url_sorted_file, *url_packed_file;
+extern uns url_pack_compress;
 extern uns auto_sort_index;
+extern uns use_known_filter;
+extern uns adaptive_timing, fast_server_time, slow_server_time;
 
 struct section_config {
   cnode n;
@@ -64,6 +67,56 @@ double_to_uns(double x)
     return (uns) x;
 }
 
+/*
+ * Adaptive timing: the number of parallel connections to a queue key is
+ * derived from the configured maximum and from the measured average download
+ * time (in seconds) and number of failed reap cycles of its sites. Fast servers
+ * get all the connections they are allowed, slow or failing ones only a single one.
+ */
+static inline uns
+adaptive_max_conn(uns max_conn, uns avg_dtime, uns error_cycles)
+{
+  if (!adaptive_timing || max_conn < 2)
+    return max_conn;
+  if (error_cycles || avg_dtime >= slow_server_time)
+    return 1;
+  if (avg_dtime <= fast_server_time)
+    return max_conn;
+  return 1 + (max_conn - 1) * (slow_server_time - avg_dtime) / (slow_server_time - fast_server_time);
+}
+
+/*
+ * Limits on the number of active URL's of a queue key, computed from the
+ * minimum delay and maximum number of connections of its sites and (with
+ * adaptive timing) from their download times weighted by dtime_weight.
+ * Shared by shep-select and by `shep --qkey-stats' which reports them.
+ */
+struct qkey_limits {
+  uns avg_dtime, max_conn;
+  uns soft_limit, hard_limit, freq_limit;
+};
+
+static inline void
+qkey_limits(struct qkey_limits *l, uns min_delay, uns max_conn, u64 dtime_sum, u64 dtime_weight, uns error_cycles, double frequent_factor)
+{
+  uns period = min_delay;
+  l->avg_dtime = 0;
+  l->max_conn = max_conn;
+  if (adaptive_timing)
+    {
+      /* Feed the measured download times back: we cannot refresh more pages than the server is able to serve */
+      l->avg_dtime = dtime_weight ? (dtime_sum + dtime_weight/2) / dtime_weight / 10 : 0;
+      l->max_conn = adaptive_max_conn(max_conn, l->avg_dtime, error_cycles);
+      period += l->avg_dtime;
+    }
+  uns soft = period ? double_to_uns(refresh_cycle * duty_factor * l->max_conn / period) : ~0U;
+  l->soft_limit = double_to_uns(soft * (1 - frequent_factor));
+  l->hard_limit = double_to_uns(l->soft_limit * hard_limit_factor);
+
+  uns soft2 = double_to_uns(refresh_cycle * duty_factor * l->max_conn / (period ? : 1));
+  l->freq_limit = double_to_uns(soft2 * frequent_factor);
+}
+
 /* footprint.c */
 
 struct site_fp {
@@ -495,9 +548,10 @@ void put_state_file(byte *state, byte *name, struct fastbuf *fb, uns clear_flags
 
 enum state_flags {
   STATE_FLAG_SORTED = 0x1,	/* The index is sorted by footprints */
+  STATE_FLAG_KNOWN = 0x2,	/* The filter of known URL's matches the index */
   STATE_FLAGS_ALL = ~0U,
 };
-#define STATE_FLAG_NAMES "S*******************************"
+#define STATE_FLAG_NAMES "SK******************************"
 
 struct state_params {
   u32 params_magic;		/* PARAMS_MAGIC */
@@ -541,6 +595,20 @@ struct area_info *area_lookup(area_t id, int what_if_nonex);
 
 #endif
 
+/* known.c */
+
+#define KNOWN_MAGIC 0x9a2736ad
+
+struct known_filter;
+
+struct known_filter *known_create(uns max_count);
+struct known_filter *known_load(byte *state);
+void known_save(struct known_filter *k, byte *state);
+void known_free(struct known_filter *k);
+uns known_lookup(struct known_filter *k, struct footprint *fp);
+void known_insert(struct known_filter *k, struct footprint *fp);
+void known_delete(struct known_filter *k, struct footprint *fp);
+
 /* url-db.c */
 
 enum index_order {
@@ -571,7 +639,7 @@ struct url_record {
 };
 
 struct url_db *url_db_open(int mode, uns open_try);
-struct url_db *url_db_open_file(byte *path, int mode, uns open_try);
+struct url_db *url_db_open_file(byte *path, byte *pack_path, int mode, uns open_try);
 void url_db_close(struct url_db *db);
 
 ucw_off_t url_db_get_size(struct url_db *db);
@@ -589,5 +657,33 @@ ucw_off_t url_db_tell(struct url_db *db);
 
 void url_db_check_header(struct url_db_hdr *hdr);
 void url_record_decode(struct url_record *rec);
+void url_record_write(struct fastbuf *fb, struct url_record *rec);
+
+/* url-pack.c */
+
+#define URL_PACK_MAGIC 0x9a2736ac
+#define URL_PACK_VERSION 0x3b00
+
+struct url_pack;
+struct url_pack_writer;
+
+extern uns url_pack_block_limit;
+
+struct url_pack *url_pack_open(byte *path, uns open_try);
+void url_pack_close(struct url_pack *pack);
+void url_pack_rewind(struct url_pack *pack);
+uns url_pack_covers(struct url_pack *pack, oid_t oid);
+
+struct url_record *url_pack_find_first(struct url_pack *pack);
+struct url_record *url_pack_find_next(struct url_pack *pack);
+struct url_record *url_pack_find_last(struct url_pack *pack);
+struct url_record *url_pack_find(struct url_pack *pack, uns oid, uns *gt);
+struct url_record *url_pack_find_forward(struct url_pack *pack, uns oid, uns *gt);
+
+struct url_pack_writer *url_pack_create(void);
+void url_pack_write(struct url_pack_writer *w, struct url_record *rec);
+struct fastbuf *url_pack_finish(struct url_pack_writer *w);
+
+void url_db_pack(byte *path, byte *pack_path);
 
 #endif
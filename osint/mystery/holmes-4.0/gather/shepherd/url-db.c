@@ -77,6 +77,8 @@ struct url_db {
   struct fastbuf *fb;
   ucw_off_t size;
   oid_t min_oid;		/* First available OID for writing */
+  struct url_pack *pack;	/* Packed older records or NULL */
+  uns in_pack;			/* Reading from the packed part */
 
   /* Buffer for the current record */
   struct url_record rec;	
@@ -87,6 +89,15 @@ static void
 url_db_rewind(struct url_db *db)
 {
   bsetpos(db->fb, sizeof(struct url_db_hdr));
+  if (db->in_pack = !!db->pack)
+    url_pack_rewind(db->pack);
+}
+
+static struct url_record *
+url_db_copy_record(struct url_db *db, struct url_record *rec)
+{
+  memcpy(&db->rec, rec, sizeof(*rec) + rec->len + 1);
+  return &db->rec;
 }
 
 void
@@ -114,7 +125,7 @@ url_db_check_header(struct url_db_hdr *hdr)
 }
 
 struct url_db *
-url_db_open_file(byte *file_name, int mode, uns open_try)
+url_db_open_file(byte *file_name, byte *pack_name, int mode, uns open_try)
 {
   /* Open the file */
   if (!file_name || !*file_name)
@@ -133,6 +144,14 @@ url_db_open_file(byte *file_name, int mode, uns open_try)
     else
       die("URL database %s: open: %m", file_name);
   db->fb = bopen(file_name, O_RDONLY, 65536);
+  if (pack_name && *pack_name)
+    if (mode & O_TRUNC)
+      {
+	if (unlink(pack_name) < 0 && errno != ENOENT)
+	  die("Packed URL database %s: unlink: %m", pack_name);
+      }
+    else
+      db->pack = url_pack_open(pack_name, 1);
 
   struct url_db_hdr hdr;
   if (!url_db_get_size(db))
@@ -150,6 +169,12 @@ url_db_open_file(byte *file_name, int mode, uns open_try)
         else
           die("URL database %s: short write", db->fb->name);
       db->size = sizeof(hdr);
+      if (db->pack)
+        {
+	  if (url_db_find_last(db))
+	    db->min_oid = db->rec.oid + 1;
+	  url_db_rewind(db);
+	}
     }
   else
     {
@@ -167,14 +192,17 @@ url_db_open_file(byte *file_name, int mode, uns open_try)
 struct url_db *
 url_db_open(int mode, uns try_open)
 {
-  return url_db_open_file(url_database_file, mode, try_open);
+  return url_db_open_file(url_database_file, url_packed_file, mode, try_open);
 }
 
 void
 url_db_close(struct url_db *db)
 {
+  if (db->pack)
+    url_pack_close(db->pack);
   bclose(db->fb);
   close(db->fd);
+  xfree(db);
 }
 
 #define SORT_PREFIX(x) url_records_sort_##x
@@ -219,6 +247,17 @@ url_db_sort_records(struct fastbuf *fb)
   return url_records_sort_sort(fb, NULL);
 }
 
+void
+url_record_write(struct fastbuf *fb, struct url_record *rec)
+{
+  struct url_record r = *rec;
+  url_record_encode(&r);
+  bwrite(fb, &r, sizeof(r));
+  bwrite(fb, rec->url, rec->len);
+  for (uns i = rec->len; i & 3; i++)
+    bputc(fb, 0);
+}
+
 void
 url_db_write(struct url_db *db, uns oid, byte *url)
 {
@@ -258,8 +297,8 @@ url_record_next(struct url_record *record)
   return (void *)(record + 1) + ALIGN_TO(record->len, 4);
 }
 
-struct url_record *
-url_db_find_next(struct url_db *db)
+static struct url_record *
+url_db_read_next(struct url_db *db)
 {
   if (btell(db->fb) >= db->size)
     return NULL;
@@ -272,6 +311,22 @@ url_db_find_next(struct url_db *db)
   return &db->rec;
 }
 
+struct url_record *
+url_db_find_next(struct url_db *db)
+{
+  struct url_record *rec;
+  if (db->in_pack)
+    {
+      if (rec = url_pack_find_next(db->pack))
+	return url_db_copy_record(db, rec);
+      db->in_pack = 0;
+    }
+  /* Skip records left in the log by an interrupted url_db_pack() */
+  while ((rec = url_db_read_next(db)) && db->pack && url_pack_covers(db->pack, rec->oid))
+    ;
+  return rec;
+}
+
 struct url_record *
 url_db_find_first(struct url_db *db)
 {
@@ -279,8 +334,8 @@ url_db_find_first(struct url_db *db)
   return url_db_find_next(db);
 }
 
-struct url_record *
-url_db_find_last(struct url_db *db)
+static struct url_record *
+url_db_read_last(struct url_db *db)
 {
   if (db->size == sizeof(struct url_db_hdr))
     return NULL;
@@ -300,6 +355,20 @@ url_db_find_last(struct url_db *db)
   return &db->rec;
 }
 
+struct url_record *
+url_db_find_last(struct url_db *db)
+{
+  struct url_record *rec = url_db_read_last(db);
+  db->in_pack = 0;
+  if (db->pack && (!rec || url_pack_covers(db->pack, rec->oid)))
+    {
+      bsetpos(db->fb, db->size);
+      if (rec = url_pack_find_last(db->pack))
+	return url_db_copy_record(db, rec);
+    }
+  return rec;
+}
+
 /* Search the interval [l, r) for the first record with OID not greater than <key>.
  * Interval limits must be aligned to record boundaries. <r> should be EOF or
  * position of a record with OID not lower than <key>.
@@ -339,6 +408,13 @@ url_db_find_interval(struct url_db *db, ucw_off_t l, ucw_off_t r, uns key)
 struct url_record *
 url_db_find(struct url_db *db, uns key, uns *gt)
 {
+  if (db->pack && url_pack_covers(db->pack, key))
+    {
+      db->in_pack = 1;
+      bsetpos(db->fb, sizeof(struct url_db_hdr));
+      return url_db_copy_record(db, url_pack_find(db->pack, key, gt));
+    }
+  db->in_pack = 0;
   *gt = url_db_find_interval(db, sizeof(struct url_db_hdr), db->size, key);
   return ((int)*gt >= 0) ? &db->rec : NULL;
 }
@@ -346,6 +422,11 @@ url_db_find(struct url_db *db, uns key, uns *gt)
 struct url_record *
 url_db_find_forward(struct url_db *db, uns key, uns *gt)
 {
+  if (db->in_pack)
+    if (url_pack_covers(db->pack, key))
+      return url_db_copy_record(db, url_pack_find_forward(db->pack, key, gt));
+    else
+      return url_db_find(db, key, gt);
   if (btell(db->fb) <= (ucw_off_t)sizeof(struct url_db_hdr))
     return url_db_find(db, key, gt);
 
@@ -436,6 +517,48 @@ check(struct url_record *rec, uns i)
       strcmp(rec->url, "http://www.centrum.cz/") && ASSERT(0);
 }
 
+static void
+fill(uns from, uns to)
+{
+  for (uns i = from; i < to; i += 2)
+    {
+      byte url_buf[MAX_URL_SIZE];
+      byte *url;
+      switch (i)
+        {
+	  case 10: url = "http://www.ucw.cz/"; break;
+	  case 100: url = "http://www.centrum.cz/"; break;
+          default: random_url(url_buf); url = url_buf; break;
+        }
+      url_db_write(db, i, url);
+    }
+}
+
+static void
+verify(void)
+{
+  check(url_db_find_next(db), 0);
+  check(url_db_find_next(db), 2);
+  check(url_db_find(db, 700, &gt), 700);
+  check(url_db_find(db, 101, &gt), 101);
+  check(url_db_find_forward(db, 300, &gt), 300);
+  check(url_db_find_forward(db, 601, &gt), 601);
+  gt = 0; check(url_db_find_last(db), (n - 1) & ~1);
+  check(url_db_find_first(db), 0);
+  for (uns i = 0; i < n + 100; i += random_max(5))
+    check(url_db_find_forward(db, i, &gt), i);
+  for (uns i = 0; i < 100; i++)
+    {
+      uns j = random_max(n + 100);
+      check(url_db_find(db, j, &gt), j);
+    }
+  uns i = 0;
+  gt = 0;
+  for (struct url_record *rec = url_db_find_first(db); rec; rec = url_db_find_next(db), i += 2)
+    check(rec, i);
+  i == ((n + 1) & ~1) || ASSERT(0);
+}
+
 int main(int argc, char **argv)
 {
   byte name[TEMP_FILE_NAME_LEN];
@@ -450,9 +573,9 @@ int main(int argc, char **argv)
 
   if (!strcmp(test, "empty"))
     {
-      db = url_db_open_file(name, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0);
+      db = url_db_open_file(name, NULL, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0);
       url_db_close(db);
-      db = url_db_open_file(name, O_RDONLY, 0);
+      db = url_db_open_file(name, NULL, O_RDONLY, 0);
       url_db_find_first(db) && ASSERT(0);
       url_db_find_last(db) && ASSERT(0);
       url_db_find_next(db) && ASSERT(0);
@@ -462,37 +585,30 @@ int main(int argc, char **argv)
     }
   else if (!strcmp(test, "random"))
     {
-      db = url_db_open_file(name, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0);
-      for (uns i = 0; i < n; i += 2)
-        {
-          byte url_buf[MAX_URL_SIZE];
-          byte *url;
-          switch (i)
-            {
-	      case 10: url = "http://www.ucw.cz/"; break;
-	      case 100: url = "http://www.centrum.cz/"; break;
-              default: random_url(url_buf); url = url_buf; break;
-            }
-          url_db_write(db, i, url);
-        }
+      db = url_db_open_file(name, NULL, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0);
+      fill(0, n);
       url_db_close(db);
-      db = url_db_open_file(name, O_RDONLY, 0);
-      check(url_db_find_next(db), 0);
-      check(url_db_find_next(db), 2);
-      check(url_db_find(db, 700, &gt), 700);
-      check(url_db_find(db, 101, &gt), 101);
-      check(url_db_find_forward(db, 300, &gt), 300);
-      check(url_db_find_forward(db, 601, &gt), 601);
-      gt = 0; check(url_db_find_last(db), (n - 1) & ~1);
-      check(url_db_find_first(db), 0);
-      for (uns i = 0; i < n + 100; i += random_max(5))
-	check(url_db_find_forward(db, i, &gt), i);
-      for (uns i = 0; i < 100; i++)
-        {
-	  uns j = random_max(n + 100);
-	  check(url_db_find(db, j, &gt), j);
-	}
+      db = url_db_open_file(name, NULL, O_RDONLY, 0);
+      verify();
+      url_db_close(db);
+    }
+  else if (!strcmp(test, "packed"))
+    {
+      byte pack_name[TEMP_FILE_NAME_LEN];
+      close(open_tmp(pack_name, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR));
+      url_pack_block_limit = 2048;
+      db = url_db_open_file(name, pack_name, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0);
+      fill(0, n / 2);
+      url_db_close(db);
+      url_db_pack(name, pack_name);
+      db = url_db_open_file(name, pack_name, O_RDWR | O_APPEND, 0);
+      fill(n / 2, n);
+      url_db_close(db);
+      db = url_db_open_file(name, pack_name, O_RDONLY, 0);
+      verify();
       url_db_close(db);
+      if (unlink(pack_name))
+	die("unlink: %m");
     }
   else
     die("Unknown test case");
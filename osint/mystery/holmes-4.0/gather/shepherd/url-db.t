@@ -4,3 +4,4 @@ Run:	../obj/gather/shepherd/url-db-t empty
 
 Run:	../obj/gather/shepherd/url-db-t random
 
+Run:	../obj/gather/shepherd/url-db-t packed
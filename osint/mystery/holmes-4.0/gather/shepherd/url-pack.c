@@ -0,0 +1,499 @@
+/*
+ *	Sherlock Shepherd Daemon -- Packed URL Database
+ *
+ *	The packed database holds the bulk of URL records in front-coded
+ *	blocks ordered by OIDs, so that a lookup costs a binary search in
+ *	the in-memory block index and a single read. Records are moved there
+ *	from the append-only URL database by url_db_pack().
+ */
+
+#undef LOCAL_DEBUG
+
+#include "sherlock/sherlock.h"
+#include "ucw/lfs.h"
+#include "ucw/fastbuf.h"
+#include "ucw/unicode.h"
+#include "ucw/lizard.h"
+#include "ucw/bbuf.h"
+#include "gather/shepherd/shepherd.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+/* See doc/file-formats for the format of the database. */
+
+uns url_pack_block_limit = 32 * 1024;
+
+struct url_pack_hdr {
+  u32 magic;			/* URL_PACK_MAGIC */
+  u32 version;			/* URL_PACK_VERSION */
+  ucw_time_t time;		/* Creation time */
+  u32 count;			/* number of records */
+  u32 idx_count;		/* number of blocks */
+  u32 last_oid;			/* OID of the last record */
+  u64 idx_pos;			/* offset of the index (array of struct url_pack_idx) */
+};
+
+struct url_pack_idx {
+  u32 first_oid;		/* OID of the first record in the block */
+  u32 count;			/* number of records in the block */
+  u32 size;			/* size of the stored block in bytes */
+  u32 buf_size;			/* size of the front-coded records (equal to size if not compressed) */
+  u64 pos;			/* offset of the block */
+};
+
+/* The layout is described in doc/file-formats */
+COMPILE_ASSERT(URL_PACK_HDR_TEST, sizeof(struct url_pack_hdr) == 32);
+COMPILE_ASSERT(URL_PACK_IDX_TEST, sizeof(struct url_pack_idx) == 24);
+
+#define URL_PACK_NEW_SITE 1	/* Record flag: site footprint follows */
+
+/*** Reading ***/
+
+struct url_pack_ref {
+  u32 oid;
+  u32 pos;			/* offset of the decoded record */
+};
+
+struct url_pack {
+  int fd;
+  byte *file_name;
+  struct url_pack_hdr hdr;
+  struct url_pack_idx *idx;
+  struct lizard_buffer *lizard;
+  bb_t buf;			/* stored block */
+  bb_t recs;			/* decoded records of the current block */
+  struct url_pack_ref *refs;	/* the same records sorted by OIDs */
+  uns refs_size;
+  uns block;			/* current block or ~0U */
+  uns pos;			/* current position in refs[] or ~0U after rewind */
+};
+
+#define ASORT_PREFIX(x) url_pack_refs_##x
+#define ASORT_KEY_TYPE struct url_pack_ref
+#define ASORT_LT(x,y) ((x).oid < (y).oid)
+#include "ucw/sorter/array-simple.h"
+
+static void NONRET
+url_pack_corrupted(struct url_pack *p, uns index)
+{
+  die("Packed URL database %s: Corrupted block %u", p->file_name, index);
+}
+
+static void
+url_pack_read_block(struct url_pack *p, uns index)
+{
+  ASSERT(index < p->hdr.idx_count);
+  p->pos = 0;
+  if (index == p->block)
+    return;
+  p->block = ~0U;
+
+  struct url_pack_idx *idx = p->idx + index;
+  bb_grow(&p->buf, idx->size);
+  if (ucw_pread(p->fd, p->buf.ptr, idx->size, idx->pos) != (int)idx->size)
+    die("Packed URL database %s: short read", p->file_name);
+  byte *data = p->buf.ptr, *end;
+  if (idx->size != idx->buf_size && !(data = lizard_decompress_safe(p->buf.ptr, p->lizard, idx->buf_size)))
+    die("Packed URL database %s: Cannot decompress block %u", p->file_name, index);
+  end = data + idx->buf_size;
+
+  if (p->refs_size < idx->count)
+    {
+      p->refs_size = idx->count;
+      p->refs = xrealloc(p->refs, p->refs_size * sizeof(struct url_pack_ref));
+    }
+  struct site_fp site = { { 0, 0 } };
+  uns size = 0, last = 0;
+  for (uns i = 0; i < idx->count; i++)
+    {
+      if (data >= end)
+	url_pack_corrupted(p, index);
+      if (*data++ & URL_PACK_NEW_SITE)
+        {
+	  memcpy(&site, data, sizeof(site));
+	  data += sizeof(site);
+	}
+      else if (!i)
+	url_pack_corrupted(p, index);
+      bb_grow(&p->recs, size + sizeof(struct url_record) + MAX_URL_SIZE + 4);
+      struct url_record *rec = (void *)(p->recs.ptr + size), *prev = (void *)(p->recs.ptr + last);
+      rec->zero = rec->flags = 0;
+      rec->fp.site = site;
+      memcpy(&rec->fp.rest, data, sizeof(rec->fp.rest));
+      data += sizeof(rec->fp.rest);
+      uns delta, prefix, suffix;
+      data = utf8_32_get(data, &delta);
+      data = utf8_32_get(data, &prefix);
+      data = utf8_32_get(data, &suffix);
+      if ((i ? prefix > prev->len : prefix) || prefix + suffix >= MAX_URL_SIZE || data + suffix > end)
+	url_pack_corrupted(p, index);
+      memmove(rec->url, prev->url, prefix);
+      memcpy(rec->url + prefix, data, suffix);
+      data += suffix;
+      rec->len = prefix + suffix;
+      rec->url[rec->len] = 0;
+      rec->oid = idx->first_oid + delta;
+      p->refs[i].oid = rec->oid;
+      p->refs[i].pos = last = size;
+      size += sizeof(*rec) + ALIGN_TO(rec->len + 1, 4);
+    }
+  if (data != end)
+    url_pack_corrupted(p, index);
+  url_pack_refs_sort(p->refs, idx->count);
+  p->block = index;
+  DBG("Decoded block %u with %u records", index, idx->count);
+}
+
+static inline struct url_record *
+url_pack_record(struct url_pack *p)
+{
+  return (void *)(p->recs.ptr + p->refs[p->pos].pos);
+}
+
+struct url_record *
+url_pack_find_first(struct url_pack *p)
+{
+  if (!p->hdr.count)
+    return NULL;
+  url_pack_read_block(p, 0);
+  return url_pack_record(p);
+}
+
+struct url_record *
+url_pack_find_next(struct url_pack *p)
+{
+  if (p->block == ~0U || p->pos == ~0U)
+    return url_pack_find_first(p);
+  if (p->pos + 1 < p->idx[p->block].count)
+    p->pos++;
+  else if (p->block + 1 < p->hdr.idx_count)
+    url_pack_read_block(p, p->block + 1);
+  else
+    {
+      p->pos = p->idx[p->block].count;
+      return NULL;
+    }
+  return url_pack_record(p);
+}
+
+struct url_record *
+url_pack_find_last(struct url_pack *p)
+{
+  if (!p->hdr.count)
+    return NULL;
+  url_pack_read_block(p, p->hdr.idx_count - 1);
+  p->pos = p->idx[p->block].count - 1;
+  return url_pack_record(p);
+}
+
+/* Find the first record with OID not lower than <key> in the current block, starting at refs[l] */
+static struct url_record *
+url_pack_find_in_block(struct url_pack *p, uns l, uns key, uns *gt)
+{
+  uns r = p->idx[p->block].count;
+  while (l < r)
+    {
+      uns m = (l + r) / 2;
+      if (p->refs[m].oid < key)
+	l = m + 1;
+      else
+	r = m;
+    }
+  p->pos = l;
+  if (l == p->idx[p->block].count)
+    return NULL;
+  *gt = p->refs[l].oid > key;
+  return url_pack_record(p);
+}
+
+/* Search blocks [l, r) for the first record with OID not lower than <key> */
+static struct url_record *
+url_pack_find_interval(struct url_pack *p, uns l, uns r, uns key, uns *gt)
+{
+  ASSERT(l < r);
+  while (l + 1 < r)
+    {
+      uns m = (l + r) / 2;
+      if (p->idx[m].first_oid <= key)
+	l = m;
+      else
+	r = m;
+    }
+  url_pack_read_block(p, l);
+  struct url_record *rec = url_pack_find_in_block(p, 0, key, gt);
+  if (!rec && l + 1 < p->hdr.idx_count)
+    {
+      /* All records of the block are lower, the next block starts with a greater one */
+      url_pack_read_block(p, l + 1);
+      *gt = 1;
+      rec = url_pack_record(p);
+    }
+  return rec;
+}
+
+struct url_record *
+url_pack_find(struct url_pack *p, uns key, uns *gt)
+{
+  *gt = -1;
+  if (!p->hdr.count)
+    return NULL;
+  return url_pack_find_interval(p, 0, p->hdr.idx_count, key, gt);
+}
+
+struct url_record *
+url_pack_find_forward(struct url_pack *p, uns key, uns *gt)
+{
+  if (p->block == ~0U || p->pos == ~0U)
+    return url_pack_find(p, key, gt);
+  *gt = -1;
+  struct url_pack_idx *idx = p->idx + p->block;
+  if (p->pos < idx->count && p->refs[idx->count - 1].oid >= key)
+    return url_pack_find_in_block(p, p->pos, key, gt);
+  if (p->block + 1 < p->hdr.idx_count)
+    return url_pack_find_interval(p, p->block + 1, p->hdr.idx_count, key, gt);
+  p->pos = idx->count;
+  return NULL;
+}
+
+void
+url_pack_rewind(struct url_pack *p)
+{
+  /* Keep the decoded block, it is likely to be needed again */
+  p->pos = ~0U;
+}
+
+uns
+url_pack_covers(struct url_pack *p, oid_t oid)
+{
+  return p->hdr.count && oid <= p->hdr.last_oid;
+}
+
+struct url_pack *
+url_pack_open(byte *file_name, uns open_try)
+{
+  if (!file_name || !*file_name)
+    if (open_try)
+      return NULL;
+    else
+      die("Undefined path to packed URL database");
+  int fd = ucw_open(file_name, O_RDONLY);
+  if (fd < 0)
+    if (open_try && errno == ENOENT)
+      return NULL;
+    else
+      die("Packed URL database %s: open: %m", file_name);
+
+  struct url_pack *p = xmalloc_zero(sizeof(*p));
+  p->fd = fd;
+  p->file_name = file_name;
+  if (ucw_pread(fd, &p->hdr, sizeof(p->hdr), 0) != sizeof(p->hdr))
+    die("Packed URL database %s: short read", file_name);
+  if (p->hdr.magic != URL_PACK_MAGIC)
+    die("Packed URL database %s: Invalid format of header", file_name);
+  if (p->hdr.version != URL_PACK_VERSION)
+    die("Packed URL database %s: Invalid version", file_name);
+  ASSERT((u64)p->hdr.idx_count * sizeof(struct url_pack_idx) < ~0U);
+  uns idx_size = p->hdr.idx_count * sizeof(struct url_pack_idx);
+  p->idx = xmalloc(idx_size);
+  if (ucw_pread(fd, p->idx, idx_size, p->hdr.idx_pos) != (int)idx_size)
+    die("Packed URL database %s: short read", file_name);
+  p->lizard = lizard_alloc();
+  bb_init(&p->buf);
+  bb_init(&p->recs);
+  p->block = ~0U;
+  DBG("Opened packed URL database %s with %u records in %u blocks", file_name, p->hdr.count, p->hdr.idx_count);
+  return p;
+}
+
+void
+url_pack_close(struct url_pack *p)
+{
+  close(p->fd);
+  lizard_free(p->lizard);
+  bb_done(&p->buf);
+  bb_done(&p->recs);
+  xfree(p->refs);
+  xfree(p->idx);
+  xfree(p);
+}
+
+/*** Writing ***/
+
+struct url_pack_writer {
+  struct fastbuf *fb;
+  struct url_pack_hdr hdr;
+  bb_t recs;			/* records of the current block */
+  uns recs_size;
+  bb_t refs;			/* their offsets (u32) */
+  uns count;			/* number of records in the current block */
+  oid_t first_oid;
+  bb_t buf;
+  bb_t lizard;
+  bb_t idx;
+  uns idx_size;
+};
+
+static int
+url_pack_cmp(struct url_record *a, struct url_record *b)
+{
+  int cmp = site_fp_cmp(&a->fp.site, &b->fp.site);
+  if (cmp)
+    return cmp;
+  return strcmp(a->url, b->url);
+}
+
+#define ASORT_PREFIX(x) url_pack_entries_##x
+#define ASORT_KEY_TYPE u32
+#define ASORT_LT(x,y) (url_pack_cmp((void *)(base + (x)), (void *)(base + (y))) < 0)
+#define ASORT_EXTRA_ARGS , byte *base
+#include "ucw/sorter/array-simple.h"
+
+struct url_pack_writer *
+url_pack_create(void)
+{
+  struct url_pack_writer *w = xmalloc_zero(sizeof(*w));
+  w->fb = bopen_tmp(65536);
+  w->hdr.magic = URL_PACK_MAGIC;
+  w->hdr.version = URL_PACK_VERSION;
+  w->hdr.time = time(NULL);
+  bwrite(w->fb, &w->hdr, sizeof(w->hdr));
+  bb_init(&w->recs);
+  bb_init(&w->refs);
+  bb_init(&w->buf);
+  bb_init(&w->lizard);
+  bb_init(&w->idx);
+  return w;
+}
+
+static void
+url_pack_flush(struct url_pack_writer *w)
+{
+  if (!w->count)
+    return;
+
+  /* Group the records by sites and front-code their URLs */
+  byte *base = w->recs.ptr;
+  u32 *refs = (u32 *)w->refs.ptr;
+  url_pack_entries_sort(refs, w->count, base);
+  bb_grow(&w->buf, w->recs_size + w->count * (1 + sizeof(struct site_fp) + 3*6) + LIZARD_NEEDS_CHARS);
+  byte *p = w->buf.ptr;
+  struct url_record *prev = NULL;
+  for (uns i = 0; i < w->count; i++)
+    {
+      struct url_record *rec = (void *)(base + refs[i]);
+      uns prefix = 0;
+      if (prev)
+	while (prefix < rec->len && prefix < prev->len && rec->url[prefix] == prev->url[prefix])
+	  prefix++;
+      if (!prev || site_fp_cmp(&prev->fp.site, &rec->fp.site))
+        {
+	  *p++ = URL_PACK_NEW_SITE;
+	  memcpy(p, &rec->fp.site, sizeof(rec->fp.site));
+	  p += sizeof(rec->fp.site);
+	}
+      else
+	*p++ = 0;
+      memcpy(p, &rec->fp.rest, sizeof(rec->fp.rest));
+      p += sizeof(rec->fp.rest);
+      p = utf8_32_put(p, rec->oid - w->first_oid);
+      p = utf8_32_put(p, prefix);
+      p = utf8_32_put(p, rec->len - prefix);
+      memcpy(p, rec->url + prefix, rec->len - prefix);
+      p += rec->len - prefix;
+      prev = rec;
+    }
+
+  struct url_pack_idx idx;
+  idx.first_oid = w->first_oid;
+  idx.count = w->count;
+  idx.buf_size = idx.size = p - w->buf.ptr;
+  idx.pos = btell(w->fb);
+  byte *data = w->buf.ptr;
+  if (url_pack_compress)
+    {
+      bb_grow(&w->lizard, LIZARD_MAX_LEN(idx.buf_size));
+      uns size = lizard_compress(w->buf.ptr, idx.buf_size, w->lizard.ptr);
+      if (size < idx.buf_size)
+        {
+	  idx.size = size;
+	  data = w->lizard.ptr;
+	}
+    }
+  bwrite(w->fb, data, idx.size);
+  bb_grow(&w->idx, w->idx_size + sizeof(idx));
+  memcpy(w->idx.ptr + w->idx_size, &idx, sizeof(idx));
+  w->idx_size += sizeof(idx);
+  DBG("Flushed block of %u records (%u -> %u -> %u bytes)", w->count, w->recs_size, idx.buf_size, idx.size);
+
+  w->count = 0;
+  w->recs_size = 0;
+}
+
+void
+url_pack_write(struct url_pack_writer *w, struct url_record *rec)
+{
+  ASSERT(!w->hdr.count || rec->oid > w->hdr.last_oid);
+  if (!w->count)
+    w->first_oid = rec->oid;
+  uns size = sizeof(*rec) + ALIGN_TO(rec->len + 1, 4);
+  bb_grow(&w->recs, w->recs_size + size);
+  struct url_record *r = (void *)(w->recs.ptr + w->recs_size);
+  memcpy(r, rec, sizeof(*rec) + rec->len);
+  r->url[r->len] = 0;
+  bb_grow(&w->refs, (w->count + 1) * sizeof(u32));
+  ((u32 *)w->refs.ptr)[w->count++] = w->recs_size;
+  w->recs_size += size;
+  w->hdr.last_oid = rec->oid;
+  w->hdr.count++;
+  if (w->recs_size >= url_pack_block_limit)
+    url_pack_flush(w);
+}
+
+struct fastbuf *
+url_pack_finish(struct url_pack_writer *w)
+{
+  url_pack_flush(w);
+  w->hdr.idx_count = w->idx_size / sizeof(struct url_pack_idx);
+  w->hdr.idx_pos = btell(w->fb);
+  bwrite(w->fb, w->idx.ptr, w->idx_size);
+  brewind(w->fb);
+  bwrite(w->fb, &w->hdr, sizeof(w->hdr));
+
+  bb_done(&w->recs);
+  bb_done(&w->refs);
+  bb_done(&w->buf);
+  bb_done(&w->lizard);
+  bb_done(&w->idx);
+  struct fastbuf *fb = w->fb;
+  xfree(w);
+  return fb;
+}
+
+/*** Conversion ***/
+
+void
+url_db_pack(byte *file_name, byte *pack_name)
+{
+  ASSERT(pack_name && *pack_name);
+  struct url_db *db = url_db_open_file(file_name, pack_name, O_RDONLY, 0);
+  struct url_pack_writer *w = url_pack_create();
+  uns count = 0;
+  for (struct url_record *r = url_db_find_first(db); r; r = url_db_find_next(db))
+    {
+      url_pack_write(w, r);
+      count++;
+    }
+  url_db_close(db);
+  struct fastbuf *fb = url_pack_finish(w);
+  log(L_INFO, "Packed %u URL records to %lld bytes", count, (long long)bfilesize(fb));
+  bfix_tmp_file(fb, pack_name);
+
+  /* Restart the log. Records already covered by the packed file are ignored,
+   * so a crash before this point loses nothing. The new creation time
+   * invalidates incremental sorting and mirroring. */
+  url_db_close(url_db_open_file(file_name, NULL, O_CREAT | O_TRUNC | O_WRONLY, 0));
+}
@@ -63,4 +63,50 @@ bget_graph_hdr(struct fastbuf *fb, u32 *node, u32 *deg)
   return 1;
 }
 
+/*
+ *  Compressed adjacency lists (the "-csr" file written by mkgraph when GraphCSR is set).
+ *  For each vertex in the virtual order, there is a row of varints: the real
+ *  vertex number, the in-degree, the first neighbour and differences between
+ *  consecutive neighbours (which are sorted, so the differences are small).
+ *  Vertices without incoming links have empty rows.  The rows are padded to
+ *  a multiple of 8 bytes and followed by an array of (vertices+1) u64 offsets
+ *  of the rows and by struct graph_csr_trailer.  Native byte order is used.
+ */
+
+#define GRAPH_CSR_MAGIC 0x47637372
+
+struct graph_csr_trailer {
+  u64 offsets;				/* position of the array of offsets */
+  u32 vertices;
+  u32 magic;
+};
+
+#define GRAPH_VARINT_MAX 5
+
+static inline byte *
+graph_put_varint(byte *p, u32 x)
+{
+  while (x >= 0x80)
+  {
+    *p++ = x | 0x80;
+    x >>= 7;
+  }
+  *p++ = x;
+  return p;
+}
+
+static inline byte *
+graph_get_varint(byte *p, u32 *x)
+{
+  u32 v = 0;
+  uns shift = 0;
+  while (*p & 0x80)
+  {
+    v |= (u32)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  *x = v | ((u32)*p++ << shift);
+  return p;
+}
+
 #endif
@@ -77,10 +77,12 @@ uns matcher_min_words = 0;
 uns matcher_threshold = 0;
 uns matcher_passes = 3;
 uns matcher_block = 64;
+uns matcher_bands = 0;
 uns max_num_objects = ~0;
 uns min_summed_size = 0;
 uns frameset_to_redir;
 uns default_weight = 128;
+uns graph_csr;
 uns raw_stage2_input;
 uns ic_connect_timeout;
 uns ic_reply_timeout;
@@ -159,6 +161,8 @@ matcher_commit(void *ptr UNUSED)
 {
   if (matcher_signatures % 2)
     return "Matcher.Signatures must be even";
+  if (matcher_bands > matcher_signatures)
+    return "Matcher.Bands must not exceed Matcher.Signatures";
   return NULL;
 }
 
@@ -234,6 +238,7 @@ static struct cf_section iconfig = {
     CF_UNS("ProgressScreen", &progress_screen),
     CF_UNS("ProgressStatusLine", &progress_status_line),
     CF_UNS("SortDeleteSrc", &sort_delete_src),
+    CF_UNS("GraphCSR", &graph_csr),
     CF_UNS("RefMaxLength", &ref_max_length),
     CF_UNS("RefMinLength", &ref_min_length),
     CF_UNS("RefMaxCount", &ref_max_count),
@@ -260,6 +265,7 @@ static struct cf_section matcher_config = {
     CF_UNS("Threshold", &matcher_threshold),
     CF_UNS("Passes", &matcher_passes),
     CF_UNS("Block", &matcher_block),
+    CF_UNS("Bands", &matcher_bands),
     CF_END
   }
 };
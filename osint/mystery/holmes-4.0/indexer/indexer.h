@@ -36,6 +36,7 @@ int index_name_defined(const char *file);
 #define FN_GRAPH_REAL "-real"
 #define FN_GRAPH_GOES "-goes"
 #define FN_GRAPH_DEG "-deg"
+#define FN_GRAPH_CSR "-csr"
 
 /* Sources */
 extern clist indexer_sources;
@@ -47,12 +48,13 @@ extern struct fb_params indexer_fb_params, indexer_stream_params;
 extern uns string_avg_bucket, indexer_fb_size, sort_delete_src;
 extern uns progress, progress_screen, progress_status_line;
 extern uns ref_max_length, ref_min_length, ref_max_count;
-extern uns matcher_signatures, matcher_context, matcher_min_words, matcher_threshold, matcher_passes, matcher_block;
+extern uns matcher_signatures, matcher_context, matcher_min_words, matcher_threshold, matcher_passes, matcher_block, matcher_bands;
 extern uns max_num_objects, min_summed_size, frameset_to_redir, num_slices;
 extern uns raw_stage2_input;
 extern uns indexer_trace;
 extern uns indexer_threads, indexer_thread_stack_size;
 extern uns default_weight;
+extern uns graph_csr;
 extern uns reject_empty;
 
 /* Filters */
@@ -205,7 +205,7 @@ if [ -n "$CLEAN" ]; then
 	deleteall 2 graph-intra-[0-9]*
 	delete 3 labels-by-id labels
 	delete 4 merges fingerprints fp-splits checksums signatures keywords url-list
-	delete 4 graph-obj graph-obj-index graph-obj-deg graph-obj-real graph-obj-goes
+	delete 4 graph-obj graph-obj-index graph-obj-csr graph-obj-deg graph-obj-real graph-obj-goes
 	delete 4 graph-skel graph-skel-index
 	delete 4 attributes notes notes-skel
 	delete 4 rank-obj rank-skel
@@ -329,7 +329,7 @@ if [ -z "$STAGE2ONLY" ] ; then
 	delete 3 labels-by-id
 	delete 4 attributes notes notes-skel
 	delete 4 merges fingerprints fp-splits checksums keywords url-list
-	delete 4 graph-obj graph-obj-index graph-obj-deg graph-obj-real graph-obj-goes
+	delete 4 graph-obj graph-obj-index graph-obj-csr graph-obj-deg graph-obj-real graph-obj-goes
 	delete 4 graph-skel graph-skel-index
 	[ "$DELETE" -le 2 ] || stats "after cleanup"
 	[ -z "$STAGE1ONLY" ] || exit 0
@@ -21,6 +21,7 @@
 
 #include "ucw/mempool.h"
 #include "ucw/prime.h"
+#include "charset/unifold.h"
 
 typedef struct verbum {
   struct verbum *next;
@@ -134,19 +135,14 @@ lh_init_word(struct verbum *v UNUSED)
 {
 #if defined(LH_MKLEX) || defined(LH_LEXORDER)
   struct verbum *ex;
-  byte ww[MAX_WORD_BYTES+4], *w, *t;
-  uns u, l, h, i, chars=0;
+  byte ww[MAX_WORD_BYTES+4], *w;
+  uns l, h, i, chars;
 
   /* Create normalized version of the word */
-  t = v->word;
-  w = ww;
-  while (*t)
-    {
-      t = utf8_get(t, &u);
-      u = Uunaccent(u);
-      w = utf8_put(w, u);
-      chars++;
-    }
+  l = strlen(v->word);
+  w = ufold_utf8(ww, ww + MAX_WORD_BYTES, v->word, v->word + l, UFOLD_UNACCENT);
+  ASSERT(w);
+  chars = utf8_strlen(v->word);
   PUT_U32(w, 0);
   l = (w-ww+4)/4;
 
@@ -209,15 +205,8 @@ static inline struct verbum *
 lh_lookup(u16 *uni, uns ulen)
 {
   byte ww[MAX_WORD_BYTES+4], *w;
-  uns u;
 
-  w = ww;
-  while (ulen--)
-    {
-      u = *uni++;
-      u = Utolower(u);
-      w = utf8_put(w, u);
-    }
+  w = ufold_uni(ww, uni, ulen, UFOLD_LOWER);
   return lh_lookup_raw(ww, w);
 }
 
@@ -225,17 +214,9 @@ static inline struct verbum *
 lh_lookup_utf8(byte *c)
 {
   byte ww[MAX_WORD_BYTES+4], *w;
-  uns u;
 
-  w = ww;
-  for(;;)
-    {
-      c = utf8_get(c, &u);
-      if (!u)
-	break;
-      u = Utolower(u);
-      w = utf8_put(w, u);
-    }
+  w = ufold_utf8(ww, ww + MAX_WORD_BYTES, c, c + strlen(c), UFOLD_LOWER);
+  ASSERT(w);
   return lh_lookup_raw(ww, w);
 }
 
@@ -243,19 +224,14 @@ lh_lookup_utf8(byte *c)
 static struct verbum *
 lh_insert(byte *c, uns noacc)
 {
-  byte ww[MAX_WORD_BYTES+1];
+  byte ww[MAX_WORD_BYTES+4];
   u32 *ww32 = (u32*)ww;
-  byte *w = ww;
-  uns u, l, h;
+  byte *w;
+  uns l, h;
   struct verbum *v;
-  while (*c)
-    {
-      c = utf8_get(c, &u);
-      u = Utolower(u);
-      if (noacc)
-	u = Uunaccent(u);
-      w = utf8_put(w, u);
-    }
+  w = ufold_utf8(ww, ww + MAX_WORD_BYTES, c, c + strlen(c), noacc ? UFOLD_LOWER_UNACCENT : UFOLD_LOWER);
+  if (!w)
+    die("Word <%s> is too long", c);
   PUT_U32(w, 0);
   l = (w-ww+4)/4;
   h = lh_hash(ww32, l);
@@ -5,9 +5,11 @@
  */
 
 #include "sherlock/sherlock.h"
+#include "ucw/lfs.h"
 #include "ucw/getopt.h"
 #include "ucw/fastbuf.h"
 #include "ucw/ff-binary.h"
+#include "ucw/hashfunc.h"
 #include "sherlock/object.h"
 #include "ucw/bitarray.h"
 #include "indexer/indexer.h"
@@ -16,8 +18,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <time.h>
 #include <alloca.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MAX_SIGNATURES	128
 #define	COMPARED	8
@@ -115,14 +121,12 @@ find_random_key(uns *forbidden_keys, uns count)
 static inline int
 similar_documents(struct signature *a, struct signature *b)
 {
+	/* No early exit, so that the compiler can vectorize the loop */
 	uns distinct = 0, i;
 	for (i=0; i<matcher_signatures; i++)
-		if (a->sign[i] != b->sign[i])
-		{
-			if (distinct >= distinct_limit)
-				return 0;
-			distinct++;
-		}
+		distinct += (a->sign[i] != b->sign[i]);
+	if (distinct > distinct_limit)
+		return 0;
 	if (matches)
 	{
 		char tmp[128];
@@ -213,11 +217,6 @@ find_similarities(void)
 	srand(time(NULL));
 	if (matcher_signatures < 2*COMPARED)
 		die("Too small value Matcher.Signatures = %d, minimal value is %d", matcher_signatures, 2*COMPARED);
-	if (matcher_signatures > MAX_SIGNATURES)
-		die("Too large value Matcher.Signatures = %d, maximal value is %d", matcher_signatures, MAX_SIGNATURES);
-	distinct_limit = matcher_signatures - matcher_threshold;
-	sign_size = matcher_signatures * sizeof(u32);
-	record_size = sizeof(u32) + sign_size;
 	key_size = OFFSETOF(struct sign_key, sign) + sign_size;
 
 	for (i=0; i<matcher_passes; i++)
@@ -237,6 +236,174 @@ find_similarities(void)
 	}
 }
 
+/*** Locality-sensitive hashing with bands.  ***/
+
+/*
+ * The signatures are split to Matcher.Bands bands of band_rows consecutive
+ * hashes.  Two documents share a bucket of a band if all hashes of the band are
+ * equal, which happens with probability s^band_rows for documents with
+ * a fraction s of equal hashes, so such documents share at least one bucket
+ * with probability 1-(1-s^band_rows)^bands.  The buckets of all bands are
+ * formed by a single sort of (band, hash of the band) pairs and the documents
+ * inside each bucket are verified by comparing their whole signatures, which
+ * are accessed in the memory-mapped signature file.
+ */
+
+struct band_key
+{
+	u64 bucket;		/* band number in the top half, hash of the band in the bottom one */
+	u32 pos;		/* position of the signature in the signature file */
+	u32 cardid;
+};
+
+#define SORT_PREFIX(x) band_##x
+#define SORT_KEY_REGULAR struct band_key
+#define SORT_INT64(k) ((k).bucket)
+#define SORT_INPUT_FB
+#define SORT_OUTPUT_FB
+#include "ucw/sorter/sorter.h"
+
+static uns band_rows;
+static byte *sign_map;
+static ucw_off_t sign_map_size;
+
+static inline struct signature *
+band_signature(uns pos)
+{
+	return (struct signature *) (sign_map + (ucw_off_t) pos * record_size);
+}
+
+static void
+band_map_signatures(void)
+{
+	char *name = index_name(fn_signatures);
+	int fd = ucw_open(name, O_RDONLY);
+	if (fd < 0)
+		die("Cannot open %s: %m", name);
+	ucw_stat_t st;
+	if (ucw_fstat(fd, &st) < 0)
+		die("Cannot stat %s: %m", name);
+	sign_map_size = st.st_size;
+	if (sign_map_size % record_size)
+		die("%s does not consist of signatures of %d hashes", name, matcher_signatures);
+	if (!sign_map_size)
+		sign_map = NULL;
+	else if ((sign_map = ucw_mmap(NULL, sign_map_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		die("Cannot mmap %s: %m", name);
+	close(fd);
+}
+
+static inline uns
+band_sign_hash(u32 *rows)
+{
+	/* Hashed by words, hash_block() could read past the end of the mapped file */
+	uns h = 0;
+	for (uns i=0; i<band_rows; i++)
+		h = hash_u32(h + rows[i]) ^ (h >> 16);
+	return h;
+}
+
+static struct fastbuf *
+band_buckets(void)
+{
+	struct fastbuf *buckets = index_bopen_tmp(1);
+	uns num = sign_map_size / record_size;
+	for (uns pos=0; pos<num; pos++)
+	{
+		struct signature *s = band_signature(pos);
+		if (bit_array_isset(untouchable, s->cardid) || (int)merges[s->cardid] >= 0)
+		{
+			/* Untouchable or already marked as a duplicate.  */
+			skipped++;
+			continue;
+		}
+		struct band_key k = { .pos = pos, .cardid = s->cardid };
+		for (uns b=0; b<matcher_bands; b++)
+		{
+			uns h = band_sign_hash(&s->sign[b * band_rows]);
+#ifdef	CONFIG_AREAS
+			h ^= hash_u32(card_areas[s->cardid]);
+#endif
+			k.bucket = ((u64) b << 32) | h;
+			bwrite(buckets, &k, sizeof(k));
+		}
+	}
+	brewind(buckets);
+	return buckets;
+}
+
+/*
+ * Each document is compared with the last Matcher.Block documents of the same
+ * bucket at most, so huge buckets (e.g., of almost empty documents) do not
+ * make the time quadratic.  Pairs which are already known to be equivalent
+ * are not compared again in the other bands.
+ */
+static void
+band_process(struct fastbuf *sorted)
+{
+	struct band_key *last = alloca(matcher_block * sizeof(struct band_key));
+	struct band_key k;
+	u64 bucket = 0;
+	uns n = 0;
+
+	while (breadb(sorted, &k, sizeof(k)))
+	{
+		if (k.bucket != bucket)
+		{
+			bucket = k.bucket;
+			n = 0;
+		}
+		uns root = merges_find_root(k.cardid);
+		for (uns j=n; j-- > 0 && j + matcher_block >= n; )
+		{
+			struct band_key *o = &last[j % matcher_block];
+			if (merges_find_root(o->cardid) == root)
+				break;
+#ifdef	CONFIG_AREAS
+			if (card_areas[o->cardid] != card_areas[k.cardid])
+				continue;
+#endif
+			if (similar_documents(band_signature(o->pos), band_signature(k.pos)))
+			{
+				similar++;
+				merges_union(o->cardid, k.cardid);
+				break;
+			}
+		}
+		last[n++ % matcher_block] = k;
+	}
+}
+
+static void
+find_similarities_banded(void)
+{
+	if (matcher_bands > matcher_signatures)
+		die("Too large value Matcher.Bands = %d, maximal value is Matcher.Signatures = %d", matcher_bands, matcher_signatures);
+	band_rows = matcher_signatures / matcher_bands;
+
+	/* Probability that documents with Threshold equal hashes are detected */
+	double p = 1, q = 1;
+	for (uns i=0; i<band_rows; i++)
+		p *= (double) matcher_threshold / matcher_signatures;
+	for (uns i=0; i<matcher_bands; i++)
+		q *= 1 - p;
+	log(L_INFO, "Using %d bands of %d hashes, recall at the threshold is %.4f", matcher_bands, band_rows, 1 - q);
+
+	band_map_signatures();
+	skipped = 0;
+	struct fastbuf *buckets = band_buckets();
+	buckets = band_sort(buckets, NULL, ((u64) matcher_bands << 32) - 1);
+	log(L_INFO, "Sorted buckets of signature bands, skipped %d documents", skipped);
+
+	similar = 0;
+	band_process(buckets);
+	bclose(buckets);
+	if (sign_map)
+		munmap(sign_map, sign_map_size);
+	if (similar)
+		log(L_INFO, "Found %d similar documents", similar);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -276,7 +443,15 @@ main(int argc, char **argv)
 	else
 		matches = NULL;
 
-	find_similarities();
+	if (matcher_signatures > MAX_SIGNATURES)
+		die("Too large value Matcher.Signatures = %d, maximal value is %d", matcher_signatures, MAX_SIGNATURES);
+	distinct_limit = matcher_signatures - matcher_threshold;
+	sign_size = matcher_signatures * sizeof(u32);
+	record_size = sizeof(u32) + sign_size;
+	if (matcher_bands)
+		find_similarities_banded();
+	else
+		find_similarities();
 
 	big_free(untouchable, BIT_ARRAY_BYTES(card_count));
 	merges_unmap();
@@ -8,11 +8,13 @@
 #include "sherlock/sherlock.h"
 #include "ucw/lfs.h"
 #include "ucw/bitarray.h"
+#include "ucw/bitops.h"
 #include "ucw/conf.h"
 #include "ucw/getopt.h"
 #include "ucw/fastbuf.h"
 #include "ucw/ff-binary.h"
 #include "ucw/stkstring.h"
+#include "ucw/bbuf.h"
 #include "indexer/indexer.h"
 #include "indexer/graph.h"
 
@@ -291,9 +293,16 @@ merge_vertices(struct fastbuf *in, struct fastbuf **out_obj, struct fastbuf **ou
 
 /* Presorting */
 
+/*
+ *  Both presorters have monotone hashes, so the array sorter can use radix-sorting
+ *  and also split the work between the sorter's threads (see Sorter.Threads).
+ */
+
 #define ASORT_PREFIX(x) dest_##x
 #define ASORT_KEY_TYPE struct resolve_output
 #define ASORT_LT(x,y) (x.dest < y.dest || x.dest == y.dest && x.src < y.src)
+#define ASORT_HASH(x) ((u64) x.dest << 32 | x.src)
+#define ASORT_LONG_HASH
 #include "ucw/sorter/array.h"
 
 static u32 *goes_to;
@@ -301,26 +310,30 @@ static u32 *goes_to;
 #define ASORT_PREFIX(x) goes_dest_##x
 #define ASORT_KEY_TYPE struct resolve_output
 #define ASORT_LT(x,y) (goes_to[x.dest] < goes_to[y.dest] || x.dest == y.dest && x.src < y.src)
+#define ASORT_HASH(x) ((u64) goes_to[x.dest] << 32 | x.src)
+#define ASORT_LONG_HASH
 #include "ucw/sorter/array.h"
 
 static struct fastbuf *presort_in;
+static uns presort_vertices;			// upper bound on (translated) destinations
 
 static int
 link_presort(struct fastbuf *dest, void *buf_ptr, size_t buf_size)
 {
   uns record = sizeof(struct resolve_output);
   struct resolve_output *buf = buf_ptr;
-  ASSERT(buf_size >= record);
-  uns len = bread(presort_in, buf, MIN(~0U, buf_size) / record * record);
+  ASSERT(buf_size >= 2*record);
+  size_t half = buf_size / 2 / record * record;	// the other half is used by radix-sorting
+  uns len = bread(presort_in, buf, MIN(~0U, half) / record * record);
   if (!len)
     return 0;
   ASSERT(!(len % record));
-  buf_size -= len;
   uns nr = len / record;
+  uns hash_bits = 32 + bit_fls(MAX(presort_vertices, 1)) + 1;
   if (goes_to)
-    goes_dest_sort(buf, nr);
+    buf = goes_dest_sort(buf, nr, buf_ptr + half, hash_bits);
   else
-    dest_sort(buf, nr);
+    buf = dest_sort(buf, nr, buf_ptr + half, hash_bits);
   for (uns i=0; i<nr; )
   {
     uns start = i++, count = 1;
@@ -339,18 +352,24 @@ link_presort(struct fastbuf *dest, void *buf_ptr, size_t buf_size)
 /* Sorting neighbors with unifying */
 
 #define ASORT_PREFIX(x) neighbors_##x
-#define ASORT_KEY_TYPE uns
-#define ASORT_ELT(i) (array[i] /*& ~ETYPE_MASK*/)		// we don't want to unify [redir], [frame], and [img]
-#define ASORT_SWAP(i,j) do { uns e=array[j]; array[j]=array[i]; array[i]=e; } while(0)
-#define ASORT_EXTRA_ARGS , uns *array
-#include "ucw/sorter/array-simple.h"
+#define ASORT_KEY_TYPE u32
+#define ASORT_HASH(x) (x)				// we don't want to unify [redir], [frame], and [img]
+#include "ucw/sorter/array.h"
+
+#define	GBUF_TYPE	u32
+#define	GBUF_PREFIX(x)	u32b_##x
+#include "ucw/gbuf.h"
 
 static inline uns
 sort_neighbors(u32 *buf, uns len)
 {
+  static u32b_t tmp;
   if (len <= 1)
     return len;
-  neighbors_sort(len, buf);
+  u32b_grow(&tmp, len);
+  u32 *sorted = neighbors_sort(buf, len, tmp.ptr, 32);
+  if (sorted != buf)
+    memcpy(buf, sorted, len * sizeof(u32));
   uns write = 1;
   for (uns i=1; i<len; i++)
     if (buf[i] != buf[i-1])
@@ -397,10 +416,6 @@ link_write_key(struct fastbuf *fb, struct link_merge *k)
   bput_graph_hdr(fb, k->dest, k->deg);
 }
 
-#define	GBUF_TYPE	u32
-#define	GBUF_PREFIX(x)	u32b_##x
-#include "ucw/gbuf.h"
-
 static void
 link_write_merged(struct fastbuf *dest, struct link_merge **keys, void **data, uns n, void *buf)
 {
@@ -448,32 +463,86 @@ append_graph_idx(struct fastbuf *graph_idx, uns node, ucw_off_t pos)
   bputo(graph_idx, pos);
 }
 
+/* Construction of the compressed graph (see graph.h for the format) */
+
+static u64 *csr_offsets;
+
+static void
+append_graph_csr(struct fastbuf *fb_csr, uns node, u32 *neigh, uns deg)
+{
+  static bb_t row;
+  ucw_off_t pos = btell(fb_csr);
+  uns v = goes_to[node];
+  while (last_index <= v)			// including empty rows of vertices without incoming links
+    csr_offsets[last_index++] = pos;
+  byte *start = bb_grow(&row, (deg + 2) * GRAPH_VARINT_MAX);
+  byte *p = graph_put_varint(start, node);
+  p = graph_put_varint(p, deg);
+  u32 last = 0;
+  for (uns i=0; i<deg; i++)
+  {
+    p = graph_put_varint(p, neigh[i] - last);
+    last = neigh[i];
+  }
+  bwrite(fb_csr, start, p - start);
+}
+
+static void
+finish_graph_csr(struct fastbuf *fb_csr, uns total_num)
+{
+  ucw_off_t pos = btell(fb_csr);
+  for (; pos % 8; pos++)
+    bputc(fb_csr, 0);
+  while (last_index <= total_num)
+    csr_offsets[last_index++] = pos;
+  bwrite(fb_csr, csr_offsets, (total_num + 1) * sizeof(u64));
+  struct graph_csr_trailer t = {
+    .offsets = pos,
+    .vertices = total_num,
+    .magic = GRAPH_CSR_MAGIC,
+  };
+  bwrite(fb_csr, &t, sizeof(t));
+}
+
 static uns total_v, max_id;
 static u64 total_e;
 
 static void
-construct_index(byte *file, uns total_num, u32 *out_degree)
+construct_index(byte *file, uns total_num, u32 *out_degree, uns csr)
 {
   struct fastbuf *graph = index_bopen(file, O_RDONLY, 1);
-  struct fastbuf *graph_idx = index_bopen(stk_strcat(file, FN_GRAPH_INDEX), O_WRONLY | O_CREAT | O_TRUNC, 1);
+  struct fastbuf *graph_idx = NULL, *fb_csr = NULL;
+  if (csr)
+  {
+    ASSERT(goes_to);
+    fb_csr = index_bopen(stk_strcat(file, FN_GRAPH_CSR), O_WRONLY | O_CREAT | O_TRUNC, 1);
+    csr_offsets = big_alloc((total_num + 1) * sizeof(u64));
+  }
+  else
+    graph_idx = index_bopen(stk_strcat(file, FN_GRAPH_INDEX), O_WRONLY | O_CREAT | O_TRUNC, 1);
   last_index = 0;
   total_v = max_id = 0;
   total_e = 0;
   //don't clear out_degree
+  static u32b_t neigh;
   u32 dest, deg;
   ucw_off_t pos = 0;
   while (bget_graph_hdr(graph, &dest, &deg))
   {
-    append_graph_idx(graph_idx, dest, pos);
+    if (graph_idx)
+      append_graph_idx(graph_idx, dest, pos);
     max_id = MAX(max_id, deg);
     total_v++;
     total_e += deg;
-    while (deg--)
+    u32b_grow(&neigh, deg);
+    for (uns i=0; i<deg; i++)
     {
-      u32 src = bgetl(graph);
+      u32 src = neigh.ptr[i] = bgetl(graph);
       if (out_degree)
 	out_degree[src & ~ETYPE_MASK]++;
     }
+    if (fb_csr)
+      append_graph_csr(fb_csr, dest, neigh.ptr, deg);
     pos = btell(graph);
   }
   if (goes_to)						// for the sake of append_graph_idx()
@@ -481,16 +550,25 @@ construct_index(byte *file, uns total_num, u32 *out_degree)
     big_free(goes_to, objects * sizeof(u32));
     goes_to = NULL;
   }
-  append_graph_idx(graph_idx, total_num, pos);
+  if (fb_csr)
+  {
+    finish_graph_csr(fb_csr, total_num);
+    big_free(csr_offsets, (total_num + 1) * sizeof(u64));
+    bclose(fb_csr);
+  }
+  else
+  {
+    append_graph_idx(graph_idx, total_num, pos);
+    bclose(graph_idx);
+  }
   bclose(graph);
-  bclose(graph_idx);
 
   uns max_od = 0;
   if (out_degree)
     for (uns i=0; i<objects; i++)
       max_od = MAX(max_od, out_degree[i]);
-  log(L_INFO, "Built index of %s, %u vertices, %llu edges, in-deg %u, out-deg %d",
-      file, total_v, (long long) total_e, max_id, max_od);
+  log(L_INFO, "Built %s of %s, %u vertices, %llu edges, in-deg %u, out-deg %d",
+      csr ? "compressed graph" : "index", file, total_v, (long long) total_e, max_id, max_od);
 }
 
 int
@@ -518,21 +596,23 @@ main(int argc, char **argv)
   merge_vertices(resolved_links, &links_obj, &links_skel);
 
   presort_in = links_skel;
+  presort_vertices = skel_objects;
   link_sort(NULL, index_name(fn_graph_skel));
   bclose(presort_in);
   log(L_INFO, "Sorted %s", fn_graph_skel);
   alloc_read_ary(fn_graph_obj, FN_GRAPH_GOES, &goes_to, objects, sizeof(u32));
   presort_in = links_obj;
+  presort_vertices = objects;
   link_sort(NULL, index_name(fn_graph_obj));
   bclose(presort_in);
   log(L_INFO, "Sorted %s", fn_graph_obj);
 
   u32 *out_degree = big_alloc_zero(sizeof(u32) * objects);
-  construct_index(fn_graph_obj, objects, out_degree);		// frees goes_to
+  construct_index(fn_graph_obj, objects, out_degree, graph_csr);		// frees goes_to
   struct fastbuf *fb_outdeg = index_bopen(stk_strcat(fn_graph_obj, FN_GRAPH_DEG), O_WRONLY | O_CREAT | O_TRUNC, 1);
   bwrite(fb_outdeg, out_degree, objects * sizeof(u32));
   bclose(fb_outdeg);
-  construct_index(fn_graph_skel, skel_objects, out_degree);
+  construct_index(fn_graph_skel, skel_objects, out_degree, 0);
   big_free(out_degree, sizeof(u32) * objects);
 
   return 0;
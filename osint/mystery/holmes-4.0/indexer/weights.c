@@ -29,6 +29,7 @@
 #include "ucw/stkstring.h"
 #include "ucw/bitarray.h"
 #include "ucw/threads.h"
+#include "ucw/mempolicy.h"
 #include "indexer/indexer.h"
 #include "indexer/graph.h"
 
@@ -37,6 +38,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
@@ -48,6 +50,8 @@
 
 /* Temporary functions */
 
+static struct mem_policy rank_policy;
+
 static void *
 my_mmap(byte *name, uns expected_size, uns write)
 {
@@ -55,11 +59,37 @@ my_mmap(byte *name, uns expected_size, uns write)
   void *ptr = mmap_file(index_name(name), &size, write);
   if (size != expected_size)
     die("Size of %s is %d, expected %d", name, size, expected_size);
+  if (mem_policy_active(&rank_policy) && size)
+    {
+      /* Random accesses to the rank vectors are much cheaper with huge pages */
+      u64 len = size;
+      void *mem = mem_policy_alloc(&rank_policy, &len);
+      memcpy(mem, ptr, size);
+      munmap_file(ptr, size);
+      return mem;
+    }
   madvise(ptr, size, MADV_RANDOM);
   return ptr;
 }
+
+static void
+my_munmap(byte *name, void *ptr, uns size, uns write)
+{
+  if (!mem_policy_active(&rank_policy) || !size)
+    {
+      munmap_file(ptr, size);
+      return;
+    }
+  if (write)
+    {
+      struct fastbuf *b = bopen(index_name(name), O_WRONLY, 1<<20);
+      bwrite(b, ptr, size);
+      bclose(b);
+    }
+  mem_policy_free(ptr, mem_policy_size(&rank_policy, size));
+}
 #define	MY_MMAP(var,name,cnt,write) var = my_mmap(name, cnt * sizeof(*var), write)
-#define	MY_MUNMAP(var,cnt) munmap_file(var, cnt * sizeof(*var))
+#define	MY_MUNMAP(var,name,cnt,write) my_munmap(name, var, cnt * sizeof(*var), write)
 
 static inline void
 my_partmap_restart(struct partmap *map)
@@ -123,6 +153,7 @@ static struct cf_section weights_config = {
     CF_STRING("ObjRank", &fn_obj_rank),
     CF_STRING("SkelRank", &fn_skel_rank),
     CF_STRING("WeightLog", &log_name),
+    CF_SECTION("RankMemory", &rank_policy, &mem_policy_cf),
     CF_END
   }
 };
@@ -208,25 +239,150 @@ lg_leaves_write_key(struct fastbuf *f, struct vertex_hdr *k)
 
 #include "ucw/sorter/sorter.h"
 
+/* Access to the object graph: either the graph file with its index, or the compressed form */
+
+#define	GBUF_TYPE	u32
+#define	GBUF_PREFIX(x)	u32b_##x
+#include "ucw/gbuf.h"
+
+static struct fastbuf *graph_fb, *graph_idx;
+static byte *csr_map;
+static ucw_off_t csr_size;
+static u64 *csr_offsets;
+static u32b_t neigh;				// incoming links of the current vertex
+
+static void
+graph_open(void)
+{
+  if (!graph_csr)
+  {
+    graph_fb = index_bopen(fn_graph_obj, O_RDONLY, 0);
+    graph_idx = index_bopen(stk_strcat(fn_graph_obj, FN_GRAPH_INDEX), O_RDONLY, 0);
+    return;
+  }
+
+  char *name = index_name(stk_strcat(fn_graph_obj, FN_GRAPH_CSR));
+  int fd = ucw_open(name, O_RDONLY);
+  if (fd < 0)
+    die("Cannot open %s: %m", name);
+  ucw_stat_t st;
+  if (ucw_fstat(fd, &st) < 0)
+    die("Cannot stat %s: %m", name);
+  csr_size = st.st_size;
+  struct graph_csr_trailer *t;
+  if (csr_size < (ucw_off_t) sizeof(*t))
+    die("%s is truncated", name);
+  csr_map = ucw_mmap(NULL, csr_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (csr_map == MAP_FAILED)
+    die("Cannot mmap %s: %m", name);
+  close(fd);
+  t = (struct graph_csr_trailer *) (csr_map + csr_size - sizeof(*t));
+  if (t->magic != GRAPH_CSR_MAGIC || t->vertices != objects ||
+      t->offsets + (objects + 1) * sizeof(u64) + sizeof(*t) != (u64) csr_size)
+    die("%s does not match the object graph", name);
+  csr_offsets = (u64 *) (csr_map + t->offsets);
+}
+
+static void
+graph_close(void)
+{
+  if (csr_map)
+  {
+    munmap(csr_map, csr_size);
+    csr_map = NULL;
+  }
+  else
+  {
+    bclose(graph_idx);
+    bclose(graph_fb);
+  }
+}
+
+static uns
+graph_csr_row(uns v, u32 *dest)
+{
+  byte *p = csr_map + csr_offsets[v];
+  if (p == csr_map + csr_offsets[v+1])
+    return 0;
+  u32 deg, n = 0;
+  p = graph_get_varint(p, dest);
+  p = graph_get_varint(p, &deg);
+  u32b_grow(&neigh, deg);
+  for (uns i=0; i<deg; i++)
+  {
+    u32 delta;
+    p = graph_get_varint(p, &delta);
+    neigh.ptr[i] = n += delta;
+  }
+  return deg;
+}
+
+static uns
+graph_get_incoming(uns v, u32 *dest)
+  /* Reads incoming links of a vertex given by its virtual ID to neigh and returns their number.  */
+{
+  if (csr_map)
+    return graph_csr_row(v, dest);
+
+  bsetpos(graph_idx, v * BYTES_PER_O);
+  ucw_off_t pos = bgeto(graph_idx);		// read position
+  if (pos == (1LL << (BYTES_PER_O*8)) - 1)
+    return 0;
+  bsetpos(graph_fb, pos);
+  u32 deg;
+  bget_graph_hdr(graph_fb, dest, &deg);
+  u32b_grow(&neigh, deg);
+  for (uns i=0; i<deg; i++)
+    neigh.ptr[i] = bgetl(graph_fb);
+  return deg;
+}
+
+static int
+graph_get_next(uns *v, u32 *dest, u32 *deg)
+  /* The same for the next vertex in the virtual order, returns 0 at the end of the graph.
+   * The graph file can contain vertices without incoming links, the compressed form skips them.  */
+{
+  if (csr_map)
+  {
+    while (*v < objects)
+    {
+      *deg = graph_csr_row((*v)++, dest);
+      if (*deg)
+	return 1;
+    }
+    return 0;
+  }
+
+  if (!bget_graph_hdr(graph_fb, dest, deg))
+    return 0;
+  u32b_grow(&neigh, *deg);
+  for (uns i=0; i<*deg; i++)
+    neigh.ptr[i] = bgetl(graph_fb);
+  return 1;
+}
+
+static void
+graph_rewind(void)
+{
+  if (!csr_map)
+    bsetpos(graph_fb, 0);
+}
+
 static int min_index = -1;
 static uns seeks, memory, max_memory;
 static struct leaf_tree leaf_tree;
 
 static struct leaf_node *
-remove_leaf(struct leaf_node *node, struct fastbuf *graph, struct fastbuf *graph_idx, s32 *outdeg, u32 *goes)
+remove_leaf(struct leaf_node *node, s32 *outdeg, u32 *goes)
 {
-  bsetpos(graph_idx, node->v * BYTES_PER_O);
-  ucw_off_t pos = bgeto(graph_idx);		// read position
-
-  if (pos != (1LL << (BYTES_PER_O*8)) - 1)
+  u32 dest;
+  uns deg = graph_get_incoming(node->v, &dest);	// read incoming links
+  if (deg)
   {
-    bsetpos(graph, pos);			// read incoming links
-    u32 dest, deg;
-    bget_graph_hdr(graph, &dest, &deg);
     ASSERT(goes[dest] == node->v);
-    while (deg--)				// decrease their out-degree
+    for (uns i=0; i<deg; i++)			// decrease their out-degree
     {
-      uns n = bgetl(graph) & ~ETYPE_MASK;
+      uns n = neigh.ptr[i] & ~ETYPE_MASK;
       ASSERT(outdeg[n] > 0);
       if (!--outdeg[n])
       {
@@ -260,8 +416,7 @@ remove_leaves(void)
   alloc_read_ary(fn_graph_obj, FN_GRAPH_DEG, &outdeg, sizeof(s32), objects);
   alloc_read_ary(fn_graph_obj, FN_GRAPH_GOES, &goes, sizeof(u32), objects);
 
-  struct fastbuf *graph = index_bopen(fn_graph_obj, O_RDONLY, 0);
-  struct fastbuf *graph_idx = index_bopen(stk_strcat(fn_graph_obj, FN_GRAPH_INDEX), O_RDONLY, 0);
+  graph_open();
   struct fastbuf *fb_realv = index_bopen(stk_strcat(fn_graph_obj, FN_GRAPH_REAL), O_RDONLY, 1);
 
   leaf_init(&leaf_tree);
@@ -275,7 +430,7 @@ remove_leaves(void)
       outdeg[v] = -1;
       struct leaf_node *node = leaf_new(&leaf_tree, i);
       memory++;
-      remove_leaf(node, graph, graph_idx, outdeg, goes);
+      remove_leaf(node, outdeg, goes);
     }
   }
   bclose(fb_realv);
@@ -285,9 +440,8 @@ remove_leaves(void)
   seeks = 1;
   struct leaf_node *curr = leaf_boundary(&leaf_tree, 0);
   while (curr)					// process all leaves
-    curr = remove_leaf(curr, graph, graph_idx, outdeg, goes);
+    curr = remove_leaf(curr, outdeg, goes);
   leaf_cleanup(&leaf_tree);
-  bclose(graph_idx);
   big_free(goes, objects * sizeof(u32));
   log(L_INFO, "Plucked %d new leaves in %d seeks, maximal chain %d, memory consumption %d", leaves - init, seeks, -min_index, max_memory);
   ASSERT(!memory);
@@ -335,12 +489,12 @@ remove_leaves(void)
 
   log(L_INFO, "Generated translation tables");
 
-  bsetpos(graph, 0);				// split the graph into two and renumber
+  graph_rewind();				// split the graph into two and renumber
   struct fastbuf *graph_intra = index_bopen(stk_printf("%s-%d", fn_intra_graph, 0), O_WRONLY | O_CREAT | O_TRUNC, 1);
   struct fastbuf *graph_leaves = index_bopen_tmp(1);
   u32 dest, deg;
-  uns curr_thread = 0;
-  while (bget_graph_hdr(graph, &dest, &deg))
+  uns curr_thread = 0, next_v = 0;
+  while (graph_get_next(&next_v, &dest, &deg))
   {
     dest = goes[dest];
     struct fastbuf *out;
@@ -359,9 +513,9 @@ remove_leaves(void)
     else
       out = graph_leaves;
     bput_graph_hdr(out, dest, deg);		// works for both graphs
-    while (deg--)
+    for (uns i=0; i<deg; i++)
     {
-      uns ss = bgetl(graph);
+      uns ss = neigh.ptr[i];
       uns s = /* (s & ETYPE_MASK) | */
 	goes[ss & ~ETYPE_MASK];			// skip the type of the link; the code is here for debugging purposes only
       if (dest < intras || s >= intras)		// ignore links from intras to leafs
@@ -372,7 +526,7 @@ remove_leaves(void)
   write_free_ary(fn_intra_graph, FN_GRAPH_GOES, &goes, objects, sizeof(u32));	// only needed in debug/pagerank.c
   write_free_ary(fn_intra_graph, FN_GRAPH_DEG, &outdeg, objects, sizeof(s32));
   bclose(fb_num);
-  bclose(graph);
+  graph_close();
   bclose(graph_intra);
   brewind(graph_leaves);
   log(L_INFO, "Link graph split into %d intras in %d threads, and %d leaves", intras, threads, leaves);
@@ -1004,8 +1158,8 @@ main(int argc, char **argv)
     MY_MMAP(rank_skel, fn_skel_rank, skeletons, 1);
     distribute_rank(rank, rank_skel);
 
-    MY_MUNMAP(rank, objects);
-    MY_MUNMAP(rank_skel, skeletons);
+    MY_MUNMAP(rank, fn_obj_rank, objects, 1);
+    MY_MUNMAP(rank_skel, fn_skel_rank, skeletons, 1);
   }
 
   if (dump_level > 1)
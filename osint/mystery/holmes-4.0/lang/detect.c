@@ -191,6 +191,7 @@ struct lang_detect {
 	struct lang_detect_results results;
 	struct mempool *pool;
 	uns len;
+	int *orders;			/* dense matrix of expected orders, [sequence][language] */
 };
 
 static void *
@@ -228,6 +229,12 @@ lang_detect_alloc(struct mempool *pool)
 	ld->results.variances = lang_detect_nr_sequences ?
 		mp_alloc(pool, lang_detect_nr_sequences * sizeof(uns)) : NULL;
 
+	/* Copy the expected orders to a single matrix, so that all languages can be scored at once */
+	ld->orders = mp_alloc(pool, lang_detect_nr_sequences * lang_detect_nr_langs * sizeof(int));
+	for (uns i = 0; i < lang_detect_nr_sequences; i++)
+		for (uns j = 0; j < lang_detect_nr_langs; j++)
+			ld->orders[i * lang_detect_nr_langs + j] = lang_detect_sequences[i]->order[j];
+
 	return ld;
 }
 
@@ -320,34 +327,39 @@ lang_detect_add_fastbuf(struct lang_detect *ld, struct fastbuf *fb)
 
 #define	TRACE(mask,par...)	if (0) fprintf(stderr, mask "\n",##par)
 
-static uns
-probability_of_language(uns id, struct sequence_freq *sorted_freqs, uns count)
+static void
+compute_variances(struct lang_detect *ld)
 {
-	uns result = 0;
-	TRACE("Computing frequence of language %d, I found %d/%d sequences:", id, count, lang_detect_nr_sequences);
-	if (count > lang_detect_lang_flags[id].nr_seq)
+	/*
+	 *  The variance of a language is the sum of differences between the real and expected
+	 *  orders of the first nr_seq most frequent sequences, with a penalty of nr_seq for
+	 *  each sequence not expected at all. We walk the sorted sequences only once and
+	 *  update all languages in the inner loop, which the compiler can vectorize.
+	 */
+	uns nl = lang_detect_nr_langs, count = ld->results.nonzero_seq, max_count = 0;
+	struct sequence_freq *sf = ld->results.sf;
+	uns *var = ld->results.variances;
+	int limit[MAX_DETECTED], penalty[MAX_DETECTED];
+	for (uns l=0; l<nl; l++)
 	{
-		count = lang_detect_lang_flags[id].nr_seq;
-		TRACE("The count cut down to %d", lang_detect_lang_flags[id].nr_seq);
+		var[l] = 0;
+		penalty[l] = lang_detect_lang_flags[l].nr_seq;
+		limit[l] = MIN(count, lang_detect_lang_flags[l].nr_seq);
+		max_count = MAX(max_count, (uns) limit[l]);
 	}
-	for (uns i=0; i<count; i++)
+	for (uns i=0; i<max_count; i++)
 	{
-		uns expected_pos = lang_detect_sequences[ sorted_freqs[i].id ]->order[id];
-		if (expected_pos)
+		int *orders = ld->orders + sf[i].id * nl;
+		for (uns l=0; l<nl; l++)
 		{
-			result += abs(expected_pos - i);
-			TRACE("\tSeq #%d with %d occ. should be at #%d, += difference %d",
-				i, sorted_freqs[i].occur, expected_pos, abs(expected_pos - i));
-		}
-		else
-		{
-			result += lang_detect_lang_flags[id].nr_seq;
-			TRACE("\tSeq #%d with %d occ. should not be present, += penalty %d",
-				i, sorted_freqs[i].occur, lang_detect_lang_flags[id].nr_seq);
+			int expected_pos = orders[l];
+			int d = expected_pos ? abs(expected_pos - (int) i) : penalty[l];
+			var[l] += ((int) i < limit[l]) ? d : 0;
 		}
 	}
-	TRACE("Total variance is %d", result);
-	return result;
+	TRACE("Found %d/%d sequences", count, lang_detect_nr_sequences);
+	for (uns l=0; l<nl; l++)
+		TRACE("Total variance of language %d is %d", l, var[l]);
 }
 
 struct lang_detect_results *
@@ -380,13 +392,11 @@ lang_detect_compute(struct lang_detect *ld)
 	if (ld->results.total_occur >= lang_detect_min_doc_length
 	&& lang_detect_nr_langs >= 1)
 	{
+		compute_variances(ld);
 		ld->results.lang1 = 0;
-		for (uns i=0; i<lang_detect_nr_langs; i++)
-		{
-			ld->results.variances[i] = probability_of_language(i, ld->results.sf, ld->results.nonzero_seq);
-			if (i > 0 && ld->results.variances[i] < ld->results.variances[ ld->results.lang1 ])
+		for (uns i=1; i<lang_detect_nr_langs; i++)
+			if (ld->results.variances[i] < ld->results.variances[ ld->results.lang1 ])
 				ld->results.lang1 = i;
-		}
 		ld->results.lang2 = lang_detect_nr_langs;
 		for (uns i=0; i<lang_detect_nr_langs; i++)
 		{
@@ -402,7 +412,7 @@ lang_detect_compute(struct lang_detect *ld)
 		ld->results.min_ratio = lang_detect_lang_flags[ ld->results.lang1 ].rel_threshold;
 		uns occur = 0;
 		for (uns i=0; i<ld->results.nonzero_seq; i++)
-		  if (lang_detect_sequences[ ld->results.sf[i].id ]->order[ ld->results.lang1 ])
+		  if (ld->orders[ ld->results.sf[i].id * lang_detect_nr_langs + ld->results.lang1 ])
 		    occur += ld->results.sf[i].occur;
 		ld->results.freq = ld->len ? 1000 * occur / ld->len : 0;
 		ld->results.min_freq = lang_detect_lang_flags[ ld->results.lang1 ].freq_threshold;
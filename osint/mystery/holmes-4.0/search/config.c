@@ -90,6 +90,7 @@ uns misaccent_penalty;
 uns blind_match_penalty;
 uns morph_penalty;
 uns stem_penalty;
+uns stem_cache_size = 4096;
 uns synonymum_penalty;
 uns spell_good_freq;
 uns spell_min_len;
@@ -110,6 +111,8 @@ uns magic_merge_bonus;
 clist access_list;
 uns hydra_processes;
 uns slice_threads;
+uns numa_pinning;
+struct mem_policy card_attrs_policy;
 uns max_image_sims;
 uns image_sim_max_weight;
 uns image_sim_slope;
@@ -343,6 +346,7 @@ static struct cf_section search_config = {
     CF_UNS("MisaccentPenalty", &misaccent_penalty),
     CF_UNS("StemPenalty", &stem_penalty),
     CF_UNS("MorphPenalty", &morph_penalty),
+    CF_UNS("StemCacheSize", &stem_cache_size),
     CF_UNS("Morphing", &global_morphing),
     CF_UNS("Spelling", &global_spelling),
     CF_UNS("SpellGoodFreq", &spell_good_freq),
@@ -366,6 +370,8 @@ static struct cf_section search_config = {
     CF_UNS("MagicMergeBonus", &magic_merge_bonus),
     CF_UNS("HydraProcesses", &hydra_processes),
     CF_UNS("SliceThreads", &slice_threads),
+    CF_UNS("NUMAPinning", &numa_pinning),
+    CF_SECTION("CardAttrsMemory", &card_attrs_policy, &mem_policy_cf),
     CF_UNS("MaxImageSims", &max_image_sims),
     CF_UNS("ImageSimMaxWeight", &image_sim_max_weight),
     CF_UNS("ImageSimSlope", &image_sim_slope),
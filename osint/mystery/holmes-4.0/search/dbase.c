@@ -23,6 +23,26 @@
 
 struct lexicon_config lexicon_config;
 
+static void
+db_place_card_attrs(struct database *db)
+{
+  /*
+   *  Card attributes are accessed randomly by all queries, so it pays off
+   *  to move them from the file mapping to memory backed by huge pages
+   *  and/or spread over NUMA nodes as the configuration says.
+   */
+  uns size = db->card_attrs_size;
+  u64 len = size;
+  struct card_attr *attrs = mem_policy_alloc(&card_attrs_policy, &len);
+  memcpy(attrs, db->card_attrs, size);
+  munmap_file(db->card_attrs, size);
+  if (mprotect(attrs, len, PROT_READ) < 0)
+    die("Cannot protect card attributes read-only: %m");
+  db->card_attrs = attrs;
+  db->card_attrs_end = attrs + db->num_ids;
+  log(L_INFO, "Database %s: card attributes moved to %llu KB of placed memory", db->name, (long long)(len >> 10));
+}
+
 void
 db_switch_config(struct database *db)
 {
@@ -186,6 +206,7 @@ db_init(int merge_only)
       int rw = (db->parts & DB_PART_PRINTS) || DARY_LEN(db->blacklists);
       uns size;
       db->card_attrs = mmap_file(db_file_name(db, "card-attrs"), &size, rw);
+      db->card_attrs_size = size;
       db->num_ids = size / sizeof(struct card_attr);
       if (db->num_ids)
 	db->num_ids--;
@@ -239,6 +260,8 @@ db_init(int merge_only)
 	  if (mprotect(db->card_attrs, db->num_ids * sizeof(struct card_attr), PROT_READ) < 0)
 	    die("Cannot reprotect card attributes read-only: %m");
 	}
+      if (mem_policy_active(&card_attrs_policy) && db->card_attrs_size)
+	db_place_card_attrs(db);
     }
 }
 
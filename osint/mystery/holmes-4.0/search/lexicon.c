@@ -10,7 +10,7 @@
 #include "ucw/mempool.h"
 #include "ucw/hashfunc.h"
 #include "ucw/unicode.h"
-#include "charset/unicat.h"
+#include "charset/unifold.h"
 #include "search/sherlockd.h"
 #include "search/lexicon.h"
 #include "search/vocabolario.h"
@@ -23,18 +23,9 @@
 uns
 word_unaccent_utf8(byte *w, byte *to)
 {
-  uns u;
-  byte *stop = to + MAX_WORD_BYTES;
-  byte *buf = to;
-
-  while (*w)
-    {
-      w = utf8_get(w, &u);
-      u = Uunaccent(u);
-      buf = utf8_put(buf, u);
-      if (buf >= stop)
-	return 0;
-    }
+  byte *buf = ufold_utf8(to, to + MAX_WORD_BYTES - 1, w, w + strlen(w), UFOLD_UNACCENT);
+  if (!buf)
+    return 0;
   *buf = 0;
   return buf - to;
 }
@@ -54,18 +45,9 @@ void
 lex_extract_noacc(uns lex_id, byte *buf)
 {
   struct lex_entry *l = lex_get(lex_id);
-  uns u;
-  byte *w, *we;
-
-  w = l->w;
-  we = w + l->length;
   ASSERT(l->length <= MAX_WORD_BYTES);
-  while (w < we)
-    {
-      w = utf8_get(w, &u);
-      u = Uunaccent(u);
-      buf = utf8_put(buf, u);
-    }
+  buf = ufold_utf8(buf, buf + MAX_WORD_BYTES, l->w, l->w + l->length, UFOLD_UNACCENT);
+  ASSERT(buf);
   *buf = 0;
 }
 
@@ -333,6 +315,14 @@ stems_load(struct database *db)
 		sb->stemmer = st;
 		sb->array = astart;
 		sb->array_items = aitems;
+		if (stem_cache_size)
+		  {
+		    uns size = 1;
+		    while (size < stem_cache_size)
+		      size *= 2;
+		    sb->cache = mp_alloc_zero(db->pool, size * sizeof(struct stem_cache_entry));
+		    sb->cache_mask = size - 1;
+		  }
 		clist_add_tail(&db->stem_block_list, &sb->n);
 		break;
 	      }
@@ -393,6 +383,42 @@ stem_lookup_expansion(u32 *ary, uns nitems, u32 stem_id)
   return NULL;
 }
 
+static inline struct stem_cache_entry *
+stem_cache_slot(struct stem_block *sb, uns key)
+{
+  return &sb->cache[hash_u32(key) & sb->cache_mask];
+}
+
+int
+stem_cache_lookup(struct stem_block *sb, uns lex_id, uns unaccented, u32 *stems)
+{
+  if (!sb->cache)
+    return -1;
+  uns key = 2*lex_id + !!unaccented + 1;
+  struct stem_cache_entry *e = stem_cache_slot(sb, key);
+  if (e->key != key)
+    return -1;
+  uns n = 0;
+  while (n < STEM_CACHE_STEMS && e->stems[n] != ~0U)
+    {
+      stems[n] = e->stems[n];
+      n++;
+    }
+  return n;
+}
+
+void
+stem_cache_insert(struct stem_block *sb, uns lex_id, uns unaccented, u32 *stems, uns n)
+{
+  if (!sb->cache || n > STEM_CACHE_STEMS)
+    return;
+  uns key = 2*lex_id + !!unaccented + 1;
+  struct stem_cache_entry *e = stem_cache_slot(sb, key);
+  e->key = key;
+  for (uns i=0; i<STEM_CACHE_STEMS; i++)
+    e->stems[i] = (i < n) ? stems[i] : ~0U;
+}
+
 #endif
 
 /*** Global initialization ***/
@@ -84,11 +84,27 @@ int query_word_classify(struct database *db, byte *word);
 
 #include "lang/lang.h"
 
+/*
+ *  Each stem block carries a small direct-mapped cache of word -> stem mappings,
+ *  so that morphological expansion of frequent query words does not have to run
+ *  the stemmer again. Results with more than STEM_CACHE_STEMS known stems are
+ *  never cached.
+ */
+
+#define STEM_CACHE_STEMS 3
+
+struct stem_cache_entry {
+  u32 key;				/* 2*lex_id + unaccented + 1, 0 if the slot is empty */
+  u32 stems[STEM_CACHE_STEMS];		/* Lexicon IDs of the stems, padded with ~0U */
+};
+
 struct stem_block {
   cnode n;
   struct stemmer *stemmer;
   u32 *array;
   uns array_items;
+  struct stem_cache_entry *cache;	/* NULL if caching is disabled */
+  uns cache_mask;
 };
 
 struct syn_block {
@@ -99,6 +115,8 @@ struct syn_block {
 };
 
 u32 *stem_lookup_expansion(u32 *ary, uns nitems, u32 stem_id);
+int stem_cache_lookup(struct stem_block *sb, uns lex_id, uns unaccented, u32 *stems);
+void stem_cache_insert(struct stem_block *sb, uns lex_id, uns unaccented, u32 *stems, uns n);
 
 #endif
 
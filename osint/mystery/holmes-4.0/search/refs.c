@@ -1379,6 +1379,8 @@ ref_thread(void *arg)
 {
   struct ref_context *c = arg;
 
+  if (numa_pinning && !hydra_processes)
+    numa_pin_node(c->thread_id % numa_num_nodes());
   for (uns i=0; i < c->dbase->params->num_slices; i++)
     if (c->thread_slice_mask & (1 << i))
       {
@@ -0,0 +1,296 @@
+/*
+ *	Sherlock Search Engine -- Offline Benchmark
+ *
+ *	Loads the databases the same way as sherlockd does and replays
+ *	a log of queries in-process, measuring the time spent in the
+ *	individual phases of query processing without any network noise.
+ */
+
+#include "sherlock/sherlock.h"
+#include "ucw/conf.h"
+#include "ucw/getopt.h"
+#include "ucw/mempool.h"
+#include "ucw/fastbuf.h"
+#include "search/sherlockd.h"
+#include "search/fulltext.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+static uns rounds = 1;
+static uns warmup;
+static uns use_cache;
+static uns threshold = 10;
+static byte *baseline_save, *baseline_compare, *reply_file;
+
+static struct fastbuf *reply_fb;
+
+/*** Phases ***/
+
+#define P(x) #x
+static char *phase_names[] = { PROFILERS(COMMA), "total" };
+#undef P
+#define NUM_PHASES ARRAY_SIZE(phase_names)
+
+static u64 phase_sum[NUM_PHASES];
+static uns *query_times;
+static uns num_times, max_times;
+
+static inline u64
+prof_usec(prof_t *p)
+{
+  return (u64) p->sec * 1000000 + p->usec;
+}
+
+static u64
+get_usec(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (u64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*** Replies ***/
+
+void
+write_reply(struct query *q UNUSED, byte *data, uns len)
+{
+  if (reply_fb)
+    bwrite(reply_fb, data, len);
+}
+
+static void
+run_query(byte *text, uns measure)
+{
+  struct mempool *pool = mp_new(8192);
+  struct query *q = mp_alloc_zero(pool, sizeof(struct query));
+  q->pool = pool;
+  init_reply_buf(&q->reply_header, pool);
+  init_reply_buf(&q->reply_footer, pool);
+  q->current_reply_buf = &q->reply_header;
+  q->iobuf = mp_strdup(pool, text);
+  q->fd = -1;
+  q->q_status = -1;
+  strcpy(q->ipaddr, "bench");
+  memory_setup(q);
+
+  u64 start = get_usec();
+  process_query(q);
+  flush_reply_buf(q, &q->reply_header);
+  write_reply(q, "\n", 1);
+  flush_reply_buf(q, &q->reply_footer);
+  write_reply(q, "+++\n", 4);
+  u64 total = get_usec() - start;
+
+  if (measure)
+    {
+      uns i = 0;
+#define P(x) phase_sum[i++] += prof_usec(&prof_##x)
+      PROFILERS(;);
+#undef P
+      phase_sum[i] += total;
+      if (num_times >= max_times)
+	{
+	  max_times = MAX(2*max_times, 1024);
+	  query_times = xrealloc(query_times, max_times * sizeof(uns));
+	}
+      query_times[num_times++] = MIN(total, (u64) ~0U);
+    }
+
+  prefetch_results_cleanup(q);
+  memory_flush(q);
+  mp_delete(pool);
+}
+
+/*** Reporting ***/
+
+#define ASORT_PREFIX(x) times_##x
+#define ASORT_KEY_TYPE uns
+#define ASORT_ELT(i) query_times[i]
+#include "ucw/sorter/array-simple.h"
+
+static double
+percentile(double q)
+{
+  if (!num_times)
+    return 0;
+  uns i = MIN((uns)(q * num_times), num_times-1);
+  return query_times[i] / 1000.;
+}
+
+static void
+report(void)
+{
+  times_sort(num_times);
+  uns n = MAX(num_times, 1);
+  log(L_INFO, "Measured %d queries", num_times);
+  log(L_INFO, "Time per query in ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f",
+      percentile(0.5), percentile(0.9), percentile(0.99), percentile(1));
+  for (uns i=0; i<NUM_PHASES; i++)
+    log(L_INFO, "Phase %-8s %10.3f s total, %10.3f us/query", phase_names[i],
+	phase_sum[i] / 1e6, (double) phase_sum[i] / n);
+}
+
+/*** Baselines ***/
+
+/* A baseline is a list of lines "<phase> <microseconds per query>" */
+
+static void
+save_baseline(byte *name)
+{
+  struct fastbuf *b = bopen(name, O_WRONLY | O_CREAT | O_TRUNC, 4096);
+  for (uns i=0; i<NUM_PHASES; i++)
+    bprintf(b, "%s\t%.3f\n", phase_names[i], (double) phase_sum[i] / MAX(num_times, 1));
+  bclose(b);
+  log(L_INFO, "Baseline saved to %s", name);
+}
+
+static uns
+compare_baseline(byte *name)
+{
+  struct fastbuf *b = bopen(name, O_RDONLY, 4096);
+  byte line[256], phase[64];
+  double base;
+  uns regressions = 0;
+
+  while (bgets(b, line, sizeof(line)))
+    {
+      if (sscanf(line, "%63s %lf", phase, &base) != 2)
+	die("%s: Malformed baseline line: %s", name, line);
+      uns i = 0;
+      while (i < NUM_PHASES && strcmp(phase_names[i], phase))
+	i++;
+      if (i >= NUM_PHASES)
+	{
+	  log(L_WARN, "Unknown phase %s in the baseline", phase);
+	  continue;
+	}
+      double now = (double) phase_sum[i] / MAX(num_times, 1);
+      double change = base ? 100 * (now - base) / base : 0;
+      int bad = (change > threshold && now - base >= 1);
+      log(bad ? L_ERROR : L_INFO, "Phase %-8s %10.3f us/query, baseline %10.3f (%+.1f%%)%s",
+	  phase, now, base, change, bad ? " REGRESSION" : "");
+      regressions += bad;
+    }
+  bclose(b);
+  return regressions;
+}
+
+/*** Main ***/
+
+static void NONRET
+usage(void)
+{
+  fputs("\
+Usage: sherlockd-bench <options> < queries\n\
+\n\
+Replays queries (one per line, as produced by utils/bench/speed/genbench.pl)\n\
+on the databases configured for sherlockd and measures phases of processing.\n\
+\n\
+Options:\n\
+" CF_USAGE "\
+-b <file>\tCompare with a baseline, exit with status 2 on a regression\n\
+-c\t\tUse the reply cache (by default, it is bypassed)\n\
+-n <count>\tReplay the queries <count> times (default: 1)\n\
+-o <file>\tWrite replies to a file\n\
+-s <file>\tSave the results as a baseline\n\
+-t <pct>\tMaximum slowdown of a phase tolerated by -b (default: 10%)\n\
+-w <count>\tRun <count> queries first without measuring them\n\
+", stderr);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  int opt;
+
+  log_init(NULL);
+  while ((opt = cf_getopt(argc, argv, CF_SHORT_OPTS "b:cn:o:s:t:w:", CF_NO_LONG_OPTS, NULL)) >= 0)
+    switch (opt)
+      {
+      case 'b':
+	baseline_compare = optarg;
+	break;
+      case 'c':
+	use_cache++;
+	break;
+      case 'n':
+	if (cf_parse_int(optarg, &rounds))
+	  usage();
+	break;
+      case 'o':
+	reply_file = optarg;
+	break;
+      case 's':
+	baseline_save = optarg;
+	break;
+      case 't':
+	if (cf_parse_int(optarg, &threshold))
+	  usage();
+	break;
+      case 'w':
+	if (cf_parse_int(optarg, &warmup))
+	  usage();
+	break;
+      default:
+	usage();
+      }
+  if (optind < argc)
+    usage();
+
+  if (!use_cache)
+    global_debug |= DEBUG_NOCACHE;
+  query_watchdog = 0;
+  db_init(0);
+  cache_init();
+  query_init();
+  refs_init();
+  fulltext_init();
+  memory_init();
+  cards_init();
+  spell_init();
+#ifdef CUSTOM_INIT
+  CUSTOM_INIT();
+#endif
+  cards_init_process();
+
+  /* Load the queries */
+  struct fastbuf *in = bfdopen_shared(0, 65536);
+  struct mempool *qpool = mp_new(65536);
+  byte **queries = NULL, line[4096];
+  uns nq = 0, maxq = 0;
+  while (bgets(in, line, sizeof(line)))
+    {
+      if (nq >= maxq)
+	{
+	  maxq = MAX(2*maxq, 256);
+	  queries = xrealloc(queries, maxq * sizeof(byte *));
+	}
+      queries[nq++] = mp_strdup(qpool, line);
+    }
+  bclose(in);
+  if (!nq)
+    die("No queries given");
+
+  if (reply_file)
+    reply_fb = bopen(reply_file, O_WRONLY | O_CREAT | O_TRUNC, 65536);
+
+  for (uns i=0; i<warmup; i++)
+    run_query(queries[i % nq], 0);
+  for (uns r=0; r<rounds; r++)
+    for (uns i=0; i<nq; i++)
+      run_query(queries[i], 1);
+
+  if (reply_fb)
+    bclose(reply_fb);
+  report();
+  if (baseline_save)
+    save_baseline(baseline_save);
+  if (baseline_compare && compare_baseline(baseline_compare))
+    return 2;
+  return 0;
+}
@@ -376,6 +376,8 @@ hydra_setup(void)
 	{
 	  log_fork();
 	  close(fds[1]);
+	  if (numa_pinning)
+	    numa_pin_node(i % numa_num_nodes());
 	  mainloop(fds[0]);
 	}
       else
@@ -7,6 +7,7 @@
 #include "ucw/clists.h"
 #include "ucw/slists.h"
 #include "ucw/bitarray.h"
+#include "ucw/mempolicy.h"
 #include "sherlock/index.h"
 #include "indexer/sites.h"
 #include "search/images.h"
@@ -27,7 +28,8 @@
 
 extern char *log_name, *status_name;
 extern uns log_incoming, log_rejected, log_requests, log_replies, log_fetches;
-extern uns port, listen_queue, connection_timeout, hydra_processes, slice_threads;
+extern uns port, listen_queue, connection_timeout, hydra_processes, slice_threads, numa_pinning;
+extern struct mem_policy card_attrs_policy;
 extern char *control_password;
 extern clist databases;
 extern clist spell_common_pairs;
@@ -52,6 +54,7 @@ extern uns magic_keyphrases, magic_keyphrases_classes, magic_keyphrases_string_t
 extern uns magic_near, magic_merge_bonus;
 extern uns near_bonus_word, near_penalty_gap, near_bonus_connect, near_min_weight, near_max_weight;
 extern uns blind_match_penalty, misaccent_penalty, stem_penalty, morph_penalty, synonymum_penalty;
+extern uns stem_cache_size;
 extern uns spell_good_freq, spell_min_len, spell_margin, spell_dwarf, spell_dwarf_margin, global_syn_expand, spell_common_penalty;
 extern uns spell_add_penalty, spell_del_penalty, spell_mod_penalty, spell_xpos_penalty, spell_accent_penalty;
 extern uns filter_repeated_nonalpha, filter_repeated_alpha;
@@ -80,6 +83,7 @@ struct database {
   oid_t num_ids;
   int fd_cards, fd_refs;
   struct card_attr *card_attrs, *card_attrs_end;
+  uns card_attrs_size;
   ucw_off_t card_file_size, ref_file_size;
 
   /* Words */
@@ -11,7 +11,7 @@
 #include "ucw/mempool.h"
 #include "ucw/wildmatch.h"
 #include "ucw/unicode.h"
-#include "charset/unicat.h"
+#include "charset/unifold.h"
 #include "search/sherlockd.h"
 #include "search/lexicon.h"
 
@@ -243,10 +243,9 @@ lm_lookup(enum word_class orig_class, u16 *uni, uns ulen, word_id_t *thisw, void
   for (i=0; i<ulen; i++)
     {
       u = uni[i];
-      u = Utolower(u);
-      wp = utf8_put(wp, u);
-      u = Uunaccent(u);
-      up = utf8_put(up, u);
+      u64 f = Ufold(u);
+      wp = utf8_put(wp, Ufold_lower(u, f));
+      up = utf8_put(up, Ufold_lower_unaccent(u, f));
     }
   *wp = *up = 0;
   wl = wp - wbuf + 1;
@@ -392,6 +391,38 @@ word_expand_post_acc(struct ph_word *p, uns require_flags)
 
 static struct mempool *stemmer_pool;
 
+static void
+word_expand_morph_stem(struct ph_word *p, struct variant *v, struct stem_block *sb, byte *wa, uns stem_id)
+{
+  struct word *w = p->word;
+  u32 sb_lang_mask = sb->stemmer->lang_mask;
+  byte stem[MAX_WORD_BYTES+1];
+  u32 *exp;
+
+  lex_extract(stem_id, stem);
+  TRACE(".M <%s> -> <%s> (langs %x)", wa, stem, sb_lang_mask);
+  add_reply("l%s %s", stem, wa);
+  if (stem_id != v->lex_id && lex_get(stem_id)->class == w->word_class)
+    word_add_variant(w, stem_id, 0, v->lang_mask & sb_lang_mask,
+		     v->penalty + stem_penalty, VF_MORPHED | VF_MORPH | VF_LEMMA);
+  if (exp = stem_lookup_expansion(sb->array, sb->array_items, lex_export_id(stem_id)))
+    {
+      while (!(*++exp & 0x80000000))
+	{
+	  uns idp = lex_import_id(*exp);
+	  if (IS_TRACING)
+	    {
+	      byte ww[MAX_WORD_BYTES+1];
+	      lex_extract(idp, ww);
+	      add_reply(".M\t-> <%s>", ww);
+	    }
+	  if (idp != v->lex_id && lex_get(idp)->class == w->word_class)
+	    word_add_variant(w, idp, 0, v->lang_mask & sb_lang_mask,
+			     v->penalty + morph_penalty, VF_MORPHED | VF_MORPH);
+	}
+    }
+}
+
 static void
 word_expand_morph_variant(struct ph_word *p, struct variant *v)
 {
@@ -402,7 +433,8 @@ word_expand_morph_variant(struct ph_word *p, struct variant *v)
   clist *stems;
   clist *sb_list = &current_dbase->stem_block_list;
   int stem_id;
-  u32 *exp;
+  u32 cached[STEM_CACHE_STEMS];
+  uns unaccented = (w->options.accent_mode == ACCENT_STRIP);
 
   lex_extract(v->lex_id, wa);
   CLIST_WALK(sb, *sb_list)
@@ -410,6 +442,16 @@ word_expand_morph_variant(struct ph_word *p, struct variant *v)
       u32 sb_lang_mask = sb->stemmer->lang_mask;
       if (!(sb_lang_mask & QUERY_LANGS))
 	continue;
+
+      /* When tracing, always ask the stemmer, so that unknown stems get reported, too */
+      int n = IS_TRACING ? -1 : stem_cache_lookup(sb, v->lex_id, unaccented, cached);
+      if (n >= 0)
+	{
+	  for (int i=0; i<n; i++)
+	    word_expand_morph_stem(p, v, sb, wa, cached[i]);
+	  continue;
+	}
+
       if (!stemmer_pool)
 	stemmer_pool = mp_new(4096);
       else
@@ -417,39 +459,24 @@ word_expand_morph_variant(struct ph_word *p, struct variant *v)
       struct word_node req = {
 	.word_form = WORD_FORM_OTHER,
 	.stem_form = WORD_FORM_LEMMA,
-	.unaccented = (w->options.accent_mode == ACCENT_STRIP),
+	.unaccented = unaccented,
 	.w = wa
       };
+      n = 0;
       if (stems = lang_stem(sb->stemmer, &req, stemmer_pool))
 	CLIST_WALK(stem, *stems)
 	  {
 	    if ((stem_id = lex_find_exact(stem->w)) >= 0)
 	      {
-		TRACE(".M <%s> -> <%s> (langs %x)", wa, stem->w, sb_lang_mask);
-		add_reply("l%s %s", stem->w, wa);
-		if (stem_id != (int) v->lex_id && lex_get(stem_id)->class == w->word_class)
-		  word_add_variant(p->word, stem_id, 0, v->lang_mask & sb_lang_mask,
-				   v->penalty + stem_penalty, VF_MORPHED | VF_MORPH | VF_LEMMA);
-		if (exp = stem_lookup_expansion(sb->array, sb->array_items, lex_export_id(stem_id)))
-		  {
-		    while (!(*++exp & 0x80000000))
-		      {
-			uns idp = lex_import_id(*exp);
-			if (IS_TRACING)
-			  {
-			    byte ww[MAX_WORD_BYTES+1];
-			    lex_extract(idp, ww);
-			    add_reply(".M\t-> <%s>", ww);
-			  }
-			if (idp != v->lex_id && lex_get(idp)->class == w->word_class)
-			  word_add_variant(w, idp, 0, v->lang_mask & sb_lang_mask,
-					   v->penalty + morph_penalty, VF_MORPHED | VF_MORPH);
-		      }
-		  }
+		if (n < STEM_CACHE_STEMS)
+		  cached[n] = stem_id;
+		n++;
+		word_expand_morph_stem(p, v, sb, wa, stem_id);
 	      }
 	    else
 	      TRACE(".M <%s> -> <%s> (langs %x) unknown", wa, stem->w, sb_lang_mask);
 	  }
+      stem_cache_insert(sb, v->lex_id, unaccented, cached, n);
     }
 }
 
@@ -0,0 +1,254 @@
+/*
+ *	Sherlock Library -- Parallel Scanning of Bucket Files
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "sherlock/sherlock.h"
+#include "sherlock/bucket.h"
+#include "ucw/fastbuf.h"
+#include "ucw/ff-binary.h"
+#include "ucw/workqueue.h"
+
+#include <string.h>
+#include <fcntl.h>
+
+/*
+ *  The chunks are cut at fixed offsets and each worker synchronizes to the
+ *  first thing looking like a bucket header in its chunk, so the file is read
+ *  only once and in parallel.  This guess can be wrong (payload can contain
+ *  a fake header), so the chunks are verified in the calling thread before
+ *  they are delivered: the first chunk starts at the beginning of the file and
+ *  each worker walks past the end of its chunk to the first bucket of the next
+ *  one, so every verified chunk tells where the next one really starts.  If the
+ *  guess does not match, the chunk is processed again from the right place.
+ */
+
+struct scan_state {
+  struct obuck_scan *scan;
+  struct worker_pool pool;
+  struct work_queue queue;
+  ucw_off_t size;				/* Size of the pool when the scan started */
+  uns chunk_size;
+};
+
+struct scan_thread {
+  struct worker_thread t;
+  struct scan_state *state;
+  struct fastbuf *in;				/* Private stream on the bucket file */
+  byte *buf;
+  uns buflen;
+  void *ctx;
+};
+
+struct scan_chunk {
+  struct work w;
+  uns id;
+  ucw_off_t lo, hi;				/* Buckets starting in this range belong to the chunk */
+  ucw_off_t start;				/* The first bucket (hi if none found) */
+  ucw_off_t end;				/* The first bucket after the chunk */
+  uns exact;					/* Start is known, not guessed by the worker */
+  uns bad;					/* The guess led to an inconsistency */
+  uns count;					/* Number of buckets processed */
+  struct fastbuf *out;				/* Results of the process() hook */
+};
+
+static struct worker_thread *
+scan_new_thread(void)
+{
+  return xmalloc_zero(sizeof(struct scan_thread));
+}
+
+static void
+scan_init_thread(struct worker_thread *t)
+{
+  struct scan_thread *st = (struct scan_thread *) t;
+  struct scan_state *s = st->state = SKIP_BACK(struct scan_state, pool, t->pool);
+  struct obuck *obuck = s->scan->obuck;
+
+  /* Opened inside the thread, so that direct I/O uses the thread's own I/O queue */
+  st->in = bopen_file(obuck->name, O_RDONLY, &obuck->p.scan_fb);
+  st->buflen = OBUCK_ALIGN;
+  st->buf = xmalloc(st->buflen);
+  if (s->scan->thread_init)
+    st->ctx = s->scan->thread_init(s->scan);
+}
+
+static void
+scan_cleanup_thread(struct worker_thread *t)
+{
+  struct scan_thread *st = (struct scan_thread *) t;
+  if (st->state->scan->thread_cleanup)
+    st->state->scan->thread_cleanup(st->state->scan, st->ctx);
+  bclose(st->in);
+  xfree(st->buf);
+}
+
+static ucw_off_t
+scan_sync(struct scan_thread *st, ucw_off_t pos, ucw_off_t end)
+{
+  /* Find the first position in [pos,end) which looks like a start of a bucket */
+  ucw_off_t size = st->state->size;
+  for (; pos < end; pos += OBUCK_ALIGN)
+    {
+      struct obuck_header h;
+      bsetpos(st->in, pos);
+      if (bread(st->in, &h, sizeof(h)) == sizeof(h) &&
+	  h.magic == OBUCK_MAGIC &&
+	  (h.oid == (oid_t)(pos >> OBUCK_SHIFT) || h.oid == OBUCK_OID_DELETED) &&
+	  h.length <= size - pos)
+	return pos;
+    }
+  return end;
+}
+
+#define SCAN_CORRUPTED(msg) do {							\
+    if (!c->exact)									\
+      {											\
+	c->bad = 1;									\
+	goto done;									\
+      }											\
+    die("Object pool %s corrupted: " msg " (pos=%llx)", obuck->name, (long long) pos);	\
+  } while (0)
+
+static void
+scan_go(struct worker_thread *t, struct work *w)
+{
+  struct scan_thread *st = (struct scan_thread *) t;
+  struct scan_chunk *c = (struct scan_chunk *) w;
+  struct scan_state *s = st->state;
+  struct obuck *obuck = s->scan->obuck;
+  ucw_off_t pos = c->exact ? c->start : scan_sync(st, c->lo, c->hi);
+  DBG("Scanning chunk %d: %llx-%llx from %llx%s", c->id, (long long) c->lo, (long long) c->hi, (long long) pos, c->exact ? "" : " (guessed)");
+  fbgrow_reset(c->out);
+  c->start = pos;
+  c->count = 0;
+  c->bad = 0;
+
+  while (pos < c->hi)
+    {
+      struct obuck_header h;
+      bsetpos(st->in, pos);
+      if (bread(st->in, &h, sizeof(h)) != sizeof(h))
+	SCAN_CORRUPTED("Short header read");
+      if (h.magic != OBUCK_MAGIC)
+	SCAN_CORRUPTED("Missing magic number");
+      uns l = obuck_bucket_size(h.length);
+      if (h.length > s->size - pos || l > s->size - pos)
+	SCAN_CORRUPTED("Bucket too long");
+      if (h.oid != OBUCK_OID_DELETED)
+	{
+	  if (h.oid != (oid_t)(pos >> OBUCK_SHIFT))
+	    SCAN_CORRUPTED("Invalid backlink");
+	  uns len = l - sizeof(h);
+	  if (len > st->buflen)
+	    {
+	      xfree(st->buf);
+	      st->buf = xmalloc(st->buflen = len);
+	    }
+	  if (bread(st->in, st->buf, len) != len)
+	    SCAN_CORRUPTED("Short read");
+	  if (GET_U32(st->buf + len - 4) != OBUCK_TRAILER)
+	    SCAN_CORRUPTED("Missing trailer");
+	  struct fastbuf fb;
+	  fbbuf_init_read(&fb, st->buf, h.length, 0);
+	  s->scan->process(s->scan, st->ctx, &h, &fb, c->out);
+	  c->count++;
+	}
+      pos += l;
+    }
+done:
+  c->end = pos;
+  fbgrow_rewind(c->out);
+}
+
+uns
+obuck_scan_pool(struct obuck_scan *scan)
+{
+  struct obuck *obuck = scan->obuck;
+  struct scan_state s = {
+    .scan = scan,
+    .chunk_size = MAX(ALIGN_TO(obuck->p.scan_chunk_size, OBUCK_ALIGN), OBUCK_ALIGN),
+  };
+  s.size = obuck_lock_scan_size(obuck);
+  uns nchunks = (s.size + s.chunk_size - 1) / s.chunk_size;
+  uns threads = scan->threads ? : MAX(obuck->p.scan_threads, 1);
+  DBG("Scanning %llx bytes in %d chunks by %d threads", (long long) s.size, nchunks, threads);
+
+  s.pool.num_threads = threads;
+  s.pool.new_thread = scan_new_thread;
+  s.pool.init_thread = scan_init_thread;
+  s.pool.cleanup_thread = scan_cleanup_thread;
+  worker_pool_init(&s.pool);
+  work_queue_init(&s.pool, &s.queue);
+
+  /*
+   * At most `window' chunks are in flight. The chunks not delivered yet
+   * always have consecutive ID's, so we can index them by their ID modulo
+   * the window size.
+   */
+  uns window = 2*threads;
+  struct scan_chunk *chunks = xmalloc_zero(window * sizeof(*chunks));
+  struct scan_chunk **free_chunks = xmalloc(window * sizeof(*free_chunks));
+  struct scan_chunk **ready = xmalloc_zero(window * sizeof(*ready));
+  for (uns i = 0; i < window; i++)
+    {
+      chunks[i].w.go = scan_go;
+      chunks[i].out = fbgrow_create(65536);
+      free_chunks[i] = &chunks[i];
+    }
+  uns nfree = window, submitted = 0, delivered = 0, total = 0;
+  ucw_off_t verified = 0;			/* The first bucket not delivered yet */
+
+  while (delivered < nchunks)
+    {
+      while (submitted < nchunks && submitted < delivered + window)
+	{
+	  struct scan_chunk *c = free_chunks[--nfree];
+	  c->id = submitted++;
+	  c->lo = (ucw_off_t) c->id * s.chunk_size;
+	  c->hi = MIN(c->lo + s.chunk_size, s.size);
+	  /* Once the verified part reaches the chunk, there is nothing to guess */
+	  c->exact = (verified >= c->lo);
+	  c->start = verified;
+	  work_submit(&s.queue, &c->w);
+	}
+      struct scan_chunk *c = (struct scan_chunk *) work_wait(&s.queue);
+      ready[c->id % window] = c;
+      while (delivered < submitted && (c = ready[delivered % window]))
+	{
+	  ready[delivered % window] = NULL;
+	  if (verified < c->hi)
+	    {
+	      if (c->bad || c->start != verified)
+		{
+		  /* Wrong guess, but now we know where the chunk starts */
+		  DBG("Chunk %d guessed %llx, restarting at %llx", c->id, (long long) c->start, (long long) verified);
+		  c->exact = 1;
+		  c->start = verified;
+		  work_submit(&s.queue, &c->w);
+		  break;
+		}
+	      scan->deliver(scan, c->out);
+	      total += c->count;
+	      verified = c->end;
+	    }
+	  /* else the chunk lies inside a single bucket, anything it found there is bogus */
+	  free_chunks[nfree++] = c;
+	  delivered++;
+	}
+    }
+
+  work_queue_cleanup(&s.queue);
+  worker_pool_cleanup(&s.pool);
+  obuck_unlock_scan(obuck);
+  for (uns i = 0; i < window; i++)
+    bclose(chunks[i].out);
+  xfree(chunks);
+  xfree(free_chunks);
+  xfree(ready);
+  return total;
+}
@@ -17,13 +17,17 @@
 #include "ucw/ff-binary.h"
 #include "ucw/lfs.h"
 #include "ucw/conf.h"
+#include "ucw/threads.h"
+#include "ucw/binsearch.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <alloca.h>
+#include <errno.h>
 
 /*** Configuration ***/
 
@@ -34,6 +38,14 @@ static struct obuck_params obuck_params = {
   .slurp_buflen = 65536,
   .prefetch_size = 8192,
   .max_size = ~(u64)0,
+  .segment_size = 256<<20,
+  .compact_threshold = 50,
+  .scan_threads = 4,
+  .scan_chunk_size = 4<<20,
+  .scan_fb = {
+    .type = FB_STD,
+    .buffer_size = 1<<20,
+  },
 };
 
 char *bucket_file_name = "db/objects";
@@ -48,6 +60,11 @@ static struct cf_section obuck_config = {
     CF_UNS("SlurpBufSize", &obuck_params.slurp_buflen),
     CF_UNS("PrefetchSize", &obuck_params.prefetch_size),
     CF_U64("MaxSize", &obuck_params.max_size),
+    CF_UNS("SegmentSize", &obuck_params.segment_size),
+    CF_UNS("CompactThreshold", &obuck_params.compact_threshold),
+    CF_UNS("ScanThreads", &obuck_params.scan_threads),
+    CF_UNS("ScanChunkSize", &obuck_params.scan_chunk_size),
+    CF_SECTION("ScanAccess", &obuck_params.scan_fb, &fbpar_cf),
     CF_END
   }
 };
@@ -72,23 +89,31 @@ obuck_broken(struct obuck *obuck, char *msg, ucw_off_t pos)
  *	Write lock	any write operations
  *	Append lock	appending to the end of the file
  *	Scan lock	reading parts which we are certain they exist
+ *	Pin lock	holding positions of buckets between calls
  *
  *  Multiple read and scan locks can co-exist together.
  *  Scan locks can co-exist with an append lock.
  *  There can be at most one write/append lock at a time.
  *  File handle position (and thus seek) is locked by write/append.
+ *  Pin locks are independent on the others, they are held by open streams
+ *  of obuck_fetch() and by iterations and they keep compaction from releasing
+ *  space of segments (see compact_release()).
  *
- *  These lock types map to a pair of normal read-write locks which
- *  we represent as fcntl() locks on the first and second byte of the
+ *  These lock types map to three normal read-write locks which
+ *  we represent as fcntl() locks on the first three bytes of the
  *  bucket file. [We cannot use flock() since it happily permits
  *  locking a shared fd (e.g., after fork()) multiple times at it also
  *  doesn't offer multiple locks on a single file.]
  *
- *			byte0		byte1
- *	Read		<read>		<read>
- *	Write		<write>		<write>
- *	Append		<write>		-
- *	Scan		-		<read>
+ *			byte0		byte1		byte2
+ *	Read		<read>		<read>		-
+ *	Write		<write>		<write>		-
+ *	Append		<write>		-		-
+ *	Scan		-		<read>		-
+ *	Pin		-		-		<read>
+ *
+ *  As the fcntl() locks are per process, pins are counted in struct obuck
+ *  and only the first one takes the lock.
  */
 
 static void
@@ -152,6 +177,34 @@ obuck_relock_read_to_scan(struct obuck *obuck)
   obuck_unlock_append(obuck);
 }
 
+static void
+obuck_pin(struct obuck *obuck)
+{
+  ucwlib_lock();
+  if (!obuck->pins++)
+    obuck_do_lock(obuck, F_RDLCK, 2, 1);
+  ucwlib_unlock();
+}
+
+static void
+obuck_unpin(struct obuck *obuck)
+{
+  ucwlib_lock();
+  ASSERT(obuck->pins);
+  if (!--obuck->pins)
+    obuck_do_lock(obuck, F_UNLCK, 2, 1);
+  ucwlib_unlock();
+}
+
+ucw_off_t
+obuck_lock_scan_size(struct obuck *obuck)
+{
+  obuck_lock_read(obuck);
+  ucw_off_t size = ucw_seek(obuck->fd, 0, SEEK_END);
+  obuck_relock_read_to_scan(obuck);
+  return size;
+}
+
 /*** FastIO emulation ***/
 
 struct fb_bucket {
@@ -166,6 +219,7 @@ struct fb_bucket {
 static void
 obuck_fb_close(struct fastbuf *f)
 {
+  obuck_unpin(FB_BUCKET(f)->obuck);
   xfree(f);
 }
 
@@ -277,6 +331,8 @@ obuck_update_params(struct obuck *obuck)
   obuck->max_size = max_size;
 }
 
+static void obuck_fwd_recover(struct obuck *obuck);
+
 void
 obuck_init(struct obuck *obuck, char *name, int writeable)
 {
@@ -285,6 +341,14 @@ obuck_init(struct obuck *obuck, char *name, int writeable)
   ASSERT(name && *name);
   obuck->p = obuck_params;
   obuck->name = name;
+  obuck->fwd_name = xmalloc(strlen(name) + 5);
+  sprintf(obuck->fwd_name, "%s.fwd", name);
+  obuck->fwd = NULL;
+  obuck->fwd_count = 0;
+  obuck->fwd_size = 0;
+  obuck->fwd_ino = 0;
+  obuck->fwd_mtime = 0;
+  obuck->pins = 0;
   obuck->fd = ucw_open(name, (writeable ? O_RDWR | O_CREAT : O_RDONLY), 0666);
   if (obuck->fd < 0)
     die("Unable to open bucket file %s: %m", obuck->name);
@@ -300,6 +364,12 @@ obuck_init(struct obuck *obuck, char *name, int writeable)
     }
   obuck_update_params(obuck);
   obuck_unlock(obuck);
+  if (writeable)
+    {
+      obuck_lock_write(obuck);
+      obuck_fwd_recover(obuck);
+      obuck_unlock(obuck);
+    }
 }
 
 void
@@ -308,6 +378,8 @@ obuck_cleanup(struct obuck *obuck)
   close(obuck->fd);
   if (obuck->write_fb)
     log(L_ERROR, "Bug: Forgot to close bucket write stream");
+  xfree(obuck->fwd);
+  xfree(obuck->fwd_name);
 }
 
 void
@@ -318,18 +390,35 @@ obuck_sync(struct obuck *obuck)
   fsync(obuck->fd);
 }
 
+static char *
+obuck_check_hdr(struct obuck_header *hdr, oid_t oid)
+{
+  if (hdr->magic != OBUCK_MAGIC)
+    return "Missing magic number";
+  if (hdr->oid == OBUCK_OID_DELETED)
+    return "Access to deleted bucket";
+  if (hdr->oid != oid)
+    return "Invalid backlink";
+  return NULL;
+}
+
 static void
 obuck_get(struct obuck *obuck, oid_t oid, struct obuck_context *ctx)
 {
-  ctx->pos = obuck_get_pos(oid);
-  if (ucw_pread(obuck->fd, &ctx->hdr, sizeof(ctx->hdr), ctx->pos) != sizeof(ctx->hdr))
-    obuck_broken(obuck, "Short header read", ctx->pos);
-  if (ctx->hdr.magic != OBUCK_MAGIC)
-    obuck_broken(obuck, "Missing magic number", ctx->pos);
-  if (ctx->hdr.oid == OBUCK_OID_DELETED)
-    obuck_broken(obuck, "Access to deleted bucket", ctx->pos);
-  if (ctx->hdr.oid != oid)
-    obuck_broken(obuck, "Invalid backlink", ctx->pos);
+  for (;;)
+    {
+      ctx->pos = obuck_get_pos(oid);
+      char *err;
+      if (ucw_pread(obuck->fd, &ctx->hdr, sizeof(ctx->hdr), ctx->pos) != sizeof(ctx->hdr))
+	err = "Short header read";
+      else if (!(err = obuck_check_hdr(&ctx->hdr, oid)))
+	return;
+      /* The bucket could have been moved by compaction */
+      oid_t new = obuck_forward(obuck, oid);
+      if (new == oid)
+	obuck_broken(obuck, err, ctx->pos);
+      oid = new;
+    }
 }
 
 void
@@ -350,6 +439,8 @@ obuck_find_first(struct obuck *obuck, struct obuck_context *ctx, uns flags)
 {
   ctx->pos = 0;
   ctx->hdr.magic = 0;
+  ctx->pinned = 1;
+  obuck_pin(obuck);
   return obuck_find_next(obuck, ctx, flags);
 }
 
@@ -368,7 +459,10 @@ obuck_find_next(struct obuck *obuck, struct obuck_context *ctx, uns flags)
       if (!(flags & OBUCK_NO_LOCK))
         obuck_unlock(obuck);
       if (!c)
-	return 0;
+	{
+	  obuck_find_end(obuck, ctx);
+	  return 0;
+	}
       if (c != sizeof(ctx->hdr))
 	obuck_broken(obuck, "Short header read", ctx->pos);
       if (ctx->hdr.magic != OBUCK_MAGIC)
@@ -378,11 +472,55 @@ obuck_find_next(struct obuck *obuck, struct obuck_context *ctx, uns flags)
     }
 }
 
+void
+obuck_find_end(struct obuck *obuck, struct obuck_context *ctx)
+{
+  if (ctx->pinned)
+    {
+      ctx->pinned = 0;
+      obuck_unpin(obuck);
+    }
+}
+
 struct fastbuf *
 obuck_fetch(struct obuck *obuck, struct obuck_context *ctx)
 {
   struct fastbuf *b;
-  uns official_buflen = ALIGN_TO(MIN(ctx->hdr.length, obuck->p.io_buflen), OBUCK_ALIGN);
+  struct obuck_context c = *ctx;
+
+  /*
+   *  The stream reads the bucket lazily without any locks, so keep compaction
+   *  from releasing it. Before we got the pin, the bucket could have been moved
+   *  since it was found, so check that it is still there and if it is not, read
+   *  the copy. If it has just been deleted, it can be read as before. The caller's
+   *  context stays untouched, it can be an iteration. Positions of deleted buckets
+   *  are stable as long as the caller iterates.
+   */
+  obuck_pin(obuck);
+  if (c.hdr.oid != OBUCK_OID_DELETED)
+    {
+      struct obuck_header hdr;
+      if (ucw_pread(obuck->fd, &hdr, sizeof(hdr), c.pos) != sizeof(hdr) ||
+	  hdr.magic != OBUCK_MAGIC || hdr.oid != c.hdr.oid || hdr.length != c.hdr.length)
+	{
+	  DBG("Bucket %08x changed while being fetched", c.hdr.oid);
+	  obuck_lock_read(obuck);
+	  oid_t new = obuck_forward(obuck, c.hdr.oid);
+	  if (new != c.hdr.oid)
+	    {
+	      c.pos = obuck_get_pos(new);
+	      if (ucw_pread(obuck->fd, &hdr, sizeof(hdr), c.pos) != sizeof(hdr) ||
+		  hdr.magic != OBUCK_MAGIC || hdr.oid != new && hdr.oid != OBUCK_OID_DELETED)
+		obuck_broken(obuck, "Lost copy of a compacted bucket", c.pos);
+	      c.hdr.length = hdr.length;
+	    }
+	  else if (hdr.magic != OBUCK_MAGIC || hdr.length != c.hdr.length)
+	    obuck_broken(obuck, "Bucket released while being fetched", c.pos);
+	  obuck_unlock(obuck);
+	}
+    }
+
+  uns official_buflen = ALIGN_TO(MIN(c.hdr.length, obuck->p.io_buflen), OBUCK_ALIGN);
   uns real_buflen = official_buflen + OBUCK_ALIGN;
 
   b = xmalloc(sizeof(struct fb_bucket) + real_buflen);
@@ -396,8 +534,8 @@ obuck_fetch(struct obuck *obuck, struct obuck_context *ctx)
   b->close = obuck_fb_close;
   b->config = NULL;
   b->can_overwrite_buffer = 2;
-  FB_BUCKET(b)->start_pos = ctx->pos;
-  FB_BUCKET(b)->bucket_size = ctx->hdr.length;
+  FB_BUCKET(b)->start_pos = c.pos;
+  FB_BUCKET(b)->bucket_size = c.hdr.length;
   FB_BUCKET(b)->obuck = obuck;
   return b;
 }
@@ -418,21 +556,26 @@ obuck_fetch_oid(struct obuck *obuck, struct obuck_context *ctx, uns flags)
 {
   oid_t oid = ctx->hdr.oid;
   ASSERT(oid < OBUCK_OID_FIRST_SPECIAL);
-  ucw_off_t pos = ctx->pos = obuck_get_pos(oid);
+  ucw_off_t pos, size;
   uns prefetch = MAX(sizeof(struct obuck_header), obuck->p.prefetch_size);
   struct obuck_fetch_oid_fb *b = xmalloc(sizeof(*b) - sizeof(struct obuck_header) + prefetch);
   bzero(b, sizeof(*b));
   if (!(flags & OBUCK_NO_LOCK))
     obuck_lock_read(obuck);
-  ucw_off_t size = ucw_pread(obuck->fd, (byte *)&b->buf, prefetch, pos);
-  if (size < (ucw_off_t)sizeof(b->buf))
-    obuck_broken(obuck, "Short header read", pos);
-  if (b->buf.magic != OBUCK_MAGIC)
-    obuck_broken(obuck, "Missing magic number", pos);
-  if (b->buf.oid == OBUCK_OID_DELETED)
-    obuck_broken(obuck, "Access to deleted bucket", pos);
-  if (b->buf.oid != oid)
-    obuck_broken(obuck, "Invalid backlink", pos);
+  for (;;)
+    {
+      pos = ctx->pos = obuck_get_pos(oid);
+      size = ucw_pread(obuck->fd, (byte *)&b->buf, prefetch, pos);
+      char *err;
+      if (size < (ucw_off_t)sizeof(b->buf))
+	err = "Short header read";
+      else if (!(err = obuck_check_hdr(&b->buf, oid)))
+	break;
+      oid_t new = obuck_forward(obuck, oid);
+      if (new == oid)
+	obuck_broken(obuck, err, pos);
+      oid = new;
+    }
   ctx->hdr = b->buf;
   uns size2 = b->buf.length + 4 + ((uns)(OBUCK_ALIGN - sizeof(struct obuck_header) - b->buf.length - 4) & (OBUCK_ALIGN - 1));
   b = xrealloc(b, sizeof(*b) + size2);
@@ -731,6 +874,7 @@ obuck_shakedown(struct obuck *obuck, int (*kibitz)(struct obuck_header *old, oid
 
   /* We need to be the only accessor, all the object ID's are becoming invalid */
   obuck_lock_write(obuck);
+  obuck_fwd_recover(obuck);
   r_file_size = ucw_seek(obuck->fd, 0, SEEK_END);
   ASSERT(!(r_file_size & (OBUCK_ALIGN - 1)));
   if (r_file_size >= (0x100000000 << OBUCK_SHIFT) - buflen)
@@ -875,6 +1019,10 @@ obuck_shakedown(struct obuck *obuck, int (*kibitz)(struct obuck_header *old, oid
   ucw_ftruncate(obuck->fd, wstart);
   shake_sync(obuck);
 
+  /* All object ID's have been renumbered, so the forwards of compacted buckets are void */
+  if (unlink(obuck->fwd_name) < 0 && errno != ENOENT)
+    die("Cannot remove %s: %m", obuck->fwd_name);
+
   obuck_unlock(obuck);
   xfree(buf);
   return;
@@ -891,26 +1039,620 @@ obuck_shakedown(struct obuck *obuck, int (*kibitz)(struct obuck_header *old, oid
   die("Fatal error during object pool shakedown");
 }
 
+/*** Forwarding of buckets moved by compaction ***/
+
+struct obuck_fwd {
+  oid_t old, new;
+};
+
+/* Both oids equal to this mark the end of a finished compaction; such entries are never looked up */
+#define OBUCK_FWD_DONE OBUCK_OID_DELETED
+
+#define ASORT_PREFIX(x) obuck_fwd_##x
+#define ASORT_KEY_TYPE struct obuck_fwd
+#define ASORT_LT(x,y) ((x).old < (y).old)
+#include "ucw/sorter/array-simple.h"
+
+static void
+obuck_fwd_load(struct obuck *obuck)
+{
+  ucw_stat_t st;
+  if (ucw_stat(obuck->fwd_name, &st) < 0)
+    {
+      if (errno != ENOENT)
+	die("Cannot stat %s: %m", obuck->fwd_name);
+      bzero(&st, sizeof(st));
+    }
+  if (st.st_size == obuck->fwd_size && (u64) st.st_ino == obuck->fwd_ino && (u64) st.st_mtime == obuck->fwd_mtime)
+    return;
+
+  /* The file has changed (or it has been replaced), so read it once again */
+  xfree(obuck->fwd);
+  obuck->fwd = NULL;
+  obuck->fwd_count = 0;
+  obuck->fwd_size = st.st_size;
+  obuck->fwd_ino = st.st_ino;
+  obuck->fwd_mtime = st.st_mtime;
+  if (!st.st_size)
+    return;
+  int fd = ucw_open(obuck->fwd_name, O_RDONLY);
+  if (fd < 0)
+    die("Cannot open %s: %m", obuck->fwd_name);
+  uns count = st.st_size / sizeof(struct obuck_fwd);
+  obuck->fwd = xmalloc(count * sizeof(struct obuck_fwd) + 1);
+  ucw_off_t l = ucw_pread(fd, obuck->fwd, count * sizeof(struct obuck_fwd), 0);
+  if (l < 0)
+    die("Error reading %s: %m", obuck->fwd_name);
+  close(fd);
+  obuck->fwd_count = l / sizeof(struct obuck_fwd);
+  obuck_fwd_sort(obuck->fwd, obuck->fwd_count);
+  DBG("Loaded %d bucket forwards", obuck->fwd_count);
+}
+
+#define OBUCK_FWD_LT(ary,i,x) (ary)[i].old < (x)
+
+oid_t
+obuck_forward(struct obuck *obuck, oid_t oid)
+{
+  /*
+   * Compaction moves buckets only to fresh positions at the end of the file
+   * and never reuses the original ones, so every oid is forwarded at most once
+   * and the chains of forwards cannot loop.
+   */
+  ucwlib_lock();
+  obuck_fwd_load(obuck);
+  for (;;)
+    {
+      uns i = BIN_SEARCH_FIRST_GE_CMP(obuck->fwd, obuck->fwd_count, oid, OBUCK_FWD_LT);
+      if (i >= obuck->fwd_count || obuck->fwd[i].old != oid)
+	break;
+      oid = obuck->fwd[i].new;
+    }
+  ucwlib_unlock();
+  return oid;
+}
+
+static void
+obuck_fwd_append(struct obuck *obuck, struct obuck_fwd *fwd, uns n)
+{
+  int fd = ucw_open(obuck->fwd_name, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd < 0)
+    die("Cannot open %s: %m", obuck->fwd_name);
+  int len = n * sizeof(*fwd);
+  if (write(fd, fwd, len) != len)
+    die("Error writing %s: %m", obuck->fwd_name);
+  if (obuck->p.shake_security)
+    ucw_fdatasync(fd);
+  close(fd);
+}
+
+static void
+obuck_fwd_commit(struct obuck *obuck, struct obuck_fwd *fwd, uns n)
+{
+  /*
+   * The forwards have been recorded, so bring the copies to life and delete
+   * the originals. If the original is not live, the move has already been
+   * finished before a crash (or the bucket has been deleted since then).
+   */
+  for (uns i = 0; i < n; i++)
+    {
+      struct obuck_header hdr;
+      ucw_off_t pos = obuck_get_pos(fwd[i].old);
+      if (ucw_pread(obuck->fd, &hdr, sizeof(hdr), pos) != sizeof(hdr) ||
+	  hdr.magic != OBUCK_MAGIC || hdr.oid != fwd[i].old)
+	continue;
+      struct obuck_header copy;
+      ucw_off_t cpos = obuck_get_pos(fwd[i].new);
+      if (ucw_pread(obuck->fd, &copy, sizeof(copy), cpos) != sizeof(copy) ||
+	  copy.magic != OBUCK_MAGIC || copy.oid != OBUCK_OID_DELETED && copy.oid != fwd[i].new)
+	obuck_broken(obuck, "Lost copy of a compacted bucket", cpos);
+      copy.oid = fwd[i].new;
+      shake_write(obuck, &copy, sizeof(copy), cpos);
+      hdr.oid = OBUCK_OID_DELETED;
+      shake_write(obuck, &hdr, sizeof(hdr), pos);
+    }
+  if (obuck->p.shake_security)
+    ucw_fdatasync(obuck->fd);
+  struct obuck_fwd done = { OBUCK_FWD_DONE, OBUCK_FWD_DONE };
+  obuck_fwd_append(obuck, &done, 1);
+}
+
+static void
+obuck_fwd_recover(struct obuck *obuck)
+{
+  /*
+   * Finish a compaction interrupted by a crash: the forwards recorded after
+   * the last end mark still have to be committed. Copies whose forwards
+   * have not been recorded are just deleted buckets. Needs the write lock.
+   */
+  int fd = ucw_open(obuck->fwd_name, O_RDWR);
+  if (fd < 0)
+    {
+      if (errno != ENOENT)
+	die("Cannot open %s: %m", obuck->fwd_name);
+      return;
+    }
+  ucw_off_t size = ucw_seek(fd, 0, SEEK_END);
+  uns count = size / sizeof(struct obuck_fwd);
+  struct obuck_fwd last;
+  if ((ucw_off_t)(count * sizeof(last)) == size &&
+      (!count || ucw_pread(fd, &last, sizeof(last), size - sizeof(last)) == sizeof(last) && last.old == OBUCK_FWD_DONE))
+    {
+      close(fd);
+      return;
+    }
+
+  struct obuck_fwd *fwd = xmalloc(count * sizeof(*fwd) + 1);
+  if (ucw_pread(fd, fwd, count * sizeof(*fwd), 0) != (int)(count * sizeof(*fwd)))
+    die("Error reading %s: %m", obuck->fwd_name);
+  uns i = count;
+  while (i && fwd[i-1].old != OBUCK_FWD_DONE)
+    i--;
+  log(L_INFO, "Finishing interrupted compaction of %s (%d forwards)", obuck->name, count - i);
+  /* Drop a partially written entry, so that the end mark is aligned */
+  if (ucw_ftruncate(fd, (ucw_off_t) count * sizeof(*fwd)) < 0)
+    die("Cannot truncate %s: %m", obuck->fwd_name);
+  close(fd);
+  obuck_fwd_commit(obuck, fwd + i, count - i);
+  xfree(fwd);
+}
+
+/*** Online compaction ***/
+
+/*
+ *  Liveness of segments is not kept anywhere, we read all bucket headers
+ *  every time. Persistent counters would have to be updated by every writer
+ *  (including obuck_delete() in other processes and writers killed in the
+ *  middle), while a scan costs a single pread() per bucket, which is small
+ *  compared to moving the buckets. Still, on large pools it takes a while,
+ *  so rather compact many segments after a single scan (as obuck_compact()
+ *  with no limit does) than call obuck_compact() for one segment at a time.
+ */
+uns
+obuck_segments(struct obuck *obuck, struct obuck_segment **segs)
+{
+  uns n = 0, max = 16;
+  struct obuck_segment *s = xmalloc(max * sizeof(*s));
+  struct obuck_context ctx;
+  u64 limit = 0;
+  int ok = obuck_find_first(obuck, &ctx, OBUCK_FULL);
+  while (ok)
+    {
+      if ((u64)ctx.pos >= limit)
+	{
+	  /* A new segment starts with the first bucket beyond the boundary */
+	  if (n == max)
+	    s = xrealloc(s, (max *= 2) * sizeof(*s));
+	  if (n)
+	    s[n-1].end = ctx.pos >> OBUCK_SHIFT;
+	  bzero(&s[n], sizeof(*s));
+	  s[n++].start = ctx.pos >> OBUCK_SHIFT;
+	  limit = ((u64)ctx.pos / obuck->p.segment_size + 1) * obuck->p.segment_size;
+	}
+      uns l = obuck_bucket_size(ctx.hdr.length);
+      if (ctx.hdr.oid == OBUCK_OID_DELETED)
+	{
+	  s[n-1].dead_count++;
+	  s[n-1].dead += l;
+	}
+      else
+	{
+	  s[n-1].live_count++;
+	  s[n-1].live += l;
+	}
+      ok = obuck_find_next(obuck, &ctx, OBUCK_FULL);
+    }
+  if (n)
+    s[n-1].end = ctx.pos >> OBUCK_SHIFT;
+  *segs = s;
+  return n;
+}
+
+static int
+compact_release(struct obuck *obuck, ucw_off_t start, ucw_off_t end)
+{
+  /*
+   *  Readers holding positions inside the segment (see obuck_pin()) would
+   *  read erased data, so we release the space only if there are none.
+   *  Otherwise the segment stays as a sequence of deleted buckets and it
+   *  is picked up by the next compaction. Pins of this process are not
+   *  seen by fcntl(), but they are counted and we keep the counter locked
+   *  until we are done, so that other threads cannot pin in the meantime.
+   */
+  struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 2, .l_len = 1 };
+  ucwlib_lock();
+  if (obuck->pins)
+    {
+      ucwlib_unlock();
+      return 0;
+    }
+  if (fcntl(obuck->fd, F_SETLK, &fl) < 0)
+    {
+      if (errno != EACCES && errno != EAGAIN)
+	die("fcntl lock: %m");
+      ucwlib_unlock();
+      return 0;
+    }
+
+  shake_erase(obuck, start, end);
+#if defined(CONFIG_LINUX) && defined(FALLOC_FL_PUNCH_HOLE)
+  /* Give the space back to the filesystem, keeping the headers and trailers written by shake_erase() */
+  for (ucw_off_t pos = start; pos < end; )
+    {
+      ucw_off_t next = pos + MIN(0x40000000, end - pos);
+      if (next - pos > 2*OBUCK_ALIGN &&
+	  fallocate(obuck->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos + OBUCK_ALIGN, next - pos - 2*OBUCK_ALIGN) < 0)
+	{
+	  DBG("Cannot punch hole to %s: %m", obuck->name);
+	  break;
+	}
+      pos = next;
+    }
+#endif
+  obuck_do_lock(obuck, F_UNLCK, 2, 1);
+  ucwlib_unlock();
+  return 1;
+}
+
+static uns
+compact_scan(struct obuck *obuck, ucw_off_t start, ucw_off_t end, u64 *live)
+{
+  /* Check the structure of the segment before touching anything */
+  *live = 0;
+  for (ucw_off_t pos = start; pos < end; )
+    {
+      struct obuck_header hdr;
+      if (ucw_pread(obuck->fd, &hdr, sizeof(hdr), pos) != sizeof(hdr))
+	obuck_broken(obuck, "Short header read", pos);
+      if (hdr.magic != OBUCK_MAGIC || hdr.oid != OBUCK_OID_DELETED && hdr.oid != (oid_t)(pos >> OBUCK_SHIFT))
+	obuck_broken(obuck, "Header mismatch", pos);
+      uns l = obuck_bucket_size(hdr.length);
+      if (hdr.oid != OBUCK_OID_DELETED)
+	*live += l;
+      pos += l;
+      if (pos > end)
+	return 0;
+    }
+  return 1;
+}
+
+int
+obuck_compact_segment(struct obuck *obuck, struct obuck_segment *seg, int (*kibitz)(struct obuck_header *old, oid_t new, byte *buck), uns flags)
+{
+  ucw_off_t start = obuck_get_pos(seg->start), end = obuck_get_pos(seg->end);
+  uns buflen = OBUCK_ALIGN, nfwd = 0, maxfwd = 16;
+  byte *buf = xmalloc(buflen);
+  struct obuck_fwd *fwd = xmalloc(maxfwd * sizeof(*fwd));
+  int done = 0;
+  u64 live;
+
+  /* No other process may access the pool while the buckets are being moved */
+  ASSERT(!obuck->write_fb);
+  if (!(flags & OBUCK_NO_LOCK))
+    obuck_lock_write(obuck);
+  obuck_fwd_recover(obuck);
+  ucw_off_t file_end = ucw_seek(obuck->fd, 0, SEEK_END);
+  if (end >= file_end || start >= end || !compact_scan(obuck, start, end, &live))
+    {
+      /* The segment must not contain the end of the file, which is still growing,
+       * and it must not have changed since it was scanned by obuck_segments(). */
+      DBG("Not compacting segment %08x-%08x", seg->start, seg->end);
+      goto out;
+    }
+  if ((u64)file_end + live >= (u64)obuck->max_size)
+    {
+      log(L_ERROR, "Not enough space left in %s for compaction", obuck->name);
+      goto out;
+    }
+  DBG("Compacting segment %08x-%08x", seg->start, seg->end);
+
+  /* Copy all live buckets to the end of the file */
+  ucw_off_t wpos = file_end;
+  for (ucw_off_t pos = start; pos < end; )
+    {
+      struct obuck_header *hdr = (struct obuck_header *) buf;
+      if (ucw_pread(obuck->fd, hdr, sizeof(*hdr), pos) != sizeof(*hdr))
+	obuck_broken(obuck, "Short header read", pos);
+      uns l = obuck_bucket_size(hdr->length);
+      if (hdr->oid == OBUCK_OID_DELETED)
+	{
+	  kibitz(hdr, OBUCK_OID_DELETED, NULL);
+	  pos += l;
+	  continue;
+	}
+      if (l > buflen)
+	{
+	  buf = xrealloc(buf, buflen = l);
+	  hdr = (struct obuck_header *) buf;
+	}
+      if (ucw_pread(obuck->fd, buf, l, pos) != (int) l)
+	obuck_broken(obuck, "Short read", pos);
+      if (GET_U32(buf + l - 4) != OBUCK_TRAILER)
+	obuck_broken(obuck, "Missing trailer", pos);
+      pos += l;
+      int status = kibitz(hdr, wpos >> OBUCK_SHIFT, (byte *)(hdr+1));
+      if (!status)
+	continue;
+      if (status > 1)
+	{
+	  /* Changed! Reconstruct the trailer. */
+	  uns lnew = obuck_bucket_size(hdr->length);
+	  ASSERT(lnew <= l);
+	  l = lnew;
+	  PUT_U32(buf + l - 4, OBUCK_TRAILER);
+	}
+      if (nfwd == maxfwd)
+	fwd = xrealloc(fwd, (maxfwd *= 2) * sizeof(*fwd));
+      fwd[nfwd].old = hdr->oid;
+      fwd[nfwd].new = wpos >> OBUCK_SHIFT;
+      nfwd++;
+      /* Until the forward is recorded, the copy stays deleted, so a crash cannot leave two live copies */
+      hdr->oid = OBUCK_OID_DELETED;
+      shake_write(obuck, buf, l, wpos);
+      wpos += l;
+    }
+  if (obuck->p.shake_security)
+    ucw_fdatasync(obuck->fd);
+
+  /* Record the forwards and switch to the copies */
+  if (nfwd)
+    {
+      obuck_fwd_append(obuck, fwd, nfwd);
+      obuck_fwd_commit(obuck, fwd, nfwd);
+    }
+
+  /* Replace the whole segment, which contains only deleted buckets now, by a single deleted bucket */
+  if (compact_release(obuck, start, end))
+    log(L_INFO, "Compacted segment %08x-%08x of %s: moved %d buckets, released %d MB",
+	seg->start, seg->end, obuck->name, nfwd, (uns)((end - start - (wpos - file_end)) >> 20));
+  else
+    log(L_INFO, "Compacted segment %08x-%08x of %s: moved %d buckets, space not released as the pool is being read",
+	seg->start, seg->end, obuck->name, nfwd);
+  shake_sync(obuck);
+  done = 1;
+
+ out:
+  if (!(flags & OBUCK_NO_LOCK))
+    obuck_unlock(obuck);
+  xfree(buf);
+  xfree(fwd);
+  return done;
+}
+
+static int
+compact_candidate(struct obuck *obuck, struct obuck_segment *s)
+{
+  /* A single deleted bucket is what a compacted segment looks like, nothing to gain there */
+  if (!s->dead_count || !s->live_count && s->dead_count == 1)
+    return 0;
+  return s->live * 100 < (s->live + s->dead) * obuck->p.compact_threshold;
+}
+
+#define ASORT_PREFIX(x) compact_##x
+#define ASORT_KEY_TYPE struct obuck_segment
+#define ASORT_LT(x,y) ((x).live < (y).live)
+#include "ucw/sorter/array-simple.h"
+
+uns
+obuck_compact(struct obuck *obuck, uns max_segs, int (*kibitz)(struct obuck_header *old, oid_t new, byte *buck))
+{
+  struct obuck_segment *segs;
+  uns n = obuck_segments(obuck, &segs);
+  uns cand = 0, done = 0;
+
+  /* Process the emptiest segments first; the last one is still being appended to */
+  for (uns i = 0; i+1 < n; i++)
+    if (compact_candidate(obuck, &segs[i]))
+      segs[cand++] = segs[i];
+  compact_sort(segs, cand);
+  log(L_INFO, "Found %d of %d segments of %s worth compacting", cand, n, obuck->name);
+  for (uns i = 0; i < cand && (!max_segs || done < max_segs); i++)
+    done += obuck_compact_segment(obuck, &segs[i], kibitz, 0);
+  xfree(segs);
+  return done;
+}
+
 /*** Testing ***/
 
 #ifdef TEST
 
+#include "sherlock/object.h"
+#include "ucw/getopt.h"
+
+#include <stdlib.h>
+#include <sys/wait.h>
+
 #define COUNT 5000
 #define MAXLEN 10000
-#define KILLPERC 13
 #define LEN(i) ((259309*(i))%MAXLEN)
 
-static int test_kibitz(struct obuck_header *h, oid_t new, byte *buck)
+static uns killperc = 13;
+
+static int test_kibitz(struct obuck_header *h UNUSED, oid_t new UNUSED, byte *buck UNUSED)
 {
   return 1;
 }
 
+static void test_read(struct obuck *obuck, oid_t *ids)
+{
+  struct obuck_context ctx;
+  for (uns j=0; j<COUNT; j++)
+    if (j % 100 >= killperc)
+      {
+	ctx.hdr.oid = ids[j];
+	obuck_find_by_oid(obuck, &ctx, 0);
+	struct fastbuf *b = obuck_fetch(obuck, &ctx);
+	printf("Reading %08x %d\n", ids[j], ctx.hdr.length);
+	if (ctx.hdr.length != LEN(j))
+	  die("Invalid length");
+	for (uns i=0; i<ctx.hdr.length; i++)
+	  if ((uns) bgetc(b) != (i+j) % 256)
+	    die("Contents mismatch");
+	if (bgetc(b) >= 0)
+	  die("EOF mismatch");
+	bclose(b);
+      }
+}
+
+static void test_walk(struct obuck *obuck, uns cnt)
+{
+  struct obuck_context ctx;
+  if (obuck_find_first(obuck, &ctx, 0))
+    do
+      {
+	printf("<<< %08x\t%d\n", ctx.hdr.oid, ctx.hdr.length);
+	cnt--;
+      }
+    while (obuck_find_next(obuck, &ctx, 0));
+  if (cnt)
+    die("Walk mismatch");
+}
+
+static void test_check(struct fastbuf *b, uns len)
+{
+  /* We do not know which bucket it was, but its contents must follow the pattern */
+  int first = bgetc(b);
+  for (uns i=1; i<len; i++)
+    if (bgetc(b) != (int)((first+i) % 256))
+      die("Contents mismatch");
+  if (bgetc(b) >= 0)
+    die("EOF mismatch");
+}
+
+static uns test_walk_fetch(struct obuck *obuck, struct obuck_context *ctx, int started)
+{
+  uns cnt = 0;
+  if (started || obuck_find_first(obuck, ctx, 0))
+    do
+      {
+	struct fastbuf *b = obuck_fetch(obuck, ctx);
+	test_check(b, ctx->hdr.length);
+	bclose(b);
+	cnt++;
+      }
+    while (obuck_find_next(obuck, ctx, 0));
+  return cnt;
+}
+
+static void NONRET test_reader(char *name, oid_t oid, uns cnt, int to_parent, int from_parent)
+{
+  struct obuck obuck;
+  struct obuck_context ctx, it;
+  byte c;
+
+  /* Keep a bucket and an iteration open while the parent compacts */
+  obuck_init(&obuck, name, 0);
+  ctx.hdr.oid = oid;
+  obuck_find_by_oid(&obuck, &ctx, 0);
+  struct fastbuf *b = obuck_fetch(&obuck, &ctx);
+  if (!obuck_find_first(&obuck, &it, 0))
+    die("Empty pool");
+  if (write(to_parent, "", 1) != 1 || read(from_parent, &c, 1) != 1)
+    die("Cannot talk to the parent: %m");
+  test_check(b, ctx.hdr.length);
+  bclose(b);
+  /* A bucket can be seen twice if it has been moved past the iterator, but none can be lost */
+  if (test_walk_fetch(&obuck, &it, 1) < cnt)
+    die("Walk lost buckets");
+  if (write(to_parent, "", 1) != 1)
+    die("Cannot talk to the parent: %m");
+
+  /* Then keep reading until the parent closes the pipe */
+  fcntl(from_parent, F_SETFL, O_NONBLOCK);
+  uns walks = 0;
+  while (read(from_parent, &c, 1) < 0 && errno == EAGAIN)
+    {
+      test_walk_fetch(&obuck, &it, 0);
+      walks++;
+    }
+  printf("Reader finished %d walks\n", walks);
+  obuck_cleanup(&obuck);
+  exit(0);
+}
+
+static uns test_concurrent(struct obuck *obuck, char *name, oid_t *ids, uns cnt)
+{
+  int to_child[2], to_parent[2];
+  uns victim = COUNT/2 + 50;
+  byte c;
+
+  /* Make all segments sparse again */
+  obuck->p.segment_size = 1 << 20;
+  obuck->p.compact_threshold = 100;
+  for (uns j=0; j<COUNT; j++)
+    if (j % 100 >= killperc && j % 100 < killperc + 20)
+      {
+	obuck_delete(obuck, ids[j]);
+	cnt--;
+      }
+  killperc += 20;
+  struct obuck_context ctx;
+  ctx.hdr.oid = ids[victim];
+  obuck_find_by_oid(obuck, &ctx, 0);
+
+  if (pipe(to_child) < 0 || pipe(to_parent) < 0)
+    die("pipe: %m");
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+    die("fork: %m");
+  if (!pid)
+    {
+      close(to_child[1]);
+      close(to_parent[0]);
+      test_reader(name, ids[victim], cnt, to_parent[1], to_child[0]);
+    }
+  close(to_child[0]);
+  close(to_parent[1]);
+  if (read(to_parent[0], &c, 1) != 1)
+    die("Reader failed to start");
+
+  /* The bucket must be moved, but its space not released while the reader holds it */
+  if (!obuck_compact(obuck, 0, test_kibitz))
+    die("Nothing compacted");
+  if (obuck_forward(obuck, ids[victim]) == ids[victim])
+    die("Victim not moved");
+  struct obuck_header hdr;
+  if (ucw_pread(obuck->fd, &hdr, sizeof(hdr), ctx.pos) != sizeof(hdr) ||
+      hdr.magic != OBUCK_MAGIC || hdr.oid != OBUCK_OID_DELETED || hdr.length != LEN(victim))
+    die("Segment released under the reader's hands");
+  if (write(to_child[1], "", 1) != 1 || read(to_parent[0], &c, 1) != 1)
+    die("Cannot talk to the reader: %m");
+
+  /* Compact repeatedly while the reader keeps walking the pool */
+  for (uns k=0; k<5; k++)
+    {
+      for (uns j=0; j<COUNT; j++)
+	if (j % 100 == killperc)
+	  {
+	    obuck_delete(obuck, ids[j]);
+	    cnt--;
+	  }
+      killperc++;
+      obuck_compact(obuck, 0, test_kibitz);
+    }
+  close(to_child[1]);
+  close(to_parent[0]);
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+    die("Reader failed");
+
+  /* Nobody reads now, so the deferred segments get released */
+  obuck_compact(obuck, 0, test_kibitz);
+  if (ucw_pread(obuck->fd, &hdr, sizeof(hdr), ctx.pos) != sizeof(hdr) || hdr.length == LEN(victim))
+    die("Deferred segment not released");
+  test_read(obuck, ids);
+  test_walk(obuck, cnt);
+  return cnt;
+}
+
 int main(int argc, char **argv)
 {
-  int ids[COUNT];
-  unsigned int i, j, cnt;
+  oid_t ids[COUNT];
+  uns cnt = 0;
   struct obuck_header h;
-  struct fastbuf *b;
+  struct obuck obuck;
+  char *name = "tmp/bucket-test";
 
   log_init(NULL);
   if (cf_getopt(argc, argv, CF_SHORT_OPTS, CF_NO_LONG_OPTS, NULL) >= 0 ||
@@ -920,52 +1662,72 @@ int main(int argc, char **argv)
     exit(1);
   }
 
-  unlink(obuck_name);
-  obuck_init(1);
-  for(j=0; j<COUNT; j++)
+  unlink(name);
+  obuck_init(&obuck, name, 1);
+  unlink(obuck.fwd_name);
+  for (uns j=0; j<COUNT; j++)
     {
-      b = obuck_create();
-      for(i=0; i<LEN(j); i++)
+      struct fastbuf *b = obuck_create(&obuck);
+      for (uns i=0; i<LEN(j); i++)
         bputc(b, (i+j) % 256);
-      obuck_create_end(b, BUCKET_TYPE_PLAIN, &h);
+      obuck_create_end(&obuck, b, BUCKET_TYPE_PLAIN, &h);
       printf("Writing %08x %d\n", h.oid, h.length);
       ids[j] = h.oid;
     }
-  for(j=0; j<COUNT; j++)
-    if (j % 100 < KILLPERC)
+  for (uns j=0; j<COUNT; j++)
+    if (j % 100 < killperc)
       {
 	printf("Deleting %08x\n", ids[j]);
-	obuck_delete(ids[j]);
-      }
-  cnt = 0;
-  for(j=0; j<COUNT; j++)
-    if (j % 100 >= KILLPERC)
-      {
-	cnt++;
-	h.oid = ids[j];
-	obuck_find_by_oid(&h);
-	b = obuck_fetch();
-	printf("Reading %08x %d\n", h.oid, h.length);
-	if (h.length != LEN(j))
-	  die("Invalid length");
-	for(i=0; i<h.length; i++)
-	  if ((unsigned) bgetc(b) != (i+j) % 256)
-	    die("Contents mismatch");
-	if (bgetc(b) >= 0)
-	  die("EOF mismatch");
-	bclose(b);
+	obuck_delete(&obuck, ids[j]);
       }
-  obuck_shakedown(test_kibitz);
-  if (obuck_find_first(&h, 0))
-    do
-      {
-	printf("<<< %08x\t%d\n", h.oid, h.length);
-	cnt--;
-      }
-    while (obuck_find_next(&h, 0));
-  if (cnt)
-    die("Walk mismatch");
-  obuck_cleanup();
+    else
+      cnt++;
+  test_read(&obuck, ids);
+
+  /* Move the buckets of all segments except for the last one, then read them by their old ID's */
+  obuck.p.segment_size = 1 << 20;
+  obuck.p.compact_threshold = 100;
+  uns segs = obuck_compact(&obuck, 0, test_kibitz);
+  if (!segs)
+    die("Nothing compacted");
+  printf("Compacted %d segments\n", segs);
+  uns moved = 0;
+  for (uns j=0; j<COUNT; j++)
+    if (j % 100 >= killperc && obuck_forward(&obuck, ids[j]) != ids[j])
+      moved++;
+  if (!moved)
+    die("No bucket has been forwarded");
+  test_read(&obuck, ids);
+  test_walk(&obuck, cnt);
+
+  /* Simulate a crash after a bucket has been copied and its forward recorded */
+  struct obuck_context ctx;
+  ctx.hdr.oid = ids[COUNT-1];
+  obuck_find_by_oid(&obuck, &ctx, 0);
+  uns l = obuck_bucket_size(ctx.hdr.length);
+  byte *buf = xmalloc(l);
+  ucw_off_t end = ucw_seek(obuck.fd, 0, SEEK_END);
+  if (ucw_pread(obuck.fd, buf, l, ctx.pos) != (int) l)
+    die("Short read");
+  ((struct obuck_header *) buf)->oid = OBUCK_OID_DELETED;
+  shake_write(&obuck, buf, l, end);
+  struct obuck_fwd fwd = { ctx.hdr.oid, end >> OBUCK_SHIFT };
+  obuck_fwd_append(&obuck, &fwd, 1);
+  xfree(buf);
+  obuck_cleanup(&obuck);
+  obuck_init(&obuck, name, 1);
+  if (obuck_forward(&obuck, ids[COUNT-1]) != fwd.new)
+    die("Interrupted compaction not recovered");
+  test_read(&obuck, ids);
+  test_walk(&obuck, cnt);
+
+  /* Compaction must not pull the ground from under readers in other processes */
+  cnt = test_concurrent(&obuck, name, ids, cnt);
+
+  obuck_shakedown(&obuck, test_kibitz);
+  test_walk(&obuck, cnt);
+  obuck_cleanup(&obuck);
+  unlink(name);
   return 0;
 }
 
@@ -30,6 +30,22 @@
  * the OBUCK_NO_LOCK flag and take care of locking yourself. In particular,
  * combining reads of existing buckets and a single append of a new bucket
  * is always safe.
+ *
+ * Compaction: Besides the shakedown, which rewrites the whole pool at once
+ * and renumbers all buckets, the pool can be compacted online by segments
+ * of Buckets.SegmentSize bytes. Live buckets of sparse segments are moved
+ * to the end of the file and the segment is replaced by a single deleted
+ * bucket (with the space released to the filesystem where supported).
+ * Moves are recorded in a forwarding file <name>.fwd, which is consulted
+ * when a bucket is not found at its original position, so readers holding
+ * old object ID's can keep going. The forwarding file is removed by the
+ * next shakedown. The copies are written as deleted buckets and brought to
+ * life only after the forwards have been recorded; a compaction interrupted
+ * by a crash is finished when the pool is opened for writing next time.
+ * Streams returned by obuck_fetch() and iterations by obuck_find_first/next()
+ * keep positions in the file, so while any of them is open (in any process),
+ * the moved buckets are only marked as deleted and the space of the segment
+ * is released by a later compaction.
  */
 
 #define OBUCK_SHIFT CONFIG_BUCKET_SHIFT
@@ -49,6 +65,11 @@ struct obuck_params {
   uns slurp_buflen;
   uns prefetch_size;
   u64 max_size;
+  uns segment_size;
+  uns compact_threshold;
+  uns scan_threads;
+  uns scan_chunk_size;
+  struct fb_params scan_fb;
 };
 
 /* Bucket header */
@@ -64,6 +85,7 @@ struct obuck_header {
 struct obuck_context {
   ucw_off_t pos;
   struct obuck_header hdr;
+  uns pinned;					/* Iteration in progress, see obuck_find_end() */
 };
 
 /* Bucket file handle */
@@ -83,6 +105,14 @@ struct obuck {
   struct fastbuf limiter;
   uns slurp_remains;
   ucw_off_t slurp_start, slurp_current, slurp_end;
+
+  /* Forwarding of buckets moved by compaction */
+  char *fwd_name;
+  struct obuck_fwd *fwd;
+  uns fwd_count;
+  ucw_off_t fwd_size;				/* Size, inode and mtime of the forwarding file loaded */
+  u64 fwd_ino, fwd_mtime;
+  uns pins;					/* Number of readers holding bucket positions */
 };
 
 /* Special parameters to obuck_find_x functions */
@@ -99,12 +129,14 @@ void obuck_lock_write(struct obuck *obuck);
 void obuck_lock_scan(struct obuck *obuck);
 void obuck_unlock(struct obuck *obuck);
 void obuck_unlock_scan(struct obuck *obuck);
+ucw_off_t obuck_lock_scan_size(struct obuck *obuck);	/* Take the scan lock and return the size of the pool which can be scanned */
 oid_t obuck_predict_last_oid(struct obuck *obuck); /* Get OID corresponding to the next to be created bucket (i.e., bucket file size estimate) */
 
 /* Searching for buckets */
 void obuck_find_by_oid(struct obuck *obuck, struct obuck_context *ctx, uns flags);
 int obuck_find_first(struct obuck *obuck, struct obuck_context *ctx, uns flags);
 int obuck_find_next(struct obuck *obuck, struct obuck_context *ctx, uns flags);
+void obuck_find_end(struct obuck *obuck, struct obuck_context *ctx);	/* Needed only if you stop before find_next returns 0 */
 
 /* Reading the current bucket */
 struct fastbuf *obuck_fetch(struct obuck *obuck, struct obuck_context *ctx);
@@ -126,6 +158,33 @@ void obuck_delete(struct obuck *obuck, oid_t oid);
 struct fastbuf *obuck_slurp_pool(struct obuck *obuck, struct obuck_header *hdrp, oid_t next_oid);
 void obuck_slurp_end(struct obuck *obuck);
 
+#ifdef CONFIG_UCW_THREADS
+
+/*
+ * Parallel reading of the whole pool: the pool is split to chunks of about
+ * Buckets.ScanChunkSize bytes aligned to bucket boundaries, which are read
+ * (using Buckets.ScanAccess) and processed by Buckets.ScanThreads threads.
+ * The process() hook is called in a worker thread for every live bucket and
+ * it writes its results to a per-chunk fastbuf, which is then passed to the
+ * deliver() hook in the calling thread in the order of object ID's. A chunk
+ * can be processed twice if its boundary was not guessed right, only the
+ * results of the right pass are delivered.
+ */
+struct obuck_scan {
+  struct obuck *obuck;
+  uns threads;					/* 0 = Buckets.ScanThreads */
+  uns ordered;					/* Deliver the chunks in the order of the pool (always done now) */
+  void *(*thread_init)(struct obuck_scan *s);	/* Optional, returns a per-thread context */
+  void (*thread_cleanup)(struct obuck_scan *s, void *ctx);
+  void (*process)(struct obuck_scan *s, void *ctx, struct obuck_header *hdr, struct fastbuf *buck, struct fastbuf *out);
+  void (*deliver)(struct obuck_scan *s, struct fastbuf *results);
+  void *user;					/* Free for use by the hooks */
+};
+
+uns obuck_scan_pool(struct obuck_scan *s);	/* Returns the number of buckets processed */
+
+#endif
+
 /* Convert bucket ID to file position (for size limitations etc.) */
 
 static inline ucw_off_t obuck_get_pos(oid_t oid)
@@ -143,6 +202,18 @@ static inline uns obuck_bucket_size(uns len)
 /* Shaking down bucket file */
 void obuck_shakedown(struct obuck *obuck, int (*kibitz)(struct obuck_header *old, oid_t new, byte *buck));
 
+/* Online compaction by segments (the kibitz is called as in obuck_shakedown, but only for the compacted segments) */
+struct obuck_segment {
+  oid_t start, end;				/* Buckets starting in [start, end) */
+  uns live_count, dead_count;			/* Number of live and deleted buckets */
+  u64 live, dead;				/* Bytes occupied by them */
+};
+
+uns obuck_segments(struct obuck *obuck, struct obuck_segment **segs);	/* Scan liveness of all segments (reads all headers), returns their number */
+int obuck_compact_segment(struct obuck *obuck, struct obuck_segment *seg, int (*kibitz)(struct obuck_header *old, oid_t new, byte *buck), uns flags);
+uns obuck_compact(struct obuck *obuck, uns max_segs, int (*kibitz)(struct obuck_header *old, oid_t new, byte *buck));
+oid_t obuck_forward(struct obuck *obuck, oid_t oid);	/* Where has the bucket been moved (or the same oid) */
+
 /* A simple interface to the default bucket file */
 
 extern char *bucket_file_name;			/* Buckets.BucketFile (default bucket file) */
@@ -0,0 +1,3 @@
+# Tests for bucket files
+
+Run:	../obj/sherlock/bucket-t
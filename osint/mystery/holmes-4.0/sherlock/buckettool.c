@@ -49,6 +49,8 @@ CF_USAGE
 -i[<type>]\tInsert buckets separated by blank lines\n\
 -l\t\tList all buckets\n\
 -L\t\tList all buckets including deleted ones\n\
+-p[<count>]\tCompact at most <count> sparse segments online (default: all)\n\
+-P\t\tShow liveness of segments\n\
 -q\t\tQuick check of bucket file consistency\n\
 -s\t\tShake down bucket file (without updating other structures!!!)\n\
 -x <obj>\tExtract bucket\n\
@@ -110,7 +112,7 @@ dump_oattrs(struct fastbuf *out, struct oattr *oa)
 }
 
 static void
-dump_parsed_bucket(struct fastbuf *out, struct obuck_header *h, struct fastbuf *b)
+dump_parsed_bucket(struct fastbuf *out, struct obuck_header *h, struct fastbuf *b, struct mempool *pool, struct buck2obj_buf *buck_buf)
 {
   struct odes *o_hdr, *o_body;
   mp_flush(pool);
@@ -142,7 +144,7 @@ extract(char *id)
   if (c.hdr.type < BUCKET_TYPE_V33 || !buck_buf)
     bbcopy_slow(b, out, ~0U);
   else
-    dump_parsed_bucket(out, &c.hdr, b);
+    dump_parsed_bucket(out, &c.hdr, b, pool, buck_buf);
   bclose(b);
   bclose(out);
   bucket_close();
@@ -240,37 +242,108 @@ insert(byte *arg)
   bclose(in);
 }
 
+static void
+cat_bucket(struct fastbuf *out, struct obuck_header *h, struct fastbuf *b, struct mempool *pool, struct buck2obj_buf *buck_buf)
+{
+  byte buf[1024];
+
+  bprintf(out, "### %08x %6d %08x\n", h->oid, h->length, h->type);
+  if (h->type < BUCKET_TYPE_V33 || !buck_buf)
+  {
+    int lf = 1, l;
+    while ((l = bread(b, buf, sizeof(buf))))
+    {
+      bwrite(out, buf, l);
+      lf = (buf[l-1] == '\n');
+    }
+    if (!lf)
+      bprintf(out, "\n# <missing EOL>\n");
+  }
+  else
+    dump_parsed_bucket(out, h, b, pool, buck_buf);
+  bputc(out, '\n');
+}
+
+#ifdef CONFIG_UCW_THREADS
+
+struct cat_context {
+  struct mempool *pool;
+  struct buck2obj_buf *buck_buf;
+};
+
+static void *
+cat_init(struct obuck_scan *s UNUSED)
+{
+  struct cat_context *c = xmalloc_zero(sizeof(*c));
+  if (buck_buf)
+    {
+      c->pool = mp_new(1<<14);
+      c->buck_buf = buck2obj_alloc();
+    }
+  return c;
+}
+
+static void
+cat_cleanup(struct obuck_scan *s UNUSED, void *ctx)
+{
+  struct cat_context *c = ctx;
+  if (c->buck_buf)
+    {
+      buck2obj_free(c->buck_buf);
+      mp_delete(c->pool);
+    }
+  xfree(c);
+}
+
+static void
+cat_process(struct obuck_scan *s UNUSED, void *ctx, struct obuck_header *h, struct fastbuf *b, struct fastbuf *results)
+{
+  struct cat_context *c = ctx;
+  cat_bucket(results, h, b, c->pool, c->buck_buf);
+}
+
+static void
+cat_deliver(struct obuck_scan *s, struct fastbuf *results)
+{
+  bbcopy(results, s->user, ~0U);
+}
+
+static void
+cat(void)
+{
+  bucket_open(0);
+  struct obuck_scan s = {
+    .obuck = &bucket_file,
+    .ordered = 1,
+    .thread_init = cat_init,
+    .thread_cleanup = cat_cleanup,
+    .process = cat_process,
+    .deliver = cat_deliver,
+    .user = bfdopen_shared(1, 65536),
+  };
+  obuck_scan_pool(&s);
+  bclose(s.user);
+  bucket_close();
+}
+
+#else
+
 static void
 cat(void)
 {
   struct obuck_header h;
   struct fastbuf *b, *out;
-  byte buf[1024];
 
   bucket_open(0);
   out = bfdopen_shared(1, 65536);
   while (b = obuck_slurp_pool(&bucket_file, &h, OBUCK_OID_ANY))
-    {
-      bprintf(out, "### %08x %6d %08x\n", h.oid, h.length, h.type);
-      if (h.type < BUCKET_TYPE_V33 || !buck_buf)
-      {
-	int lf = 1, l;
-	while ((l = bread(b, buf, sizeof(buf))))
-	{
-	  bwrite(out, buf, l);
-	  lf = (buf[l-1] == '\n');
-	}
-	if (!lf)
-	  bprintf(out, "\n# <missing EOL>\n");
-      }
-      else
-	dump_parsed_bucket(out, &h, b);
-      bputc(out, '\n');
-    }
+    cat_bucket(out, &h, b, pool, buck_buf);
   bclose(out);
   bucket_close();
 }
 
+#endif
+
 static void
 fsck(int fix)
 {
@@ -389,6 +462,33 @@ shake(void)
   bucket_close();
 }
 
+static void
+segments(void)
+{
+  struct obuck_segment *segs;
+  bucket_open(0);
+  uns n = obuck_segments(&bucket_file, &segs);
+  for (uns i = 0; i < n; i++)
+    {
+      struct obuck_segment *s = &segs[i];
+      printf("%08x-%08x %6d live (%5d MB), %6d deleted (%5d MB), %3d%% live\n",
+	     s->start, s->end, s->live_count, (uns)(s->live >> 20), s->dead_count, (uns)(s->dead >> 20),
+	     (uns)(s->live * 100 / MAX(s->live + s->dead, 1)));
+    }
+  xfree(segs);
+  bucket_close();
+}
+
+static void
+compact(char *arg)
+{
+  uns max = arg ? atol(arg) : 0;
+  bucket_open(1);
+  uns n = obuck_compact(&bucket_file, max, shake_kibitz);
+  printf("Compacted %d segments\n", n);
+  bucket_close();
+}
+
 static void
 quickcheck(void)
 {
@@ -405,7 +505,7 @@ main(int argc, char **argv)
 
   log_init(NULL);
   op = 0;
-  while ((i = cf_getopt(argc, argv, CF_SHORT_OPTS "b:cd:fFi::lLqrsvx:", CF_NO_LONG_OPTS, NULL)) != -1)
+  while ((i = cf_getopt(argc, argv, CF_SHORT_OPTS "b:cd:fFi::lLp::Pqrsvx:", CF_NO_LONG_OPTS, NULL)) != -1)
     if (i == '?' || op)
       help();
     else if (i == 'v')
@@ -459,6 +559,12 @@ main(int argc, char **argv)
     case 's':
       shake();
       break;
+    case 'P':
+      segments();
+      break;
+    case 'p':
+      compact(arg);
+      break;
     default:
       help();
     }
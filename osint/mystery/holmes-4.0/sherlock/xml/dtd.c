@@ -513,6 +513,9 @@ xml_parse_entity_decl(struct xml_context *ctx)
       /* Internal entity:
        * EntityValue ::= '"' ([^%&"] | PEReference | Reference)* '"' | "'" ([^%&'] | PEReference | Reference)* "'" */
       char *p = mp_start_noalign(dtd->pool, 1);
+      /* Detect trivial entities, whose replacement text can be copied to the output without parsing:
+       * no markup, no references and no characters changed by new line or attribute value normalization */
+      uns trivial = !flags, trivial_cat = ctx->cat_unrestricted & ~ctx->cat_new_line;
       while (1)
         {
 	  if ((c = xml_get_char(ctx)) == sep)
@@ -542,6 +545,7 @@ xml_parse_entity_decl(struct xml_context *ctx)
 		  p += l;
 		  *p++ = ';';;
 		  mp_restore(ctx->stack, &state);
+		  trivial = 0;
 		  continue;
 	        }
 	      else
@@ -550,6 +554,8 @@ xml_parse_entity_decl(struct xml_context *ctx)
 	          c = xml_parse_char_ref(ctx);
 		}
 	    }
+	  if (c == '&' || c == '<' || c == '\t' || !(xml_char_cat(c) & trivial_cat))
+	    trivial = 0;
 	  p = mp_spread(dtd->pool, p, 5);
 	  p = utf8_32_put(p, c);
 	}
@@ -557,7 +563,7 @@ xml_parse_entity_decl(struct xml_context *ctx)
       ent->len = p - (char *)mp_ptr(dtd->pool);
       ent->text = mp_end(dtd->pool, p + 1);
       slist_add_tail(list, &ent->n);
-      ent->flags = flags | XML_DTD_ENTITY_DECLARED;
+      ent->flags = flags | XML_DTD_ENTITY_DECLARED | (trivial ? XML_DTD_ENTITY_TRIVIAL : 0);
     }
   else
     {
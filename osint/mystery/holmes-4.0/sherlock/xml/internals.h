@@ -159,7 +159,7 @@ xml_char_cat(uns c)
 static inline uns
 xml_ascii_cat(uns c)
 {
-  return xml_char_tab1[c];
+  return 1U << xml_char_tab1[c];
 }
 
 struct xml_source *xml_push_source(struct xml_context *ctx);
@@ -63,8 +63,23 @@ xml_parse_string(struct xml_context *ctx, struct mempool *pool, uns first_cat, u
     xml_fatal(ctx, "%s", err);
   do
     {
-      p = mp_spread(pool, p, 5);
-      p = utf8_32_put(p, xml_skip_char(ctx));
+      /* Copy the whole run of ASCII name characters in the buffer at once
+       * (each NameStartChar is also a NameChar, so the first one can be tested against next_cat) */
+      u32 *bptr = ctx->bptr, *run = bptr;
+      while (run < ctx->bstop && run[0] < 0x80 && (run[1] & next_cat))
+	run += 2;
+      if (run != bptr)
+        {
+	  p = mp_spread(pool, p, (run - bptr) / 2 + 1);
+	  for (; bptr != run; bptr += 2)
+	    *p++ = *bptr;
+	  ctx->bptr = run;
+	}
+      else
+        {
+	  p = mp_spread(pool, p, 5);
+	  p = utf8_32_put(p, xml_skip_char(ctx));
+	}
     }
   while (xml_peek_cat(ctx) & next_cat);
   *p++ = 0;
@@ -452,6 +467,37 @@ xml_pop_chars(struct xml_context *ctx)
   TRACE(ctx, "pop_chars");
 }
 
+/* Sets of ASCII characters which stop xml_copy_ascii() */
+#define STOP(c) (1U << ((c) & 31))
+static const u32 xml_stop_chars[4] = { 0, STOP('&') | STOP('<'), 0, 0 };
+static const u32 xml_stop_attr_value[4] = { ~0U, STOP('&') | STOP('<') | STOP('\'') | STOP('"'), 0, 0 };
+static const u32 xml_stop_cdata[4] = { 0, 0, STOP(']'), 0 };
+#undef STOP
+
+static inline void
+xml_copy_ascii(struct xml_context *ctx, const u32 *stop)
+{
+  /* Fast path for character data: copy a run of ASCII characters from the input
+   * buffer directly to ctx->chars, until a character from the stop set, a non-ASCII
+   * character or the end of either buffer is reached */
+  struct fastbuf *out = &ctx->chars;
+  u32 *bptr = ctx->bptr, *bstop = ctx->bstop;
+  byte *optr = out->bptr;
+  uns room = out->bufend - optr;
+  if ((uns)(bstop - bptr) > 2 * room)
+    bstop = bptr + 2 * room;
+  while (bptr < bstop)
+    {
+      uns c = *bptr;
+      if (c >= 0x80 || (stop[c >> 5] & (1U << (c & 31))))
+	break;
+      *optr++ = c;
+      bptr += 2;
+    }
+  ctx->bptr = bptr;
+  out->bptr = optr;
+}
+
 static inline void
 xml_append_chars(struct xml_context *ctx)
 {
@@ -468,14 +514,19 @@ xml_append_chars(struct xml_context *ctx)
 	  break;
 	}
   else
-    while (xml_get_char(ctx) != '<')
-      if (xml_last_char(ctx) == '&')
-        {
-	  xml_inc(ctx);
-          xml_parse_ref(ctx);
-        }
-      else
-        bput_utf8_32(out, xml_last_char(ctx));
+    while (1)
+      {
+	xml_copy_ascii(ctx, xml_stop_chars);
+	if (xml_get_char(ctx) == '<')
+	  break;
+	if (xml_last_char(ctx) == '&')
+	  {
+	    xml_inc(ctx);
+	    xml_parse_ref(ctx);
+	  }
+	else
+	  bput_utf8_32(out, xml_last_char(ctx));
+      }
   xml_unget_char(ctx);
 }
 
@@ -486,7 +537,17 @@ xml_skip_cdata(struct xml_context *ctx)
 {
   TRACE(ctx, "skip_cdata");
   xml_parse_seq(ctx, "CDATA[");
-  while (xml_get_char(ctx) != ']' || xml_get_char(ctx) != ']' || xml_get_char(ctx) != '>');
+  uns n = 0;
+  while (1)
+    {
+      uns c = xml_get_char(ctx);
+      if (c == ']')
+	n++;
+      else if (c == '>' && n >= 2)
+	break;
+      else
+	n = 0;
+    }
   xml_dec(ctx);
 }
 
@@ -510,16 +571,25 @@ xml_append_cdata(struct xml_context *ctx)
     ctx->h_block(ctx, rtext, rlen);
   while (1)
     {
+      xml_copy_ascii(ctx, xml_stop_cdata);
       if (xml_get_char(ctx) == ']')
         {
-          if (xml_get_char(ctx) == ']')
-	    if (xml_get_char(ctx) == '>')
+	  /* Any number of ']' can precede the final "]]>" */
+	  uns n = 1;
+	  while (xml_get_char(ctx) == ']')
+	    n++;
+	  if (n >= 2 && xml_last_char(ctx) == '>')
+	    {
+	      while (n-- > 2)
+		bputc(out, ']');
 	      break;
-	    else
-	      bputc(out, ']');
-	  bputc(out, ']');
+	    }
+	  while (n--)
+	    bputc(out, ']');
+	  xml_unget_char(ctx);
 	}
-      bput_utf8_32(out, xml_last_char(ctx));
+      else
+	bput_utf8_32(out, xml_last_char(ctx));
     }
   if ((ctx->flags & XML_REPORT_CHARS) && ctx->h_cdata && (rlen = xml_report_chars(ctx, &rtext)))
     ctx->h_cdata(ctx, rtext, rlen);
@@ -541,6 +611,7 @@ xml_parse_attr_value(struct xml_context *ctx, struct xml_dtd_attr *attr UNUSED)
   struct xml_source *src = ctx->src;
   while (1)
     {
+      xml_copy_ascii(ctx, xml_stop_attr_value);
       uns c = xml_get_char(ctx);
       if (c == '&')
         {
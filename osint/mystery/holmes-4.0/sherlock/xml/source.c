@@ -177,7 +177,7 @@ xml_error_restricted(struct xml_context *ctx, uns c)
 
 void xml_parse_decl(struct xml_context *ctx);
 
-#define REFILL(ctx, func, params...)							\
+#define REFILL(ctx, ascii, func, params...)						\
   struct xml_source *src = ctx->src;							\
   struct fastbuf *fb = src->fb;								\
   if (ctx->bptr == ctx->bstop)								\
@@ -190,8 +190,19 @@ void xml_parse_decl(struct xml_context *ctx);
       c = func(fb, ##params);								\
       uns t = xml_char_cat(c);								\
       if (t & t1)									\
-        /* Typical branch */								\
-	*bstop++ = c, *bstop++ = t;							\
+        {										\
+	  /* Typical branch */								\
+	  *bstop++ = c, *bstop++ = t;							\
+	  if (ascii)									\
+	    {										\
+	      /* Fast path for a run of ASCII characters in the fastbuf */		\
+	      byte *in = fb->bptr, *in_stop = fb->bstop;				\
+	      while (bstop < bend && in < in_stop && *in < 0x80 &&			\
+		     ((t = xml_ascii_cat(*in)) & t1))					\
+		*bstop++ = *in++, *bstop++ = t;						\
+	      fb->bptr = in;								\
+	    }										\
+	}										\
       else if (t & t2)									\
         {										\
 	  /* New line */								\
@@ -230,19 +241,19 @@ void xml_parse_decl(struct xml_context *ctx);
 static void
 xml_refill_utf8(struct xml_context *ctx)
 {
-  REFILL(ctx, bget_utf8_repl, ~1U);
+  REFILL(ctx, 1, bget_utf8_repl, ~1U);
 }
 
 static void
 xml_refill_utf16_le(struct xml_context *ctx)
 {
-  REFILL(ctx, bget_utf16_le_repl, ~1U);
+  REFILL(ctx, 0, bget_utf16_le_repl, ~1U);
 }
 
 static void
 xml_refill_utf16_be(struct xml_context *ctx)
 {
-  REFILL(ctx, bget_utf16_be_repl, ~1U);
+  REFILL(ctx, 0, bget_utf16_be_repl, ~1U);
 }
 
 #undef REFILL
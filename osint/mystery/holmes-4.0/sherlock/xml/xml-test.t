@@ -56,3 +56,24 @@ Out:	PULL: start
 	DOM:      chars text='text'
 	DOM:      element <a>
 	DOM:          chars text='<text>'
+
+Run:	../obj/sherlock/xml/xml-test -sd
+In:	<?xml version="1.0"?>
+	<!DOCTYPE root [
+	<!ELEMENT root (#PCDATA)>
+	<!ATTLIST root a CDATA #IMPLIED>
+	<!ENTITY t "a&#233;b">
+	<!ENTITY w "a&#9;b">
+	]>
+	<root a="&t;&w;">x&t;<![CDATA[]y]]]]>z&t;</root>
+Out:	PULL: start
+	SAX:  document_start
+	SAX:  xml_decl version=1.0 standalone=0 fb_encoding=UTF-8
+	SAX:  doctype_decl type=root public='' system='' extsub=0 intsub=1
+	SAX:  dtd_start
+	SAX:  dtd_end
+	SAX:  stag <root> a='aéba b'
+	SAX:  chars text='xaéb]y]]zaéb'
+	SAX:  etag </root>
+	SAX:  document_end
+	PULL: eof
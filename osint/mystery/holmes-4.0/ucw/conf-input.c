@@ -196,6 +196,8 @@ split_command(void)
 
 /* Parsing multiple files */
 
+static struct cf_parse_hooks *parse_hooks;	// set while compiling a snapshot
+
 static char *
 parse_fastbuf(const char *name_fb, struct fastbuf *fb, uns depth)
 {
@@ -231,6 +233,8 @@ parse_fastbuf(const char *name_fb, struct fastbuf *fb, uns depth)
 	err = cf_printf("Cannot open file %s: %m", pars[0]);
 	goto error;
       }
+      if (parse_hooks)
+	parse_hooks->file(pars[0]);
       uns ll = line_num;
       err = parse_fastbuf(stk_strdup(pars[0]), new_fb, depth+1);
       line_num = ll;
@@ -267,7 +271,10 @@ parse_fastbuf(const char *name_fb, struct fastbuf *fb, uns depth)
     }
     if (ends_by_brace)
       op |= OP_OPEN;
-    err = cf_interpret_line(name, op, words-1, pars);
+    if (parse_hooks)
+      err = parse_hooks->line(name_fb, line_num, name, op, words-1, pars);
+    else
+      err = cf_interpret_line(name, op, words-1, pars);
     if (err)
       goto error;
   }
@@ -311,6 +318,9 @@ static int
 load_file(const char *file)
 {
   cf_init_stack();
+  int snap_err = cf_snapshot_load(file);
+  if (snap_err >= 0)
+    return snap_err || done_stack();
   struct fastbuf *fb = bopen_try(file, O_RDONLY, 1<<14);
   if (!fb) {
     msg(L_ERROR, "Cannot open %s: %m", file);
@@ -321,6 +331,22 @@ load_file(const char *file)
   return !!err_msg || done_stack();
 }
 
+int
+cf_parse_hooked(const char *file, struct cf_parse_hooks *hooks)
+{
+  struct fastbuf *fb = bopen_try(file, O_RDONLY, 1<<14);
+  if (!fb) {
+    msg(L_ERROR, "Cannot open %s: %m", file);
+    return 1;
+  }
+  parse_hooks = hooks;
+  hooks->file(file);
+  char *err_msg = parse_fastbuf(file, fb, 0);
+  parse_hooks = NULL;
+  bclose(fb);
+  return !!err_msg;
+}
+
 static int
 load_string(const char *string)
 {
@@ -25,6 +25,16 @@ char *cf_interpret_line(char *name, enum cf_operation op, int number, char **par
 void cf_init_stack(void);
 int cf_check_stack(void);
 
+/* conf-input.c */
+struct cf_parse_hooks {			// replace interpretation of the parsed commands
+  void (*file)(const char *name);	// called for the top-level file and for each included one
+  char *(*line)(const char *file, uns line, char *name, enum cf_operation op, int number, char **pars);
+};
+int cf_parse_hooked(const char *file, struct cf_parse_hooks *hooks);
+
+/* conf-snap.c */
+int cf_snapshot_load(const char *file);	// -1 if there is no usable snapshot, otherwise like load_file()
+
 /* conf-journal.c */
 void cf_journal_swap(void);
 void cf_journal_delete(void);
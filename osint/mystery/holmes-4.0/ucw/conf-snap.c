@@ -0,0 +1,277 @@
+/*
+ *	UCW Library -- Configuration files: compiled snapshots
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+/*
+ *  A snapshot contains the configuration commands of a file and of all files
+ *  it includes, already split to words, unescaped and stripped of comments.
+ *  Loading the snapshot replays the commands on the interpreter, so the result
+ *  is exactly the same as if the text files were parsed, including all commit
+ *  hooks.  The snapshot remembers size, modification and change times and inode
+ *  of all source files and it is ignored as soon as any of them changes.  The times
+ *  are kept with nanosecond resolution where the system provides it, so that even
+ *  a quick edit of a file of the same size is noticed.
+ *
+ *  The format uses native byte order and it is not meant to be portable:
+ *
+ *	header:		struct snap_header
+ *	for each file:	u64 size, u64 mtime, u64 ctime, u64 inode, u32 name length, name
+ *			(both times in nanoseconds since the epoch)
+ *	for each cmd:	u32 file index, u32 line, u32 operation, u32 number of parameters,
+ *			u32 length of strings, name and parameters (each 0-terminated)
+ *
+ *  The checksum is an Adler-32 of everything following the header.
+ */
+
+#include "ucw/lib.h"
+#include "ucw/conf.h"
+#include "ucw/getopt.h"
+#include "ucw/conf-internal.h"
+#include "ucw/mempool.h"
+#include "ucw/fastbuf.h"
+#include "ucw/ff-binary.h"
+#include "ucw/unaligned.h"
+#include "ucw/lizard.h"
+#include "ucw/stkstring.h"
+#include "ucw/bbuf.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define SNAP_MAGIC 0x43665332		// "CfS2"
+
+struct snap_header {
+  u32 magic;
+  u32 checksum;
+  u32 num_files;
+  u32 num_cmds;
+  u64 body_size;
+};
+
+char *cf_snapshot_suffix = ".snap";
+
+static u64
+snap_time(time_t sec, long nsec)
+{
+  return (u64) sec * 1000000000 + nsec;
+}
+
+#if defined(CONFIG_LINUX)
+#define SNAP_MTIME(st) snap_time((st)->st_mtime, (st)->st_mtim.tv_nsec)
+#define SNAP_CTIME(st) snap_time((st)->st_ctime, (st)->st_ctim.tv_nsec)
+#elif defined(CONFIG_DARWIN)
+#define SNAP_MTIME(st) snap_time((st)->st_mtime, (st)->st_mtimespec.tv_nsec)
+#define SNAP_CTIME(st) snap_time((st)->st_ctime, (st)->st_ctimespec.tv_nsec)
+#else
+#define SNAP_MTIME(st) snap_time((st)->st_mtime, 0)
+#define SNAP_CTIME(st) snap_time((st)->st_ctime, 0)
+#endif
+
+/* Writing */
+
+static struct snap_writer {
+  struct fastbuf *files, *cmds;
+  uns num_files, num_cmds;
+  const char **names;
+  uns max_names;
+} sw;
+
+static void
+snap_write_file(const char *name)
+{
+  struct stat st;
+  if (stat(name, &st) < 0)
+    die("Cannot stat %s: %m", name);
+  bputq(sw.files, st.st_size);
+  bputq(sw.files, SNAP_MTIME(&st));
+  bputq(sw.files, SNAP_CTIME(&st));
+  bputq(sw.files, st.st_ino);
+  uns len = strlen(name);
+  bputl(sw.files, len);
+  bwrite(sw.files, name, len);
+
+  if (sw.num_files >= sw.max_names)
+    {
+      sw.max_names = MAX(2*sw.max_names, 16);
+      sw.names = xrealloc(sw.names, sw.max_names * sizeof(char *));
+    }
+  sw.names[sw.num_files++] = xstrdup(name);
+}
+
+static char *
+snap_write_line(const char *file, uns line, char *name, enum cf_operation op, int number, char **pars)
+{
+  uns fi = 0;
+  while (fi < sw.num_files && strcmp(sw.names[fi], file))
+    fi++;
+  ASSERT(fi < sw.num_files);
+  uns len = strlen(name) + 1;
+  for (int i=0; i<number; i++)
+    len += strlen(pars[i]) + 1;
+  bputl(sw.cmds, fi);
+  bputl(sw.cmds, line);
+  bputl(sw.cmds, op);
+  bputl(sw.cmds, number);
+  bputl(sw.cmds, len);
+  bwrite(sw.cmds, name, strlen(name) + 1);
+  for (int i=0; i<number; i++)
+    bwrite(sw.cmds, pars[i], strlen(pars[i]) + 1);
+  sw.num_cmds++;
+  return NULL;
+}
+
+int
+cf_snapshot_write(const char *file, const char *snapshot)
+{
+  if (!snapshot)
+    snapshot = stk_strcat(file, cf_snapshot_suffix ? : ".snap");
+
+  bzero(&sw, sizeof(sw));
+  sw.files = fbgrow_create(4096);
+  sw.cmds = fbgrow_create(65536);
+  struct mempool *old_pool = cf_pool;		// the parser formats its error messages there
+  cf_pool = mp_new(1<<10);
+  struct cf_parse_hooks hooks = {
+    .file = snap_write_file,
+    .line = snap_write_line,
+  };
+  int err = cf_parse_hooked(file, &hooks);
+  mp_delete(cf_pool);
+  cf_pool = old_pool;
+
+  if (!err)
+    {
+      fbgrow_rewind(sw.files);
+      fbgrow_rewind(sw.cmds);
+      uns files_len = sw.files->bstop - sw.files->buffer;
+      uns cmds_len = sw.cmds->bstop - sw.cmds->buffer;
+      struct snap_header h = {
+	.magic = SNAP_MAGIC,
+	.checksum = adler32_update(adler32(sw.files->buffer, files_len), sw.cmds->buffer, cmds_len),
+	.num_files = sw.num_files,
+	.num_cmds = sw.num_cmds,
+	.body_size = files_len + cmds_len,
+      };
+
+      /* Replace the snapshot atomically, other processes can be reading it */
+      char *tmp = stk_strcat(snapshot, ".tmp");
+      struct fastbuf *out = bopen(tmp, O_WRONLY | O_CREAT | O_TRUNC, 65536);
+      bwrite(out, &h, sizeof(h));
+      bwrite(out, sw.files->buffer, files_len);
+      bwrite(out, sw.cmds->buffer, cmds_len);
+      bclose(out);
+      if (rename(tmp, snapshot) < 0)
+	die("Cannot rename %s to %s: %m", tmp, snapshot);
+    }
+
+  bclose(sw.files);
+  bclose(sw.cmds);
+  for (uns i=0; i<sw.num_files; i++)
+    xfree((char *) sw.names[i]);
+  xfree(sw.names);
+  return err;
+}
+
+/* Reading */
+
+static int
+snap_check_file(const char *name, byte *rec)
+{
+  struct stat st;
+  return stat(name, &st) >= 0 &&
+    (u64) st.st_size == get_u64(rec) &&
+    SNAP_MTIME(&st) == get_u64(rec + 8) &&
+    SNAP_CTIME(&st) == get_u64(rec + 16) &&
+    (u64) st.st_ino == get_u64(rec + 24);
+}
+
+static int
+snap_replay(const char *file, const char *snapshot, byte *map, u64 map_size)
+{
+  struct snap_header *h = (struct snap_header *) map;
+  byte *p = map + sizeof(*h);
+  byte *end = map + map_size;
+  if (map_size < sizeof(*h) || h->magic != SNAP_MAGIC || h->body_size != map_size - sizeof(*h) ||
+      h->checksum != adler32(p, h->body_size) || !h->num_files)
+    {
+      msg(L_WARN, "Configuration snapshot %s is corrupted, ignoring it", snapshot);
+      return -1;
+    }
+
+  /* Check that none of the source files has changed. The first one need not be at the same path. */
+  char *names[h->num_files];
+  for (uns i=0; i<h->num_files; i++)
+    {
+      uns len = get_u32(p + 32);
+      char *name = stk_strndup((char *) p + 36, len);
+      if (!snap_check_file(i ? name : file, p))
+	{
+	  msg(L_INFO, "Configuration snapshot %s is out of date, ignoring it", snapshot);
+	  return -1;
+	}
+      names[i] = name;
+      p += 36 + len;
+    }
+
+  /* The interpreter modifies the strings, so we copy each command to a scratch buffer */
+  bb_t buf;
+  bb_init(&buf);
+  int err = 0;
+  for (uns i=0; i<h->num_cmds && !err; i++)
+    {
+      uns fi = get_u32(p), line = get_u32(p + 4), op = get_u32(p + 8), number = get_u32(p + 12), len = get_u32(p + 16);
+      p += 20;
+      ASSERT(fi < h->num_files && p + len <= end);
+      char *s = bb_grow(&buf, len);
+      memcpy(s, p, len);
+      p += len;
+      char *name = s;
+      char *pars[number];
+      for (uns j=0; j<number; j++)
+	{
+	  s += strlen(s) + 1;
+	  pars[j] = s;
+	}
+      char *err_msg = cf_interpret_line(name, op, number, pars);
+      if (err_msg)
+	{
+	  msg(L_ERROR, "File %s, line %d: %s", names[fi], line, err_msg);
+	  err = 1;
+	}
+    }
+  bb_done(&buf);
+  return err;
+}
+
+int
+cf_snapshot_load(const char *file)
+{
+  if (!cf_snapshot_suffix)
+    return -1;
+  char *snapshot = stk_strcat(file, cf_snapshot_suffix);
+  int fd = open(snapshot, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !st.st_size)
+    {
+      close(fd);
+      return -1;
+    }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    {
+      msg(L_WARN, "Cannot map configuration snapshot %s: %m", snapshot);
+      return -1;
+    }
+  int err = snap_replay(file, snapshot, map, st.st_size);
+  munmap(map, st.st_size);
+  return err;
+}
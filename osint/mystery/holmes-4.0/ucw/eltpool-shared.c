@@ -0,0 +1,251 @@
+/*
+ *	UCW Library -- Shared Pools of Fixed-Size Elements with Per-Thread Caches
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+/*
+ *  Each thread has its own cache with a free list, so the fast paths of allocation
+ *  and freeing are the same as in a plain eltpool. The caches exchange whole batches
+ *  of elements with a depot protected by a mutex, which amortizes the locking
+ *  over many operations. A cache keeps between 0 and 2*batch free elements,
+ *  so a thread alternating between allocation and freeing never touches the depot.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "ucw/lib.h"
+#include "ucw/eltpool.h"
+
+#include <string.h>
+#include <pthread.h>
+
+struct ep_batch {			/* The first element of a batch in the depot */
+  struct eltpool_free f;		/* Links the elements of the batch */
+  struct ep_batch *next;		/* Links the batches */
+};
+
+struct ep_shared {
+  pthread_mutex_t lock;
+  struct eltpool *pool;			/* Source of new elements, protected by the lock */
+  struct ep_batch *depot;		/* Full batches, protected by the lock */
+  uns batch;
+};
+
+struct ep_shared *
+ep_shared_new(uns elt_size, uns elts_per_chunk, uns batch)
+{
+  struct ep_shared *sp = xmalloc_zero(sizeof(*sp));
+  pthread_mutex_init(&sp->lock, NULL);
+  sp->pool = ep_new(MAX(elt_size, sizeof(struct ep_batch)), elts_per_chunk);
+  sp->batch = batch ? : (uns) CLAMP(CPU_PAGE_SIZE / sp->pool->elt_size, 8, 256);
+  DBG("ep_shared_new(): elt_size=%d, batch=%d", sp->pool->elt_size, sp->batch);
+  return sp;
+}
+
+void
+ep_shared_delete(struct ep_shared *sp)
+{
+  ep_delete(sp->pool);
+  pthread_mutex_destroy(&sp->lock);
+  xfree(sp);
+}
+
+u64
+ep_shared_total_size(struct ep_shared *sp)
+{
+  pthread_mutex_lock(&sp->lock);
+  u64 size = ep_total_size(sp->pool) + sizeof(*sp);
+  pthread_mutex_unlock(&sp->lock);
+  return size;
+}
+
+void
+ep_cache_init(struct ep_cache *c, struct ep_shared *sp)
+{
+  bzero(c, sizeof(*c));
+  c->shared = sp;
+  c->batch = sp->batch;
+}
+
+void *
+ep_cache_refill(struct ep_cache *c)
+{
+  struct ep_shared *sp = c->shared;
+  struct eltpool_free *list;
+  ASSERT(!c->first_free);
+
+  pthread_mutex_lock(&sp->lock);
+  struct ep_batch *b = sp->depot;
+  if (b)
+    {
+      sp->depot = b->next;
+      list = &b->f;
+    }
+  else
+    {
+      list = NULL;
+      for (uns i = 0; i < c->batch; i++)
+	{
+	  struct eltpool_free *f = ep_alloc(sp->pool);
+	  f->next = list;
+	  list = f;
+	}
+    }
+  pthread_mutex_unlock(&sp->lock);
+
+  c->num_refills++;
+  c->first_free = list->next;
+  c->num_free = c->batch - 1;
+  return list;
+}
+
+void
+ep_cache_spill(struct ep_cache *c)
+{
+  struct ep_shared *sp = c->shared;
+  ASSERT(c->num_free >= c->batch);
+
+  /* Detach the first batch from the free list, outside the lock */
+  struct eltpool_free *last = c->first_free;
+  for (uns i = 1; i < c->batch; i++)
+    last = last->next;
+  struct ep_batch *b = (struct ep_batch *) c->first_free;
+  c->first_free = last->next;
+  last->next = NULL;
+  c->num_free -= c->batch;
+
+  pthread_mutex_lock(&sp->lock);
+  b->next = sp->depot;
+  sp->depot = b;
+  pthread_mutex_unlock(&sp->lock);
+  c->num_spills++;
+}
+
+void
+ep_cache_cleanup(struct ep_cache *c)
+{
+  struct ep_shared *sp = c->shared;
+  while (c->num_free >= c->batch)
+    ep_cache_spill(c);
+
+  /* Incomplete batches go back to the underlying pool */
+  pthread_mutex_lock(&sp->lock);
+  struct eltpool_free *f;
+  while (f = c->first_free)
+    {
+      c->first_free = f->next;
+      ep_free(sp->pool, f);
+    }
+  pthread_mutex_unlock(&sp->lock);
+  c->num_free = 0;
+}
+
+#ifdef TEST
+
+#include "ucw/mempool.h"
+
+#include <stdio.h>
+
+#define THREADS 4
+#define ROUNDS 100000
+#define RING 1024
+
+struct elt {
+  uns owner;
+  uns seq;
+};
+
+static struct ep_shared *sp;
+static struct mp_arena *arena;
+
+/* Each thread passes elements to the next one over a ring protected by a mutex */
+static struct {
+  pthread_mutex_t lock;
+  struct elt *ring[RING];
+  uns head, tail;
+} pipes[THREADS];
+
+static struct ep_cache caches[THREADS];
+
+static void *
+worker(void *arg)
+{
+  uns id = (uintptr_t) arg;
+  struct ep_cache *c = &caches[id];
+  struct mempool *mp = mp_arena_pool(arena);
+  uns next = (id + 1) % THREADS;
+  ep_cache_init(c, sp);
+  for (uns i = 0; i < ROUNDS; i++)
+    {
+      struct elt *e = ep_cache_alloc(c);
+      e->owner = id;
+      e->seq = i;
+      mp_alloc(mp, 1 + i % 50);
+
+      /* Send it to the next thread, or free it ourselves if the ring is full */
+      pthread_mutex_lock(&pipes[next].lock);
+      if (pipes[next].head - pipes[next].tail < RING)
+	{
+	  pipes[next].ring[pipes[next].head++ % RING] = e;
+	  e = NULL;
+	}
+      pthread_mutex_unlock(&pipes[next].lock);
+      if (e)
+	ep_cache_free(c, e);
+
+      /* Free elements received from the previous thread */
+      for (;;)
+	{
+	  pthread_mutex_lock(&pipes[id].lock);
+	  e = (pipes[id].head != pipes[id].tail) ? pipes[id].ring[pipes[id].tail++ % RING] : NULL;
+	  pthread_mutex_unlock(&pipes[id].lock);
+	  if (!e)
+	    break;
+	  if (e->owner != (id + THREADS - 1) % THREADS)
+	    die("Element damaged");
+	  ep_cache_free(c, e);
+	}
+    }
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t threads[THREADS];
+  sp = ep_shared_new(sizeof(struct elt), 64, 0);
+  arena = mp_arena_new(4096);
+  for (uns i = 0; i < THREADS; i++)
+    pthread_mutex_init(&pipes[i].lock, NULL);
+  for (uns i = 0; i < THREADS; i++)
+    if (pthread_create(&threads[i], NULL, worker, (void *)(uintptr_t) i))
+      die("pthread_create failed");
+  for (uns i = 0; i < THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  /* Free the elements left in the rings */
+  int allocated = 0;
+  for (uns i = 0; i < THREADS; i++)
+    {
+      while (pipes[i].head != pipes[i].tail)
+	ep_cache_free(&caches[i], pipes[i].ring[pipes[i].tail++ % RING]);
+      allocated += caches[i].num_allocated;
+      ep_cache_cleanup(&caches[i]);
+    }
+  if (allocated)
+    die("Lost %d elements", allocated);
+  if (ep_shared_total_size(sp) > 1000000)
+    die("Shared pool too large");
+
+  struct mempool_stats stats;
+  mp_arena_stats(arena, &stats);
+  if (stats.total_size < (u64) THREADS * ROUNDS * 25)
+    die("Arena statistics do not match");
+  mp_arena_delete(arena);
+  ep_shared_delete(sp);
+  puts("OK");
+  return 0;
+}
+
+#endif
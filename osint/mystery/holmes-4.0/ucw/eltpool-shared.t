@@ -0,0 +1,4 @@
+# Tests for shared eltpools and mempool arenas
+
+Run:	../obj/ucw/eltpool-shared-t
+Out:	OK
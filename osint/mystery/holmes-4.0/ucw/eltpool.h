@@ -109,4 +109,93 @@ static inline void ep_free(struct eltpool *pool, void *p)
 #endif
 }
 
+#ifdef CONFIG_UCW_THREADS
+
+/***
+ * [[shared]]
+ * Shared pools with per-thread caches
+ * -----------------------------------
+ *
+ * A shared pool can be used by multiple threads at once. Each thread
+ * allocates and frees elements through its own cache, which needs no locking.
+ * Only when the cache runs empty or overflows, a whole batch of elements
+ * is moved between the cache and a common depot under a lock.
+ *
+ * Elements can be freed by a different thread than the one which allocated
+ * them, so worker threads can pass objects to each other. They return to the
+ * depot in batches when the freeing thread's cache overflows.
+ ***/
+
+struct ep_shared;		/** Shared pool, an opaque handle. **/
+
+/**
+ * A per-thread cache of a shared pool. Each cache must be used
+ * by a single thread at a time. The insides are internal, with the exception
+ * of the statistics.
+ **/
+struct ep_cache {
+  struct ep_shared *shared;
+  struct eltpool_free *first_free;
+  uns num_free;			// Number of elements in the free list
+  uns batch;			// Size of batches exchanged with the depot
+  int num_allocated;		// Elements allocated minus freed by this cache (negative if it frees other threads' elements)
+  uns num_refills;		// Batches taken from the depot
+  uns num_spills;		// Batches returned to the depot
+};
+
+/**
+ * Create a shared pool for elements of @elt_size bytes, allocating
+ * chunks of at least @elts_per_chunk elements. Caches exchange elements
+ * with the depot by @batch elements (0 for a default).
+ **/
+struct ep_shared *ep_shared_new(uns elt_size, uns elts_per_chunk, uns batch);
+
+/**
+ * Delete a shared pool including all its elements.
+ * All caches must be cleaned up first.
+ **/
+void ep_shared_delete(struct ep_shared *sp);
+
+u64 ep_shared_total_size(struct ep_shared *sp);		/** Total number of bytes allocated by the pool. **/
+
+void ep_cache_init(struct ep_cache *c, struct ep_shared *sp);	/** Initialize a new cache of a shared pool. **/
+void ep_cache_cleanup(struct ep_cache *c);			/** Return all cached elements to the depot. **/
+
+void *ep_cache_refill(struct ep_cache *c); /* Internal. Do not call directly. */
+void ep_cache_spill(struct ep_cache *c); /* Internal. Do not call directly. */
+
+/**
+ * Allocate an element of a shared pool. The result is aligned
+ * to `CPU_STRUCT_ALIGN`.
+ **/
+static inline void *ep_cache_alloc(struct ep_cache *c)
+{
+  c->num_allocated++;
+  struct eltpool_free *elt;
+  if (elt = c->first_free)
+    {
+      c->first_free = elt->next;
+      c->num_free--;
+    }
+  else
+    elt = ep_cache_refill(c);
+  return elt;
+}
+
+/**
+ * Free an element of a shared pool. It need not have been allocated
+ * through the same cache.
+ **/
+static inline void ep_cache_free(struct ep_cache *c, void *p)
+{
+  c->num_allocated--;
+  struct eltpool_free *elt = p;
+  elt->next = c->first_free;
+  c->first_free = elt;
+  if (++c->num_free >= 2*c->batch)
+    ep_cache_spill(c);
+}
+
+#endif
+
 #endif
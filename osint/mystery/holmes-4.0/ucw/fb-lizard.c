@@ -0,0 +1,537 @@
+/*
+ *	UCW Library -- Block-Parallel LiZaRd Compression of Fastbufs
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "ucw/lib.h"
+#include "ucw/fastbuf.h"
+#include "ucw/ff-binary.h"
+#include "ucw/fb-lizard.h"
+#include "ucw/lizard.h"
+#include "ucw/workqueue.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define FBLZ_MAGIC	0x4c5a4231	/* "LZB1" */
+#define FBLZ_MAGIC_END	0x4c5a4245	/* "LZBE" */
+#define FBLZ_STORED	0x80000000	/* Flag of the compressed length: the block is not compressed */
+#define FBLZ_TRAILER	24
+#define FBLZ_MAX_BLOCK	(1 << 28)
+#define FBLZ_STACK_SIZE	(256 << 10)	/* lizard_compress() keeps its hash table on the stack */
+
+struct fblz_block {
+  struct work w;
+  struct fb_lizard *F;
+  uns seq;					/* Sequence number = index of the frame */
+  uns done;					/* Already returned from the work queue */
+  int error;
+  byte *raw, *comp;				/* Uncompressed and compressed data */
+  struct lizard_buffer *lz_buf;			/* Reader: output buffer of lizard_decompress_safe(), raw points to it */
+  uns raw_len, comp_len;
+  u32 adler;
+  uns stored;
+};
+
+struct fb_lizard {
+  struct fastbuf fb;
+  struct fastbuf *orig;				/* The underlying stream */
+  struct worker_pool *pool, own_pool;
+  struct work_queue queue;
+  uns block_size;
+  uns window;					/* Size of blocks[], blocks are indexed by seq % window */
+  uns comp_size;				/* Allocated size of the compressed buffers (reader only) */
+  struct fblz_block *blocks;
+  uns submitted, finished;			/* Blocks submitted to the pool / written or delivered */
+  uns running;					/* Blocks in the pool */
+  ucw_off_t start;				/* Position of the stream in the underlying one (reader only) */
+  ucw_off_t out_pos;				/* Bytes written to the underlying stream (writer only) */
+  u64 *index;					/* Frame offsets */
+  uns index_len, index_max;
+  ucw_off_t total;				/* Uncompressed size (reader, known after loading the index) */
+  uns in_eof;					/* Reader: the end frame has been seen */
+};
+#define FB_LIZARD(f) ((struct fb_lizard *)(f)->is_fastbuf)
+
+static inline struct fblz_block *
+fblz_block(struct fb_lizard *F, uns seq)
+{
+  return &F->blocks[seq % F->window];
+}
+
+static struct fblz_block *
+fblz_wait(struct fb_lizard *F)
+{
+  ASSERT(F->running);
+  struct fblz_block *b = (struct fblz_block *) work_wait(&F->queue);
+  F->running--;
+  b->done = 1;
+  return b;
+}
+
+static void
+fblz_submit(struct fb_lizard *F, struct fblz_block *b, void (*go)(struct worker_thread *t, struct work *w))
+{
+  b->w.go = go;
+  b->w.priority = 0;
+  b->done = 0;
+  b->error = 0;
+  b->seq = F->submitted++;
+  F->running++;
+  work_submit(&F->queue, &b->w);
+}
+
+static void
+fblz_init(struct fb_lizard *F, struct fastbuf *orig, struct fblizard_params *par, uns extra_window)
+{
+  F->orig = orig;
+  if (par->pool)
+    {
+      F->pool = par->pool;
+      ASSERT(F->pool->stack_size >= FBLZ_STACK_SIZE);
+    }
+  else
+    {
+      uns threads = par->threads;
+      if (!threads)
+	{
+	  long n = sysconf(_SC_NPROCESSORS_ONLN);
+	  threads = (n > 0) ? n : 1;
+	}
+      F->pool = &F->own_pool;
+      F->own_pool.num_threads = threads;
+      F->own_pool.stack_size = FBLZ_STACK_SIZE;
+      worker_pool_init(F->pool);
+    }
+  work_queue_init(F->pool, &F->queue);
+  F->window = (par->window ? : 2*F->pool->num_threads) + extra_window;
+  F->blocks = xmalloc_zero(F->window * sizeof(struct fblz_block));
+  for (uns i = 0; i < F->window; i++)
+    F->blocks[i].F = F;
+}
+
+static void
+fblz_cleanup(struct fb_lizard *F)
+{
+  while (F->running)
+    fblz_wait(F);
+  work_queue_cleanup(&F->queue);
+  if (F->pool == &F->own_pool)
+    worker_pool_cleanup(F->pool);
+  for (uns i = 0; i < F->window; i++)
+    {
+      struct fblz_block *b = &F->blocks[i];
+      if (b->lz_buf)
+	lizard_free(b->lz_buf);
+      else
+	xfree(b->raw);
+      xfree(b->comp);
+    }
+  xfree(F->blocks);
+  xfree(F->index);
+  xfree(F);
+}
+
+/*** Writing ***/
+
+static void
+fblz_compress(struct worker_thread *t UNUSED, struct work *w)
+{
+  struct fblz_block *b = (struct fblz_block *) w;
+  b->adler = adler32(b->raw, b->raw_len);
+  b->comp_len = lizard_compress(b->raw, b->raw_len, b->comp);
+  b->stored = (b->comp_len >= b->raw_len);
+}
+
+static void
+fblz_write_block(struct fb_lizard *F, struct fblz_block *b)
+{
+  struct fastbuf *o = F->orig;
+  if (F->index_len >= F->index_max)
+    {
+      F->index_max = MAX(2*F->index_max, 256);
+      F->index = xrealloc(F->index, F->index_max * sizeof(u64));
+    }
+  F->index[F->index_len++] = F->out_pos;
+  DBG("FBLZ: Writing block %u: %u -> %u%s", b->seq, b->raw_len, b->comp_len, (b->stored ? " (stored)" : ""));
+  if (b->stored)
+    {
+      bputl(o, b->raw_len | FBLZ_STORED);
+      bputl(o, b->raw_len);
+      bputl(o, b->adler);
+      bwrite(o, b->raw, b->raw_len);
+      F->out_pos += 12 + b->raw_len;
+    }
+  else
+    {
+      bputl(o, b->comp_len);
+      bputl(o, b->raw_len);
+      bputl(o, b->adler);
+      bwrite(o, b->comp, b->comp_len);
+      F->out_pos += 12 + b->comp_len;
+    }
+}
+
+static void
+fblz_write_ready(struct fb_lizard *F)
+{
+  /* Write all finished blocks which are next in the order */
+  struct fblz_block *b;
+  while (F->finished < F->submitted && (b = fblz_block(F, F->finished))->done)
+    {
+      fblz_write_block(F, b);
+      F->finished++;
+    }
+}
+
+static void
+fblz_set_write_buffer(struct fb_lizard *F)
+{
+  /* The next block must have a free slot in the window */
+  while (F->submitted - F->finished >= F->window)
+    {
+      fblz_wait(F);
+      fblz_write_ready(F);
+    }
+  struct fastbuf *f = &F->fb;
+  struct fblz_block *b = fblz_block(F, F->submitted);
+  f->buffer = f->bptr = f->bstop = b->raw;
+  f->bufend = b->raw + F->block_size;
+}
+
+static void
+fblz_submit_write(struct fb_lizard *F)
+{
+  struct fastbuf *f = &F->fb;
+  struct fblz_block *b = fblz_block(F, F->submitted);
+  b->raw_len = f->bptr - f->buffer;
+  fblz_submit(F, b, fblz_compress);
+  f->pos += b->raw_len;
+
+  /* Write what is already compressed, but do not wait for it */
+  struct work *w;
+  while (F->running && (w = work_try_wait(&F->queue)))
+    {
+      F->running--;
+      ((struct fblz_block *) w)->done = 1;
+    }
+  fblz_write_ready(F);
+}
+
+static void
+fblz_spout(struct fastbuf *f)
+{
+  /* Only full blocks are written, so that we can find block boundaries by simple arithmetic */
+  if (f->bptr < f->bufend)
+    return;
+  struct fb_lizard *F = FB_LIZARD(f);
+  fblz_submit_write(F);
+  fblz_set_write_buffer(F);
+}
+
+static void
+fblz_close_write(struct fastbuf *f)
+{
+  struct fb_lizard *F = FB_LIZARD(f);
+  struct fastbuf *o = F->orig;
+  if (f->bptr > f->buffer)
+    fblz_submit_write(F);
+  while (F->running)
+    {
+      fblz_wait(F);
+      fblz_write_ready(F);
+    }
+  ASSERT(F->finished == F->submitted);
+
+  bputl(o, 0);
+  bputl(o, 0);
+  bputl(o, 0);
+  F->out_pos += 12;
+  ucw_off_t index_pos = F->out_pos;
+  for (uns i = 0; i < F->index_len; i++)
+    bputq(o, F->index[i]);
+  bputq(o, index_pos);
+  bputq(o, f->pos);
+  bputl(o, F->index_len);
+  bputl(o, FBLZ_MAGIC_END);
+  DBG("FBLZ: Written %u frames, %llu -> %llu bytes", F->index_len, (long long) f->pos, (long long) F->out_pos + 8*F->index_len + FBLZ_TRAILER);
+  fblz_cleanup(F);
+}
+
+struct fastbuf *
+fblizard_create_write(struct fastbuf *out, struct fblizard_params *par)
+{
+  struct fb_lizard *F = xmalloc_zero(sizeof(*F));
+  struct fastbuf *f = &F->fb;
+  F->block_size = par->block_size ? : 256 << 10;
+  ASSERT(F->block_size <= FBLZ_MAX_BLOCK);
+  fblz_init(F, out, par, 0);
+  for (uns i = 0; i < F->window; i++)
+    {
+      F->blocks[i].raw = xmalloc(F->block_size + LIZARD_NEEDS_CHARS);
+      F->blocks[i].comp = xmalloc(LIZARD_MAX_LEN(F->block_size));
+    }
+  bputl(out, FBLZ_MAGIC);
+  bputl(out, F->block_size);
+  F->out_pos = 8;
+
+  f->name = "<lizard>";
+  f->spout = fblz_spout;
+  f->close = fblz_close_write;
+  fblz_set_write_buffer(F);
+  return f;
+}
+
+/*** Reading ***/
+
+static void
+fblz_decompress(struct worker_thread *t UNUSED, struct work *w)
+{
+  struct fblz_block *b = (struct fblz_block *) w;
+  if (b->stored)
+    b->raw = b->comp;
+  else
+    b->raw = lizard_decompress_safe(b->comp, b->lz_buf, b->raw_len);
+  if (!b->raw || adler32(b->raw, b->raw_len) != b->adler)
+    b->error = 1;
+}
+
+static void
+fblz_read_ahead(struct fb_lizard *F)
+{
+  /*
+   * Read frames and submit them for decompression. One slot of the window
+   * is reserved for the block whose data are currently in the buffer.
+   */
+  struct fastbuf *in = F->orig;
+  while (!F->in_eof && F->submitted - F->finished + 1 < F->window)
+    {
+      struct fblz_block *b = fblz_block(F, F->submitted);
+      if (bpeekc(in) < 0)
+	die("%s: Truncated LiZaRd stream", in->name);
+      u32 clen = bgetl(in);
+      u32 rlen = bgetl(in);
+      u32 adler = bgetl(in);
+      if (!clen && !rlen)
+	{
+	  F->in_eof = 1;
+	  break;
+	}
+      b->stored = !!(clen & FBLZ_STORED);
+      clen &= ~FBLZ_STORED;
+      if (!rlen || rlen > F->block_size || (b->stored ? clen != rlen : clen > F->comp_size))
+	die("%s: Corrupted LiZaRd stream (frame %u)", in->name, F->submitted);
+      b->raw_len = rlen;
+      b->comp_len = clen;
+      b->adler = adler;
+      if (breadb(in, b->comp, clen) != clen)
+	die("%s: Truncated LiZaRd stream", in->name);
+      fblz_submit(F, b, fblz_decompress);
+    }
+}
+
+static int
+fblz_refill(struct fastbuf *f)
+{
+  struct fb_lizard *F = FB_LIZARD(f);
+  fblz_read_ahead(F);
+  if (F->finished == F->submitted)
+    return 0;
+  struct fblz_block *b = fblz_block(F, F->finished);
+  while (!b->done)
+    fblz_wait(F);
+  if (b->error)
+    die("%s: Corrupted LiZaRd stream (frame %u)", F->orig->name, b->seq);
+  f->buffer = f->bptr = b->raw;
+  f->bufend = f->bstop = b->raw + b->raw_len;
+  f->pos = (ucw_off_t) b->seq * F->block_size + b->raw_len;
+  F->finished++;
+  fblz_read_ahead(F);
+  return 1;
+}
+
+static void
+fblz_load_index(struct fb_lizard *F)
+{
+  struct fastbuf *in = F->orig;
+  bseek(in, -FBLZ_TRAILER, SEEK_END);
+  ucw_off_t index_pos = bgetq(in);
+  F->total = bgetq(in);
+  uns n = bgetl(in);
+  if (bgetl(in) != FBLZ_MAGIC_END ||
+      (F->total + F->block_size - 1) / F->block_size != n ||
+      F->start + index_pos + 8*(ucw_off_t)n + FBLZ_TRAILER != btell(in))
+    die("%s: LiZaRd stream has an invalid index", in->name);
+  F->index = xmalloc((n+1) * sizeof(u64));
+  F->index_len = n;
+  bsetpos(in, F->start + index_pos);
+  for (uns i = 0; i < n; i++)
+    F->index[i] = bgetq(in);
+  F->index[n] = index_pos - 12;		/* The end frame */
+}
+
+static int
+fblz_seek(struct fastbuf *f, ucw_off_t pos, int whence)
+{
+  struct fb_lizard *F = FB_LIZARD(f);
+  if (!F->orig->seek)
+    return 0;
+  if (!F->index)
+    fblz_load_index(F);
+  if (whence == SEEK_END)
+    pos += F->total;
+  if (pos < 0 || pos > F->total)
+    return 0;
+
+  /* Forget everything read ahead and start again at the frame containing the position */
+  while (F->running)
+    fblz_wait(F);
+  uns k = pos / F->block_size;
+  DBG("FBLZ: Seeking to %llu (frame %u)", (long long) pos, k);
+  F->submitted = F->finished = k;
+  F->in_eof = 0;
+  bsetpos(F->orig, F->start + F->index[k]);
+  f->buffer = f->bptr = f->bstop = f->bufend = NULL;
+  f->pos = (ucw_off_t) k * F->block_size;
+  if (pos == f->pos)
+    return 1;
+  if (!fblz_refill(f))
+    return 0;
+  f->bptr = f->buffer + (pos - (ucw_off_t) k * F->block_size);
+  return 1;
+}
+
+static void
+fblz_close_read(struct fastbuf *f)
+{
+  fblz_cleanup(FB_LIZARD(f));
+}
+
+struct fastbuf *
+fblizard_create_read(struct fastbuf *in, struct fblizard_params *par)
+{
+  struct fb_lizard *F = xmalloc_zero(sizeof(*F));
+  struct fastbuf *f = &F->fb;
+  F->start = btell(in);
+  if (bgetl(in) != FBLZ_MAGIC)
+    die("%s: Not a LiZaRd stream", in->name);
+  F->block_size = bgetl(in);
+  if (!F->block_size || F->block_size > FBLZ_MAX_BLOCK)
+    die("%s: LiZaRd stream has an invalid block size", in->name);
+  fblz_init(F, in, par, 1);
+  F->comp_size = LIZARD_MAX_LEN(F->block_size);
+  for (uns i = 0; i < F->window; i++)
+    {
+      F->blocks[i].comp = xmalloc(F->comp_size);
+      F->blocks[i].lz_buf = lizard_alloc();
+    }
+
+  f->name = in->name;
+  f->refill = fblz_refill;
+  f->seek = fblz_seek;
+  f->close = fblz_close_read;
+  return f;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static byte *
+gen_data(uns len)
+{
+  /* Compressible pseudo-random text with a few incompressible stretches */
+  byte *d = xmalloc(len);
+  uns x = 1;
+  for (uns i = 0; i < len; i++)
+    {
+      x = x * 1103515245 + 12345;
+      if ((i >> 15) % 7 == 3)
+	d[i] = x >> 16;
+      else
+	d[i] = "abcdefgh  \n"[(x >> 16) % 11];
+    }
+  return d;
+}
+
+static void
+check(uns len, uns block_size, uns threads)
+{
+  byte *d = gen_data(len);
+  struct fblizard_params par = { .block_size = block_size, .threads = threads };
+  struct fastbuf *g = fbgrow_create(4096);
+  struct fastbuf *w = fblizard_create_write(g, &par);
+  for (uns i = 0; i < len; )
+    {
+      uns l = MIN(len - i, (i % 5000) + 1);
+      bwrite(w, d + i, l);
+      if (i % 3)
+	bflush(w);
+      i += l;
+    }
+  bclose(w);
+  fbgrow_rewind(g);
+
+  struct fastbuf *r = fblizard_create_read(g, &par);
+  byte *buf = xmalloc(len + 3*block_size);
+  if (bread(r, buf, len + 1) != len || memcmp(buf, d, len))
+    die("Sequential read failed");
+  for (uns i = 0; i < 200 && len; i++)
+    {
+      uns pos = random() % len;
+      uns l = random() % (3*block_size);
+      l = MIN(l, len - pos);
+      bsetpos(r, pos);
+      if (bread(r, buf, l) != l || memcmp(buf, d + pos, l))
+	die("Random read at %u failed", pos);
+    }
+  bseek(r, 0, SEEK_END);
+  if (btell(r) != len || bgetc(r) >= 0)
+    die("Seek to the end failed");
+  bclose(r);
+  bclose(g);
+  printf("%u bytes in blocks of %u: OK\n", len, block_size);
+  xfree(buf);
+  xfree(d);
+}
+
+static void
+check_corrupt(void)
+{
+  /* Damage the payload of the first frame, the reader must die cleanly */
+  uns len = 100000;
+  byte *d = gen_data(len);
+  struct fblizard_params par = { .block_size = 65536, .threads = 2 };
+  struct fastbuf *g = fbgrow_create(4096);
+  struct fastbuf *w = fblizard_create_write(g, &par);
+  bwrite(w, d, len);
+  bclose(w);
+  fbgrow_rewind(g);
+  for (uns i = 20; i < 2000; i++)
+    g->buffer[i] = 0xff;
+
+  struct fastbuf *r = fblizard_create_read(g, &par);
+  bread(r, d, len);
+  puts("Corruption not detected");
+}
+
+int main(int argc, char **argv UNUSED)
+{
+  if (argc > 1)
+    {
+      check_corrupt();
+      return 0;
+    }
+  check(0, 4096, 2);
+  check(65536, 4096, 3);
+  check(1000000, 65536, 4);
+  check(3000001, 1 << 20, 1);
+  return 0;
+}
+
+#endif
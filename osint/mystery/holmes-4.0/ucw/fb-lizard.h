@@ -0,0 +1,61 @@
+/*
+ *	UCW Library -- Block-Parallel LiZaRd Compression of Fastbufs
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#ifndef _UCW_FB_LIZARD_H
+#define _UCW_FB_LIZARD_H
+
+#include "ucw/fastbuf.h"
+
+struct worker_pool;
+
+/***
+ * The stream is cut to blocks of a fixed size, which are compressed
+ * independently of each other by @lizard_compress(). The blocks are
+ * processed by a pool of worker threads and written in their original order.
+ *
+ * The compressed stream consists of:
+ *
+ *   - a header: magic number and the block size (both u32),
+ *   - frames: compressed length (u32; the top bit set if the block is stored
+ *     uncompressed), uncompressed length (u32), Adler-32 checksum of the
+ *     uncompressed data (u32) and the payload; all frames except the last one
+ *     contain exactly one block of data,
+ *   - an end frame with both lengths zero,
+ *   - an index: offsets of all frames relative to the start of the stream (u64),
+ *   - a trailer: position of the index (u64), uncompressed length (u64),
+ *     number of frames (u32) and another magic number (u32).
+ *
+ * The reader decompresses several frames ahead in parallel. If the underlying
+ * stream is seekable and the compressed stream ends at its end, the reader
+ * is seekable, too: it uses the index to find the right frame.
+ *
+ * The frames are decompressed by @lizard_decompress_safe(), so damaged
+ * frames cannot overwrite memory of the process. Corrupted data are detected
+ * by it or by the checksums and the process dies.
+ ***/
+
+struct fblizard_params {	/** Parameters of LiZaRd streams. Zero means a default. **/
+  uns block_size;		// Uncompressed size of a block [256K]
+  uns threads;			// Number of worker threads [number of CPUs]
+  uns window;			// Maximum number of blocks in flight [2*threads]
+  struct worker_pool *pool;	// Use this thread pool instead of creating a private one (its threads need 256K of stack)
+};
+
+/**
+ * Create a stream compressing data to @out. When the stream is closed,
+ * all data are flushed and the trailer is written to @out, but @out itself
+ * stays open. @bflush() does not end the current block.
+ **/
+struct fastbuf *fblizard_create_write(struct fastbuf *out, struct fblizard_params *par);
+
+/**
+ * Create a stream decompressing data from @in. The @block_size parameter is
+ * ignored, since the stream knows it. Closing the stream does not close @in.
+ **/
+struct fastbuf *fblizard_create_read(struct fastbuf *in, struct fblizard_params *par);
+
+#endif
@@ -0,0 +1,10 @@
+# Tests for fb-lizard
+
+Run:	../obj/ucw/fb-lizard-t
+Out:	0 bytes in blocks of 4096: OK
+	65536 bytes in blocks of 4096: OK
+	1000000 bytes in blocks of 65536: OK
+	3000001 bytes in blocks of 1048576: OK
+
+Run:	../obj/ucw/fb-lizard-t corrupt
+Exit:	1
@@ -45,6 +45,29 @@ int cf_load(const char *file);		/** Load configuration from @file. If @file is N
  **/
 int cf_set(const char *string);
 
+/***
+ * [[conf_snapshot]]
+ * Compiled snapshots
+ * ~~~~~~~~~~~~~~~~~~
+ *
+ * A configuration file together with all files it includes can be compiled
+ * to a binary snapshot, which is loaded by @cf_load() instead of the text
+ * files as long as none of them has changed. See <<config:snapshots,the
+ * configuration syntax>> for details.
+ ***/
+
+/**
+ * Suffix appended to the name of a configuration file to get the name
+ * of its snapshot (".snap" by default). Set it to NULL to ignore snapshots.
+ **/
+extern char *cf_snapshot_suffix;
+/**
+ * Compile configuration @file and all files it includes to a @snapshot.
+ * If @snapshot is NULL, the name is derived from @file using @cf_snapshot_suffix.
+ * Returns a non-zero value if the configuration could not be parsed.
+ **/
+int cf_snapshot_write(const char *file, const char *snapshot);
+
 /***
  * [[conf_direct]]
  * Direct access
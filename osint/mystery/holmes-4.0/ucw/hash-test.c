@@ -295,10 +295,244 @@ static void test5(void)
   puts("OK");
 }
 
+/* TEST 6: complex keys in an open-addressing table */
+
+struct node6 {
+  int port;
+  int data;
+  char host[1];
+};
+
+#define HASH_NODE struct node6
+#define HASH_PREFIX(x) test6_##x
+#define HASH_KEY_COMPLEX(x) x host, x port
+#define HASH_KEY_DECL char *host, int port
+#define HASH_OPEN_ADDRESSING
+
+#define HASH_WANT_CLEANUP
+#define HASH_WANT_FIND
+#define HASH_WANT_NEW
+#define HASH_WANT_LOOKUP
+#define HASH_WANT_DELETE
+#define HASH_WANT_REMOVE
+
+#define HASH_GIVE_HASHFN
+static uns test6_hash(char *host, int port)
+{
+  return hash_string_nocase(host) ^ hash_u32(port);
+}
+
+#define HASH_GIVE_EQ
+static inline int test6_eq(char *host1, int port1, char *host2, int port2)
+{
+  return !strcasecmp(host1,host2) && port1 == port2;
+}
+
+#define HASH_GIVE_EXTRA_SIZE
+static inline uns test6_extra_size(char *host, int port UNUSED)
+{
+  return strlen(host);
+}
+
+#define HASH_GIVE_INIT_KEY
+static inline void test6_init_key(struct node6 *n, char *host, int port)
+{
+  strcpy(n->host, host);
+  n->port = port;
+}
+
+#include "ucw/hashtable.h"
+
+static void test6(void)
+{
+  int i;
+  char x[32];
+  struct node6 *n;
+
+  test6_init();
+  for (i=0; i<100000; i++)
+    if ((i % 3) == 0)
+      {
+	sprintf(x, "abc%d", i);
+	n = test6_new(x, i%10);
+	n->data = i;
+      }
+  for (i=0; i<100000; i++)
+    {
+      sprintf(x, "abc%d", i);
+      n = test6_lookup(x, i%10);
+      n->data = i;
+    }
+  for (i=0; i<100000; i++)
+    if (i % 2)
+      {
+	sprintf(x, "aBc%d", i);
+	if ((i % 7) < 3)
+	  {
+	    n = test6_find(x, i%10);
+	    ASSERT(n);
+	    test6_remove(n);
+	  }
+	else
+	  test6_delete(x, i%10);
+      }
+  for (i=0; i<100000; i++)
+    {
+      sprintf(x, "ABC%d", i);
+      n = test6_find(x, i%10);
+      if (!n != (i&1) || (n && n->data != i))
+	die("Inconsistency at i=%d", i);
+    }
+  test6_cleanup();
+  puts("OK");
+}
+
+/* TEST 7: duplicate integer keys in a dynamic open-addressing table with 64-bit hashing */
+
+struct node7 {
+  int key;
+  int data;
+};
+
+#define HASH_NODE struct node7
+#define HASH_PREFIX(x) test7_##x
+#define HASH_KEY_ATOMIC key
+#define HASH_ATOMIC_TYPE int
+#define HASH_TABLE_DYNAMIC
+#define HASH_OPEN_ADDRESSING
+#define HASH_USE_HASH64
+
+#define HASH_WANT_CLEANUP
+#define HASH_WANT_FIND
+#define HASH_WANT_FIND_NEXT
+#define HASH_WANT_NEW
+#define HASH_WANT_DELETE
+
+#include "ucw/hashtable.h"
+
+static void test7(void)
+{
+  struct test7_table tab;
+  int i;
+
+  test7_init(&tab);
+  for (int round=0; round<3; round++)
+    {
+      /* Insert 3 copies of each key, then delete some, leaving tombstones */
+      for (i=0; i<3000; i++)
+	test7_new(&tab, i % 1000)->data = i;
+      for (i=0; i<1000; i+=2)
+	while (test7_delete(&tab, i))
+	  ;
+      for (i=0; i<1000; i++)
+	{
+	  uns cnt = 0, sum = 0;
+	  for (struct node7 *n = test7_find(&tab, i); n; n = test7_find_next(&tab, n))
+	    cnt++, sum += n->data;
+	  if (cnt != ((i & 1) ? 3U*(round+1) : 0U) || (cnt && sum != (round+1)*(3U*i + 3000U)))
+	    die("Inconsistency at i=%d, round %d: cnt=%d", i, round, cnt);
+	}
+    }
+  i = 0;
+  HASH_FOR_ALL_DYNAMIC(test7, &tab, n)
+    i += n->key;
+  HASH_END_FOR;
+  ASSERT(i == 9*250000);
+  test7_cleanup(&tab);
+  puts("OK");
+}
+
+/* Benchmark of chained and open-addressing tables on word-like keys */
+
+struct nodeb {
+  uns data;
+  char key[1];
+};
+
+#define HASH_NODE struct nodeb
+#define HASH_PREFIX(x) benchc_##x
+#define HASH_KEY_ENDSTRING key
+#define HASH_AUTO_POOL 65536
+#define HASH_WANT_FIND
+#define HASH_WANT_LOOKUP
+#include "ucw/hashtable.h"
+
+#define HASH_NODE struct nodeb
+#define HASH_PREFIX(x) bencho_##x
+#define HASH_KEY_ENDSTRING key
+#define HASH_AUTO_POOL 65536
+#define HASH_OPEN_ADDRESSING
+#define HASH_WANT_FIND
+#define HASH_WANT_LOOKUP
+#include "ucw/hashtable.h"
+
+static char **bench_gen(uns n, uns seed)
+{
+  char **w = xmalloc(n * sizeof(char *));
+  srandom(seed);
+  for (uns i=0; i<n; i++)
+    {
+      uns len = 3 + random() % 10;
+      w[i] = xmalloc(len + 12);
+      for (uns j=0; j<len; j++)
+	w[i][j] = 'a' + random() % 26;
+      sprintf(w[i] + len, "%x", i);		/* make the words unique */
+    }
+  return w;
+}
+
+#define BENCH(px, name)									\
+  {											\
+    timestamp_t timer;									\
+    uns sum = 0, ti, tf, tm;								\
+    px##_init();									\
+    init_timer(&timer);									\
+    for (uns i=0; i<n; i++)								\
+      px##_lookup(keys[i])->data = i;							\
+    ti = get_timer(&timer);								\
+    for (uns r=0; r<rounds; r++)							\
+      for (uns i=0; i<n; i++)								\
+	sum += px##_find(hits[i])->data;						\
+    tf = get_timer(&timer);								\
+    for (uns r=0; r<rounds; r++)							\
+      for (uns i=0; i<n; i++)								\
+	sum += !!px##_find(misses[i]);							\
+    tm = get_timer(&timer);								\
+    printf("%-8s insert %5d ms, hit %5d ms, miss %5d ms (%u)\n", name, ti, tf, tm, sum);	\
+  }
+
+static void bench(uns n, uns rounds)
+{
+  char **keys = bench_gen(n, 1);
+  char **misses = bench_gen(n, 2);
+  for (uns i=0; i<n; i++)
+    misses[i][0] = '_';
+
+  /* Nodes are allocated in the order of insertion, so look them up in a different one */
+  char **hits = xmalloc(n * sizeof(char *));
+  memcpy(hits, keys, n * sizeof(char *));
+  for (uns i=n-1; i>0; i--)
+    {
+      uns j = random() % (i+1);
+      char *k = hits[i];
+      hits[i] = hits[j];
+      hits[j] = k;
+    }
+
+  printf("%u keys, %u lookup rounds\n", n, rounds);
+  BENCH(benchc, "chained");
+  BENCH(bencho, "open");
+}
+
 int
 main(int argc, char **argv)
 {
   uns m = ~0U;
+  if (argc > 1 && !strcmp(argv[1], "bench"))
+    {
+      bench((argc > 2) ? atol(argv[2]) : 2000000, (argc > 3) ? atol(argv[3]) : 3);
+      return 0;
+    }
   if (argc > 1)
     {
       m = 0;
@@ -315,5 +549,9 @@ main(int argc, char **argv)
     test4();
   if (m & (1 << 5))
     test5();
+  if (m & (1 << 6))
+    test6();
+  if (m & (1 << 7))
+    test7();
   return 0;
 }
@@ -11,3 +11,12 @@ Out:	OK
 
 Run:	../obj/ucw/hash-test 4
 Out:	OK
+
+Run:	../obj/ucw/hash-test 5
+Out:	OK
+
+Run:	../obj/ucw/hash-test 6
+Out:	OK
+
+Run:	../obj/ucw/hash-test 7
+Out:	OK
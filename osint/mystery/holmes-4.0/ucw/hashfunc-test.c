@@ -93,12 +93,31 @@ main(int argc, char **argv)
 			printf(" upper case?");
 		printf("\n");
 	}
+	for (i=0; strings[i]; i++)
+	{
+		/* 64-bit hashes must not depend on alignment and the nocase one must agree with upper-casing */
+		uns len = strlen(strings[i]);
+		byte buf[len + 16], up[len + 1];
+		u64 h = hash64_string(strings[i]);
+		for (uns j=0; j<8; j++)
+		{
+			memcpy(buf + j, strings[i], len + 1);
+			if (hash64_block(buf + j, len) != h || hash64_string(buf + j) != h)
+				die("Internal hash64_string() error on string %d, shift %d", i, j);
+		}
+		for (uns j=0; j<=len; j++)
+			up[j] = (strings[i][j] >= 'a' && strings[i][j] <= 'z') ? strings[i][j] - 32 : strings[i][j];
+		if (hash64_string_nocase(strings[i]) != hash64_string(up))
+			die("Internal hash64_string_nocase() error on string %d", i);
+		printf("hash64 %2d = %016llx\n", i, (long long) h);
+	}
 	for (i=0; lengths[i] >= 0; i++)
 	{
 		byte str[lengths[i] + 1 + alignment];
 		uns count = TEST_TIME / (lengths[i] + 10);
-		uns el1 = 0, el2 = 0, elh = 0, elhn = 0;
+		uns el1 = 0, el2 = 0, elh = 0, elhn = 0, elh64 = 0, elhn64 = 0;
 		uns tot1 = 0, tot2 = 0, hash = 0, hashn = 0;
+		u64 hash64 = 0, hashn64 = 0;
 		uns j;
 		for (j=0; j<count; j++)
 		{
@@ -114,12 +133,17 @@ main(int argc, char **argv)
 			elh += elapsed_time();
 			hashn ^= hash_string_nocase(str + alignment);
 			elhn += elapsed_time();
+			hash64 ^= hash64_string(str + alignment);
+			elh64 += elapsed_time();
+			hashn64 ^= hash64_string_nocase(str + alignment);
+			elhn64 += elapsed_time();
 		}
 		if (tot1 != tot2)
 			die("Internal error during test %d", i);
 		printf("Test %d: strlen = %d, passes = %d, classical = %d usec, speedup = %.4f\n",
 			i, lengths[i], count, el1, (el1 + 0.) / el2);
 		printf("\t\t total hash = %08x/%08x, hash time = %d/%d usec\n", hash, hashn, elh, elhn);
+		printf("\t\t total hash64 = %016llx/%016llx, hash64 time = %d/%d usec\n", (long long) hash64, (long long) hashn64, elh64, elhn64);
 	}
 /*
 	printf("test1: %d\n", hash_modify(10000000, 10000000, 99777555));
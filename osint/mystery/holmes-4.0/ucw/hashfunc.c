@@ -14,6 +14,7 @@
 #include "ucw/lib.h"
 #include "ucw/hashfunc.h"
 #include "ucw/chartype.h"
+#include "ucw/unaligned.h"
 
 /* The number of bits the hash in the function hash_*() is rotated by after
  * every pass.  It should be prime with the word size.  */
@@ -211,3 +212,143 @@ hash_string_nocase(const char *str)
 	}
 	return hash;
 }
+
+/*
+ * 64-bit hashes: a variant of the wyhash design by Wang Yi. Everything is
+ * mixed by multiplying 64-bit words to 128 bits and folding the halves.
+ * Short inputs are read by overlapping loads, so no byte-by-byte loop is needed.
+ */
+
+static const u64 hash64_secret[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline void
+hash64_mul(u64 *a, u64 *b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 r = (unsigned __int128) *a * *b;
+	*a = r;
+	*b = r >> 64;
+#else
+	u64 ha = *a >> 32, hb = *b >> 32, la = (u32) *a, lb = (u32) *b;
+	u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	u64 t = rl + (rm0 << 32), c = t < rl;
+	u64 lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline u64
+hash64_mix(u64 a, u64 b)
+{
+	hash64_mul(&a, &b);
+	return a ^ b;
+}
+
+/* Convert ASCII lower case letters in all 8 bytes of x to upper case */
+static inline u64
+hash64_upcase(u64 x)
+{
+	u64 t = x & 0x7f7f7f7f7f7f7f7fULL;
+	u64 ge_a = t + 0x1f1f1f1f1f1f1f1fULL;		/* Top bit set iff the byte is >= 'a' */
+	u64 gt_z = t + 0x0505050505050505ULL;		/* ... iff > 'z' */
+	u64 m = ge_a & ~gt_z & ~x & 0x8080808080808080ULL;
+	return x ^ (m >> 2);
+}
+
+static inline u64
+hash64_r8(const byte *p, int nocase)
+{
+	u64 x = get_u64_le(p);
+	return nocase ? hash64_upcase(x) : x;
+}
+
+static inline u64
+hash64_r4(const byte *p, int nocase)
+{
+	u64 x = get_u32_le(p);
+	return nocase ? hash64_upcase(x) : x;
+}
+
+static inline u64
+hash64_r3(const byte *p, uns len, int nocase)
+{
+	u64 x = ((u64) p[0] << 16) | ((u64) p[len >> 1] << 8) | p[len - 1];
+	return nocase ? hash64_upcase(x) : x;
+}
+
+static inline u64
+hash64_core(const byte *p, uns len, u64 seed, int nocase)
+{
+	const u64 *s = hash64_secret;
+	u64 a, b;
+
+	seed ^= hash64_mix(seed ^ s[0], s[1]);
+	if (len <= 16)
+	{
+		if (len >= 4)
+		{
+			uns d = (len >> 3) << 2;
+			a = (hash64_r4(p, nocase) << 32) | hash64_r4(p + d, nocase);
+			b = (hash64_r4(p + len - 4, nocase) << 32) | hash64_r4(p + len - 4 - d, nocase);
+		}
+		else if (len)
+		{
+			a = hash64_r3(p, len, nocase);
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else
+	{
+		uns i = len;
+		if (i > 48)
+		{
+			u64 seed1 = seed, seed2 = seed;
+			do
+			{
+				seed = hash64_mix(hash64_r8(p, nocase) ^ s[1], hash64_r8(p + 8, nocase) ^ seed);
+				seed1 = hash64_mix(hash64_r8(p + 16, nocase) ^ s[2], hash64_r8(p + 24, nocase) ^ seed1);
+				seed2 = hash64_mix(hash64_r8(p + 32, nocase) ^ s[3], hash64_r8(p + 40, nocase) ^ seed2);
+				p += 48;
+				i -= 48;
+			}
+			while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (i > 16)
+		{
+			seed = hash64_mix(hash64_r8(p, nocase) ^ s[1], hash64_r8(p + 8, nocase) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hash64_r8(p + i - 16, nocase);
+		b = hash64_r8(p + i - 8, nocase);
+	}
+	a ^= s[1];
+	b ^= seed;
+	hash64_mul(&a, &b);
+	return hash64_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+u64
+hash64_block_seed(const byte *buf, uns len, u64 seed)
+{
+	return hash64_core(buf, len, seed, 0);
+}
+
+u64
+hash64_string(const char *str)
+{
+	return hash64_core(str, str_len(str), 0, 0);
+}
+
+u64
+hash64_string_nocase(const char *str)
+{
+	return hash64_core(str, str_len(str), 0, 1);
+}
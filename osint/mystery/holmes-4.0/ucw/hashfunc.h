@@ -44,4 +44,32 @@ static inline uns CONST hash_u32(uns x) { return 0x01008041*x; } /** Hash a 32 b
 static inline uns CONST hash_u64(u64 x) { return hash_u32((uns)x ^ (uns)(x >> 32)); } /** Hash a 64 bit unsigned integer. **/
 static inline uns CONST hash_pointer(void *x) { return ((sizeof(x) <= 4) ? hash_u32((uns)(uintptr_t)x) : hash_u64((u64)(uintptr_t)x)); } /** Hash a pointer. **/
 
+/*** === 64-bit hashes [[hash64]] ***/
+
+/***
+ * The 32-bit hashes above are simple and fast, but they have poor
+ * avalanche properties and with tens of millions of keys their results
+ * collide quite often. The following functions return 64-bit hashes of
+ * much better quality. They process 16 or 48 bytes at a time by 64x64->128
+ * bit multiplications and they do not care about alignment of the data.
+ * Their results are the same on all platforms, so they can be stored in files.
+ ***/
+
+u64 hash64_block_seed(const byte *buf, uns len, u64 seed) PURE; /** Hash arbitrary data, starting with a given seed (for example a random one to defeat collision attacks). **/
+static inline u64 PURE hash64_block(const byte *buf, uns len) { return hash64_block_seed(buf, len, 0); } /** Hash arbitrary data. **/
+u64 hash64_string(const char *str) PURE; /** Hash a string, equivalent to @hash64_block() on its characters. **/
+u64 hash64_string_nocase(const char *str) PURE; /** Hash a string in a case insensitive way. Works only with ASCII characters. **/
+
+/** Hash a 64 bit unsigned integer, all bits of the result depend on all bits of the argument. **/
+static inline u64 CONST hash64_u64(u64 x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  return x ^ (x >> 33);
+}
+
+static inline uns CONST hash64_fold(u64 x) { return x ^ (x >> 32); } /** Reduce a 64-bit hash to an `uns`, for example for a hash table. **/
+
 #endif
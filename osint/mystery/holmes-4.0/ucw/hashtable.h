@@ -89,6 +89,9 @@
  *  HASH_CONSERVE_SPACE	Use as little space as possible.
  *  HASH_FN_BITS=n	The hash function gives only `n' significant bits.
  *  HASH_ATOMIC_TYPE=t	Atomic values are of type `t' instead of int.
+ *  HASH_USE_HASH64	The default hash functions use the 64-bit hashes
+ *			from ucw/hashfunc.h (folded to 32 bits), which are
+ *			slower for very short keys, but distribute much better.
  *  HASH_USE_POOL=pool	Allocate all nodes from given mempool. Note, however, that
  *			deallocation is not supported by mempools, so delete/remove
  *			will leak pool memory.
@@ -99,6 +102,15 @@
  *			the default xmalloc().
  *  HASH_TABLE_DYNAMIC	Support multiple hash tables; the first parameter of all
  *			hash table operations is struct HASH_PREFIX(table) *.
+ *  HASH_OPEN_ADDRESSING Instead of chaining the nodes, keep pointers to them
+ *			in a flat array probed by open addressing. Each slot has
+ *			a control byte holding 7 bits of the hash and the control
+ *			bytes are compared 16 at a time (by a single instruction
+ *			if SSE2 is available), so most probes touch a single
+ *			cache line and only the matching nodes are visited.
+ *			The nodes are still allocated one by one, so pointers
+ *			to them survive rehashing, and the interface is unchanged.
+ *			Deleted slots leave tombstones until the next rehash.
  *
  *  You also get a iterator macro at no extra charge:
  *
@@ -128,6 +140,70 @@
 
 #include <string.h>
 
+#if defined(HASH_OPEN_ADDRESSING) && !defined(_UCW_HASHTABLE_GROUPS)
+#define _UCW_HASHTABLE_GROUPS
+
+#include "ucw/bitops.h"
+
+/* Control bytes of open-addressing tables: full slots contain 7 bits of the hash */
+
+#define HASH_GROUP 16
+#define HASH_CTRL_EMPTY 0x80
+#define HASH_CTRL_DELETED 0xfe
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* Bit mask of slots in the group whose control byte is c */
+static inline uns hash_group_match(byte *g, uns c)
+{
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) g), _mm_set1_epi8(c)));
+}
+
+/* Bit mask of empty and deleted slots (the only ones with the top bit set) */
+static inline uns hash_group_free(byte *g)
+{
+  return _mm_movemask_epi8(_mm_loadu_si128((__m128i *) g));
+}
+
+#else
+
+static inline uns hash_group_match(byte *g, uns c)
+{
+  uns m = 0;
+  for (uns i=0; i<HASH_GROUP; i++)
+    m |= (g[i] == c) << i;
+  return m;
+}
+
+static inline uns hash_group_free(byte *g)
+{
+  uns m = 0;
+  for (uns i=0; i<HASH_GROUP; i++)
+    m |= (g[i] >> 7) << i;
+  return m;
+}
+
+#endif
+
+/* Spread the hash, so that both the position and the control byte get independent bits */
+static inline uns hash_group_mix(uns h)
+{
+  h ^= h >> 16;
+  h *= 0x7feb352d;
+  h ^= h >> 15;
+  h *= 0x846ca68b;
+  return h ^ (h >> 16);
+}
+
+#define HASH_GROUP_CTRL(x) ((x) >> 25)
+
+/* Triangular probing of groups visits all of them if their number is a power of two */
+#define HASH_FOR_GROUPS(g, x, size) \
+  for (uns g = (x) & ((size)-1) & ~(HASH_GROUP-1), g##_step = 0;; g##_step += HASH_GROUP, g = (g + g##_step) & ((size)-1))
+
+#endif
+
 /* Initial setup of parameters */
 
 #if !defined(HASH_NODE) || !defined(HASH_PREFIX)
@@ -145,13 +221,37 @@
 typedef HASH_NODE P(node);
 
 typedef struct P(bucket) {
+#ifndef HASH_OPEN_ADDRESSING
   struct P(bucket) *next;
+#endif
 #ifndef HASH_CONSERVE_SPACE
   uns hash;
 #endif
   P(node) n;
 } P(bucket);
 
+#ifdef HASH_OPEN_ADDRESSING
+
+/* Control bytes share cache lines with the pointers they describe */
+struct P(group) {
+  byte ctrl[HASH_GROUP];
+  P(bucket) *slot[HASH_GROUP];		/* NULL for empty and deleted slots */
+};
+
+struct P(table) {
+  uns hash_size;			/* number of slots, a power of two */
+  uns hash_count, hash_max, hash_min, hash_deleted;
+  struct P(group) *groups;
+#ifdef HASH_AUTO_POOL
+  struct mempool *pool;
+#endif
+};
+
+static inline P(bucket) *P(slot) (struct P(table) *t, uns i) { return t->groups[i / HASH_GROUP].slot[i % HASH_GROUP]; }
+static inline P(bucket) *P(bucket_next) (P(bucket) *b UNUSED) { return NULL; }
+
+#else
+
 struct P(table) {
   uns hash_size;
   uns hash_count, hash_max, hash_min, hash_hard_max;
@@ -161,6 +261,11 @@ struct P(table) {
 #endif
 };
 
+static inline P(bucket) *P(slot) (struct P(table) *t, uns i) { return t->ht[i]; }
+static inline P(bucket) *P(bucket_next) (P(bucket) *b) { return b->next; }
+
+#endif
+
 #ifdef HASH_TABLE_DYNAMIC
 #define T (*table)
 #define TA struct P(table) *table
@@ -193,8 +298,13 @@ struct P(table) P(table);
 
 #ifndef HASH_GIVE_HASHFN
 #  define HASH_GIVE_HASHFN
+#  ifdef HASH_USE_HASH64
+   static inline uns P(hash) (TAUC HASH_ATOMIC_TYPE x)
+   { return hash64_fold(hash64_u64(x)); }
+#  else
    static inline int P(hash) (TAUC HASH_ATOMIC_TYPE x)
    { return ((sizeof(x) <= 4) ? hash_u32(x) : hash_u64(x)); }
+#  endif
 #endif
 
 #ifndef HASH_GIVE_EQ
@@ -218,7 +328,11 @@ struct P(table) P(table);
 #ifndef HASH_GIVE_HASHFN
 #  define HASH_GIVE_HASHFN
    static inline int P(hash) (TAUC byte *x)
+#  ifdef HASH_USE_HASH64
+   { return hash64_fold(hash64_block(x, HASH_KEY_SIZE)); }
+#  else
    { return hash_block(x, HASH_KEY_SIZE); }
+#  endif
 #endif
 
 #ifndef HASH_GIVE_EQ
@@ -259,7 +373,11 @@ struct P(table) P(table);
 #define HASH_GIVE_HASHFN
   static inline uns P(hash) (TAUC char *k)
    {
-#    ifdef HASH_NOCASE
+#    if defined(HASH_USE_HASH64) && defined(HASH_NOCASE)
+       return hash64_fold(hash64_string_nocase(k));
+#    elif defined(HASH_USE_HASH64)
+       return hash64_fold(hash64_string(k));
+#    elif defined(HASH_NOCASE)
        return hash_string_nocase(k);
 #    else
        return hash_string(k);
@@ -379,6 +497,8 @@ static inline void * P(new_bucket)(TAUC uns size) { return P(alloc)(TTC size); }
 
 /* Now the operations */
 
+#ifndef HASH_OPEN_ADDRESSING
+
 static void P(alloc_table) (TAU)
 {
   T.hash_size = next_table_prime(T.hash_size);
@@ -643,6 +763,258 @@ static void HASH_PREFIX(remove)(TAC HASH_NODE *n)
 }
 #endif
 
+#else /* HASH_OPEN_ADDRESSING */
+
+/*
+ *  The same operations on open-addressing tables. The table must always
+ *  contain an empty slot to terminate the probing, so we keep the number
+ *  of full and deleted slots below 7/8 of the size.
+ */
+
+#define HASH_SLOT(i) T.groups[(i) / HASH_GROUP].slot[(i) % HASH_GROUP]
+#define HASH_CTRL(i) T.groups[(i) / HASH_GROUP].ctrl[(i) % HASH_GROUP]
+#define HASH_GROUP_CTRLS(g) T.groups[(g) / HASH_GROUP].ctrl
+
+static void P(alloc_table) (TAU)
+{
+  uns size = HASH_GROUP;
+  while (size < T.hash_size)
+    size *= 2;
+  T.hash_size = size;
+  T.groups = P(table_alloc)(TTC sizeof(struct P(group)) * (size / HASH_GROUP));
+  for (uns i=0; i<size/HASH_GROUP; i++)
+    {
+      memset(T.groups[i].ctrl, HASH_CTRL_EMPTY, HASH_GROUP);
+      bzero(T.groups[i].slot, sizeof(T.groups[i].slot));
+    }
+  T.hash_deleted = 0;
+  T.hash_max = size - size/8;
+  if (size/2 > HASH_DEFAULT_SIZE)
+    T.hash_min = size/8;
+  else
+    T.hash_min = 0;
+}
+
+static void HASH_PREFIX(init)(TA)
+{
+  T.hash_count = 0;
+  T.hash_size = HASH_DEFAULT_SIZE;
+  P(init_alloc)(TT);
+  P(alloc_table)(TT);
+}
+
+#ifdef HASH_WANT_CLEANUP
+static void HASH_PREFIX(cleanup)(TA)
+{
+#ifndef HASH_USE_POOL
+  for (uns i=0; i<T.hash_size; i++)
+    if (HASH_SLOT(i))
+      P(free)(TTC HASH_SLOT(i));
+#endif
+  P(cleanup_alloc)(TT);
+  P(table_free)(TTC T.groups);
+}
+#endif
+
+static inline uns P(bucket_hash) (TAUC P(bucket) *b)
+{
+#ifdef HASH_CONSERVE_SPACE
+  return P(hash)(TTC HASH_KEY(b->n.));
+#else
+  return b->hash;
+#endif
+}
+
+static void P(place) (TAC P(bucket) *b, uns x)
+{
+  HASH_FOR_GROUPS(g, x, T.hash_size)
+    {
+      uns m = hash_group_free(HASH_GROUP_CTRLS(g));
+      if (m)
+	{
+	  uns i = g + bit_ffs(m);
+	  if (HASH_CTRL(i) == HASH_CTRL_DELETED)
+	    T.hash_deleted--;
+	  HASH_CTRL(i) = HASH_GROUP_CTRL(x);
+	  HASH_SLOT(i) = b;
+	  return;
+	}
+    }
+}
+
+static void P(rehash) (TAC uns size)
+{
+  struct P(group) *oldt = T.groups;
+  uns oldsize = T.hash_size;
+
+  DBG("Rehashing %d->%d at count %d", oldsize, size, T.hash_count);
+  T.hash_size = size;
+  P(alloc_table)(TT);
+  for (uns i=0; i<oldsize/HASH_GROUP; i++)
+    for (uns j=0; j<HASH_GROUP; j++)
+      if (oldt[i].slot[j])
+	P(place)(TTC oldt[i].slot[j], hash_group_mix(P(bucket_hash)(TTC oldt[i].slot[j])));
+  P(table_free)(TTC oldt);
+}
+
+static inline void P(make_room) (TAU)
+{
+  if (T.hash_count + T.hash_deleted >= T.hash_max)
+    P(rehash)(TTC (T.hash_count >= T.hash_max/2) ? 2*T.hash_size : T.hash_size);
+}
+
+#if defined(HASH_WANT_NEW) || defined(HASH_WANT_LOOKUP)
+static P(bucket) *P(insert) (TAC uns h0 UNUSED, HASH_KEY_DECL)
+{
+  P(bucket) *b = P(new_bucket) (TTC sizeof(struct P(bucket)) + HASH_EXTRA_SIZE(HASH_KEY( )));
+#ifndef HASH_CONSERVE_SPACE
+  b->hash = h0;
+#endif
+  P(init_key)(TTC &b->n, HASH_KEY( ));
+  P(init_data)(TTC &b->n);
+  P(make_room)(TT);
+  P(place)(TTC b, hash_group_mix(h0));
+  T.hash_count++;
+  return b;
+}
+#endif
+
+#if defined(HASH_WANT_DELETE) || defined(HASH_WANT_REMOVE)
+static void P(clear_slot) (TAC uns i)
+{
+  P(free)(TTC HASH_SLOT(i));
+  HASH_SLOT(i) = NULL;
+  /*
+   *  A group which has an empty slot never had all slots used since the last
+   *  rehash, so no probe sequence continues past it and we need no tombstone.
+   */
+  if (hash_group_match(HASH_GROUP_CTRLS(i & ~(HASH_GROUP-1)), HASH_CTRL_EMPTY))
+    HASH_CTRL(i) = HASH_CTRL_EMPTY;
+  else
+    {
+      HASH_CTRL(i) = HASH_CTRL_DELETED;
+      T.hash_deleted++;
+    }
+  if (--T.hash_count < T.hash_min)
+    P(rehash)(TTC T.hash_size/2);
+}
+#endif
+
+#if defined(HASH_WANT_FIND) || defined(HASH_WANT_LOOKUP) || defined(HASH_WANT_DELETE)
+static int P(find_slot) (TAC uns h0, HASH_KEY_DECL)
+{
+  uns x = hash_group_mix(h0);
+  HASH_FOR_GROUPS(g, x, T.hash_size)
+    {
+      byte *c = HASH_GROUP_CTRLS(g);
+      for (uns m = hash_group_match(c, HASH_GROUP_CTRL(x)); m; m &= m-1)
+	{
+	  uns i = g + bit_ffs(m);
+	  P(bucket) *b = HASH_SLOT(i);
+	  if (
+#ifndef HASH_CONSERVE_SPACE
+	      b->hash == h0 &&
+#endif
+	      P(eq)(TTC HASH_KEY( ), HASH_KEY(b->n.)))
+	    return i;
+	}
+      if (hash_group_match(c, HASH_CTRL_EMPTY))
+	return -1;
+    }
+}
+#endif
+
+#ifdef HASH_WANT_FIND
+static HASH_NODE* HASH_PREFIX(find)(TAC HASH_KEY_DECL)
+{
+  int i = P(find_slot)(TTC P(hash) (TTC HASH_KEY( )), HASH_KEY( ));
+  return (i >= 0) ? &HASH_SLOT(i)->n : NULL;
+}
+#endif
+
+#ifdef HASH_WANT_FIND_NEXT
+static HASH_NODE* HASH_PREFIX(find_next)(TAC P(node) *start)
+{
+  P(bucket) *s = SKIP_BACK(P(bucket), n, start);
+  uns h0 = P(bucket_hash)(TTC s);
+  uns x = hash_group_mix(h0);
+  int seen = 0;
+
+  /* Duplicates are found in the order of the probe sequence, so we continue after the start node */
+  HASH_FOR_GROUPS(g, x, T.hash_size)
+    {
+      byte *c = HASH_GROUP_CTRLS(g);
+      for (uns m = hash_group_match(c, HASH_GROUP_CTRL(x)); m; m &= m-1)
+	{
+	  P(bucket) *b = HASH_SLOT(g + bit_ffs(m));
+	  if (b == s)
+	    seen = 1;
+	  else if (seen &&
+#ifndef HASH_CONSERVE_SPACE
+	      b->hash == h0 &&
+#endif
+	      P(eq)(TTC HASH_KEY(start->), HASH_KEY(b->n.)))
+	    return &b->n;
+	}
+      if (hash_group_match(c, HASH_CTRL_EMPTY))
+	return NULL;
+    }
+}
+#endif
+
+#ifdef HASH_WANT_NEW
+static HASH_NODE * HASH_PREFIX(new)(TAC HASH_KEY_DECL)
+{
+  return &P(insert)(TTC P(hash) (TTC HASH_KEY( )), HASH_KEY( ))->n;
+}
+#endif
+
+#ifdef HASH_WANT_LOOKUP
+static HASH_NODE* HASH_PREFIX(lookup)(TAC HASH_KEY_DECL)
+{
+  uns h0 = P(hash) (TTC HASH_KEY( ));
+  int i = P(find_slot)(TTC h0, HASH_KEY( ));
+  if (i >= 0)
+    return &HASH_SLOT(i)->n;
+  return &P(insert)(TTC h0, HASH_KEY( ))->n;
+}
+#endif
+
+#ifdef HASH_WANT_DELETE
+static int HASH_PREFIX(delete)(TAC HASH_KEY_DECL)
+{
+  int i = P(find_slot)(TTC P(hash) (TTC HASH_KEY( )), HASH_KEY( ));
+  if (i < 0)
+    return 0;
+  P(clear_slot)(TTC i);
+  return 1;
+}
+#endif
+
+#ifdef HASH_WANT_REMOVE
+static void HASH_PREFIX(remove)(TAC HASH_NODE *n)
+{
+  P(bucket) *b = SKIP_BACK(struct P(bucket), n, n);
+  uns x = hash_group_mix(P(bucket_hash)(TTC b));
+  HASH_FOR_GROUPS(g, x, T.hash_size)
+    {
+      for (uns m = hash_group_match(HASH_GROUP_CTRLS(g), HASH_GROUP_CTRL(x)); m; m &= m-1)
+	if (HASH_SLOT(g + bit_ffs(m)) == b)
+	  {
+	    P(clear_slot)(TTC g + bit_ffs(m));
+	    return;
+	  }
+      ASSERT(!hash_group_match(HASH_GROUP_CTRLS(g), HASH_CTRL_EMPTY));
+    }
+}
+#endif
+
+#undef HASH_SLOT
+#undef HASH_CTRL
+#undef HASH_GROUP_CTRLS
+
+#endif /* HASH_OPEN_ADDRESSING */
+
 /* And the iterator */
 
 #ifndef HASH_FOR_ALL
@@ -652,7 +1024,7 @@ do {											\
   uns h_slot;										\
   struct GLUE_(h_px,bucket) *h_buck;							\
   for (h_slot=0; h_slot < (h_table)->hash_size; h_slot++)				\
-    for (h_buck = (h_table)->ht[h_slot]; h_buck; h_buck = h_buck->next)			\
+    for (h_buck = GLUE_(h_px,slot)((h_table), h_slot); h_buck; h_buck = GLUE_(h_px,bucket_next)(h_buck))	\
       {											\
 	GLUE_(h_px,node) *h_var = &h_buck->n;
 #define HASH_FOR_ALL(h_px, h_var) HASH_FOR_ALL_DYNAMIC(h_px, &GLUE_(h_px,table), h_var)
@@ -694,7 +1066,9 @@ do {											\
 #undef HASH_KEY_SIZE
 #undef HASH_NOCASE
 #undef HASH_NODE
+#undef HASH_OPEN_ADDRESSING
 #undef HASH_PREFIX
+#undef HASH_USE_HASH64
 #undef HASH_USE_POOL
 #undef HASH_AUTO_POOL
 #undef HASH_WANT_CLEANUP
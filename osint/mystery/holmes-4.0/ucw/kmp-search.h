@@ -103,8 +103,7 @@ P(search) (struct KP(struct) *kmp, struct P(search) *s, P(search_source_t) src)
 # endif
   for (;;)
   {
-    for (struct KP(state) *t = s->s; t && !(s->s = KP(hash_find)(&kmp->hash, t, s->c)); t = t->back);
-    s->s = s->s ? : &kmp->null;
+    s->s = KP(step)(kmp, s->s, s->c);
 
 #   ifdef KMPS_STEP
     { KMPS_STEP(kmp, src, s); }
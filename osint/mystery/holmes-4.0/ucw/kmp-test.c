@@ -199,6 +199,73 @@ test4(void)
   kmp4_cleanup(&kmp);
 }
 
+/* TEST5 - characters from several pages of the compact automaton */
+
+#define KMP_PREFIX(x) kmp5_##x
+#define KMP_SOURCE u16 *
+#define KMP_GET_CHAR(kmp,src,c) ({ c = *src++; !!c; })
+#define KMP_STATE_VARS uns index;
+#define KMP_ADD_EXTRA_ARGS uns index
+#define KMP_ADD_NEW(kmp,src,s) s->u.index = index
+#define KMP_WANT_CLEANUP
+#define KMP_WANT_SEARCH
+#define KMPS_VARS uns sum, *cnt;
+#define KMPS_FOUND(kmp,src,s) do{ ASSERT(s->u.cnt[s->out->u.index]); s->u.cnt[s->out->u.index]--; s->u.sum--; }while(0)
+#include "ucw/kmp.h"
+
+static void
+test5(void)
+{
+  TRACE("Running test5");
+  static const u16 alphabet[] = { 'a', 'b', 0xe1, 0x10d, 0x3b1, 0xfffe };
+  for (uns testn = 0; testn < 20; testn++)
+  {
+    uns n = 1 + random_max(500);
+    u16 s[n][9];
+    struct kmp5_struct kmp;
+    kmp5_init(&kmp);
+    for (uns i = 0; i < n; i++)
+      {
+	do
+	  {
+	    uns m = 1 + random_max(8);
+	    for (uns j = 0; j < m; j++)
+	      s[i][j] = alphabet[random_max(ARRAY_SIZE(alphabet))];
+	    s[i][m] = 0;
+	  }
+	while (kmp5_add(&kmp, s[i], i)->u.index != i);
+      }
+    kmp5_build(&kmp);
+    for (uns i = 0; i < 10; i++)
+      {
+	uns m = random_max(1000);
+	u16 b[m + 1];
+	for (uns j = 0; j < m; j++)
+	  b[j] = alphabet[random_max(ARRAY_SIZE(alphabet))] + !random_max(10);
+	b[m] = 0;
+	uns cnt[n];
+	struct kmp5_search search;
+	search.u.sum = 0;
+	search.u.cnt = cnt;
+	for (uns j = 0; j < n; j++)
+	  {
+	    cnt[j] = 0;
+	    for (uns k = 0; k < m; k++)
+	      {
+		uns l = 0;
+		while (s[j][l] && s[j][l] == b[k + l])
+		  l++;
+		if (!s[j][l])
+		  cnt[j]++, search.u.sum++;
+	      }
+	  }
+	kmp5_search(&kmp, &search, b);
+	ASSERT(search.u.sum == 0);
+      }
+    kmp5_cleanup(&kmp);
+  }
+}
+
 int
 main(void)
 {
@@ -208,5 +275,6 @@ main(void)
 #endif
   test3();
   test4();
+  test5();
   return 0;
 }
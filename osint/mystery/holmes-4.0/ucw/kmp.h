@@ -14,6 +14,10 @@
  *  preprocessor macros, it generates KMP structures and functions
  *  with the parameters given.
  *
+ *  When the automaton is built, its transitions are stored in a compact
+ *  double-array indexed by dense numbers of characters occurring in the
+ *  key strings, so the search does not need to consult the hash table.
+ *
  *  This file contains only construction of the automaton. The search
  *  itself can be generated by inclusion of file ucw/kmp-search.h.
  *  Separeted headers allow the user to define multiple search
@@ -53,7 +57,8 @@
  *				defined by the KMP generator); mandatory;
  *				we abbreviate this to P(x) below
  *
- *	KMP_CHAR		alphabet type, the default is u16
+ *	KMP_CHAR		alphabet type, the default is u16; characters of the key strings
+ *				must not exceed 0xffff unless KMP_HASH_SEARCH is set
  *
  *	KMP_SOURCE		user-defined text source; KMP_GET_CHAR must
  *	KMP_GET_CHAR(kmp,src,c)	return zero at the end or nonzero together with the next character in c otherwise;
@@ -101,7 +106,10 @@
  *				default hash function works only for integer character types
  *	KMP_GIVE_EQ		if set, you must supply custom compare function of two characters:
  *				int eq(struct P(struct) *kmp, KMP_CHAR a, KMP_CHAR b);
- *				default is 'a == b'
+ *				default is 'a == b'; implies KMP_HASH_SEARCH
+ *	KMP_HASH_SEARCH		do not build the compact automaton, the search looks up
+ *				all transitions in the hash table (slower, but works for
+ *				arbitrary character types)
  */
 
 #ifndef KMP_PREFIX
@@ -114,6 +122,10 @@
 
 #define P(x) KMP_PREFIX(x)
 
+#ifdef KMP_GIVE_EQ
+#define KMP_HASH_SEARCH
+#endif
+
 #ifdef KMP_CHAR
 typedef KMP_CHAR P(char_t);
 #else
@@ -136,6 +148,9 @@ struct P(state) {
   struct P(state) *next;	/* the longest of shorter matches (or NULL) */
   P(len_t) len;			/* state depth if it represents a key string, zero otherwise */
   P(char_t) c;			/* last character of the represented string */
+#ifndef KMP_HASH_SEARCH
+  uns base;			/* transitions by class x are in cell base+x of the double-array */
+#endif
   struct {
 #   ifdef KMP_STATE_VARS
     KMP_STATE_VARS
@@ -243,9 +258,22 @@ P(hash_init_key) (struct P(hash_table) *t UNUSED, struct P(state) *s, struct P(s
 #include "ucw/hashtable.h"
 #define P(x) KMP_PREFIX(x)
 
+#ifndef KMP_HASH_SEARCH
+struct P(da_cell) {
+  struct P(state) *check;		/* the state owning this cell or NULL */
+  struct P(state) *next;		/* target of the transition */
+};
+#endif
+
 struct P(struct) {
   struct P(hash_table) hash;		/* hash table of state transitions */
   struct P(state) null;			/* null state */
+#ifndef KMP_HASH_SEARCH
+  struct P(da_cell) *da;		/* double-array of transitions, built by build() */
+  uns da_size;
+  uns classes;				/* number of distinct characters in the key strings */
+  u16 *class_page[256];			/* two-level table mapping characters to 1..classes (0 for others) */
+#endif
   struct {
 #   ifdef KMP_VARS
     KMP_VARS
@@ -363,17 +391,63 @@ enter_new:
   return s;
 }
 
+#ifndef KMP_HASH_SEARCH
+static const u16 P(no_classes)[256];
+
+static inline void *
+P(da_alloc) (struct P(struct) *kmp UNUSED, uns size)
+{
+# if defined(KMP_GIVE_ALLOC)
+  return P(alloc)(kmp, size);
+# elif defined(KMP_USE_POOL)
+  return mp_alloc(KMP_USE_POOL, size);
+# else
+  return xmalloc(size);
+# endif
+}
+
+static inline void
+P(da_free) (struct P(struct) *kmp UNUSED, void *ptr UNUSED)
+{
+# if defined(KMP_GIVE_ALLOC)
+  P(free)(kmp, ptr);
+# elif !defined(KMP_USE_POOL)
+  xfree(ptr);
+# endif
+}
+
+static inline uns
+P(class) (struct P(struct) *kmp, P(char_t) c)
+{
+  uns x = c;
+  return (x >> 16) ? 0 : kmp->class_page[x >> 8][x & 0xff];
+}
+#endif
+
 static void
 P(init) (struct P(struct) *kmp)
 {
   bzero(&kmp->null, sizeof(struct P(state)));
   P(hash_init)(&kmp->hash);
+#ifndef KMP_HASH_SEARCH
+  kmp->da = NULL;
+  kmp->da_size = kmp->classes = 0;
+  for (uns i = 0; i < 256; i++)
+    kmp->class_page[i] = (u16 *) P(no_classes);
+#endif
 }
 
 #ifdef KMP_WANT_CLEANUP
 static inline void
 P(cleanup) (struct P(struct) *kmp)
 {
+#ifndef KMP_HASH_SEARCH
+  if (kmp->da)
+    P(da_free)(kmp, kmp->da);
+  for (uns i = 0; i < 256; i++)
+    if (kmp->class_page[i] != P(no_classes))
+      P(da_free)(kmp, kmp->class_page[i]);
+#endif
   P(hash_cleanup)(&kmp->hash);
 }
 #endif
@@ -390,6 +464,146 @@ P(chain_start) (struct P(state) *s)
   return s->len ? s : s->next;
 }
 
+#ifndef KMP_HASH_SEARCH
+/*
+ *  Called at the end of build() with all states in the BFS order. The sons of each
+ *  state are stored consecutively there and the base of the state temporarily
+ *  holds the position of its first son.
+ */
+static void
+P(build_da) (struct P(struct) *kmp, struct P(state) **fifo)
+{
+  uns n = kmp->hash.hash_count;
+
+  /* Give dense numbers to the characters, those close to the root come first */
+  for (uns i = 0; i < n; i++)
+    {
+      uns x = fifo[i]->c;
+      ASSERT(x <= 0xffff);
+      u16 *page = kmp->class_page[x >> 8];
+      if (page == P(no_classes))
+        {
+	  page = kmp->class_page[x >> 8] = P(da_alloc)(kmp, 256 * sizeof(u16));
+	  bzero(page, 256 * sizeof(u16));
+	}
+      if (!page[x & 0xff])
+	page[x & 0xff] = ++kmp->classes;
+    }
+
+  /* Ranges of sons in the fifo, index 0 stands for the null state */
+  uns *first = xmalloc((n + 2) * sizeof(uns));
+  first[0] = 0;
+  for (uns i = 1; i <= n; i++)
+    first[i] = fifo[i - 1]->base;
+  first[n + 1] = n;
+
+  /* States with more sons are harder to fit, so they go first (counting sort) */
+  uns *order = xmalloc((n + 1) * sizeof(uns)), *cnt = xmalloc_zero((kmp->classes + 2) * sizeof(uns));
+  for (uns i = 0; i <= n; i++)
+    cnt[first[i + 1] - first[i]]++;
+  for (uns k = kmp->classes + 1, pos = 0; k--; )
+    {
+      uns c = cnt[k];
+      cnt[k] = pos;
+      pos += c;
+    }
+  for (uns i = 0; i <= n; i++)
+    order[cnt[first[i + 1] - first[i]]++] = i;
+  xfree(cnt);
+
+  /*
+   *  Free cells form a circular doubly linked list with the head in the cell 0,
+   *  which is never used (classes are counted from 1).
+   */
+  uns size = 0, top = 0;
+  struct P(da_cell) *da = NULL;
+  uns *next_free = NULL, *prev_free = NULL;
+#define GROW(to) do {								\
+    uns old = size;								\
+    size = (to);								\
+    da = xrealloc(da, size * sizeof(*da));					\
+    next_free = xrealloc(next_free, size * sizeof(uns));			\
+    prev_free = xrealloc(prev_free, size * sizeof(uns));			\
+    bzero(da + old, (size - old) * sizeof(*da));				\
+    for (uns c = MAX(old, 1); c < size; c++)					\
+      {										\
+	next_free[c] = 0;							\
+	prev_free[c] = old ? prev_free[0] : c - 1;				\
+	next_free[prev_free[c]] = c;						\
+	prev_free[0] = c;							\
+      }										\
+    if (!old)									\
+      next_free[0] = (size > 1) ? 1 : 0;					\
+  } while (0)
+  GROW(2 * (n + kmp->classes + 1));
+
+  /*
+   *  Cells skipped when placing a state are not likely to fit the next state with the same
+   *  number of sons, so we continue where the previous one was placed.
+   */
+  uns last_sons = 0, hint = 0;
+  for (uns o = 0; o <= n; o++)
+    {
+      uns i = order[o], sons = first[i + 1] - first[i];
+      struct P(state) *s = i ? fifo[i - 1] : &kmp->null;
+      s->base = 0;
+      if (!sons)
+	continue;
+      uns x0 = ~0U, base, f;
+      for (uns j = first[i]; j < first[i + 1]; j++)
+	x0 = MIN(x0, P(class)(kmp, fifo[j]->c));
+      if (sons == last_sons)
+	{
+	  for (f = hint; f < size && da[f].check; f++)
+	    ;
+	  if (f >= size)
+	    f = 0;
+	}
+      else
+	f = next_free[0];
+      for (; ; f = next_free[f])
+	{
+	  if (!f || f + kmp->classes >= size)
+	    {
+	      uns old = size;
+	      GROW(2 * size);
+	      if (!f)
+		f = old;
+	    }
+	  if (f < x0)
+	    continue;
+	  base = f - x0;
+	  uns j = first[i];
+	  while (j < first[i + 1] && !da[base + P(class)(kmp, fifo[j]->c)].check)
+	    j++;
+	  if (j == first[i + 1])
+	    break;
+	}
+      last_sons = sons;
+      hint = f;
+      for (uns j = first[i]; j < first[i + 1]; j++)
+	{
+	  uns c = base + P(class)(kmp, fifo[j]->c);
+	  da[c] = (struct P(da_cell)) { s, fifo[j] };
+	  next_free[prev_free[c]] = next_free[c];
+	  prev_free[next_free[c]] = prev_free[c];
+	}
+      s->base = base;
+      top = MAX(top, base);
+    }
+#undef GROW
+  xfree(next_free);
+  xfree(prev_free);
+  xfree(order);
+  xfree(first);
+
+  kmp->da_size = top + kmp->classes + 1;
+  kmp->da = P(da_alloc)(kmp, kmp->da_size * sizeof(*da));
+  memcpy(kmp->da, da, kmp->da_size * sizeof(*da));
+  xfree(da);
+}
+#endif
+
 static void
 P(build) (struct P(struct) *kmp)
 {
@@ -406,6 +620,9 @@ P(build) (struct P(struct) *kmp)
   while (read != write)
     {
       struct P(state) *s = fifo[read++], *t;
+#     ifndef KMP_HASH_SEARCH
+      s->base = write;
+#     endif
       for (t = s->back; t; t = t->next)
 	fifo[write++] = t;
       for (t = s->from->back; 1; t = t->back)
@@ -427,6 +644,30 @@ P(build) (struct P(struct) *kmp)
       { KMP_BUILD_STATE(kmp, s); }
 #     endif
     }
+#ifndef KMP_HASH_SEARCH
+  P(build_da)(kmp, fifo);
+#endif
+}
+
+/* Move from the state s by the character c */
+static inline struct P(state) *
+P(step) (struct P(struct) *kmp, struct P(state) *s, P(char_t) c)
+{
+#ifdef KMP_HASH_SEARCH
+  for (struct P(state) *t = s; t; t = t->back)
+    if (s = P(hash_find)(&kmp->hash, t, c))
+      return s;
+#else
+  uns x = P(class)(kmp, c);
+  if (x)
+    for (; s; s = s->back)
+      {
+	struct P(da_cell) *d = kmp->da + s->base + x;
+	if (d->check == s)
+	  return d->next;
+      }
+#endif
+  return &kmp->null;
 }
 
 #undef P
@@ -452,6 +693,7 @@ P(build) (struct P(struct) *kmp)
 #undef KMP_GIVE_ALLOC
 #undef KMP_GIVE_HASHFN
 #undef KMP_GIVE_EQ
+#undef KMP_HASH_SEARCH
 
 #ifdef KMP_WANT_SEARCH
 #  undef KMP_WANT_SEARCH
@@ -60,11 +60,10 @@ lizard_realloc(struct lizard_buffer *buf, uns max_len)
     die("mprotect: %m");
 }
 
-static jmp_buf safe_decompress_jump;
 static int
 sigsegv_handler(int signal UNUSED)
 {
-  longjmp(safe_decompress_jump, 1);
+  longjmp(*(jmp_buf *) ucwlib_thread_context()->lizard_jump, 1);
   return 1;
 }
 
@@ -73,15 +72,19 @@ lizard_decompress_safe(const byte *in, struct lizard_buffer *buf, uns expected_l
   /* Decompresses in into buf, sets *ptr to the data, and returns the
    * uncompressed length.  If an error has occured, -1 is returned and errno is
    * set.  The buffer buf is automatically reallocated.  SIGSEGV is caught in
-   * case of buffer-overflow.  The function is not re-entrant because of a
-   * static longjmp handler.  */
+   * case of buffer-overflow.  The longjmp target is kept per thread, so
+   * multiple threads can decompress at once, each to its own buffer.  */
 {
+  struct ucwlib_context *ctx = ucwlib_thread_context();
+  jmp_buf jump;
+  void *old_jump = ctx->lizard_jump;
   uns lock_offset = ALIGN_TO(expected_length + 3, CPU_PAGE_SIZE);	// +3 due to the unaligned access
   if (lock_offset > buf->len)
     lizard_realloc(buf, lock_offset);
   volatile ucw_sighandler_t old_handler = set_signal_handler(SIGSEGV, sigsegv_handler);
   byte *ptr;
-  if (!setjmp(safe_decompress_jump))
+  ctx->lizard_jump = &jump;
+  if (!setjmp(jump))
   {
     ptr = buf->ptr + buf->len - lock_offset;
     int len = lizard_decompress(in, ptr);
@@ -98,5 +101,6 @@ lizard_decompress_safe(const byte *in, struct lizard_buffer *buf, uns expected_l
     errno = EFAULT;
   }
   set_signal_handler(SIGSEGV, old_handler);
+  ctx->lizard_jump = old_jump;
   return ptr;
 }
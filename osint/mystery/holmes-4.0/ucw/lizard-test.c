@@ -5,10 +5,13 @@
 #include "ucw/lizard.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-static char *options = CF_SHORT_OPTS "cdtx";
+static char *options = CF_SHORT_OPTS "cdtxb:r:";
 static char *help = "\
 Usage: lizard-test <options> input-file [output-file]\n\
 \n\
@@ -18,6 +21,8 @@ CF_USAGE
 -d\t\tDecompress\n\
 -t\t\tCompress, decompress, and compare (in memory only, default)\n\
 -x\t\tLet the test crash by shrinking the output buffer\n\
+-b<rounds>\tBenchmark compression and decompression of the input\n\
+-r<count>\tRound-trip test on <count> random inputs (no input file)\n\
 ";
 
 static void NONRET
@@ -27,12 +32,132 @@ usage(void)
   exit(1);
 }
 
+static void
+gen_random(byte *p, uns len)
+{
+  /* Literals, runs, short periods and distant repeats, so that all commands get used */
+  uns i = 0;
+  while (i < len)
+    {
+      uns l = 1 + random_max(random_max(4) ? 64 : 2000);
+      l = MIN(l, len - i);
+      switch (random_max(5))
+	{
+	case 0:
+	  for (uns j = 0; j < l; j++)
+	    p[i+j] = random_max(256);
+	  break;
+	case 1:
+	  memset(p+i, random_max(256), l);
+	  break;
+	case 2:
+	  for (uns j = 0; j < l; j++)
+	    p[i+j] = "abc de"[random_max(6)];
+	  break;
+	default:
+	  if (!i)
+	    continue;
+	  uns dist = random_max(2) ? 16 : 70000;
+	  dist = 1 + random_max(MIN(i, dist));
+	  for (uns j = 0; j < l; j++)
+	    p[i+j] = p[i+j-dist];
+	}
+      i += l;
+    }
+}
+
+static byte *
+alloc_guarded(uns map_len)
+{
+  byte *p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (p == MAP_FAILED)
+    die("mmap: %m");
+  if (mprotect(p + map_len - CPU_PAGE_SIZE, CPU_PAGE_SIZE, PROT_NONE) < 0)
+    die("mprotect: %m");
+  return p;
+}
+
+static void
+random_test(uns count)
+{
+  struct lizard_buffer *buf = lizard_alloc();
+  uns max_len = 1 << 18;
+  byte *in = xmalloc(max_len + LIZARD_NEEDS_CHARS);
+  byte *comp = xmalloc(LIZARD_MAX_LEN(max_len));
+  srandom(1);
+  for (uns n = 0; n < count; n++)
+    {
+      uns len = random_max(2) ? random_max(100) : random_max(max_len);
+      gen_random(in, len);
+      int clen = lizard_compress(in, len, comp);
+      if (clen < 0 || clen > LIZARD_MAX_LEN(len))
+	die("Round %u: compressed %u bytes to %d", n, len, clen);
+
+      /* Plain decompression to a buffer followed by a guard page (3 bytes are allowed for the unaligned access) */
+      uns map_len = ALIGN_TO(len + 3, CPU_PAGE_SIZE) + CPU_PAGE_SIZE;
+      byte *map = alloc_guarded(map_len);
+      byte *out = map + map_len - CPU_PAGE_SIZE - len - 3;
+      if (lizard_decompress(comp, out) != (int) len || memcmp(in, out, len))
+	die("Round %u: round trip of %u bytes failed", n, len);
+      munmap(map, map_len);
+
+      byte *p = lizard_decompress_safe(comp, buf, len);
+      if (!p || memcmp(in, p, len))
+	die("Round %u: safe round trip of %u bytes failed", n, len);
+
+      /* Damaged input must not get past the guards, the result does not matter */
+      if (clen > 0)
+	{
+	  for (uns k = 1 + random_max(4); k--; )
+	    comp[random_max(clen)] ^= 1 << random_max(8);
+	  lizard_decompress_safe(comp, buf, len);
+	}
+    }
+  lizard_free(buf);
+  xfree(in);
+  xfree(comp);
+  printf("%u round trips OK\n", count);
+}
+
+static void
+benchmark(byte *mi, uns li, uns rounds)
+{
+  byte *mo = xmalloc(LIZARD_MAX_LEN(li));
+  byte *out = xmalloc(li + 3);
+  struct lizard_buffer *buf = lizard_alloc();
+  timestamp_t timer;
+  uns lo = 0;
+
+  init_timer(&timer);
+  for (uns i = 0; i < rounds; i++)
+    lo = lizard_compress(mi, li, mo);
+  uns tc = get_timer(&timer);
+  for (uns i = 0; i < rounds; i++)
+    if (lizard_decompress(mo, out) != (int) li)
+      die("Decompression failed");
+  uns td = get_timer(&timer);
+  for (uns i = 0; i < rounds; i++)
+    if (!lizard_decompress_safe(mo, buf, li))
+      die("Safe decompression failed: %m");
+  uns ts = get_timer(&timer);
+
+  double total = (double) li * rounds;
+  printf("%u -> %u (%.1f%%)\n", li, lo, 100. * lo / MAX(li, 1));
+  printf("compress:        %8.3f GB/s\n", total / MAX(tc, 1) / 1e6);
+  printf("decompress:      %8.3f GB/s\n", total / MAX(td, 1) / 1e6);
+  printf("decompress_safe: %8.3f GB/s\n", total / MAX(ts, 1) / 1e6);
+  lizard_free(buf);
+  xfree(out);
+  xfree(mo);
+}
+
 int
 main(int argc, char **argv)
 {
   int opt;
   uns action = 't';
   uns crash = 0;
+  uns rounds = 0;
   log_init(argv[0]);
   while ((opt = cf_getopt(argc, argv, options, CF_NO_LONG_OPTS, NULL)) >= 0)
     switch (opt)
@@ -45,11 +170,23 @@ main(int argc, char **argv)
       case 'x':
 	crash++;
 	break;
+      case 'b':
+      case 'r':
+	action = opt;
+	rounds = atoi(optarg);
+	break;
       default:
 	usage();
     }
-  if (action == 't' && argc != optind+1
-  || action != 't' && argc != optind+2)
+  if (action == 'r')
+  {
+    if (argc != optind)
+      usage();
+    random_test(rounds);
+    return 0;
+  }
+  if ((action == 't' || action == 'b') && argc != optind+1
+  || action != 't' && action != 'b' && argc != optind+2)
     usage();
 
   void *mi, *mo;
@@ -76,6 +213,12 @@ main(int argc, char **argv)
   li = bread(fi, mi, li);
   bclose(fi);
 
+  if (action == 'b')
+  {
+    benchmark(mi, li, MAX(rounds, 1));
+    return 0;
+  }
+
   printf("%d ", li);
   if (action == 'd')
     printf("->expected %d (%08x) ", lo, adler);
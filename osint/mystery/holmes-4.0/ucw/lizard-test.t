@@ -0,0 +1,4 @@
+# Tests for LiZaRd compression
+
+Run:	../obj/ucw/lizard-test -r 500 2>/dev/null
+Out:	500 round trips OK
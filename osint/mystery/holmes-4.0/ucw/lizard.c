@@ -290,6 +290,43 @@ read_unary_value(const byte *in, uns *val)
   return (byte *)in;
 }
 
+static inline void
+copy_bytes(byte *out, const byte *in, uns len)
+  /* Copies exactly len bytes between non-overlapping areas by overlapping
+   * wide moves.  It touches no byte outside the areas, so a guard page
+   * after the output buffer behaves exactly as with a byte-wise copy.  */
+{
+  if (len >= 16)
+  {
+    const byte *last = in + len - 16;
+    byte *out_last = out + len - 16;
+    do
+    {
+      memcpy(out, in, 16);
+      out += 16;
+      in += 16;
+    }
+    while (in < last);
+    memcpy(out_last, last, 16);
+  }
+  else if (len >= 8)
+  {
+    memcpy(out, in, 8);
+    memcpy(out + len - 8, in + len - 8, 8);
+  }
+  else if (len >= 4)
+  {
+    memcpy(out, in, 4);
+    memcpy(out + len - 4, in + len - 4, 4);
+  }
+  else if (len)
+  {
+    out[0] = in[0];
+    out[len/2] = in[len/2];
+    out[len-1] = in[len-1];
+  }
+}
+
 int
 lizard_decompress(const byte *in, byte *out)
   /* Requires out being allocated for the decompressed length must be known
@@ -309,31 +346,29 @@ lizard_decompress(const byte *in, byte *out)
   {
     uns c = *in++;
     uns pos;
-    if (c < 0x10)
-      if (expect_copy_command == 1)
+    /* The commands are tested in the order of their frequency */
+    if (c >= 0x40)				/* high bits encode the length */
+    {
+      len = ((c&0xe0)>>5) -2 +3;
+      pos = (c&0x1c)<<6;
+      pos |= *in++;
+      pos++;
+    }
+    else if (c >= 0x20)
+    {
+      len = c&0x1f;
+      if (!len)
       {
-	if (!c)
-	{
-	  in = read_unary_value(in, &len);
-	  len += 18;
-	}
-	else
-	  len = c + 3;
-	goto perform_copy_command;
+	in = read_unary_value(in, &len);
+	len += 33;
       }
       else
-      {
-	pos = ((c&0xc)<<6) | *in++;
-	if (expect_copy_command == 2)
-	{
-	  pos += 1<<11;
-	  len = 3;
-	}
-	else
-	  len = 2;
-	pos++;
-      }
-    else if (c < 0x20)
+	len += 2;
+      pos = (*in++ & 0xfc)<<6;
+      pos |= *in++;
+      pos++;
+    }
+    else if (c >= 0x10)
     {
       pos = (c&0x8)<<11;
       len = c&0x7;
@@ -350,35 +385,45 @@ lizard_decompress(const byte *in, byte *out)
 	break;
       /* do NOT pos++ */
     }
-    else if (c < 0x40)
+    else if (expect_copy_command == 1)
     {
-      len = c&0x1f;
-      if (!len)
+      if (!c)
       {
 	in = read_unary_value(in, &len);
-	len += 33;
+	len += 18;
       }
       else
-	len += 2;
-      pos = (*in++ & 0xfc)<<6;
-      pos |= *in++;
-      pos++;
+	len = c + 3;
+      goto perform_copy_command;
     }
-    else /* high bits encode the length */
+    else
     {
-      len = ((c&0xe0)>>5) -2 +3;
-      pos = (c&0x1c)<<6;
-      pos |= *in++;
+      pos = ((c&0xc)<<6) | *in++;
+      if (expect_copy_command == 2)
+      {
+	pos += 1<<11;
+	len = 3;
+      }
+      else
+	len = 2;
       pos++;
     }
     /* take from the sliding window */
     if (len <= pos)
     {
-      memcpy(out, out-pos, len);
+      copy_bytes(out, out-pos, len);
+      out += len;
+    }
+    else if (pos == 1)				/* a run of a single character */
+    {
+      memset(out, out[-1], len);
       out += len;
     }
     else
     {						/* overlapping */
+      if (pos >= 8)
+	for (; len >= 8; len -= 8, out += 8)
+	  memcpy(out, out-pos, 8);
       for (; len-- > 0; out++)
 	*out = *(out-pos);
       /* It's tempting to use out[-pos] above, but unfortunately it's not the same */
@@ -403,7 +448,7 @@ lizard_decompress(const byte *in, byte *out)
 
 perform_copy_command:
     expect_copy_command = 2;
-    memcpy(out, in, len);
+    copy_bytes(out, in, len);
     out += len;
     in += len;
   }
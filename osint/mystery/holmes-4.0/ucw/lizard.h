@@ -114,8 +114,8 @@ void lizard_free(struct lizard_buffer *buf);
  * The @buf argument may be reused for multiple decompresses. However,
  * the data will be overwritten by the next call.
  *
- * Beware this function is not thread-safe and is not even reentrant
- * (because of internal segfault handling).
+ * Multiple threads can call this function at once, as long as each of
+ * them uses its own buffer.
  **/
 byte *lizard_decompress_safe(const byte *in, struct lizard_buffer *buf, uns expected_length);
 
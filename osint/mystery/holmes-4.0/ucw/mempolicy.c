@@ -0,0 +1,271 @@
+/*
+ *	UCW Library -- Huge Pages and NUMA Placement of Large Memory Blocks
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "ucw/lib.h"
+#include "ucw/conf.h"
+#include "ucw/mempolicy.h"
+#include "ucw/threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef CONFIG_LINUX
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#define MAX_NODES 32			/* As many as bits in mem_policy->nodes */
+
+struct cf_section mem_policy_cf = {
+# define F(x) PTR_TO(struct mem_policy, x)
+  CF_TYPE(struct mem_policy),
+  CF_ITEMS {
+    CF_LOOKUP("HugePages", (int *)F(huge_pages), ((const char * const []){"none", "transparent", "explicit", NULL})),
+    CF_LOOKUP("NUMA", (int *)F(numa), ((const char * const []){"default", "interleave", "bind", NULL})),
+    CF_UNS("Nodes", F(nodes)),
+    CF_END
+  }
+# undef F
+};
+
+/*** Topology ***/
+
+#ifdef CONFIG_LINUX
+
+static int numa_nodes = -1;			/* Unknown yet */
+static cpu_set_t numa_cpus[MAX_NODES];
+
+static int
+numa_read_list(char *name, void (*set)(uns i, void *data), void *data)
+{
+  /* Parse a list of ranges in the "0-3,8,10-11" format used by sysfs */
+  FILE *f = fopen(name, "r");
+  if (!f)
+    return 0;
+  char buf[1024];
+  int ok = !!fgets(buf, sizeof(buf), f);
+  fclose(f);
+  char *c = buf;
+  while (ok && *c >= '0' && *c <= '9')
+    {
+      uns lo = strtoul(c, &c, 10), hi = lo;
+      if (*c == '-')
+	hi = strtoul(c+1, &c, 10);
+      for (uns i = lo; i <= hi; i++)
+	set(i, data);
+      if (*c == ',')
+	c++;
+    }
+  return ok;
+}
+
+static void
+numa_set_node(uns i, void *data)
+{
+  int *max = data;
+  if (i < MAX_NODES)
+    *max = MAX(*max, (int) i+1);
+}
+
+static void
+numa_set_cpu(uns i, void *data)
+{
+  if (i < CPU_SETSIZE)
+    CPU_SET(i, (cpu_set_t *) data);
+}
+
+static void
+numa_init(void)
+{
+  ucwlib_lock();
+  if (numa_nodes < 0)
+    {
+      int n = 0;
+      if (!numa_read_list("/sys/devices/system/node/online", numa_set_node, &n))
+	n = 0;
+      for (int i = 0; i < n; i++)
+	{
+	  char name[64];
+	  sprintf(name, "/sys/devices/system/node/node%d/cpulist", i);
+	  CPU_ZERO(&numa_cpus[i]);
+	  numa_read_list(name, numa_set_cpu, &numa_cpus[i]);
+	}
+      DBG("NUMA: %d nodes", n);
+      numa_nodes = n;
+    }
+  ucwlib_unlock();
+}
+
+uns
+numa_num_nodes(void)
+{
+  if (numa_nodes < 0)
+    numa_init();
+  return MAX(numa_nodes, 1);
+}
+
+int
+numa_pin_node(uns node)
+{
+  if (numa_nodes < 0)
+    numa_init();
+  if ((int) node >= numa_nodes || !CPU_COUNT(&numa_cpus[node]))
+    return -1;
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &numa_cpus[node]) < 0)
+    {
+      msg(L_WARN, "Cannot pin to NUMA node %u: %m", node);
+      return -1;
+    }
+  return 0;
+}
+
+static void
+numa_apply(struct mem_policy *p, void *start, u64 len)
+{
+#ifdef __NR_mbind
+  if (p->numa == MEM_NUMA_DEFAULT || numa_num_nodes() < 2)
+    return;
+  unsigned long mask = p->nodes ? : (1UL << numa_nodes) - 1;
+  int mode = (p->numa == MEM_NUMA_INTERLEAVE) ? 3 : 2;		/* MPOL_INTERLEAVE or MPOL_BIND */
+  if (syscall(__NR_mbind, start, (unsigned long) len, mode, &mask, 8*sizeof(mask) + 1, 0) < 0)
+    msg(L_WARN, "Cannot set NUMA policy: %m");
+#else
+  (void) p; (void) start; (void) len;
+#endif
+}
+
+#else
+
+uns
+numa_num_nodes(void)
+{
+  return 1;
+}
+
+int
+numa_pin_node(uns node UNUSED)
+{
+  return -1;
+}
+
+static void
+numa_apply(struct mem_policy *p UNUSED, void *start UNUSED, u64 len UNUSED)
+{
+}
+
+#endif
+
+/*** Allocation ***/
+
+static u64
+mem_huge_page_size(void)
+{
+  static u64 size;
+  if (!size)
+    {
+      size = 2 << 20;
+#ifdef CONFIG_LINUX
+      FILE *f = fopen("/proc/meminfo", "r");
+      char line[256];
+      unsigned long kb;
+      while (f && fgets(line, sizeof(line), f))
+	if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb)
+	  size = (u64) kb << 10;
+      if (f)
+	fclose(f);
+#endif
+    }
+  return size;
+}
+
+void
+mem_policy_apply(struct mem_policy *p, void *start, u64 len)
+{
+#ifdef MADV_HUGEPAGE
+  if (p->huge_pages != MEM_HUGE_NONE && madvise(start, len, MADV_HUGEPAGE) < 0)
+    msg(L_WARN, "Cannot use transparent huge pages: %m");
+#endif
+  numa_apply(p, start, len);
+}
+
+u64
+mem_policy_size(struct mem_policy *p, u64 len)
+{
+  if (p->huge_pages == MEM_HUGE_NONE)
+    return ALIGN_TO(len, (u64) CPU_PAGE_SIZE);
+  else
+    return ALIGN_TO(len, mem_huge_page_size());
+}
+
+void *
+mem_policy_alloc(struct mem_policy *p, u64 *len)
+{
+  byte *start;
+  *len = mem_policy_size(p, *len);
+  if (p->huge_pages == MEM_HUGE_NONE)
+    {
+      start = page_alloc(*len);
+      numa_apply(p, start, *len);
+      return start;
+    }
+
+  u64 huge = mem_huge_page_size();
+#ifdef MAP_HUGETLB
+  if (p->huge_pages == MEM_HUGE_EXPLICIT)
+    {
+      start = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+      if (start != MAP_FAILED)
+	{
+	  numa_apply(p, start, *len);
+	  return start;
+	}
+      msg(L_WARN, "Cannot allocate %llu MB of huge pages, falling back to transparent ones: %m", (long long)(*len >> 20));
+    }
+#endif
+
+  /* Align the block to the huge page size, so that it can be covered by huge pages completely */
+  byte *map = page_alloc(*len + huge);
+  start = (byte *) ALIGN_TO((uintptr_t) map, huge);
+  if (start > map)
+    munmap(map, start - map);
+  if (start + *len < map + *len + huge)
+    munmap(start + *len, map + huge - start);
+  mem_policy_apply(p, start, *len);
+  DBG("Allocated %llu bytes at %p", (long long) *len, start);
+  return start;
+}
+
+void
+mem_policy_free(void *start, u64 len)
+{
+  munmap(start, len);
+}
+
+#ifdef TEST
+
+int main(void)
+{
+  struct mem_policy p = { .huge_pages = MEM_HUGE_TRANSPARENT, .numa = MEM_NUMA_INTERLEAVE };
+  u64 len = 3 << 20;
+  byte *m = mem_policy_alloc(&p, &len);
+  if (len < (3 << 20) || ((uintptr_t) m & (mem_huge_page_size() - 1)))
+    die("Wrong allocation");
+  memset(m, 0xaa, len);
+  mem_policy_free(m, len);
+  if (numa_num_nodes() < 1)
+    die("No nodes");
+  numa_pin_node(0);
+  puts("OK");
+  return 0;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ *	UCW Library -- Huge Pages and NUMA Placement of Large Memory Blocks
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#ifndef _UCW_MEMPOLICY_H
+#define _UCW_MEMPOLICY_H
+
+/***
+ * Large data structures accessed at random (card attributes, rank vectors, ...)
+ * suffer from TLB misses if they are mapped by ordinary pages. A memory policy
+ * describes how such blocks should be backed by huge pages and distributed
+ * among NUMA nodes. All settings are only hints: when the system does not support
+ * them (or it is not Linux), ordinary memory is used.
+ ***/
+
+enum mem_huge_pages {		/** How to use huge pages **/
+  MEM_HUGE_NONE,		// Ordinary pages
+  MEM_HUGE_TRANSPARENT,		// Transparent huge pages (madvise)
+  MEM_HUGE_EXPLICIT,		// Pre-allocated huge pages (MAP_HUGETLB), fall back to transparent ones
+};
+
+enum mem_numa {			/** How to place memory on NUMA nodes **/
+  MEM_NUMA_DEFAULT,		// Leave it to the kernel (usually the node of the first access)
+  MEM_NUMA_INTERLEAVE,		// Interleave pages over the given nodes
+  MEM_NUMA_BIND,		// Allocate only on the given nodes
+};
+
+struct mem_policy {		/** Memory policy, usually filled in by the configuration **/
+  int huge_pages;		// enum mem_huge_pages
+  int numa;			// enum mem_numa
+  uns nodes;			// Bit mask of NUMA nodes, 0 means all nodes
+};
+
+struct cf_section;
+extern struct cf_section mem_policy_cf;	/** Configuration section with which you can fill the `mem_policy` **/
+
+/** Does the policy request anything unusual? **/
+static inline int mem_policy_active(struct mem_policy *p)
+{
+  return p->huge_pages != MEM_HUGE_NONE || p->numa != MEM_NUMA_DEFAULT;
+}
+
+/**
+ * Allocate an anonymous block of memory according to the policy. The length
+ * is rounded up (to a multiple of the huge page size if needed) and the real
+ * length is stored back to @len. Dies on failure.
+ **/
+void *mem_policy_alloc(struct mem_policy *p, u64 *len);
+
+/** The length @mem_policy_alloc() would allocate for a block of @len bytes. **/
+u64 mem_policy_size(struct mem_policy *p, u64 len);
+
+/** Free a block allocated by @mem_policy_alloc(). Pass the length it returned. **/
+void mem_policy_free(void *start, u64 len);
+
+/**
+ * Apply the policy to an existing anonymous mapping, which has not been
+ * touched yet. Only transparent huge pages can be used there.
+ **/
+void mem_policy_apply(struct mem_policy *p, void *start, u64 len);
+
+uns numa_num_nodes(void);	/** Number of NUMA nodes (1 on non-NUMA systems). **/
+
+/**
+ * Restrict the calling thread (or process, if it has a single thread) to the CPUs
+ * of the given NUMA node. Memory it touches first is then allocated on the same
+ * node. Returns 0 on success, -1 if not supported.
+ **/
+int numa_pin_node(uns node);
+
+#endif
@@ -0,0 +1,4 @@
+# Tests for memory policies
+
+Run:	../obj/ucw/mempolicy-t
+Out:	OK
@@ -0,0 +1,89 @@
+/*
+ *	UCW Library -- Memory Pools (Concurrent Arenas)
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "ucw/lib.h"
+#include "ucw/mempool.h"
+
+#include <string.h>
+#include <pthread.h>
+
+struct mp_arena_pool {
+  struct mp_arena_pool *next;
+  struct mempool pool;
+};
+
+struct mp_arena {
+  pthread_mutex_t lock;
+  uns chunk_size;
+  struct mp_arena_pool *pools;
+};
+
+struct mp_arena *
+mp_arena_new(uns chunk_size)
+{
+  struct mp_arena *a = xmalloc_zero(sizeof(*a));
+  pthread_mutex_init(&a->lock, NULL);
+  a->chunk_size = chunk_size;
+  return a;
+}
+
+struct mempool *
+mp_arena_pool(struct mp_arena *a)
+{
+  struct mp_arena_pool *p = xmalloc(sizeof(*p));
+  mp_init(&p->pool, a->chunk_size);
+  pthread_mutex_lock(&a->lock);
+  p->next = a->pools;
+  a->pools = p;
+  pthread_mutex_unlock(&a->lock);
+  DBG("Arena %p: new pool %p", a, &p->pool);
+  return &p->pool;
+}
+
+void
+mp_arena_flush(struct mp_arena *a)
+{
+  pthread_mutex_lock(&a->lock);
+  for (struct mp_arena_pool *p = a->pools; p; p = p->next)
+    mp_flush(&p->pool);
+  pthread_mutex_unlock(&a->lock);
+}
+
+void
+mp_arena_delete(struct mp_arena *a)
+{
+  struct mp_arena_pool *p;
+  while (p = a->pools)
+    {
+      a->pools = p->next;
+      mp_delete(&p->pool);
+      xfree(p);
+    }
+  pthread_mutex_destroy(&a->lock);
+  xfree(a);
+}
+
+void
+mp_arena_stats(struct mp_arena *a, struct mempool_stats *stats)
+{
+  bzero(stats, sizeof(*stats));
+  pthread_mutex_lock(&a->lock);
+  for (struct mp_arena_pool *p = a->pools; p; p = p->next)
+    {
+      struct mempool_stats s;
+      mp_stats(&p->pool, &s);
+      stats->total_size += s.total_size;
+      for (uns i = 0; i < 3; i++)
+	{
+	  stats->chain_count[i] += s.chain_count[i];
+	  stats->chain_size[i] += s.chain_size[i];
+	}
+    }
+  pthread_mutex_unlock(&a->lock);
+}
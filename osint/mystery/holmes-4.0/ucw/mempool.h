@@ -433,4 +433,40 @@ char *mp_printf_append(struct mempool *mp, char *ptr, const char *fmt, ...) FORM
  **/
 char *mp_vprintf_append(struct mempool *mp, char *ptr, const char *fmt, va_list args);
 
+#ifdef CONFIG_UCW_THREADS
+
+/***
+ * [[arena]]
+ * Concurrent arenas
+ * -----------------
+ *
+ * A mempool must not be used by multiple threads at once. An arena is a set
+ * of mempools, one for each thread, which share their lifetime. Every thread
+ * allocates from its own pool without any locking, but the data can be passed
+ * freely to other threads and they stay valid until the whole arena is flushed
+ * or deleted.
+ ***/
+
+struct mp_arena;	/** Concurrent arena, an opaque handle. **/
+
+struct mp_arena *mp_arena_new(uns chunk_size);	/** Create an arena, whose pools allocate chunks of @chunk_size. **/
+
+/**
+ * Create a new pool in the arena. Each thread should call this function
+ * once and then use the returned pool for its allocations. Statistics of
+ * the pool (see @mp_stats()) are thus per-thread.
+ **/
+struct mempool *mp_arena_pool(struct mp_arena *a);
+
+/** Flush all pools of the arena (see @mp_flush()). No thread may be using them. **/
+void mp_arena_flush(struct mp_arena *a);
+
+/** Delete the arena with all its pools. No thread may be using them. **/
+void mp_arena_delete(struct mp_arena *a);
+
+/** Sum statistics of all pools of the arena. **/
+void mp_arena_stats(struct mp_arena *a, struct mempool_stats *stats);
+
+#endif
+
 #endif
@@ -17,6 +17,7 @@ struct ucwlib_context {
   int temp_counter;			// Counter for fb-temp.c
   struct asio_queue *io_queue;		// Async I/O queue for fb-direct.c
   ucw_sighandler_t *signal_handlers;	// Signal handlers for sighandler.c
+  void *lizard_jump;			// Where lizard-safe.c recovers from SIGSEGV (a jmp_buf)
 };
 
 struct ucwlib_context *ucwlib_thread_context(void);
@@ -0,0 +1,56 @@
+/*
+ *	UCW Library Utilities -- Compiling Configuration Snapshots
+ *
+ *	This software may be freely distributed and used according to the terms
+ *	of the GNU Lesser General Public License.
+ */
+
+#include "ucw/lib.h"
+#include "ucw/getopt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void NONRET
+usage(void)
+{
+  fputs("\
+Usage: confsnap [-o <snapshot>] <config-file> [<config-file> ...]\n\
+\n\
+Compiles each configuration file together with all files it includes to\n\
+a binary snapshot, which is loaded instead of the text files as long as\n\
+none of them changes.\n\
+\n\
+-o <snapshot>\tName of the snapshot (default: <config-file>.snap)\n\
+", stderr);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  char *out = NULL;
+  int opt;
+
+  log_init(argv[0]);
+  while ((opt = getopt(argc, argv, "o:")) >= 0)
+    switch (opt)
+      {
+      case 'o':
+	out = optarg;
+	break;
+      default:
+	usage();
+      }
+  if (optind >= argc || (out && optind != argc-1))
+    usage();
+
+  int err = 0;
+  for (int i=optind; i<argc; i++)
+    if (cf_snapshot_write(argv[i], out))
+      {
+	msg(L_ERROR, "Cannot compile %s", argv[i]);
+	err = 1;
+      }
+  return err;
+}
@@ -0,0 +1,22 @@
+# Tests for compiled configuration snapshots
+
+Run:	../obj/ucw/utils/confsnap $1 && ../obj/ucw/shell/config -C$1 'sec1{#int1; @list1{str1}}'
+In1:	sec1 {
+	  int1 0x10
+	  list1 "a b"
+	  list1:append 'c'; list1:prepend d
+	}
+Out:	CF_sec1_int1='16'
+	CF_sec1_list1_str1[1]='d'
+	CF_sec1_list1_str1[2]='a b'
+	CF_sec1_list1_str1[3]='c'
+
+Run:	../obj/ucw/utils/confsnap $1 && echo 'sec1.int1=8' >>$1 && ../obj/ucw/shell/config -C$1 'sec1{#int1}' 2>$2 && grep -c 'out of date' $2
+In1:	sec1{int1=7}
+Out:	CF_sec1_int1='8'
+	1
+
+Run:	../obj/ucw/utils/confsnap $1 && echo 'sec1{int1=9}' >$1 && ../obj/ucw/shell/config -C$1 'sec1{#int1}' 2>$2 && grep -c 'out of date' $2
+In1:	sec1{int1=7}
+Out:	CF_sec1_int1='9'
+	1
@@ -4,6 +4,16 @@
  *	(c) 2006 Martin Mares <mj@ucw.cz>
  */
 
+/*
+ *  In the rate-driven modes, the benchmark is open-loop: requests are scheduled
+ *  independently of the replies and the latency is measured from the planned
+ *  time of the request, so a stalled server is not hidden by requests which
+ *  were not sent because of it (the so called coordinated omission).
+ *
+ *  Latencies are recorded in microseconds and summarized by log-linear
+ *  histograms (like the HDR histograms), separately for each class of queries.
+ */
+
 /*
  *  Error codes used internally:
  *
@@ -21,6 +31,8 @@
 #include "ucw/fastbuf.h"
 #include "ucw/mempool.h"
 #include "ucw/log.h"
+#include "ucw/bitops.h"
+#include "ucw/chartype.h"
 #include "sherlock/object.h"
 #include "sherlock/objread.h"
 
@@ -51,7 +63,19 @@ static uns max_in_flight = 5;
 static byte *host = "localhost";
 static uns port = 8192;
 static byte *logfile;
+static byte *result_file;
 static uns verbose;
+static double ramp_to, ramp_step;
+static uns slo_ms;
+
+/* Classes of queries, the same as genbench.pl recognizes */
+enum query_class {
+  CLASS_PLAIN,
+  CLASS_STATS,
+  CLASS_IMAGE,
+  CLASS_MAX
+};
+static char *class_names[] = { "plain", "stats", "image", "all" };
 
 static int log_fd = -1;
 static struct sockaddr_in sockaddr;
@@ -83,7 +107,7 @@ setup(void)
 
   if ((log_fd = open(logfile, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0666)) < 0)
     die("Cannot create %s: %m", logfile);
-  static const byte hdr[] = "# ID\tstat\ttotal\tconn\tanswr\tmatches\n";
+  static const byte hdr[] = "# ID\tstat\tstage\tclass\ttotal\tdelay\tconn\tanswr\tmatches (times in us)\n";
   write(log_fd, hdr, sizeof(hdr)-1);
 
   trace("Resolving host %s", host);
@@ -100,7 +124,27 @@ whats_the_time(void)
 {
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  return (s64)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  return (s64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int
+has_word(byte *q, char *w)
+{
+  uns l = strlen(w);
+  for (byte *p = q; *p; p++)
+    if ((p == q || Cspace(p[-1])) && !strncasecmp(p, w, l))
+      return 1;
+  return 0;
+}
+
+static uns
+query_class(byte *q)
+{
+  if (has_word(q, "STATS "))
+    return CLASS_STATS;
+  if (has_word(q, "MUXSS \"img\""))
+    return CLASS_IMAGE;
+  return CLASS_PLAIN;
 }
 
 static s64 t_start, t_end, t_connect, t_reply;
@@ -176,7 +220,7 @@ fire(byte *req)
 }
 
 static void
-handle_request(uns index, byte *req, s64 t_planned)
+handle_request(uns index, uns stage, byte *req, s64 t_planned)
 {
   log_fork();
   log_set_format(log_default_stream(), ~0U, LSFMT_USEC);
@@ -193,8 +237,8 @@ handle_request(uns index, byte *req, s64 t_planned)
 
   int matches = obj_find_anum(obj, 'N', 0);
 
-  byte *s = stk_printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
-		       index, rc,
+  byte *s = stk_printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+		       index, rc, stage, query_class(req),
 		       (int)(t_end - t_start),
 		       (int)(t_start - t_planned),
 		       t_connect ? (int)(t_connect - t_start) : 0,
@@ -208,13 +252,26 @@ handle_request(uns index, byte *req, s64 t_planned)
 static struct fastbuf *query_fb;
 static s64 tt_start, tt_now, tt_next, tt_next_progress;
 static uns n_req;
+static int queries_seekable;
+
+static int
+read_query(byte *buf)
+{
+  if (bgets(query_fb, buf, 4096))
+    return 1;
+  /* When ramping, reuse the queries if possible */
+  if (!ramp_to || !queries_seekable || btell(query_fb) <= 0)
+    return 0;
+  bsetpos(query_fb, 0);
+  return !!bgets(query_fb, buf, 4096);
+}
 
 static s64
-next_query(byte *buf)
+next_query(byte *buf, s64 t_last)
 {
-  if (!bgets(query_fb, buf, 4096) ||
-      max_time && tt_now > tt_start + 1000*(s64)max_time ||
-      n_req >= max_requests)
+  if (max_time && tt_now > tt_start + 1000000*(s64)max_time ||
+      n_req >= max_requests ||
+      !read_query(buf))
     return 0;
 
   double delta;
@@ -242,7 +299,13 @@ next_query(byte *buf)
 
   if (verbose > 1)
     log(L_DEBUG, "Delta = %.3g", delta);
-  return tt_now + (int)(delta*1000+0.5);
+  /*
+   *  The schedule of the rate-driven modes does not depend on when the last
+   *  request could be really sent, otherwise we would wait for the server.
+   */
+  if (mode == MODE_FLOOD)
+    t_last = tt_now;
+  return t_last + (s64)(delta*1000000+0.5);
 }
 
 static void
@@ -267,8 +330,8 @@ progress(void)
 {
   if (tt_now < tt_next_progress)
     return;
-  tt_next_progress += 1000;
-  double rs = (tt_now > tt_start) ? (n_req / ((tt_now-tt_start)/1000.)) : 0;
+  tt_next_progress += 1000000;
+  double rs = (tt_now > tt_start) ? (n_req / ((tt_now-tt_start)/1e6)) : 0;
   setproctitle("bench: %d req, %.3f r/s", n_req, rs);
   if (verbose)
     {
@@ -277,8 +340,21 @@ progress(void)
     }
 }
 
+/*** Stages ***/
+
+#define MAX_STAGES 256
+
+struct stage {
+  double rate;				// Offered rate (0 in the flood mode)
+  s64 t_start, t_end;
+  uns n_req;
+};
+
+static struct stage stages[MAX_STAGES];
+static uns num_stages;
+
 static void
-loop(void)
+loop(uns stage)
 {
   uns children = 0;
   byte query[4096];
@@ -286,15 +362,9 @@ loop(void)
   int status;
   uns err_cnt = 0;
 
-  struct sigaction sa = { .sa_handler = sigchld_handler, .sa_flags = SA_RESTART };
-  sigaction(SIGCHLD, &sa, NULL);
-  sa.sa_handler = sigint_handler;
-  sigaction(SIGINT, &sa, NULL);
-  signal(SIGPIPE, SIG_IGN);
-
-  query_fb = bfdopen(0, 65536);
-  tt_start = tt_now = whats_the_time();
-  tt_next = next_query(query);
+  tt_start = tt_now = tt_next_progress = whats_the_time();
+  n_req = 0;
+  tt_next = next_query(query, tt_now);
   if (tt_next)
     tt_next = tt_now;
   while (tt_next && !hey_shut_down ||
@@ -311,6 +381,7 @@ loop(void)
 		{
 		  log(L_FATAL, "Too many failed connections, giving up.");
 		  tt_next = 0;
+		  hey_shut_down = 1;
 		}
 	    }
 	  else if (format_exit_status(status_msg, status))
@@ -325,80 +396,266 @@ loop(void)
 	}
       if (tt_next && tt_now >= tt_next && children < max_in_flight && !hey_shut_down)
 	{
-	  uns dly = tt_now - tt_next;
-	  if (dly >= 200 && mode != MODE_FLOOD)
+	  uns dly = (tt_now - tt_next) / 1000;
+	  if (dly >= 200 && mode != MODE_FLOOD && verbose > 1)
 	    log(L_WARN, "Request delayed by %d ms", dly);
 	  pid = fork();
 	  if (pid < 0)
 	    {
 	      log(L_FATAL, "fork failed: %m. Shutting down.");
 	      tt_next = 0;
+	      hey_shut_down = 1;
 	    }
 	  else if (!pid)
 	    {
 	      signal(SIGINT, SIG_DFL);
-	      handle_request(n_req, query, tt_next);
+	      handle_request(n_req, stage, query, tt_next);
 	      exit(0);
 	    }
 	  else
 	    {
 	      children++;
 	      n_req++;
-	      tt_next = next_query(query);
+	      tt_next = next_query(query, tt_next);
 	    }
 	  continue;
 	}
-      int timeout = tt_next ? tt_next - tt_now : 10000;
-      poll(NULL, 0, timeout);
+      int timeout = tt_next ? (tt_next - tt_now + 999) / 1000 : 10000;
+      if (tt_next && children >= max_in_flight)
+	timeout = 100;			// Wait for SIGCHLD, but do not rely on it
+      poll(NULL, 0, MAX(timeout, 0));
     }
 
-  double tt = (tt_now - tt_start) / 1000.;
+  struct stage *st = &stages[stage];
+  st->t_start = tt_start;
+  st->t_end = tt_now;
+  st->n_req = n_req;
+  double tt = (tt_now - tt_start) / 1e6;
   log(L_INFO, "Fired %d requests in %.3f seconds (%.3f req/sec = %.3f sec/req)", n_req, tt,
       tt ? n_req/tt : 0, n_req ? tt/n_req : 0);
 }
 
+/*** Histograms ***/
+
+/*
+ *  Values below 2^HIST_BITS are stored exactly, larger values are split to
+ *  power-of-two ranges, each of them divided to 2^(HIST_BITS-1) buckets.
+ *  Therefore the relative error is below 2^-(HIST_BITS-1).
+ */
+
+#define HIST_BITS 7
+#define HIST_HALF (1 << (HIST_BITS-1))
+#define HIST_BUCKETS ((33 - HIST_BITS) * HIST_HALF + 2*HIST_HALF)
+
+struct hist {
+  uns count;
+  uns max;
+  u64 sum;
+  uns buckets[HIST_BUCKETS];
+};
+
 static void
-stats(void)
+hist_add(struct hist *h, uns val)
+{
+  uns shift = 0;
+  if (val >= 2*HIST_HALF)
+    shift = bit_fls(val) - HIST_BITS + 1;
+  h->buckets[shift*HIST_HALF + (val >> shift)]++;
+  h->count++;
+  h->sum += val;
+  h->max = MAX(h->max, val);
+}
+
+static uns
+hist_percentile(struct hist *h, double q)
+{
+  /* Returns the highest value equivalent to the percentile */
+  uns rank = (uns)(q * h->count + 0.999999);
+  uns seen = 0;
+  for (uns i=0; i<HIST_BUCKETS; i++)
+    if ((seen += h->buckets[i]) >= MAX(rank, 1))
+      {
+	uns shift = (i < 2*HIST_HALF) ? 0 : i/HIST_HALF - 1;
+	u64 top = ((u64)(i - shift*HIST_HALF + 1) << shift) - 1;
+	return MIN(top, (u64) h->max);
+      }
+  return h->max;
+}
+
+/*** Statistics ***/
+
+struct class_stats {
+  uns cnt, errs, matches;
+  struct hist latency;			// From the planned time to the end of the reply
+  struct hist service;			// From the connection attempt to the end of the reply
+  struct hist delay, connect, reply;	// Parts of the latency
+};
+
+static struct class_stats class_stats[CLASS_MAX+1];	// The last one for all classes
+
+/* Read the log file and summarize the given stage (~0U = all stages) */
+static void
+collect(uns stage)
 {
+  bzero(class_stats, sizeof(class_stats));
   lseek(log_fd, 0, SEEK_SET);
   struct fastbuf *fb = bfdopen_shared(log_fd, 4096);
   byte buf[LINE_LEN];
-  uns cnt = 0, errs = 0;
-  uns stot = 0, scon = 0, srep = 0, sdly = 0, smat = 0;
-  uns mtot = 0, mcon = 0, mrep = 0, mdly = 0, mmat = 0;
 
   while (get_line(fb, buf))
     {
-      uns n, rc, tot, con, rep, mat, dly;
+      uns n, rc, stg, cls, tot, con, rep, mat, dly;
       if (!buf[0] || buf[0] == '#')
 	continue;
-      if (sscanf(buf, "%d%d%d%d%d%d%d", &n, &rc, &tot, &dly, &con, &rep, &mat) != 7)
+      if (sscanf(buf, "%d%d%d%d%d%d%d%d%d", &n, &rc, &stg, &cls, &tot, &dly, &con, &rep, &mat) != 9 || cls >= CLASS_MAX)
 	ASSERT(0);
-      cnt++;
-      if (rc)
-	errs++;
-#define UC(x) s##x += x; m##x = MAX(m##x, x)
-      UC(tot);
-      UC(con);
-      UC(rep);
-      UC(dly);
-      UC(mat);
+      if (stage != ~0U && stg != stage)
+	continue;
+      struct class_stats *cs[2] = { &class_stats[cls], &class_stats[CLASS_MAX] };
+      for (uns i=0; i<2; i++)
+	{
+	  struct class_stats *c = cs[i];
+	  c->cnt++;
+	  if (rc)
+	    c->errs++;
+	  c->matches += mat;
+	  hist_add(&c->latency, (mode == MODE_FLOOD) ? tot : tot + dly);
+	  hist_add(&c->service, tot);
+	  hist_add(&c->delay, dly);
+	  hist_add(&c->connect, con);
+	  hist_add(&c->reply, rep);
+	}
     }
   bclose(fb);
+}
+
+static double
+stage_throughput(uns stage, uns cnt)
+{
+  struct stage *st = &stages[stage];
+  return (st->t_end > st->t_start) ? cnt / ((st->t_end - st->t_start) / 1e6) : 0;
+}
 
-  log(L_INFO, "Finished reqs:  %d", cnt);
-  log(L_INFO, "Errors:         %d", errs);
-  log(L_INFO, "Total matches:  %d", smat);
-  if (cnt)
+#define MS(x) ((x) / 1000.)
+
+static void
+log_percentiles(char *what, struct hist *h)
+{
+  log(L_INFO, "%-15s %8.3f avg, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f", what,
+      MS((double) h->sum / MAX(h->count, 1)),
+      MS(hist_percentile(h, 0.5)), MS(hist_percentile(h, 0.9)),
+      MS(hist_percentile(h, 0.99)), MS(hist_percentile(h, 0.999)),
+      MS(h->max));
+}
+
+static void
+stats(void)
+{
+  collect(~0U);
+  struct class_stats *all = &class_stats[CLASS_MAX];
+
+  log(L_INFO, "Finished reqs:  %d", all->cnt);
+  log(L_INFO, "Errors:         %d", all->errs);
+  log(L_INFO, "Total matches:  %d", all->matches);
+  if (all->cnt)
     {
-#define AVG(x) (double)s##x/cnt/1000	/* Hack warning */
-#define EX(x) (double)m##x/1000
-      log(L_INFO, "Total latency:  %.3f avg, %.3f max", AVG(tot), EX(tot));
+      log(L_INFO, "Latencies in ms:");
+      log_percentiles("Total latency:", &all->latency);
       if (mode != MODE_FLOOD)
-	log(L_INFO, "Request delay:  %.3f avg, %.3f max", AVG(dly), EX(dly));
-      log(L_INFO, "Connect delay:  %.3f avg, %.3f max", AVG(con), EX(con));
-      log(L_INFO, "Req. to reply:  %.3f avg, %.3f max", AVG(rep), EX(rep));
+	{
+	  log_percentiles("Service time:", &all->service);
+	  log_percentiles("Request delay:", &all->delay);
+	}
+      log_percentiles("Connect delay:", &all->connect);
+      log_percentiles("Req. to reply:", &all->reply);
+      for (uns c=0; c<CLASS_MAX; c++)
+	if (class_stats[c].cnt)
+	  log_percentiles(stk_printf("Class %s:", class_names[c]), &class_stats[c].latency);
+    }
+}
+
+/* Export machine-readable results: one line per stage and class */
+static void
+export_results(void)
+{
+  struct fastbuf *b = bopen(result_file, O_WRONLY | O_CREAT | O_TRUNC, 4096);
+  bputs(b, "# stage\trate\tclass\tcount\terrors\tthroughput\tmean\tp50\tp90\tp99\tp99.9\tmax\t(latencies in ms)\n");
+  for (uns i=0; i<num_stages; i++)
+    {
+      collect(i);
+      for (uns c=0; c<=CLASS_MAX; c++)
+	{
+	  struct class_stats *cs = &class_stats[c];
+	  struct hist *h = &cs->latency;
+	  if (!cs->cnt && c < CLASS_MAX)
+	    continue;
+	  bprintf(b, "%d\t%.3f\t%s\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n",
+		  i, stages[i].rate, class_names[c], cs->cnt, cs->errs,
+		  stage_throughput(i, cs->cnt),
+		  MS((double) h->sum / MAX(h->count, 1)),
+		  MS(hist_percentile(h, 0.5)), MS(hist_percentile(h, 0.9)),
+		  MS(hist_percentile(h, 0.99)), MS(hist_percentile(h, 0.999)),
+		  MS(h->max));
+	}
+    }
+  bclose(b);
+}
+
+/*
+ *  Raise the offered rate step by step until the server stops keeping up:
+ *  either the completed throughput falls below 90% of the offered rate,
+ *  or the 99th percentile of latency exceeds the limit given by the user.
+ */
+static void
+ramp(void)
+{
+  double best = 0;
+  for (double r = rate; r <= ramp_to + 1e-9 && !hey_shut_down && num_stages < MAX_STAGES; r += ramp_step)
+    {
+      uns stage = num_stages++;
+      rate = stages[stage].rate = r;
+      log(L_INFO, "Stage %d: offering %.3f req/sec", stage, r);
+      loop(stage);
+      collect(stage);
+      struct class_stats *all = &class_stats[CLASS_MAX];
+      double tput = stage_throughput(stage, all->cnt - all->errs);
+      uns p99 = hist_percentile(&all->latency, 0.99);
+      log(L_INFO, "Stage %d: %.3f req/sec completed, p99 latency %.3f ms", stage, tput, MS(p99));
+      if (!stages[stage].n_req)
+	break;
+      if (tput < 0.9 * r || slo_ms && p99 > 1000*slo_ms)
+	{
+	  log(L_INFO, "Saturated at %.3f req/sec offered", r);
+	  break;
+	}
+      best = MAX(best, tput);
     }
+  log(L_INFO, "Saturation throughput: %.3f req/sec", best);
+}
+
+static void
+run(void)
+{
+  struct sigaction sa = { .sa_handler = sigchld_handler, .sa_flags = SA_RESTART };
+  sigaction(SIGCHLD, &sa, NULL);
+  sa.sa_handler = sigint_handler;
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  query_fb = bfdopen(0, 65536);
+  queries_seekable = (lseek(0, 0, SEEK_CUR) >= 0);
+
+  if (ramp_to)
+    ramp();
+  else
+    {
+      stages[0].rate = (mode == MODE_FLOOD) ? 0 : rate;
+      num_stages = 1;
+      loop(0);
+    }
+  stats();
+  if (result_file)
+    export_results();
 
   if (temp_file && unlink(temp_file) < 0)
     log(L_ERROR, "Cannot unlink %s: %m", temp_file);
@@ -414,18 +671,23 @@ Basic options:\n\
 " CF_USAGE "\
 -h <host>[:<port>]\tConnect to the given host and port (default: localhost, 8192)\n\
 -l <log>\t\tLog request timing to the specified file\n\
+-o <file>\t\tExport summary of the results (per stage and query class) to a file\n\
 -p <max>\t\tRun at most <max> requests in parallel (default: 5)\n\
 -v\t\t\tBe verbose\n\
 -vv\t\t\tBe very verbose and trace execution\n\
 \n\
 Duration options:\n\
--n <count>\t\tStop after <count> requests\n\
--t <time>\t\tStop after <time> seconds\n\
+-n <count>\t\tStop after <count> requests (per stage if ramping)\n\
+-t <time>\t\tStop after <time> seconds (per stage if ramping, default: 10)\n\
 \n\
 Request distribution options:\n\
 \t\t\tBy default, fire as many requests in parallel as -p allows\n\
 -r <rate>\t\tExponential distribution with <rate> requests per second\n\
 -u <rate>\t\tUniform distribution with <rate> requests per second\n\
+\n\
+Finding the saturation point (with -r or -u as the initial rate):\n\
+-R <max>:<step>\t\tRaise the rate by <step> up to <max> req/sec until the server saturates\n\
+-L <ms>\t\t\tConsider the server saturated when the p99 latency exceeds <ms>\n\
 ");
   exit(1);
 }
@@ -436,7 +698,7 @@ int main(int argc, char **argv)
 
   log_init("bench");
   setproctitle_init(argc, argv);
-  while ((opt = cf_getopt(argc, argv, "h:l:n:p:r:t:u:v" CF_SHORT_OPTS, CF_NO_LONG_OPTS, NULL)) >= 0)
+  while ((opt = cf_getopt(argc, argv, "h:l:n:o:p:r:t:u:vR:L:" CF_SHORT_OPTS, CF_NO_LONG_OPTS, NULL)) >= 0)
     switch (opt)
       {
       case 'h':
@@ -460,6 +722,9 @@ int main(int argc, char **argv)
 	if (cf_parse_int(optarg, &max_requests))
 	  usage();
 	break;
+      case 'o':
+	result_file = xstrdup(optarg);		// setproctitle() overwrites argv
+	break;
       case 'p':
 	if (cf_parse_int(optarg, &max_in_flight))
 	  usage();
@@ -481,14 +746,34 @@ int main(int argc, char **argv)
       case 'v':
 	verbose++;
 	break;
+      case 'R':
+	{
+	  byte *sep = strchr(optarg, ':');
+	  if (!sep)
+	    usage();
+	  *sep++ = 0;
+	  if (cf_parse_double(optarg, &ramp_to) || cf_parse_double(sep, &ramp_step) || ramp_step <= 0)
+	    usage();
+	  break;
+	}
+      case 'L':
+	if (cf_parse_int(optarg, &slo_ms))
+	  usage();
+	break;
       default:
 	usage();
       }
   if (optind != argc)
     usage();
+  if (ramp_to)
+    {
+      if (mode == MODE_FLOOD || rate <= 0)
+	usage();
+      if (!max_time)
+	max_time = 10;
+    }
 
   setup();
-  loop();
-  stats();
+  run();
   return 0;
 }
@@ -39,6 +39,7 @@ Input format options: (default is -1)\n\
 -2\t\t\tRead two-part (header and body) textual buckets from stdin\n\
 -d\t\t\tRead idxdump output (textual, buckets separated by ### lines)\n\
 -f<path>\t\t\tRead the bucket file\n\
+-t<threads>\t\tNumber of threads scanning the bucket file (default: see Buckets.ScanThreads)\n\
 \n\
 Output options: (default is to print whole matching objects)\n\
 -A[<attrs>]\t\tPrint selected attributes from merged header and body\n\
@@ -66,9 +67,8 @@ Attribute specifications (<attrs>):\n\
 }
 
 static byte *buck_name;
-static struct mempool *pool;
-static struct buck2obj_buf *buck_buf;
 static struct fastbuf *out;
+static uns num_threads;
 
 enum input_type {
   INPUT_TEXT_1PART,
@@ -92,15 +92,54 @@ struct attrs {
 struct matcher {
   struct matcher *next;
   uns expr_id;				/* or column number for output nodes */
-  regex *rx;
 };
 
 static struct attrs *out_header, *out_body, *out_merged, *out_tabsep;
 static struct attrs *match_header, *match_body;
 static uns num_exprs;
+static byte *expr_patterns[32];
+static int expr_icase[32];
 
 static uns out_num_columns;
-static byte **out_columns;
+
+/*
+ *  Everything modified during matching lives in a context, so that
+ *  buckets can be grepped by multiple threads at once. Even the regexes
+ *  are compiled separately for each context, because rx_match() stores
+ *  the sub-matches in the regex.
+ */
+struct grep_context {
+  struct mempool *pool;
+  struct buck2obj_buf *buck_buf;
+  regex *rx[32];
+  byte **out_columns;
+  struct fastbuf *out;
+};
+
+static struct grep_context *
+grep_new_context(void)
+{
+  struct grep_context *c = xmalloc_zero(sizeof(*c));
+  c->pool = mp_new(1<<14);
+  c->buck_buf = buck2obj_alloc();
+  for (uns i=0; i<num_exprs; i++)
+    c->rx[i] = rx_compile(expr_patterns[i], expr_icase[i]);
+  if (out_tabsep)
+    c->out_columns = xmalloc(out_num_columns * sizeof(c->out_columns[0]));
+  c->out = out;
+  return c;
+}
+
+static void
+grep_free_context(struct grep_context *c)
+{
+  for (uns i=0; i<num_exprs; i++)
+    rx_free(c->rx[i]);
+  xfree(c->out_columns);
+  buck2obj_free(c->buck_buf);
+  mp_delete(c->pool);
+  xfree(c);
+}
 
 static void
 debug_matchers(struct attrs *a UNUSED)
@@ -147,7 +186,7 @@ debug_matchers(struct attrs *a UNUSED)
 }
 
 static void
-add_matcher(struct attrs *a, uns attr, regex *rx, uns id)
+add_matcher(struct attrs *a, uns attr, uns id)
 {
   struct matcher *m = cf_malloc(sizeof(*m));
   m->next = a->matchers[attr];
@@ -156,21 +195,20 @@ add_matcher(struct attrs *a, uns attr, regex *rx, uns id)
     m->expr_id = id;
   else
     m->expr_id = out_num_columns++;
-  m->rx = rx;
   bit_array_set(a->names, attr);
 }
 
 static void
-add_attr(struct attrs **where, byte *patt, regex *rx, uns id)
+add_attr(struct attrs **where, byte *patt, uns id)
 {
   struct attrs *a = *where;
   byte *orig_patt = patt;
   if (!a)
     a = *where = xmalloc_zero(sizeof(*a));
   if (!patt[0])
-    add_matcher(a, 0, rx, id);
+    add_matcher(a, 0, id);
   else if (patt[0] == '*' && !patt[1])
-    add_matcher(a, 1, rx, id);
+    add_matcher(a, 1, id);
   else
     {
       while (*patt)
@@ -197,7 +235,7 @@ add_attr(struct attrs **where, byte *patt, regex *rx, uns id)
 		}
 	      patt[-1] = 0;
 	      bit_array_set(a->names, sub + OBJ_ATTR_SON);
-	      add_attr(&a->nested[sub], start, rx, id);
+	      add_attr(&a->nested[sub], start, id);
 	      patt[-1] = ')';
 	    }
 	  else
@@ -205,7 +243,7 @@ add_attr(struct attrs **where, byte *patt, regex *rx, uns id)
 	      uns attr = *patt++;
 	      if (attr < 0x21 || attr > 0x7e)
 		die("Invalid pattern `%s': invalid name of attribute", orig_patt);
-	      add_matcher(a, attr, rx, id);
+	      add_matcher(a, attr, id);
 	    }
 	}
     }
@@ -214,13 +252,13 @@ add_attr(struct attrs **where, byte *patt, regex *rx, uns id)
 static void
 add_out(struct attrs **where, byte *patt)
 {
-  add_attr(where, cf_strdup(patt), NULL, 0);
+  add_attr(where, cf_strdup(patt), 0);
 }
 
 static void
 add_out_tabsep(struct attrs **where, byte *patt)
 {
-  add_attr(where, cf_strdup(patt), NULL, ~0U);
+  add_attr(where, cf_strdup(patt), ~0U);
 }
 
 static void
@@ -235,8 +273,10 @@ add_match(struct attrs **where, byte *patt)
   if (num_exprs >= 32)
     die("At most 32 expressions at once are supported");
   DBG("@@ expr %d: <%s>", num_exprs, sep);
-  regex *rx = rx_compile(sep, ignore_case);
-  add_attr(where, patt, rx, num_exprs);
+  rx_free(rx_compile(sep, ignore_case));		/* Report syntax errors early */
+  expr_patterns[num_exprs] = sep;
+  expr_icase[num_exprs] = ignore_case;
+  add_attr(where, patt, num_exprs);
   num_exprs++;
 }
 
@@ -343,7 +383,7 @@ fold_matchers(byte *name UNUSED, struct attrs *a)
 }
 
 static u32
-match_obj(struct odes *obj, struct attrs *at)
+match_obj(struct grep_context *c, struct odes *obj, struct attrs *at)
 {
   if (!at)
     return 0;
@@ -356,11 +396,11 @@ match_obj(struct odes *obj, struct attrs *at)
 	  {
 	    for (struct matcher *m=at->matchers[a->attr]; m; m=m->next)
 	      for (struct oattr *b=a; b && !(mask & (1 << m->expr_id)); b=b->same)
-		if (rx_match(m->rx, b->val))
+		if (rx_match(c->rx[m->expr_id], b->val))
 		  mask |= 1 << m->expr_id;
 	  }
 	else
-	  mask |= match_obj(a->son, at->nested[a->attr - OBJ_ATTR_SON]);
+	  mask |= match_obj(c, a->son, at->nested[a->attr - OBJ_ATTR_SON]);
       }
   return mask;
 }
@@ -368,7 +408,7 @@ match_obj(struct odes *obj, struct attrs *at)
 #define MAX_NESTING 100
 
 static void
-do_output(struct odes *obj, struct attrs *at, byte *namebuf, uns nesting)
+do_output(struct grep_context *c, struct odes *obj, struct attrs *at, byte *namebuf, uns nesting)
 {
   if (nesting >= MAX_NESTING)
     die("Object nesting too deep (maximum is %d)", MAX_NESTING);
@@ -380,8 +420,8 @@ do_output(struct odes *obj, struct attrs *at, byte *namebuf, uns nesting)
 	    if (out_tabsep)
 	      {
 		uns column = at->matchers[a->attr]->expr_id;
-		if (!out_columns[column])
-		  out_columns[column] = b->val;
+		if (!c->out_columns[column])
+		  c->out_columns[column] = b->val;
 		break;
 	      }
 	    else
@@ -389,11 +429,11 @@ do_output(struct odes *obj, struct attrs *at, byte *namebuf, uns nesting)
 		if (fold_names)
 		  {
 		    namebuf[nesting] = a->attr;
-		    bwrite(out, namebuf, nesting+1);
+		    bwrite(c->out, namebuf, nesting+1);
 		  }
 		else
-		  bputc(out, a->attr);
-		bputsn(out, b->val);
+		  bputc(c->out, a->attr);
+		bputsn(c->out, b->val);
 	      }
 	  }
 	else
@@ -401,102 +441,158 @@ do_output(struct odes *obj, struct attrs *at, byte *namebuf, uns nesting)
 	    uns attr = a->attr - OBJ_ATTR_SON;
 	    namebuf[nesting] = attr;
 	    if (!fold_names && !out_tabsep)
-	      bprintf(out, "(%c\n", attr);
-	    do_output(b->son, at->nested[attr], namebuf, nesting+1);
+	      bprintf(c->out, "(%c\n", attr);
+	    do_output(c, b->son, at->nested[attr], namebuf, nesting+1);
 	    if (!fold_names && !out_tabsep)
-	      bputs(out, ")\n");
+	      bputs(c->out, ")\n");
 	  }
 }
 
 static void
-output(struct odes *obj, struct attrs *at)
+output(struct grep_context *c, struct odes *obj, struct attrs *at)
 {
   if (!at)
     return;
 
   byte namebuf[MAX_NESTING+1];
-  do_output(obj, at, namebuf, 0);
+  do_output(c, obj, at, namebuf, 0);
 }
 
 static int
-is_matching(struct odes *o_hdr, struct odes *o_body)
+is_matching(struct grep_context *c, struct odes *o_hdr, struct odes *o_body)
 {
   if (match_all)
     return 1;
 
-  u32 mask = match_obj(o_hdr, match_header) | match_obj(o_body, match_body);
+  u32 mask = match_obj(c, o_hdr, match_header) | match_obj(c, o_body, match_body);
   u32 all = (num_exprs == 32 ? ~0U : ((1U << num_exprs) - 1));
   DBG(">>> Mask %08x of %08x", mask, all);
   return (mask == all);
 }
 
 static void
-grep(byte *leader, struct odes *o_hdr, struct odes *o_body)
+grep(struct grep_context *c, byte *leader, struct odes *o_hdr, struct odes *o_body)
 {
   DBG("<<< Trying %s", leader);
-  int match = is_matching(o_hdr, o_body);
+  int match = is_matching(c, o_hdr, o_body);
   if (negate_match ? match : !match)
     return;
 
   DBG(">>> OK");
   if (leader && leader[0] && !quiet_please)
-    bputsn(out, leader);
+    bputsn(c->out, leader);
   if (out_merged)
     {
-      output(o_hdr, out_merged);
-      output(o_body, out_merged);
+      output(c, o_hdr, out_merged);
+      output(c, o_body, out_merged);
     }
   else if (out_tabsep)
     {
-      bzero(out_columns, out_num_columns * sizeof(out_columns[0]));
-      output(o_hdr, out_tabsep);
-      output(o_body, out_tabsep);
+      bzero(c->out_columns, out_num_columns * sizeof(c->out_columns[0]));
+      output(c, o_hdr, out_tabsep);
+      output(c, o_body, out_tabsep);
       for (uns i=0; i<out_num_columns; i++)
 	{
 	  if (i)
-	    bputc(out, '\t');
-	  if (out_columns[i])
-	    bputs(out, out_columns[i]);
+	    bputc(c->out, '\t');
+	  if (c->out_columns[i])
+	    bputs(c->out, c->out_columns[i]);
 	}
-      bputc(out, '\n');
+      bputc(c->out, '\n');
     }
   else
     {
-      output(o_hdr, out_header);
+      output(c, o_hdr, out_header);
       if (quiet_please < 2)
-	bputc(out, '\n');
-      output(o_body, out_body);
+	bputc(c->out, '\n');
+      output(c, o_body, out_body);
     }
   if (quiet_please < 2)
-    bputc(out, '\n');
+    bputc(c->out, '\n');
+}
+
+static void
+grep_bucket(struct grep_context *c, struct obuck_header *h, struct fastbuf *b)
+{
+  struct odes *o_hdr, *o_body;
+  mp_flush(c->pool);
+  o_hdr = obj_new(c->pool);
+  o_body = obj_new(c->pool);
+  if (buck2obj_parse(c->buck_buf, h->type, h->length, b, o_hdr, NULL, o_body, 1) < 0)
+    log(L_ERROR, "Cannot parse bucket %x of type %x and length %d: %m", h->oid, h->type, h->length);
+  else
+    {
+      byte leader[256];
+      sprintf(leader, "### %08x %6d %08x", h->oid, h->length, h->type);
+      grep(c, leader, o_hdr, o_body);
+    }
+}
+
+#ifdef CONFIG_UCW_THREADS
+
+static void *
+scan_init(struct obuck_scan *s UNUSED)
+{
+  return grep_new_context();
+}
+
+static void
+scan_cleanup(struct obuck_scan *s UNUSED, void *ctx)
+{
+  grep_free_context(ctx);
+}
+
+static void
+scan_process(struct obuck_scan *s UNUSED, void *ctx, struct obuck_header *h, struct fastbuf *b, struct fastbuf *results)
+{
+  struct grep_context *c = ctx;
+  c->out = results;
+  grep_bucket(c, h, b);
+}
+
+static void
+scan_deliver(struct obuck_scan *s UNUSED, struct fastbuf *results)
+{
+  bbcopy(results, out, ~0U);
 }
 
+static void
+parse_buckets(void)
+{
+  struct obuck obuck;
+  obuck_init(&obuck, buck_name, 0);
+  struct obuck_scan s = {
+    .obuck = &obuck,
+    .threads = num_threads,
+    .ordered = 1,
+    .thread_init = scan_init,
+    .thread_cleanup = scan_cleanup,
+    .process = scan_process,
+    .deliver = scan_deliver,
+  };
+  obuck_scan_pool(&s);
+  obuck_cleanup(&obuck);
+}
+
+#else
+
 static void
 parse_buckets(void)
 {
   struct fastbuf *b;
   struct obuck obuck;
   struct obuck_header h;
+  struct grep_context *c = grep_new_context();
 
   obuck_init(&obuck, buck_name, 0);
   while (b = obuck_slurp_pool(&obuck, &h, OBUCK_OID_ANY))
-    {
-      struct odes *o_hdr, *o_body;
-      mp_flush(pool);
-      o_hdr = obj_new(pool);
-      o_body = obj_new(pool);
-      if (buck2obj_parse(buck_buf, h.type, h.length, b, o_hdr, NULL, o_body, 1) < 0)
-	log(L_ERROR, "Cannot parse bucket %x of type %x and length %d: %m", h.oid, h.type, h.length);
-      else
-	{
-	  byte leader[256];
-	  sprintf(leader, "### %08x %6d %08x", h.oid, h.length, h.type);
-	  grep(leader, o_hdr, o_body);
-	}
-    }
+    grep_bucket(c, &h, b);
   obuck_cleanup(&obuck);
+  grep_free_context(c);
 }
 
+#endif
+
 static void
 parse_text(void)
 {
@@ -504,6 +600,7 @@ parse_text(void)
   bb_t line, leader;
   struct odes *o_hdr = NULL, *o_body = NULL;
   struct obj_read_state ors;
+  struct grep_context *c = grep_new_context();
   int phase = 0;
   byte *lend;
   bzero(&ors, sizeof(ors));
@@ -531,7 +628,7 @@ parse_text(void)
 	      else
 		{
 		  obj_read_end(&ors);
-		  grep(leader.ptr, o_hdr, o_body);
+		  grep(c, leader.ptr, o_hdr, o_body);
 		  phase = 0;
 		  leader.ptr[0] = 0;
 		}
@@ -549,9 +646,9 @@ parse_text(void)
 	{
 	  if (!phase)
 	    {
-	      mp_flush(pool);
-	      o_hdr = obj_new(pool);
-	      o_body = obj_new(pool);
+	      mp_flush(c->pool);
+	      o_hdr = obj_new(c->pool);
+	      o_body = obj_new(c->pool);
 	      obj_read_start(&ors, o_hdr);
 	      phase = 1;
 	    }
@@ -562,6 +659,7 @@ parse_text(void)
   bb_done(&leader);
   bb_done(&line);
   bclose(b);
+  grep_free_context(c);
 }
 
 int
@@ -570,7 +668,7 @@ main(int argc, char **argv)
   int opt;
 
   log_init(NULL);
-  while ((opt = cf_getopt(argc, argv, CF_SHORT_OPTS "12A:B:H:V:b:df:h:imnqr", CF_NO_LONG_OPTS, NULL)) != -1)
+  while ((opt = cf_getopt(argc, argv, CF_SHORT_OPTS "12A:B:H:V:b:df:h:imnqrt:", CF_NO_LONG_OPTS, NULL)) != -1)
     switch (opt)
       {
       case 'A':
@@ -616,6 +714,9 @@ main(int argc, char **argv)
       case 'r':
 	fold_names++;
 	break;
+      case 't':
+	num_threads = atoi(optarg);
+	break;
       default:
 	help();
       }
@@ -635,7 +736,6 @@ main(int argc, char **argv)
     {
       if (out_header || out_body || out_merged)
 	die("-V cannot be mixed with -A, -H or -B");
-      out_columns = xmalloc(out_num_columns * sizeof(out_columns[0]));
       quiet_please = 2;
     }
   else if (!out_header && !out_body)
@@ -652,8 +752,6 @@ main(int argc, char **argv)
   fold_matchers("Out Body", out_body);
   fold_matchers("Out Merged", out_merged);
 
-  pool = mp_new(1<<14);
-  buck_buf = buck2obj_alloc();
   out = bfdopen_shared(1, 65536);
 
   if (input_type == INPUT_BUCKETS)
@@ -663,7 +761,5 @@ main(int argc, char **argv)
   DBG("DONE");
 
   bclose(out);
-  buck2obj_free(buck_buf);
-  mp_delete(pool);
   return 0;
 }
@@ -1111,25 +1111,99 @@ dump_lex_stats(u64 start, void *tmp)
 	}
 }
 
+static void
+dump_graph_edge(u32 x)
+{
+	static byte *vtypes[8] = { "", " [site2]", " [redir]", " [redir+site2]",
+		" [frame]", " [frame+site2]", " [img]", " [img+site2]" };
+
+	bprintf(output, "\t<- %x%s\n",
+	       x & ~ETYPE_MASK,
+	       vtypes[x >> ETYPE_SHIFT]);
+}
+
 static void
 dump_graph(u64 start, void *tmp)
 {
 	struct fastbuf *f = tmp;
 	u32 src, deg;
-	byte *vtypes[8] = { "", " [site2]", " [redir]", " [redir+site2]",
-		" [frame]", " [frame+site2]", " [img]", " [img+site2]" };
 
 	if (!f)
 		return;
 	bget_graph_hdr(f, &src, &deg);
 	bprintf(output, "Vertex %x (degree %d) at %08llx:\n", src, deg, (long long) start);
 	while (deg--)
-	{
-		u32 x = bgetl(f);
-		bprintf(output, "\t<- %x%s\n",
-		       x & ~ETYPE_MASK,
-		       vtypes[x >> ETYPE_SHIFT]);
-	}
+		dump_graph_edge(bgetl(f));
+}
+
+/* The compressed graph written instead of the graph index if Indexer.GraphCSR is set */
+
+static struct fastbuf *
+graph_csr_open(char *graph_name, struct graph_csr_trailer *t)
+{
+	struct fastbuf *f = bopen_try(stk_strcat(graph_name, FN_GRAPH_CSR), O_RDONLY, 1<<16);
+	if (!f)
+		return NULL;
+	ucw_off_t size = bfilesize(f);
+	if (size < (ucw_off_t) sizeof(*t))
+		die("%s is truncated", f->name);
+	bsetpos(f, size - sizeof(*t));
+	breadb(f, t, sizeof(*t));
+	if (t->magic != GRAPH_CSR_MAGIC || t->offsets + (t->vertices + 1) * sizeof(u64) + sizeof(*t) != (u64) size)
+		die("%s is not a compressed graph", f->name);
+	return f;
+}
+
+static u32
+bget_graph_varint(struct fastbuf *f)
+{
+	byte buf[GRAPH_VARINT_MAX];
+	uns i = 0;
+	do
+	{
+		int c = bgetc(f);
+		if (c < 0 || i >= GRAPH_VARINT_MAX)
+			die("Corrupted row in %s", f->name);
+		buf[i] = c;
+	}
+	while (buf[i++] & 0x80);
+	u32 x;
+	graph_get_varint(buf, &x);
+	return x;
+}
+
+static void
+dump_graph_csr_row(struct fastbuf *f, struct graph_csr_trailer *t, uns v)
+{
+	if (v >= t->vertices)
+		die("No such vertex in %s", f->name);
+	u64 ofs[2];
+	bsetpos(f, t->offsets + v * sizeof(u64));
+	breadb(f, ofs, sizeof(ofs));
+	if (ofs[0] == ofs[1])			// no incoming links
+		return;
+	bsetpos(f, ofs[0]);
+	u32 src = bget_graph_varint(f);
+	u32 deg = bget_graph_varint(f);
+	bprintf(output, "Vertex %x (degree %d) at %08llx:\n", src, deg, (long long) ofs[0]);
+	u32 x = 0;
+	while (deg--)
+		dump_graph_edge(x += bget_graph_varint(f));
+}
+
+static void
+dump_graph_csr(struct fastbuf *b, int argc, char **argv)
+{
+	struct graph_csr_trailer t;
+	struct fastbuf *f = graph_csr_open(b->name, &t);
+	if (!f)
+		die("%s%s does not exist, the graph is not compressed", b->name, FN_GRAPH_CSR);
+	if (!argc)
+		for (uns v=0; v<t.vertices; v++)
+			dump_graph_csr_row(f, &t, v);
+	while (argc--)
+		dump_graph_csr_row(f, &t, xtol64(*argv++));
+	bclose(f);
 }
 
 static void
@@ -1146,7 +1220,11 @@ static void
 dump_graph_vertex(struct fastbuf *b, int argc, char **argv)
 {
 	struct fastbuf *fb_goes = bopen_try(stk_strcat(b->name, FN_GRAPH_GOES), O_RDONLY, 4);
-	struct fastbuf *fb_index = bopen(stk_strcat(b->name, FN_GRAPH_INDEX), O_RDONLY, 4);
+	struct fastbuf *fb_index = bopen_try(stk_strcat(b->name, FN_GRAPH_INDEX), O_RDONLY, 4);
+	struct graph_csr_trailer csr;
+	struct fastbuf *fb_csr = fb_index ? NULL : graph_csr_open(b->name, &csr);
+	if (!fb_index && !fb_csr)
+		die("Neither %s%s nor %s%s exists", b->name, FN_GRAPH_INDEX, b->name, FN_GRAPH_CSR);
 	while (argc--)
 	{
 		uns vertex = xtol64(*argv++);
@@ -1157,6 +1235,11 @@ dump_graph_vertex(struct fastbuf *b, int argc, char **argv)
 			if (vertex == 0xffffffff)
 				die("No such vertex in %s", fb_goes->name);
 		}
+		if (fb_csr)
+		{
+			dump_graph_csr_row(fb_csr, &csr, vertex);
+			continue;
+		}
 		bsetpos(fb_index, BYTES_PER_O * (ucw_off_t)vertex);
 		ucw_off_t pos = bgeto(fb_index);
 		if (verbose)
@@ -1164,6 +1247,7 @@ dump_graph_vertex(struct fastbuf *b, int argc, char **argv)
 		bsetpos(b, pos);
 		dump_graph(pos, b);
 	}
+	bclose(fb_csr);
 	bclose(fb_index);
 	bclose(fb_goes);
 }
@@ -1875,6 +1959,7 @@ static char *fn_rank = "rank-obj";
 enum long_opt {
 	F_FIRST = 1000,
 	F_FP_SPLITS,
+	F_LINK_GRAPH_CSR,
 	F_LINK_GRAPH_DEG,
 	F_LINK_GRAPH_GOES,
 	F_LINK_GRAPH_INDEX,
@@ -1908,6 +1993,7 @@ static struct index_file index_files[] = {
 	{ 'k',			&fn_links,		sizeof(struct card_print),	dump_fingerprint,	NULL,	NULL },
 	{ 'K',			&fn_blacklist,		4,				dump_u32,		NULL,	u32_zoeks },
 	{ 'g',			&fn_graph_obj,		0,				dump_graph,		NULL,	NULL },
+	{ F_LINK_GRAPH_CSR,	&fn_graph_obj,		0,				NULL /* kludge */,	NULL,	NULL },
 	{ F_LINK_GRAPH_DEG,	&fn_graph_obj_deg,	4,				dump_u32,		NULL,	u32_zoeks },
 	{ F_LINK_GRAPH_GOES,	&fn_graph_obj_goes,	4,				dump_u32,		NULL,	u32_zoeks },
 	{ F_LINK_GRAPH_INDEX,	&fn_graph_obj_index,	-BYTES_PER_O,			dump_graph_index,	NULL,	NULL },
@@ -1976,6 +2062,7 @@ static struct option longopts[] =
 	{ "lexicon-words",	0, 0, 'W' },
 	{ "link",		0, 0, 'k' },
 	{ "link-graph",		0, 0, 'g' },
+	{ "link-graph-csr",	0, 0, F_LINK_GRAPH_CSR },
 	{ "link-graph-deg",	0, 0, F_LINK_GRAPH_DEG },
 	{ "link-graph-goes",	0, 0, F_LINK_GRAPH_GOES },
 	{ "link-graph-index",	0, 0, F_LINK_GRAPH_INDEX },
@@ -2053,6 +2140,7 @@ Index files:\n\
 -T, --lexicon-stats\tRaw lexicon statistics\n\
 -k, --link\t\tLinks by url\n\
 -g, --link-graph\tLink graph\n\
+    --link-graph-csr\t... compressed, translated vertices\n\
     --link-graph-deg\t... vertex degrees (-z Value=<intset>)\n\
     --link-graph-index\t... translated vertex -> position\n\
     --link-graph-goes\t... real vertex -> translated (-z Value=<intset>)\n\
@@ -2166,6 +2254,9 @@ dump_index_file(struct index_file *f, struct fastbuf *b, int argc, char **argv)
 		/* As have the graph lookup functions */
 		dump_graph_vertex(b, argc, argv);
 		return;
+	case F_LINK_GRAPH_CSR:
+		dump_graph_csr(b, argc, argv);
+		return;
 	case F_STRING_FP:
 		lookup_string_fp(argc, argv);
 		return;
@@ -2273,7 +2364,15 @@ main(int argc, char **argv)
 		liz_buf = lizard_alloc();	// charset conversion handled by objdump
 	else if (!raw)
 		output = fb_wrap_charconv_out(output, CONV_CHARSET_UTF8, term_charset_id);
-	b = force_filename ? bopen(force_filename, O_RDONLY, 1<<20) : NULL;
+	if (f->option == F_LINK_GRAPH_INDEX)
+	{
+		/* Not written at all if the graph is compressed */
+		b = bopen_try(force_filename, O_RDONLY, 1<<20);
+		if (!b)
+			die("%s does not exist, a compressed graph can be dumped by --link-graph-csr", force_filename);
+	}
+	else
+		b = force_filename ? bopen(force_filename, O_RDONLY, 1<<20) : NULL;
 	dump_index_file(f, b, argc - optind, argv + optind);
 	if (liz_buf)
 		lizard_free(liz_buf);